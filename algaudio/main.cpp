@@ -24,17 +24,134 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "MainWindow.hpp"
 #include "SDLMain.hpp"
 #include "SCLang.hpp"
+#include "MIDI.hpp"
+#include "Headless.hpp"
+#include "NRTRender.hpp"
 #include "Version.hpp"
 #include "Config.hpp"
+#include "CanvasBinary.hpp"
 
 using namespace AlgAudio;
 
 int main(int argc, char *argv[]){
-  (void)argc;
-  (void)argv;
 
   std::cout << "Algaudio " << ALGAUDIO_VERSION_LONG << " starting." << std::endl;
 
+  // --midi-replay FILE [--midi-replay-loop] may be used with any mode, these
+  // are removed before the remaining arguments are parsed.
+  int n = 1;
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if(arg == "--midi-replay" && i + 1 < argc){
+      Config::GlobalWriteable().midi_replay_file = argv[++i];
+    }else if(arg == "--midi-replay-loop"){
+      Config::GlobalWriteable().midi_replay_loop = true;
+    }else{
+      argv[n++] = argv[i];
+    }
+  }
+  argc = n;
+
+  // algaudio --headless patch.algaudio [--fuse] runs the patch with no
+  // windows.
+  if(argc >= 2 && std::string(argv[1]) == "--headless"){
+    if(argc < 3){
+      std::cout << "Usage: " << argv[0] << " --headless PATCH_FILE [--fuse] [--midi-replay MIDI_FILE [--midi-replay-loop]]" << std::endl;
+      return 1;
+    }
+    if(argc >= 4 && std::string(argv[3]) == "--fuse")
+      Config::GlobalWriteable().fuse_modules = true;
+    try{
+      ModuleCollectionBase::InstallDir("modules");
+      return Headless::Run(argv[2]);
+    }catch(Exceptions::Exception ex){
+      std::cout << "An unhandled exception occured: " << ex.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // algaudio --convert in out converts a patch between the XML and binary
+  // formats. The output format is chosen by the output file extension.
+  if(argc >= 2 && std::string(argv[1]) == "--convert"){
+    if(argc < 4){
+      std::cout << "Usage: " << argv[0] << " --convert INPUT_FILE OUTPUT_FILE" << std::endl;
+      return 1;
+    }
+    try{
+      std::string in = argv[2], out = argv[3];
+      std::shared_ptr<CanvasBinary> binary;
+      std::shared_ptr<CanvasXML> xml;
+      if(CanvasBinary::IsBinaryFile(in)) binary = CanvasBinary::CreateFromFile(in);
+      else xml = CanvasXML::CreateFromFile(in);
+      if(CanvasBinary::HasBinaryExtension(out)){
+        if(!binary) binary = CanvasBinary::CreateFromXML(xml);
+        binary->SaveToFile(out);
+      }else{
+        if(!xml) xml = binary->ToXML();
+        xml->SaveToFile(out);
+      }
+      return 0;
+    }catch(Exceptions::Exception ex){
+      std::cout << "Conversion failed: " << ex.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // algaudio --render patch.algaudio out.wav [duration [sample_rate]]
+  // [--schedule file] renders the patch offline and exits. The schedule file
+  // lists param changes, see NRTRender::ScheduleFromFile.
+  if(argc >= 2 && std::string(argv[1]) == "--render"){
+    std::string schedule_path;
+    if(argc >= 4 && std::string(argv[argc - 2]) == "--schedule"){
+      schedule_path = argv[argc - 1];
+      argc -= 2;
+    }
+    if(argc < 4){
+      std::cout << "Usage: " << argv[0] << " --render PATCH_FILE OUTPUT_FILE [DURATION [SAMPLE_RATE]] [--schedule SCHEDULE_FILE]" << std::endl;
+      return 1;
+    }
+    NRTRender::Options options;
+    options.output_path = argv[3];
+    try{
+      if(argc >= 5) options.duration = std::stof(argv[4]);
+      if(argc >= 6) options.sample_rate = std::stoi(argv[5]);
+    }catch(...){
+      std::cout << "Invalid duration or sample rate." << std::endl;
+      return 1;
+    }
+    int status = 0;
+    std::unique_ptr<NRTRender> render;
+    Subscription sub = Headless::on_patch_loaded.Subscribe([&](std::shared_ptr<Canvas> canvas){
+      render = std::make_unique<NRTRender>(canvas);
+      if(schedule_path != ""){
+        try{
+          render->ScheduleFromFile(schedule_path);
+        }catch(Exceptions::NRTRender ex){
+          std::cout << "Render failed: " << ex.what() << std::endl;
+          status = 1;
+          Headless::Quit();
+          return;
+        }
+      }
+      render->Render(options).Then([](){
+        std::cout << "Render complete." << std::endl;
+        Headless::Quit();
+      }).Catch<Exceptions::NRTRender>([&status](auto ex){
+        std::cout << "Render failed: " << ex->what() << std::endl;
+        status = 1;
+        Headless::Quit();
+      });
+    });
+    try{
+      ModuleCollectionBase::InstallDir("modules");
+      int result = Headless::Run(argv[2]);
+      return (result != 0) ? result : status;
+    }catch(Exceptions::Exception ex){
+      std::cout << "An unhandled exception occured: " << ex.what() << std::endl;
+      return 1;
+    }
+  }
+
   try{
     Theme::Init();
     SDLMain::Init();
@@ -68,6 +185,7 @@ int main(int argc, char *argv[]){
 
     SDLMain::Loop();
 
+    MIDI::Stop();
     SCLang::Stop();
     // SDL seems to have problems when the destroy functions are called from
     // the DLL destroy call. Thus, we explicitly free all our window pointers
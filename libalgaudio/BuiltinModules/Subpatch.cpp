@@ -20,9 +20,11 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "BuiltinModules.hpp"
 #include "UI/UIButton.hpp"
 #include "UI/UIBox.hpp"
+#include "UI/UICheckbox.hpp"
 #include "ModuleUI/ModuleGUI.hpp"
 #include "CanvasView.hpp"
 #include "CanvasXML.hpp"
+#include "CanvasBinary.hpp"
 #include "SCLang.hpp"
 #include "Config.hpp"
 
@@ -59,6 +61,7 @@ LateReturn<> Subpatch::on_init_latereturn(){
   });
   s.WhenAll([r, this](){
     if(modulegui) modulegui->OnInletsChanged();
+    if(Config::Global().flatten_subpatches) SetFlattened(true);
     r.Return();
   });
   
@@ -81,7 +84,10 @@ LateReturn<> Subpatch::on_init_latereturn(){
 }
 
 void Subpatch::on_destroy(){
-  
+  if(flattened){
+    flattened = false;
+    ApplyFlattening();
+  }
 }
 
 void Subpatch::state_store_xml(rapidxml::xml_node<char>* node) const {
@@ -89,27 +95,67 @@ void Subpatch::state_store_xml(rapidxml::xml_node<char>* node) const {
   auto filesave_node = node->document()->allocate_node(rapidxml::node_type::node_element,"algaudio");
   node->append_node(filesave_node);
   canvasxml->CloneToAnotherXMLTree(filesave_node, node->document());
+  if(flattened) node->append_attribute(node->document()->allocate_attribute("flatten", "1"));
 }
 void Subpatch::state_load_xml(rapidxml::xml_node<char>* node){
+  auto flatten_attr = node->first_attribute("flatten");
+  if(flatten_attr) SetFlattened(std::string(flatten_attr->value()) == "1");
+
   auto filesave_node = node->first_node("algaudio");
   if(!filesave_node) return; // ??? No save node? Apparently custom save data has no subpatch information, so ignore it.
   
-  auto canvasxml = CanvasXML::CreateFromNode(filesave_node);
-  
+  LoadFromDefinition(CanvasXML::CreateFromNode(filesave_node));
+}
+
+template <typename Definition>
+void Subpatch::ApplyDefinition(std::shared_ptr<Definition> def){
   auto parent = canvas.lock();
-  Canvas::CreateEmpty(parent).Then([this,canvasxml,parent](auto c){
+  loading++;
+  Canvas::CreateEmpty(parent).Then([this,def,parent](auto c){
     c->owner_hint = this->shared_from_this();
     internal_canvas = c;
-    canvasxml->ApplyToCanvas(c);
+    def->ApplyToCanvas(c).Then([this](auto){
+      FinishLoading();
+    }).template Catch<Exceptions::XMLParse>([this](auto ex){
+      std::cout << "WARNING: Failed to load subpatch contents: " << ex->what() << std::endl;
+      FinishLoading();
+    }).template Catch<Exceptions::BinaryPatchParse>([this](auto ex){
+      std::cout << "WARNING: Failed to load subpatch contents: " << ex->what() << std::endl;
+      FinishLoading();
+    });
     // After the canvas was substituted, force recalculate order to use the new group id.
     parent->RecalculateOrder();
   });
 }
+void Subpatch::FinishLoading(){
+  if(--loading > 0) return;
+  std::vector<Relay<>> waiters;
+  waiters.swap(load_waiters);
+  for(auto& r : waiters) r.Return();
+}
+LateReturn<> Subpatch::WhenLoaded(){
+  Relay<> r;
+  if(loading == 0) r.Return();
+  else load_waiters.push_back(r);
+  return r;
+}
+void Subpatch::LoadFromDefinition(std::shared_ptr<CanvasXML> canvasxml){
+  ApplyDefinition(canvasxml);
+}
+void Subpatch::LoadFromDefinition(std::shared_ptr<CanvasBinary> canvasbinary){
+  ApplyDefinition(canvasbinary);
+}
 
 void Subpatch::on_gui_build(std::shared_ptr<ModuleGUI> gui){
   auto paramsbox = std::dynamic_pointer_cast<UIVBox>( gui->Widget()->FindChild(UIWidget::ID("paramsbox")) );
   auto button = UIButton::Create(gui->Widget()->GetWindow(), "Edit...");
   paramsbox->Insert(button, UIBox::PackMode::TIGHT);
+  auto flatten = UICheckbox::Create(gui->Widget()->GetWindow(), "Flatten");
+  flatten->SetActive(flattened);
+  paramsbox->Insert(flatten, UIBox::PackMode::TIGHT);
+  subscriptions += flatten->on_toggled.Subscribe([this](bool state){
+    SetFlattened(state);
+  });
   
   subscriptions += button->on_clicked.Subscribe([this](){
     auto canvasview = std::dynamic_pointer_cast<CanvasView>(modulegui->Widget()->parent.lock());
@@ -127,18 +173,77 @@ void Subpatch::LinkToEntrance(std::shared_ptr<SubpatchEntrance> e){
   if(inlets[1] != nullptr) e->LinkOutput(1, inlets[1]->bus->GetID());
   if(inlets[2] != nullptr) e->LinkOutput(2, inlets[2]->bus->GetID());
   if(inlets[3] != nullptr) e->LinkOutput(3, inlets[3]->bus->GetID());
+  if(flattened) UpdateFlattening();
 }
 
 void Subpatch::LinkToExit(std::shared_ptr<SubpatchExit> e){  
   exit = e;
 }
 
+void Subpatch::SetFlattened(bool f){
+  if(f == flattened) return;
+  flattened = f;
+  UpdateFlattening();
+}
+
+void Subpatch::ApplyFlattening(){
+  std::weak_ptr<Subpatch> wthis = std::static_pointer_cast<Subpatch>(shared_from_this());
+  for(unsigned int i = 0; i < inlets.size(); i++){
+    if(!inlets[i]) continue;
+    if(!flattened){
+      inlets[i]->bus->redirect = nullptr;
+      continue;
+    }
+    // Whoever writes to this inlet, writes directly to the entrance targets.
+    inlets[i]->bus->redirect = [wthis, i](){
+      auto s = wthis.lock();
+      if(!s || !s->entrance || i >= s->entrance->outlets.size()) return std::vector<int>();
+      return s->entrance->outlets[i]->GetTargetBusIDs();
+    };
+  }
+  if(exit){
+    for(unsigned int i = 0; i < exit->inlets.size(); i++){
+      if(!exit->inlets[i]) continue;
+      if(!flattened){
+        exit->inlets[i]->bus->redirect = nullptr;
+        continue;
+      }
+      // Whoever writes to the exit, writes directly to the subpatch targets.
+      exit->inlets[i]->bus->redirect = [wthis, i](){
+        auto s = wthis.lock();
+        if(!s || i >= s->outlets.size()) return std::vector<int>();
+        return s->outlets[i]->GetTargetBusIDs();
+      };
+    }
+  }
+  // The copying synths have nothing to do while flattened.
+  SCLang::SendOSC("/algaudioSC/runinstance", "ii", sc_id, flattened ? 0 : 1);
+  if(entrance) SCLang::SendOSC("/algaudioSC/runinstance", "ii", entrance->sc_id, flattened ? 0 : 1);
+}
+
+void Subpatch::UpdateFlattening(){
+  ApplyFlattening();
+  auto parent = canvas.lock();
+  if(!parent) return;
+  auto root = parent->GetFlatteningRoot();
+  root->RefreshFlattenedConnections();
+  if(!flattened && internal_canvas){
+    // The internal canvas is no longer a part of the flattened hierarchy, so
+    // it has to be refreshed separately, and its modules go back to its group.
+    internal_canvas->RefreshFlattenedConnections();
+    internal_canvas->RecalculateOrder();
+  }
+  root->RecalculateOrder();
+}
+
  int Subpatch::GetGroupID() const {
    return internal_canvas->GetGroup()->GetID();
  }
  
  void Subpatch::LinkOutput(int output_no, int busid){
    SCLang::SendOSC("/algaudioSC/setparam", "isi", sc_id, ("subout" + std::to_string(output_no + 1)).c_str(), busid);
+   // A new exit inlet has to be redirected as well.
+   if(flattened) UpdateFlattening();
  }
 
 // ============= SubpatchEntrance ===========
@@ -18,7 +18,6 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "Canvas.hpp"
 #include <algorithm>
-#include <stack>
 #include <queue>
 #include <unordered_set>
 #include "ModuleFactory.hpp"
@@ -27,6 +26,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "Config.hpp"
 #include "BuiltinModules.hpp"
 #include "ParamController.hpp"
+#include "GraphCompiler.hpp"
 
 namespace AlgAudio{
 
@@ -60,85 +60,95 @@ LateReturn<std::shared_ptr<Canvas>> Canvas::CreateEmpty(std::shared_ptr<Canvas>
 LateReturn<std::shared_ptr<Module>> Canvas::CreateModule(std::string id){
   Relay<std::shared_ptr<Module>> r;
   ModuleFactory::CreateNewInstance(id, shared_from_this()).Then([this,r](std::shared_ptr<Module> m){
-    modules.emplace(m);
-    m->canvas = shared_from_this();
+    InsertModule(m);
     r.Return(m);
   }).Catch(r);
   return r;
 }
 
+void Canvas::InsertModule(std::shared_ptr<Module> m){
+  modules.emplace(m);
+  m->canvas = shared_from_this();
+  CanvasGraph::ModuleHandle h = graph.AddModule(m);
+  // Place the new module at the head of the topological order.
+  if(topo_position.size() <= h) topo_position.resize(h + 1);
+  topo_position[h] = --topo_head;
+  topo_order[topo_position[h]] = h;
+  // The new module's custom params need ranks below its outputs.
+  data_graph_dirty = true;
+  UpdatePausingAround({h}, true);
+  SubscribeParamEdits(m);
+  on_module_inserted.Happen(m);
+  NotifyEdit({Edit::Type::ModuleInserted, this, m, IOID(), IOID(), DataConnectionMode::Relative});
+}
+
 void Canvas::RemoveModule(std::shared_ptr<Module> m){
   if(!m) std::cout << "WARNING: Canvas asked to remove module (nullptr) " << std::endl;
-  // First, remove all audio connections that start at this module.
-  for(auto iolettempl : m->templ->outlets){
-    std::string outid = iolettempl.id;
-    auto it = audio_connections.find(IOID{m, outid});
-    if(it != audio_connections.end()){
-      GetOutletByIOID(IOID{m, outid})->DetachFromAll();
-      audio_connections.erase(it);
-    }
-  }
-  // Next, erase all audio connections that end at this module.
-  for(auto iolettempl : m->templ->inlets){
-    std::string inid = iolettempl.id;
-    for(auto it = audio_connections.begin(); it != audio_connections.end(); /*--*/){
-      IOID from = it->first;
-      auto from_outlet = GetOutletByIOID(from);
-      std::list<IOID>& tolist = it->second;
-      for(IOID &to : tolist)
-        if(to.module == m && to.iolet == inid)
-          from_outlet->DetachFromInlet(GetInletByIOID(to));
-      tolist.remove(IOID{m,inid});
-      if(tolist.empty()){
-        // That was the last connection from that outlet.
-        audio_connections.erase(it++);
-      }else{
-        it++;
-      }
+  param_edit_subscriptions.erase(m.get());
+  DecompileModule(m);
+  CanvasGraph::ModuleHandle h = GetHandle(m);
+  if(h != CanvasGraph::Invalid){
+    // Remove all connections that start or end at this module. This has to
+    // work on a copy, as disconnecting modifies the edge lists.
+    std::vector<CanvasGraph::EdgeHandle> edges = graph.GetOutEdges(h);
+    const std::vector<CanvasGraph::EdgeHandle>& in = graph.GetInEdges(h);
+    edges.insert(edges.end(), in.begin(), in.end());
+    for(CanvasGraph::EdgeHandle e : edges){
+      CanvasGraph::EdgeType type = graph.GetEdgeType(e);
+      // A data connection between two params of this module is listed twice.
+      if(type == CanvasGraph::EdgeType::None) continue;
+      IOID from{graph.GetModule(graph.GetEdgeFrom(e)), graph.GetEdgeFromPort(e)};
+      IOID to  {graph.GetModule(graph.GetEdgeTo(e)),   graph.GetEdgeToPort(e)};
+      if(type == CanvasGraph::EdgeType::Audio) Disconnect(from, to);
+      else DisconnectData(from, to);
     }
+    topo_order.erase(topo_position[h]);
+    if(h < paused.size()) paused[h] = 0;
+    if(h < live.size()) live[h] = 0;
+    // The clearing synth is freed together with the instance.
+    if(h < bus_clears.size()) bus_clears[h].clear();
+    graph.RemoveModule(h);
   }
 
-  // Then, remove all data connections that start at this module.
-  for(auto param : m->templ->params){
-    std::string paramid = param->id;
-    auto it = data_connections.find(IOID{m, paramid});
-    if(it != data_connections.end()){
-      // There is a connection from that param output.
-      
-      // Remove the subscription
-      auto it2 = data_connections_subscriptions.find(it->first);
-      if(it2 == data_connections_subscriptions.end()){
-        std::cout << "WARNING: Unable to remove data_connections subscriptions, as none was found!" << std::endl;
-      }else data_connections_subscriptions.erase(it2);
-      // Erase the connection
-      data_connections.erase(it);
-    }
-  }
-  // Finally, remove all data connections that end at this module.
-  for(auto param : m->templ->params){
-    std::string paramid = param->id;
-    for(auto it = data_connections.begin(); it != data_connections.end(); /*--*/){
-      std::list<IOIDWithMode>& tolist = it->second;
-      tolist.remove(IOIDWithMode{{m,paramid}, DataConnectionMode::Absolute}); // connection mode is ignored in comparison
-      if(tolist.empty()){
-        // That was the last connection from that outlet.
-        // Remove the subscription
-        auto it2 = data_connections_subscriptions.find(it->first);
-        if(it2 == data_connections_subscriptions.end()){
-          std::cout << "WARNING: Unable to remove data_connections subscriptions, as none was found!" << std::endl;
-        }else data_connections_subscriptions.erase(it2);
-        // Erase the connection
-        data_connections.erase(it++);
-      }else{
-        it++;
-      }
-    }
-  }
-
-
   // Then, erase the module and destroy it via ModuleFactory.
   modules.erase(m);
-  ModuleFactory::DestroyInstance(m);
+  ModuleFactory::DestroyInstance(m, in_batch ? &batch_removals : nullptr);
+  // Modules that fed this one were updated when their connections were
+  // removed.
+  UpdatePausingAround({}, true);
+  NotifyEdit({Edit::Type::ModuleRemoved, this, m, IOID(), IOID(), DataConnectionMode::Relative});
+}
+
+void Canvas::NotifyEdit(const Edit& e){
+  on_edit.Happen(e);
+  auto p = parent.lock();
+  if(p) p->NotifyEdit(e);
+}
+
+void Canvas::SubscribeParamEdits(std::shared_ptr<Module> m){
+  SubscriptionList& subs = param_edit_subscriptions[m.get()];
+  std::weak_ptr<Module> wm = m;
+  for(const auto& pc : m->param_controllers){
+    auto notify = [this, wm, param = pc->id](Edit::Type type, float value){
+      auto m = wm.lock();
+      if(!m) return;
+      Edit e{type, this, m, IOID{m, param}, IOID(), DataConnectionMode::Relative};
+      e.value = value;
+      NotifyEdit(e);
+    };
+    // Output params are driven by the module or by SC, and values that
+    // arrive through data connections are recomputed from their sources.
+    if(pc->templ->mode == ParamTemplate::ParamMode::Input)
+      subs += pc->after_set.Subscribe([notify, p = pc.get()](float value, float){
+        if(p->IsSetDirectly()) notify(Edit::Type::ParamSet, value);
+      });
+    subs += pc->on_range_min_set.Subscribe([notify](float value){
+      notify(Edit::Type::ParamRangeSet, value);
+    });
+    subs += pc->on_range_max_set.Subscribe([notify](float value){
+      notify(Edit::Type::ParamRangeSet, value);
+    });
+  }
 }
 
 std::shared_ptr<Module::Inlet>  Canvas::GetInletByIOID(IOID i) const{
@@ -155,33 +165,48 @@ void Canvas::Connect(IOID from, IOID to){
     std::cout << "WARNING: Invalid connection between unexisting inlet/outlet." << std::endl;
     return;
   }
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid){
+    std::cout << "WARNING: Invalid connection between modules that are not on this canvas." << std::endl;
+    return;
+  }
+  DecompileModule(from.module);
+  DecompileModule(to.module);
 
-  if(TestNewConnectionForLoop(from, to))
-    throw Exceptions::ConnectionLoop("Cannot add the selected connection, adding it would close a loop.");
+  if(graph.FindEdge(CanvasGraph::EdgeType::Audio, hfrom, from.iolet, hto, to.iolet) != CanvasGraph::Invalid)
+    throw Exceptions::DoubleConnection("Cannot add the connection, it already exists!");
+  if(outlet->channels != inlet->GetChannels())
+    throw Exceptions::ChannelMismatch("Cannot connect an outlet with " + std::to_string(outlet->channels) + " channel(s) to an inlet with " + std::to_string(inlet->GetChannels()) + " channel(s).");
+  if(graph.CountEdgesFrom(CanvasGraph::EdgeType::Audio, hfrom, from.iolet) >= 20)
+    throw Exceptions::MultipleConnections("Cannot add another connection to the same outlet, maximum (20) reached.");
 
-  auto it = audio_connections.find(from);
-  if(it == audio_connections.end()){
-    // First connection from this inlet
-    std::list<IOID> tmp;
-    tmp.push_back(to);
-    audio_connections[from] = tmp;
-  }else{
-    // Not the first connectin from this inlet.
-    auto it2 = std::find(it->second.begin(), it->second.end(), to);
-    if(it2 != it->second.end()) // if found
-      throw Exceptions::DoubleConnection("Cannot add the connection, it already exists!");
-    else{
-      if(audio_connections[from].size() >= 20) throw Exceptions::MultipleConnections("Cannot add another connection to the same outlet, maximum (20) reached.");
-      audio_connections[from].push_back(to);
-    }
+  if(in_batch){
+    // Loops will be checked once, when the whole batch is applied.
+    graph.AddEdge(CanvasGraph::EdgeType::Audio, hfrom, from.iolet, hto, to.iolet);
+    batch_order_dirty = true;
+    outlet->AddInlet(inlet);
+    if(std::find(batch_outlets.begin(), batch_outlets.end(), outlet) == batch_outlets.end())
+      batch_outlets.push_back(outlet);
+    NotifyEdit({Edit::Type::Connected, this, nullptr, from, to, DataConnectionMode::Relative});
+    return;
   }
 
+  // Checking for loops and updating the topological order is done at once.
+  std::vector<CanvasGraph::ModuleHandle> moved;
+  if(!UpdateOrderForConnection(hfrom, hto, moved))
+    throw Exceptions::ConnectionLoop("Cannot add the selected connection, adding it would close a loop.");
+
+  graph.AddEdge(CanvasGraph::EdgeType::Audio, hfrom, from.iolet, hto, to.iolet);
+
   std::cout << "Connecting" << std::endl;
   outlet->ConnectToInlet(inlet);
+  if(IsFlatteningInvolved()) GetFlatteningRoot()->RefreshFlattenedConnections();
 
   // Correct SC synth order.
   if(!do_not_recalculate_ordering)
-    RecalculateOrder();
+    SendOrderChanges(moved);
+  UpdatePausingAround({hfrom}, true);
+  NotifyEdit({Edit::Type::Connected, this, nullptr, from, to, DataConnectionMode::Relative});
 }
 
 void Canvas::Disconnect(IOID from, IOID to){
@@ -191,238 +216,1071 @@ void Canvas::Disconnect(IOID from, IOID to){
     std::cout << "WARNING: cannot remove between unexisting inlet/outlet." << std::endl;
     return;
   }
+  DecompileModule(from.module);
+  DecompileModule(to.module);
 
   std::cout << "Disonnecting" << std::endl;
-  outlet->DetachFromInlet(inlet);
+  if(in_batch){
+    outlet->RemoveInlet(inlet);
+    if(std::find(batch_outlets.begin(), batch_outlets.end(), outlet) == batch_outlets.end())
+      batch_outlets.push_back(outlet);
+  }else{
+    outlet->DetachFromInlet(inlet);
+    if(IsFlatteningInvolved()) GetFlatteningRoot()->RefreshFlattenedConnections();
+  }
 
-  auto it = audio_connections.find(from);
-  if(it == audio_connections.end()) return; // no such connection
-  it->second.remove(to);
-  if(it->second.size() == 0)
-    audio_connections.erase(it);
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid) return;
+  CanvasGraph::EdgeHandle e = graph.FindEdge(CanvasGraph::EdgeType::Audio, hfrom, from.iolet, hto, to.iolet);
+  if(e == CanvasGraph::Invalid) return; // no such connection
+  graph.RemoveEdge(e);
+  UpdatePausingAround({hfrom}, true);
+  NotifyEdit({Edit::Type::Disconnected, this, nullptr, from, to, DataConnectionMode::Relative});
 }
 
 
 void Canvas::ConnectData(IOID from, IOID to, DataConnectionMode m){
-  auto it = data_connections.find(from);
-  if(it == data_connections.end()){
-    // First connection from this inlet
-    std::list<IOIDWithMode> tmp;
-    tmp.push_back({to,m});
-    data_connections[from] = tmp;
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid){
+    std::cout << "WARNING: Invalid data connection between modules that are not on this canvas." << std::endl;
+    return;
+  }
+  // A server data link could not map a param of a fused synth.
+  DecompileModule(to.module);
+  if(graph.FindEdge(CanvasGraph::EdgeType::Data, hfrom, from.iolet, hto, to.iolet) != CanvasGraph::Invalid)
+    throw Exceptions::DoubleConnection("This connection already exists!");
+
+  if(graph.CountEdgesFrom(CanvasGraph::EdgeType::Data, hfrom, from.iolet) == 0){
+    // First connection from this param
     auto paramctrl = from.module->GetParamControllerByID(from.iolet);
     if(!paramctrl) std::cout << "WARNING: pointless connection form unexisting paramcontroller" << std::endl;
-    data_connections_subscriptions[from] = paramctrl->after_set.Subscribe([this, source=from](float val, float val2){
+    data_connections_subscriptions[from] = paramctrl->after_set.Subscribe([this, source=paramctrl.get()](float val, float val2){
       PassData(source, val, val2);
     });
-  }else{
-    // Not the first connection from this inlet.
-    auto it2 = std::find(it->second.begin(), it->second.end(), IOIDWithMode{to, DataConnectionMode::Relative}); // Note that connection mode is ignored in comparison.
-    if(it2 != it->second.end()) // if found
-      throw Exceptions::DoubleConnection("This connection already exists!");
-
-    it->second.push_back({to,m});
   }
+  graph.AddEdge(CanvasGraph::EdgeType::Data, hfrom, from.iolet, hto, to.iolet, (unsigned char)m);
+  data_graph_dirty = true;
+  TryLinkDataOnServer(from, to, m);
+  UpdatePausingAround({hfrom}, false);
+  NotifyEdit({Edit::Type::DataConnected, this, nullptr, from, to, m});
+}
+
+void Canvas::TryLinkDataOnServer(IOID from, IOID to, DataConnectionMode m){
+  auto source = from.module->GetParamControllerByID(from.iolet);
+  auto target = to.module->GetParamControllerByID(to.iolet);
+  if(!ServerDataLink::IsApplicable(source, target)) return;
+  std::weak_ptr<Canvas> wself = shared_from_this();
+  ServerDataLink::Create(source, target, m == DataConnectionMode::Relative).Then([wself, from, to](std::shared_ptr<ServerDataLink> link){
+    auto self = wself.lock();
+    if(!self) return;
+    // The connection might have been removed while we were waiting for SC.
+    // In such case the link is simply dropped, which frees it.
+    if(!self->GetDirectDataConnectionExists(from, to).first) return;
+    if(self->server_data_links.find({from, to}) != self->server_data_links.end()) return;
+    self->server_data_links[{from, to}] = link;
+    self->data_graph_dirty = true;
+  });
 }
 void Canvas::DisconnectData(IOID from, IOID to){
-  auto it = data_connections.find(from);
-  if(it == data_connections.end()) return; // no such connection
-  it->second.remove({to, DataConnectionMode::Relative});
-  it->second.remove({to, DataConnectionMode::Absolute});
-  if(it->second.size() == 0){
-    // The last connection from that source was removed. Erase the entry,
-    // and cleanup the subscription
-    data_connections.erase(it);
-    auto it2 = data_connections_subscriptions.find(from);
-    if(it2 == data_connections_subscriptions.end()){
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid) return;
+  CanvasGraph::EdgeHandle e = graph.FindEdge(CanvasGraph::EdgeType::Data, hfrom, from.iolet, hto, to.iolet);
+  if(e == CanvasGraph::Invalid) return; // no such connection
+  DecompileModule(to.module);
+  graph.RemoveEdge(e);
+  data_graph_dirty = true;
+  server_data_links.erase({from, to});
+  if(graph.CountEdgesFrom(CanvasGraph::EdgeType::Data, hfrom, from.iolet) == 0){
+    // The last connection from that source was removed, cleanup the
+    // subscription.
+    auto it = data_connections_subscriptions.find(from);
+    if(it == data_connections_subscriptions.end()){
       std::cout << "WARNING: Unable to remove data_connections subscriptions, as none was found!" << std::endl;
     }else{
-      data_connections_subscriptions.erase(it2);
+      data_connections_subscriptions.erase(it);
+    }
+  }
+  UpdatePausingAround({hfrom}, false);
+  NotifyEdit({Edit::Type::DataDisconnected, this, nullptr, from, to, DataConnectionMode::Relative});
+}
+
+void Canvas::CompileDataGraph(){
+  data_edges.clear();
+  data_edge_ranges.clear();
+  std::vector<CanvasGraph::EdgeHandle> out;
+  for(CanvasGraph::ModuleHandle h = 0; h < graph.GetModuleSlots(); h++){
+    const std::shared_ptr<Module>& m = graph.GetModule(h);
+    if(!m) continue;
+    // Group data edges of this module by their source param.
+    out.clear();
+    for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(h))
+      if(graph.GetEdgeType(e) == CanvasGraph::EdgeType::Data) out.push_back(e);
+    std::stable_sort(out.begin(), out.end(), [this](CanvasGraph::EdgeHandle a, CanvasGraph::EdgeHandle b){
+      return graph.GetEdgeFromPort(a) < graph.GetEdgeFromPort(b);
+    });
+    for(unsigned int i = 0; i < out.size(); /*--*/){
+      Symbol port = graph.GetEdgeFromPort(out[i]);
+      auto source = m->GetParamControllerByID(port);
+      unsigned int first = data_edges.size();
+      for(; i < out.size() && graph.GetEdgeFromPort(out[i]) == port; i++){
+        CanvasGraph::EdgeHandle e = out[i];
+        if(!source) continue;
+        const std::shared_ptr<Module>& target_module = graph.GetModule(graph.GetEdgeTo(e));
+        Symbol target_port = graph.GetEdgeToPort(e);
+        // Connections realized on the server need no passing.
+        if(server_data_links.find({IOID{m, port}, IOID{target_module, target_port}}) != server_data_links.end()) continue;
+        auto target = target_module->GetParamControllerByID(target_port);
+        if(!target){
+          std::cout << "WARNING: Data connection to an unexisting paramcontroller " << target_port << std::endl;
+          continue;
+        }
+        data_edges.push_back(DataEdge{target.get(), (DataConnectionMode)graph.GetEdgeTag(e)});
+      }
+      if(source) data_edge_ranges[source.get()] = {first, data_edges.size()};
+    }
+  }
+  CalculatePropagationRanks();
+  data_graph_dirty = false;
+}
+
+void Canvas::CalculatePropagationRanks(){
+  // Params are committed in the order of their ranks, so that a value change
+  // reaches each param only once, after all params it depends on are already
+  // up to date. A rank is the length of the longest path of dependencies that
+  // leads to a param, computed with a variant of Kahn's algorithm.
+  // Dependencies are data connections, and also the implicit links inside
+  // modules with custom param actions: such module may set any of its output
+  // params whenever one of its custom params changes.
+  std::unordered_map<ParamController*, std::vector<ParamController*>> next;
+  std::unordered_map<ParamController*, int> indegrees;
+
+  for(const std::shared_ptr<Module>& m : modules){
+    std::vector<ParamController*> custom, outputs;
+    for(const auto& p : m->param_controllers){
+      indegrees[p.get()];
+      p->propagation_rank = 0;
+      if(p->templ->action == ParamTemplate::ParamAction::Custom) custom.push_back(p.get());
+      if(p->templ->mode == ParamTemplate::ParamMode::Output) outputs.push_back(p.get());
+    }
+    for(ParamController* c : custom)
+      for(ParamController* o : outputs){
+        next[c].push_back(o);
+        indegrees[o]++;
+      }
+  }
+  for(auto& it : data_edge_ranges){
+    ParamController* source = const_cast<ParamController*>(it.first);
+    for(unsigned int i = it.second.first; i < it.second.second; i++){
+      next[source].push_back(data_edges[i].target);
+      indegrees[data_edges[i].target]++;
     }
   }
+
+  std::queue<ParamController*> frontier;
+  for(auto& it : indegrees)
+    if(it.second == 0) frontier.push(it.first);
+
+  int max_rank = 0;
+  while(!frontier.empty()){
+    ParamController* current = frontier.front(); frontier.pop();
+    max_rank = std::max(max_rank, current->propagation_rank);
+    indegrees.erase(current);
+    for(ParamController* n : next[current]){
+      n->propagation_rank = std::max(n->propagation_rank, current->propagation_rank + 1);
+      if(--indegrees[n] == 0) frontier.push(n);
+    }
+  }
+
+  // Whatever was not visited is a part of a loop, or depends on one. There is
+  // no correct order for these, so they are committed after everything else,
+  // and the loop itself is broken by ParamController, which ignores values
+  // set to params already committed in the current tick.
+  for(auto& it : indegrees)
+    it.first->propagation_rank = max_rank + 1;
+
+  // Params already pending in the current tick were keyed by their old ranks.
+  ParamController::RekeyPending();
 }
 
-void Canvas::PassData(IOID source, float value, float relative){
-  auto it = data_connections.find(source);
-  if(it == data_connections.end()){
+void Canvas::PassData(const ParamController* source, float value, float relative){
+  if(data_graph_dirty) CompileDataGraph();
+  auto it = data_edge_ranges.find(source);
+  if(it == data_edge_ranges.end()){
     std::cout << "WARNING: Passing data from source, which has no connections anymore..." << std::endl;
     return;
   }
-  auto list = it->second;
-  for(const IOIDWithMode& iwm : list){
-    auto ctrl = iwm.ioid.module->GetParamControllerByID(iwm.ioid.iolet);
-    if(iwm.mode == DataConnectionMode::Absolute){
-      ctrl->Set(value);
+  // Setting a target may fire further data connections, and any of these
+  // nested calls may recompile the table, after which the range would point
+  // at other edges. Therefore the edges of this source are copied first.
+  std::vector<DataEdge> edges(data_edges.begin() + it->second.first, data_edges.begin() + it->second.second);
+  for(const DataEdge& e : edges){
+    if(e.mode == DataConnectionMode::Absolute){
+      e.target->Set(value);
     }else{
-      ctrl->SetRelative(relative);
+      e.target->SetRelative(relative);
     }
   }
 }
 
 bool Canvas::GetDirectAudioConnectionExists(IOID from, IOID to){
-  auto it = audio_connections.find(from);
-  if(it != audio_connections.end())
-    if(std::find(it->second.begin(), it->second.end(), to) != it->second.end())
-      return true;
-  return false;
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid) return false;
+  return graph.FindEdge(CanvasGraph::EdgeType::Audio, hfrom, from.iolet, hto, to.iolet) != CanvasGraph::Invalid;
 }
 
 std::pair<bool, Canvas::DataConnectionMode> Canvas::GetDirectDataConnectionExists(IOID from, IOID to){
-  auto it = data_connections.find(from);
-  if(it != data_connections.end()){
-    auto it2 = std::find(it->second.begin(), it->second.end(), IOIDWithMode{to, DataConnectionMode::Relative}); /* Note that connection mode is ignored in comparison. */
-    if(it2 != it->second.end())
-      return {true, it2->mode};
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom != CanvasGraph::Invalid && hto != CanvasGraph::Invalid){
+    CanvasGraph::EdgeHandle e = graph.FindEdge(CanvasGraph::EdgeType::Data, hfrom, from.iolet, hto, to.iolet);
+    if(e != CanvasGraph::Invalid)
+      return {true, (DataConnectionMode)graph.GetEdgeTag(e)};
   }
   return {false, DataConnectionMode()};
 }
 
+std::vector<std::pair<Canvas::IOID, Canvas::IOID>> Canvas::GetAudioConnections() const{
+  std::vector<std::pair<IOID, IOID>> res;
+  for(CanvasGraph::EdgeHandle e = 0; e < graph.GetEdgeSlots(); e++){
+    if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+    res.push_back({IOID{graph.GetModule(graph.GetEdgeFrom(e)), graph.GetEdgeFromPort(e)},
+                   IOID{graph.GetModule(graph.GetEdgeTo(e)),   graph.GetEdgeToPort(e)}});
+  }
+  return res;
+}
+
+std::vector<std::pair<Canvas::IOID, Canvas::IOIDWithMode>> Canvas::GetDataConnections() const{
+  std::vector<std::pair<IOID, IOIDWithMode>> res;
+  for(CanvasGraph::EdgeHandle e = 0; e < graph.GetEdgeSlots(); e++){
+    if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Data) continue;
+    res.push_back({IOID{graph.GetModule(graph.GetEdgeFrom(e)), graph.GetEdgeFromPort(e)},
+                   IOIDWithMode{IOID{graph.GetModule(graph.GetEdgeTo(e)), graph.GetEdgeToPort(e)}, (DataConnectionMode)graph.GetEdgeTag(e)}});
+  }
+  return res;
+}
+
+std::vector<std::shared_ptr<Module>> Canvas::GetModulesInOrder() const{
+  std::vector<std::shared_ptr<Module>> result;
+  result.reserve(topo_order.size());
+  for(const auto& it : topo_order) result.push_back(graph.GetModule(it.second));
+  return result;
+}
+
 void Canvas::RecalculateOrder(){
-  // To calculate a correct ordering determining how the modules SC synths
-  // should be executed, we do a simple topological sort on the graph of
-  // connections. It will be calculated whenever a new connection is added.
-  // Note that neither of:
+  // The topological order is kept up to date whenever a connection is added,
+  // (see UpdateOrderForConnection), and neither of:
   //    1) creating a new module
   //    2) removing any module
   //    3) removing any connection
-  // may change the topological order, so there is no need to recalculate it
-  // in such cases.
+  // may invalidate it. So all that is left is to send it to SC.
+
+/*
+  // For debugging purposes, demonstrate when the computed odrer is.
+  std::cout << "New synth ordering:" << std::endl;
+  for(const auto& it : topo_order)
+    std::cout << "   \"" << graph.GetModule(it.second)->templ->name << "\"" << std::endl;
+*/
+
+  if(DelegateOrdering()) return;
 
-  // We will need to remember the current (in the sense of the steps of the
-  // toposort algorithm) indegree of each verticle (module). We will use a map
-  // for this. It may look as a waste of efficiency, because this information
-  // might be stored withing a module, but please note this costs us only
-  // O(V+E), since map operations are O(1).
+  // Send the ordering to SC.
+  SCLang::SendOSCCustom("/algaudioSC/ordering", GetOrderingMessage());
+
+}
 
-  std::map<std::shared_ptr<Module>, int> indegrees;
+lo::Message Canvas::GetOrderingMessage() const{
+  lo::Message msg;
+  msg.add_int32(group->GetID());
+  for(int id : GetFlatOrderableIDs())
+    msg.add_int32(id);
+  return msg;
+}
 
-  // Once we fill the map with initial data for all modules, we will always
-  // assume that all .find()s return a valid iterator, i.e. each module always
-  // has an entry in the map.
+std::vector<int> Canvas::GetFlatOrderableIDs() const{
+  std::vector<int> result;
+  for(const auto& it : topo_order){
+    std::vector<int> ids = GetOrderableIDs(graph.GetModule(it.second));
+    result.insert(result.end(), ids.begin(), ids.end());
+  }
+  return result;
+}
+
+std::shared_ptr<Builtin::Subpatch> Canvas::GetFlattenedOwner() const{
+  auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(owner_hint);
+  if(subpatch && subpatch->IsFlattened()) return subpatch;
+  return nullptr;
+}
+
+std::shared_ptr<Canvas> Canvas::GetFlatteningRoot(){
+  std::shared_ptr<Canvas> c = shared_from_this();
+  while(auto owner = c->GetFlattenedOwner()){
+    auto parent = owner->canvas.lock();
+    if(!parent) break;
+    c = parent;
+  }
+  return c;
+}
+
+bool Canvas::IsFlatteningInvolved() const{
+  if(GetFlattenedOwner()) return true;
+  for(const auto& m : modules){
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    if(subpatch && subpatch->IsFlattened()) return true;
+  }
+  return false;
+}
 
-  for(const std::shared_ptr<Module>& m : modules)
-    if(m->templ->has_sc_code)
-      indegrees[m] = 0;
+void Canvas::RefreshFlattenedConnections(){
+  std::vector<std::pair<std::string, lo::Message>> messages;
+  CollectChangedConnections(messages);
+  if(!messages.empty()) SCLang::SendOSCBundle(messages);
+}
 
-  // Calculate initial indegrees.
-  for(auto &it : audio_connections) // For each connection
-    for(const IOID& i : it.second) // For each ending
-      indegrees[i.module]++; // Increase the indeg for that module
+void Canvas::CollectChangedConnections(std::vector<std::pair<std::string, lo::Message>>& messages){
+  for(const auto& m : modules){
+    if(m->sc_id >= 0)
+      for(const auto& outlet : m->outlets)
+        if(outlet->TargetsChanged())
+          messages.push_back({"/algaudioSC/connectoutlet", outlet->GetConnectionsMessage()});
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    if(subpatch && subpatch->IsFlattened() && subpatch->GetInternalCanvas())
+      subpatch->GetInternalCanvas()->CollectChangedConnections(messages);
+  }
+}
 
-  std::stack<std::shared_ptr<Module>> frontier;
+bool Canvas::DelegateOrdering(){
+  auto owner = GetFlattenedOwner();
+  if(!owner) return false;
+  auto parent = owner->canvas.lock();
+  if(parent && !parent->do_not_recalculate_ordering) parent->RecalculateOrder();
+  return true;
+}
 
-  // Initialize the frontier
-  for(auto &it : indegrees) // Look at all modules...
-    if(it.second == 0)        // ... that have 0 indeg, ...
-      frontier.push(it.first);  // ... add them.
+void Canvas::RebuildOrder(){
+  // A variant of Kahn's algorithm, which always picks the module with the
+  // lowest current position among those available. This way modules which
+  // do not need to move stay in their relative order.
+  std::vector<unsigned int> indegrees(graph.GetModuleSlots(), 0);
+  for(CanvasGraph::EdgeHandle e = 0; e < graph.GetEdgeSlots(); e++)
+    if(graph.GetEdgeType(e) == CanvasGraph::EdgeType::Audio)
+      indegrees[graph.GetEdgeTo(e)]++;
 
-  std::list<std::shared_ptr<Module>> ordering;
+  typedef std::pair<int, CanvasGraph::ModuleHandle> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> frontier;
+  for(const auto& it : topo_order)
+    if(indegrees[it.second] == 0) frontier.push({it.first, it.second});
 
+  std::vector<CanvasGraph::ModuleHandle> ordering;
   while(!frontier.empty()){
-    // Get a new module from frontier.
-    std::shared_ptr<Module> current = frontier.top(); frontier.pop();
-    // Add the current module to the resulting ordering.
+    CanvasGraph::ModuleHandle current = frontier.top().second; frontier.pop();
     ordering.push_back(current);
-    std::list<std::shared_ptr<Module>> next_list = GetConnectedModules(current);
-    // For each module that is directly connected after the current one:
-    for(const std::shared_ptr<Module>& m : next_list)
-      if( --indegrees[m]  == 0) // Decrease the indeg, also it it's zero, then add the module to frontier.
-        frontier.push(m);
+    for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(current)){
+      if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      CanvasGraph::ModuleHandle next = graph.GetEdgeTo(e);
+      if(--indegrees[next] == 0) frontier.push({topo_position[next], next});
+    }
   }
 
-  if(ordering.size() != indegrees.size()){
-    // Failure. We did not traverse all modules. This can only happen
-    // if the connection graph has a cycle.
-    // The ordering is inconclusive.
-    throw Exceptions::ConnectionLoop("");
+  if(ordering.size() != topo_order.size()){
+    // We did not traverse all modules. This can only happen if the
+    // connection graph has a cycle.
+    throw Exceptions::ConnectionLoop("Cannot apply the changes, they would close a loop.");
   }
 
-/*
-  // For debugging purposes, demonstrate when the computed odrer is.
-  std::cout << "New synth ordering:" << std::endl;
-  for(const std::shared_ptr<Module> &m : ordering)
-    std::cout << "   \"" << m->templ->name << "\"" << std::endl;
-*/
+  topo_order.clear();
+  topo_head = 0;
+  for(unsigned int i = 0; i < ordering.size(); i++){
+    topo_position[ordering[i]] = i;
+    topo_order[i] = ordering[i];
+  }
+}
 
-  // Send the ordering to SC.
-  lo::Message msg;
-  for(const std::shared_ptr<Module> &m : ordering){
-    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
-    if(subpatch){
-      // Special cas for builtin subpatch module. Ordering full node groups (subtrees)
-      msg.add_int32(subpatch->GetGroupID());
-      msg.add_int32(m->sc_id);
-    }else{
+bool Canvas::IsPaused(std::shared_ptr<Module> m) const{
+  CanvasGraph::ModuleHandle h = GetHandle(m);
+  if(h == CanvasGraph::Invalid || h >= paused.size()) return false;
+  return paused[h];
+}
+
+bool Canvas::IsSink(const std::shared_ptr<Module>& m){
+  if(m->GetKeepRunning()) return true;
+  if(m->templ && m->templ->sink) return true;
+  // A subpatch needs its input if the signal leads to a sink inside.
+  auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+  if(subpatch){
+    auto internal = subpatch->GetInternalCanvas();
+    return internal && internal->entrance_reaches_sink;
+  }
+  // A subpatch exit passes signal to the parent canvas, where it is needed
+  // only if the subpatch is live.
+  auto exit = std::dynamic_pointer_cast<Builtin::SubpatchExit>(m);
+  if(exit){
+    if(!exit->subpatch) return true;
+    auto parent = exit->subpatch->canvas.lock();
+    return !parent || parent->IsLive(exit->subpatch);
+  }
+  return false;
+}
+
+bool Canvas::IsLive(const std::shared_ptr<Module>& m) const{
+  CanvasGraph::ModuleHandle h = GetHandle(m);
+  if(!live_valid || h == CanvasGraph::Invalid || h >= live.size()) return true;
+  return live[h];
+}
+
+bool Canvas::IsPausable(const std::shared_ptr<Module>& m){
+  if(m->sc_id < 0 || !m->templ || !m->templ->has_sc_code) return false;
+  if(std::dynamic_pointer_cast<Builtin::Subpatch>(m)) return false;
+  if(std::dynamic_pointer_cast<Builtin::SubpatchEntrance>(m)) return false;
+  return true;
+}
+
+void Canvas::UpdatePausing(){
+  // Partial states are not worth sending, the update will be repeated
+  // when the batch is over.
+  if(in_batch || do_not_recalculate_ordering){
+    live_valid = false;
+    return;
+  }
+  
+  unsigned int slots = graph.GetModuleSlots();
+  std::vector<CanvasGraph::ModuleHandle> stack, all;
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++)
+    if(graph.GetModule(h)) all.push_back(h);
+  auto before = GetSubpatchLiveness(all);
+
+  // Walk the graph backwards, starting from all sinks.
+  live.assign(slots, 0);
+  for(CanvasGraph::ModuleHandle h : all){
+    if(!IsSink(graph.GetModule(h))) continue;
+    live[h] = 1;
+    stack.push_back(h);
+  }
+  while(!stack.empty()){
+    CanvasGraph::ModuleHandle current = stack.back(); stack.pop_back();
+    for(CanvasGraph::EdgeHandle e : graph.GetInEdges(current)){
+      CanvasGraph::ModuleHandle prev = graph.GetEdgeFrom(e);
+      if(live[prev]) continue;
+      live[prev] = 1;
+      stack.push_back(prev);
+    }
+  }
+  live_valid = true;
+  
+  SendPausingChanges(all);
+  UpdateBusSharing();
+  PassLivenessAcrossSubpatches(before);
+}
+
+void Canvas::UpdatePausingAround(std::vector<CanvasGraph::ModuleHandle> changed, bool audio_changed){
+  if(in_batch || do_not_recalculate_ordering){
+    live_valid = false;
+    return;
+  }
+  if(!live_valid){
+    UpdatePausing();
+    return;
+  }
+
+  unsigned int slots = graph.GetModuleSlots();
+  live.resize(slots, 0);
+  // Only modules that can reach one of the changed ones may have changed
+  // their liveness. Collect them by walking the graph backwards.
+  std::vector<char> affected(slots, 0);
+  std::vector<CanvasGraph::ModuleHandle> region;
+  for(CanvasGraph::ModuleHandle h : changed){
+    if(h == CanvasGraph::Invalid || h >= slots || !graph.GetModule(h) || affected[h]) continue;
+    affected[h] = 1;
+    region.push_back(h);
+  }
+  for(unsigned int i = 0; i < region.size(); i++){
+    for(CanvasGraph::EdgeHandle e : graph.GetInEdges(region[i])){
+      CanvasGraph::ModuleHandle prev = graph.GetEdgeFrom(e);
+      if(affected[prev]) continue;
+      affected[prev] = 1;
+      region.push_back(prev);
+    }
+  }
+
+  auto before = GetSubpatchLiveness(region);
+
+  // Within that region, a module is live if it is a sink, or if it leads
+  // to a live module outside of the region, or to a live one within it.
+  std::vector<CanvasGraph::ModuleHandle> stack;
+  for(CanvasGraph::ModuleHandle h : region) live[h] = 0;
+  for(CanvasGraph::ModuleHandle h : region){
+    bool seed = IsSink(graph.GetModule(h));
+    for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(h)){
+      if(seed) break;
+      CanvasGraph::ModuleHandle next = graph.GetEdgeTo(e);
+      if(!affected[next] && live[next]) seed = true;
+    }
+    if(!seed) continue;
+    live[h] = 1;
+    stack.push_back(h);
+  }
+  while(!stack.empty()){
+    CanvasGraph::ModuleHandle current = stack.back(); stack.pop_back();
+    for(CanvasGraph::EdgeHandle e : graph.GetInEdges(current)){
+      CanvasGraph::ModuleHandle prev = graph.GetEdgeFrom(e);
+      if(live[prev]) continue;
+      live[prev] = 1;
+      stack.push_back(prev);
+    }
+  }
+
+  // Intervals of shared buses only depend on audio connections, the order
+  // and pausing.
+  bool pausing_changed = SendPausingChanges(region);
+  if(pausing_changed || audio_changed) UpdateBusSharing();
+  PassLivenessAcrossSubpatches(before);
+}
+
+std::vector<std::pair<CanvasGraph::ModuleHandle, int>> Canvas::GetSubpatchLiveness(const std::vector<CanvasGraph::ModuleHandle>& handles) const{
+  std::vector<std::pair<CanvasGraph::ModuleHandle, int>> res;
+  for(CanvasGraph::ModuleHandle h : handles){
+    if(!std::dynamic_pointer_cast<Builtin::Subpatch>(graph.GetModule(h))) continue;
+    res.push_back({h, (live_valid && h < live.size()) ? live[h] : -1});
+  }
+  return res;
+}
+
+void Canvas::PassLivenessAcrossSubpatches(const std::vector<std::pair<CanvasGraph::ModuleHandle, int>>& before){
+  // Exits of subpatches that became live or not live are the changed
+  // modules on their internal canvases. Whether an entrance reaches a sink
+  // does not depend on exits, so this does not come back here.
+  for(const auto& p : before){
+    if(p.second == live[p.first]) continue;
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(graph.GetModule(p.first));
+    auto internal = subpatch ? subpatch->GetInternalCanvas() : nullptr;
+    if(!internal) continue;
+    std::vector<CanvasGraph::ModuleHandle> exits;
+    for(CanvasGraph::ModuleHandle h = 0; h < internal->graph.GetModuleSlots(); h++)
+      if(std::dynamic_pointer_cast<Builtin::SubpatchExit>(internal->graph.GetModule(h))) exits.push_back(h);
+    if(!exits.empty()) internal->UpdatePausingAround(exits, false);
+  }
+
+  auto owner = std::dynamic_pointer_cast<Builtin::Subpatch>(owner_hint);
+  if(!owner) return;
+  // Search forwards from the entrances for a sink, skipping exits.
+  unsigned int slots = graph.GetModuleSlots();
+  std::vector<char> visited(slots, 0);
+  std::vector<CanvasGraph::ModuleHandle> stack;
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++){
+    if(!std::dynamic_pointer_cast<Builtin::SubpatchEntrance>(graph.GetModule(h))) continue;
+    visited[h] = 1;
+    stack.push_back(h);
+  }
+  bool reaches = false;
+  while(!stack.empty() && !reaches){
+    CanvasGraph::ModuleHandle current = stack.back(); stack.pop_back();
+    for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(current)){
+      CanvasGraph::ModuleHandle next = graph.GetEdgeTo(e);
+      if(visited[next]) continue;
+      visited[next] = 1;
+      const std::shared_ptr<Module>& m = graph.GetModule(next);
+      if(!std::dynamic_pointer_cast<Builtin::SubpatchExit>(m) && IsSink(m)) reaches = true;
+      stack.push_back(next);
+    }
+  }
+  if(reaches == entrance_reaches_sink) return;
+  entrance_reaches_sink = reaches;
+  auto parent = owner->canvas.lock();
+  if(parent) parent->UpdatePausingAround({parent->GetHandle(owner)}, false);
+}
+
+bool Canvas::SendPausingChanges(const std::vector<CanvasGraph::ModuleHandle>& handles){
+  paused.resize(graph.GetModuleSlots(), 0);
+  std::vector<std::pair<std::string, lo::Message>> messages;
+  for(CanvasGraph::ModuleHandle h : handles){
+    const std::shared_ptr<Module>& m = graph.GetModule(h);
+    if(!m) continue;
+    char p = (Config::Global().auto_pause_modules && !live[h] && IsPausable(m)) ? 1 : 0;
+    if(p == paused[h]) continue;
+    paused[h] = p;
+    lo::Message msg;
+    msg.add_int32(m->sc_id);
+    msg.add_int32(p ? 0 : 1);
+    messages.push_back({"/algaudioSC/runinstance", msg});
+    m->NotifyRunStateChanged();
+  }
+  if(!messages.empty()) SCLang::SendOSCBundle(messages);
+  return !messages.empty();
+}
+
+void Canvas::UpdateRunPolicy(std::shared_ptr<Module> m){
+  UpdatePausingAround({GetHandle(m)}, false);
+}
+
+bool Canvas::MayShareBuses(CanvasGraph::ModuleHandle h) const{
+  const std::shared_ptr<Module>& m = graph.GetModule(h);
+  if(!m || m->sc_id < 0 || !m->templ) return false;
+  const ModuleTemplate& t = *m->templ;
+  // Custom modules may pass inlet buses elsewhere, and silence gates watch
+  // the buses they were created with.
+  if(!t.has_sc_code || t.has_class || t.silence_gate > 0.0f) return false;
+  unsigned int channels = 0;
+  for(const auto& inlet : m->inlets) if(inlet) channels += inlet->GetChannels();
+  if(channels > 16) return false;
+  // The clearing synth runs in the instance group, so it stops together
+  // with the instance.
+  if(h < paused.size() && paused[h]) return false;
+  return fused_modules.count(m.get()) == 0;
+}
+
+void Canvas::UpdateBusSharing(){
+  if(in_batch || do_not_recalculate_ordering) return;
+  unsigned int slots = graph.GetModuleSlots();
+  bool enabled = Config::Global().share_buses && !IsFlatteningInvolved();
+
+  struct Interval{
+    int start, end;
+    std::shared_ptr<Module::Inlet> inlet;
+    CanvasGraph::ModuleHandle reader;
+  };
+  std::vector<Interval> intervals;
+  for(CanvasGraph::ModuleHandle h = 0; enabled && h < slots; h++){
+    if(!MayShareBuses(h)) continue;
+    int end = topo_position[h];
+    for(const auto& inlet : graph.GetModule(h)->inlets){
+      if(!inlet || !inlet->bus) continue;
+      // An inlet nothing writes to is live only while it is read.
+      int start = end;
+      for(CanvasGraph::EdgeHandle e : graph.GetInEdges(h)){
+        if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio || graph.GetEdgeToPort(e) != inlet->id) continue;
+        start = std::min(start, topo_position[graph.GetEdgeFrom(e)]);
+      }
+      intervals.push_back(Interval{start, end, inlet, h});
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b){
+    return (a.start != b.start) ? a.start < b.start : a.end < b.end;
+  });
+
+  // Linear scan. A bus becomes free only after the module that reads it, as
+  // the module may write its outlets while reading. Buses are only reused by
+  // inlets with the same number of channels.
+  typedef std::pair<int, std::shared_ptr<Bus>> Active;
+  auto later = [](const Active& a, const Active& b){ return a.first > b.first; };
+  std::priority_queue<Active, std::vector<Active>, decltype(later)> active(later);
+  std::map<unsigned int, std::vector<std::shared_ptr<Bus>>> free;
+  std::vector<std::shared_ptr<Bus>> assigned(intervals.size());
+  // The index of the last interval assigned to each bus so far.
+  std::map<Bus*, unsigned int> last_user;
+  std::vector<char> needs_clear(intervals.size(), 0);
+  for(unsigned int i = 0; i < intervals.size(); i++){
+    while(!active.empty() && active.top().first < intervals[i].start){
+      free[active.top().second->GetChannels()].push_back(active.top().second);
+      active.pop();
+    }
+    std::shared_ptr<Bus> bus = intervals[i].inlet->bus;
+    std::vector<std::shared_ptr<Bus>>& candidates = free[bus->GetChannels()];
+    if(!candidates.empty()){
+      bus = candidates.back();
+      candidates.pop_back();
+    }
+    auto it = last_user.find(bus.get());
+    if(it != last_user.end()) needs_clear[it->second] = 1;
+    last_user[bus.get()] = i;
+    assigned[i] = bus;
+    active.push({intervals[i].end, bus});
+  }
+
+  // Apply the assignment, resetting all inlets that do not take part.
+  std::map<Module::Inlet*, std::shared_ptr<Bus>> substitutes;
+  std::vector<std::vector<int>> clears(slots);
+  for(unsigned int i = 0; i < intervals.size(); i++){
+    if(assigned[i] != intervals[i].inlet->bus) substitutes[intervals[i].inlet.get()] = assigned[i];
+    if(!needs_clear[i]) continue;
+    for(unsigned int c = 0; c < assigned[i]->GetChannels(); c++)
+      clears[intervals[i].reader].push_back(assigned[i]->GetID() + c);
+  }
+  std::vector<std::pair<std::string, lo::Message>> messages;
+  std::set<std::shared_ptr<Module::Outlet>> writers;
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++){
+    const std::shared_ptr<Module>& m = graph.GetModule(h);
+    if(!m) continue;
+    for(const auto& inlet : m->inlets){
+      if(!inlet || !inlet->bus) continue;
+      auto it = substitutes.find(inlet.get());
+      std::shared_ptr<Bus> substitute = (it == substitutes.end()) ? nullptr : it->second;
+      if(inlet->bus->substitute == substitute) continue;
+      inlet->bus->substitute = substitute;
+      lo::Message msg;
       msg.add_int32(m->sc_id);
+      msg.add_string(inlet->id.str());
+      msg.add_int32(inlet->bus->GetUsedID());
+      messages.push_back({"/algaudioSC/connectinlet", msg});
+      for(CanvasGraph::EdgeHandle e : graph.GetInEdges(h)){
+        if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio || graph.GetEdgeToPort(e) != inlet->id) continue;
+        auto outlet = graph.GetModule(graph.GetEdgeFrom(e))->GetOutletByID(graph.GetEdgeFromPort(e));
+        if(outlet) writers.insert(outlet);
+      }
     }
+    if(bus_clears.size() <= h) bus_clears.resize(h + 1);
+    if(bus_clears[h] == clears[h]) continue;
+    bus_clears[h] = clears[h];
+    lo::Message msg;
+    msg.add_int32(m->sc_id);
+    for(int id : clears[h]) msg.add_int32(id);
+    messages.push_back({"/algaudioSC/busclear", msg});
   }
-  SCLang::SendOSCCustom("/algaudioSC/ordering", msg);
+  for(const auto& outlet : writers)
+    messages.push_back({"/algaudioSC/connectoutlet", outlet->GetConnectionsMessage()});
+  if(!messages.empty()) SCLang::SendOSCBundle(messages);
+}
 
+LateReturn<> Canvas::Compile(){
+  Relay<> r;
+  Decompile();
+  auto chains = GraphCompiler::FindChains(*this);
+  if(chains.empty()) return r.Return();
+  // Fused modules stop using shared buses before the fused synth is made.
+  std::vector<unsigned int> numbers;
+  for(const auto& chain : chains){
+    numbers.push_back(fused_counter++);
+    for(const auto& m : chain) fused_modules[m.get()] = numbers.back();
+  }
+  UpdateBusSharing();
+  std::weak_ptr<Canvas> wself = shared_from_this();
+  Sync s(chains.size());
+  for(unsigned int i = 0; i < chains.size(); i++){
+    unsigned int n = numbers[i];
+    FusedChain::Create(shared_from_this(), chains[i]).Then([wself, s, n](std::shared_ptr<FusedChain> f){
+      auto self = wself.lock();
+      bool pending = false;
+      if(self)
+        for(const auto& p : self->fused_modules)
+          if(p.second == n) pending = true;
+      // The chain was edited while SC was fusing it.
+      if(pending) self->fused_chains[n] = f;
+      else f->Release();
+      s.Trigger();
+    });
+  }
+  s.WhenAll([r](){
+    r.Return();
+  });
+  return r;
+}
+
+void Canvas::Decompile(){
+  for(auto& p : fused_chains) p.second->Release();
+  fused_chains.clear();
+  fused_modules.clear();
+  UpdateBusSharing();
+}
+
+void Canvas::DecompileModule(const std::shared_ptr<Module>& m){
+  auto it = fused_modules.find(m.get());
+  if(it == fused_modules.end()) return;
+  unsigned int n = it->second;
+  for(auto jt = fused_modules.begin(); jt != fused_modules.end();){
+    if(jt->second == n) jt = fused_modules.erase(jt);
+    else jt++;
+  }
+  auto chain = fused_chains.find(n);
+  if(chain == fused_chains.end()) return;
+  chain->second->Release();
+  fused_chains.erase(chain);
+}
+
+void Canvas::BeginBatch(){
+  in_batch = true;
+  batch_order_dirty = false;
+  batch_outlets.clear();
+  batch_removals.clear();
+}
+
+void Canvas::EndBatch(bool send){
+  in_batch = false;
+  if(send){
+    std::vector<std::pair<std::string, lo::Message>> messages;
+    for(const auto& outlet : batch_outlets)
+      messages.push_back({"/algaudioSC/connectoutlet", outlet->GetConnectionsMessage()});
+    bool delegate = (GetFlattenedOwner() != nullptr);
+    if(batch_order_dirty && !do_not_recalculate_ordering && !delegate)
+      messages.push_back({"/algaudioSC/ordering", GetOrderingMessage()});
+    messages.insert(messages.end(), batch_removals.begin(), batch_removals.end());
+    if(!messages.empty()) SCLang::SendOSCBundle(messages);
+    if(IsFlatteningInvolved()) GetFlatteningRoot()->RefreshFlattenedConnections();
+    if(batch_order_dirty && !do_not_recalculate_ordering && delegate) DelegateOrdering();
+    UpdatePausing();
+  }
+  batch_order_dirty = false;
+  batch_outlets.clear();
+  batch_removals.clear();
+}
+
+void Canvas::Transaction::Connect(IOID from, IOID to){
+  operations.push_back(Operation{Operation::Type::Connect, from, to, DataConnectionMode::Absolute});
+}
+void Canvas::Transaction::Disconnect(IOID from, IOID to){
+  operations.push_back(Operation{Operation::Type::Disconnect, from, to, DataConnectionMode::Absolute});
+}
+void Canvas::Transaction::ConnectData(IOID from, IOID to, DataConnectionMode m){
+  operations.push_back(Operation{Operation::Type::ConnectData, from, to, m});
+}
+void Canvas::Transaction::DisconnectData(IOID from, IOID to){
+  operations.push_back(Operation{Operation::Type::DisconnectData, from, to, DataConnectionMode::Absolute});
+}
+void Canvas::Transaction::RemoveModule(std::shared_ptr<Module> m){
+  operations.push_back(Operation{Operation::Type::RemoveModule, IOID{m, Symbol()}, IOID{nullptr, Symbol()}, DataConnectionMode::Absolute});
+}
+
+void Canvas::Transaction::Commit(){
+  if(committed){
+    std::cout << "WARNING: A canvas transaction may be committed only once." << std::endl;
+    return;
+  }
+  committed = true;
+  Canvas& c = *canvas;
+  std::vector<std::shared_ptr<Module>> to_remove;
+  c.BeginBatch();
+  try{
+    for(const Operation& op : operations){
+      if(op.type != Operation::Type::RemoveModule){
+        Apply(op);
+        continue;
+      }
+      std::shared_ptr<Module> m = op.from.module;
+      CanvasGraph::ModuleHandle h = c.GetHandle(m);
+      if(h == CanvasGraph::Invalid) continue;
+      if(std::find(to_remove.begin(), to_remove.end(), m) != to_remove.end()) continue;
+      to_remove.push_back(m);
+      // Disconnect the module first, so that these changes can be reverted.
+      std::vector<CanvasGraph::EdgeHandle> edges = c.graph.GetOutEdges(h);
+      const std::vector<CanvasGraph::EdgeHandle>& in = c.graph.GetInEdges(h);
+      edges.insert(edges.end(), in.begin(), in.end());
+      for(CanvasGraph::EdgeHandle e : edges){
+        CanvasGraph::EdgeType type = c.graph.GetEdgeType(e);
+        if(type == CanvasGraph::EdgeType::None) continue;
+        IOID from{c.graph.GetModule(c.graph.GetEdgeFrom(e)), c.graph.GetEdgeFromPort(e)};
+        IOID to  {c.graph.GetModule(c.graph.GetEdgeTo(e)),   c.graph.GetEdgeToPort(e)};
+        if(type == CanvasGraph::EdgeType::Audio)
+          Apply(Operation{Operation::Type::Disconnect, from, to, DataConnectionMode::Absolute});
+        else
+          Apply(Operation{Operation::Type::DisconnectData, from, to, DataConnectionMode::Absolute});
+      }
+    }
+    if(c.batch_order_dirty) c.RebuildOrder();
+  }catch(Exceptions::Exception&){
+    // Revert everything that was done so far.
+    for(auto it = journal.rbegin(); it != journal.rend(); it++) Revert(*it);
+    journal.clear();
+    c.EndBatch(false);
+    throw;
+  }
+  // There is no point in updating outlets of modules that are to be removed.
+  c.batch_outlets.erase(std::remove_if(c.batch_outlets.begin(), c.batch_outlets.end(), [&to_remove](const std::shared_ptr<Module::Outlet>& o){
+    for(const auto& m : to_remove) if(&o->mod == m.get()) return true;
+    return false;
+  }), c.batch_outlets.end());
+  // Removals cannot be reverted, so they wait until nothing can fail, but
+  // they are still a part of the batch, and are sent in the same bundle.
+  for(const auto& m : to_remove) c.RemoveModule(m);
+  c.EndBatch(true);
+}
+
+void Canvas::Transaction::Apply(const Operation& op){
+  Canvas& c = *canvas;
+  if(op.type == Operation::Type::Connect){
+    bool existed = c.GetDirectAudioConnectionExists(op.from, op.to);
+    c.Connect(op.from, op.to);
+    if(!existed && c.GetDirectAudioConnectionExists(op.from, op.to)) journal.push_back(op);
+  }else if(op.type == Operation::Type::Disconnect){
+    if(!c.GetDirectAudioConnectionExists(op.from, op.to)) return;
+    c.Disconnect(op.from, op.to);
+    journal.push_back(op);
+  }else if(op.type == Operation::Type::ConnectData){
+    c.ConnectData(op.from, op.to, op.mode);
+    if(c.GetDirectDataConnectionExists(op.from, op.to).first) journal.push_back(op);
+  }else if(op.type == Operation::Type::DisconnectData){
+    auto existing = c.GetDirectDataConnectionExists(op.from, op.to);
+    if(!existing.first) return;
+    c.DisconnectData(op.from, op.to);
+    // Remember the mode, so that the connection can be restored.
+    journal.push_back(Operation{op.type, op.from, op.to, existing.second});
+  }
+}
+
+void Canvas::Transaction::Revert(const Operation& op){
+  Canvas& c = *canvas;
+  if(op.type == Operation::Type::Connect){
+    c.Disconnect(op.from, op.to);
+  }else if(op.type == Operation::Type::Disconnect){
+    c.Connect(op.from, op.to);
+  }else if(op.type == Operation::Type::ConnectData){
+    c.DisconnectData(op.from, op.to);
+  }else if(op.type == Operation::Type::DisconnectData){
+    c.ConnectData(op.from, op.to, op.mode);
+  }
 }
 
 void Canvas::BlockReordering(bool enable){
   do_not_recalculate_ordering = enable;
   if(!do_not_recalculate_ordering){
     RecalculateOrder();
+    UpdatePausing();
   }
 }
 
 bool Canvas::TestNewConnectionForLoop(IOID from, IOID to){
-  // DFS search starting in TO. If we find FROM, then the new connection would
-  // create a loop. If we don't, then the new connection is okay.
-
-  // Usually the connection graph is VERY sparse, multiple connections to
-  // an inlet are usually rare. Therefore, when traversing the graph, we should
-  // end up visiting only a very small number of vertices (modules). Thus it
-  // might be inefficient to prepare a large bitmask and use it to mark whether
-  // a module was already visited or not, instead we'll use an unordered set
-  // which will gather visited vertices. Access to the set should be O(1) on
-  // average.
-
   if(to.module == from.module) // Loop of size 0
     return true;
+  CanvasGraph::ModuleHandle hfrom = GetHandle(from.module), hto = GetHandle(to.module);
+  if(hfrom == CanvasGraph::Invalid || hto == CanvasGraph::Invalid) return false;
+  // If TO is already after FROM in the topological order, the new connection
+  // agrees with it and cannot close a loop. Otherwise, a loop exists iff FROM
+  // is reachable from TO, and any such path may only visit modules between
+  // the two in the current order.
+  int bound = topo_position[hfrom];
+  if(topo_position[hto] > bound) return false;
+  std::vector<CanvasGraph::ModuleHandle> visited;
+  return SearchForward(hto, hfrom, bound, visited);
+}
 
-  std::unordered_set<std::shared_ptr<Module>> visited;
-  std::queue<std::shared_ptr<Module>> frontier;
-
-  // Initialize the frontier with the starting vertex.
-  frontier.push(to.module);
-
-  while(!frontier.empty()){
-    std::shared_ptr<Module> current = frontier.front(); frontier.pop();
-    // Mark as visited.
-    visited.insert(current);
-    std::list<std::shared_ptr<Module>> next_list = GetConnectedModules(current);
-    // For each module that is connected to current:
-    for(const std::shared_ptr<Module>& next_module : next_list){
+bool Canvas::SearchForward(CanvasGraph::ModuleHandle start, CanvasGraph::ModuleHandle target, int bound, std::vector<CanvasGraph::ModuleHandle>& result) const{
+  // Usually the connection graph is VERY sparse, and the search is limited to
+  // the region between the two endpoints, so only a handful of modules is
+  // visited. Thus the visited modules are simply gathered in the result
+  // vector and tracked with a small set.
+  std::unordered_set<CanvasGraph::ModuleHandle> visited;
+  std::vector<CanvasGraph::ModuleHandle> stack;
+  stack.push_back(start);
+  visited.insert(start);
+  while(!stack.empty()){
+    CanvasGraph::ModuleHandle current = stack.back(); stack.pop_back();
+    result.push_back(current);
+    for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(current)){
+      if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      CanvasGraph::ModuleHandle next = graph.GetEdgeTo(e);
       // If that's the one we are looking for, end the search.
-      if(next_module == from.module) return true;
-      // If already visited, ignore this vertex.
-      if(visited.find(next_module) != visited.end()) continue;
-      // Finally, add the new module to frontier.
-      frontier.push(next_module);
+      if(next == target) return true;
+      if(visited.count(next)) continue;
+      // Modules past the bound cannot lead to the target.
+      if(topo_position[next] > bound) continue;
+      visited.insert(next);
+      stack.push_back(next);
     }
   }
   return false;
 }
 
-std::list<std::shared_ptr<Module>> Canvas::GetConnectedModules(std::shared_ptr<Module> m){
-  std::list<std::shared_ptr<Module>> result;
-  for(const IOLetTemplate& iolettempl : m->templ->outlets){
-    std::string outletid = iolettempl.id;
-    // For each outlet, get the list of connections from it
-    auto it = audio_connections.find(IOID{m,outletid});
-    if(it == audio_connections.end()) continue; // No connections from this outlet.
-    for(const IOID& inlet : it->second){
-      result.push_back(inlet.module);
+void Canvas::SearchBackward(CanvasGraph::ModuleHandle end, int bound, std::vector<CanvasGraph::ModuleHandle>& result) const{
+  std::unordered_set<CanvasGraph::ModuleHandle> visited;
+  std::vector<CanvasGraph::ModuleHandle> stack;
+  stack.push_back(end);
+  visited.insert(end);
+  while(!stack.empty()){
+    CanvasGraph::ModuleHandle current = stack.back(); stack.pop_back();
+    result.push_back(current);
+    for(CanvasGraph::EdgeHandle e : graph.GetInEdges(current)){
+      if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      CanvasGraph::ModuleHandle prev = graph.GetEdgeFrom(e);
+      if(visited.count(prev)) continue;
+      if(topo_position[prev] < bound) continue;
+      visited.insert(prev);
+      stack.push_back(prev);
     }
   }
+}
+
+bool Canvas::UpdateOrderForConnection(CanvasGraph::ModuleHandle from, CanvasGraph::ModuleHandle to, std::vector<CanvasGraph::ModuleHandle>& moved){
+  if(from == to) return false;
+  int lower = topo_position[to], upper = topo_position[from];
+  // The order already agrees with the new connection.
+  if(lower > upper) return true;
+
+  // Find the modules which have to be moved after FROM (those reachable from
+  // TO), and the ones which have to be moved before TO (those that lead to
+  // FROM). Both searches stay within the [lower, upper] range.
+  std::vector<CanvasGraph::ModuleHandle> forward, backward;
+  if(SearchForward(to, from, upper, forward)) return false;
+  SearchBackward(from, lower, backward);
+
+  // Reuse the positions of all affected modules: backward ones take the
+  // lowest of them, forward ones the rest, each group keeping its relative
+  // order.
+  auto by_position = [this](CanvasGraph::ModuleHandle a, CanvasGraph::ModuleHandle b){
+    return topo_position[a] < topo_position[b];
+  };
+  std::sort(forward.begin(), forward.end(), by_position);
+  std::sort(backward.begin(), backward.end(), by_position);
+  moved = backward;
+  moved.insert(moved.end(), forward.begin(), forward.end());
+  std::vector<int> positions;
+  for(CanvasGraph::ModuleHandle h : moved) positions.push_back(topo_position[h]);
+  std::sort(positions.begin(), positions.end());
+  for(unsigned int i = 0; i < moved.size(); i++){
+    topo_position[moved[i]] = positions[i];
+    topo_order[positions[i]] = moved[i];
+  }
+  return true;
+}
+
+void Canvas::SendOrderChanges(const std::vector<CanvasGraph::ModuleHandle>& moved){
+  if(moved.empty()) return;
+  if(DelegateOrdering()) return;
+  // Each moved module is placed right after its predecessor in the new
+  // order. Doing so in the order of moved modules restores the complete
+  // order on SC, as the relative order of all other modules is unchanged.
+  // Pairs of (node, predecessor) are sent, with -1 meaning the head of the
+  // canvas group.
+  lo::Message msg;
+  msg.add_int32(group->GetID());
+  bool any = false;
+  for(CanvasGraph::ModuleHandle h : moved){
+    std::vector<int> ids = GetOrderableIDs(graph.GetModule(h));
+    if(ids.empty()) continue;
+    int after = -1;
+    auto it = topo_order.find(topo_position[h]);
+    while(it != topo_order.begin()){
+      --it;
+      std::vector<int> prev_ids = GetOrderableIDs(graph.GetModule(it->second));
+      if(!prev_ids.empty()){
+        after = prev_ids.back();
+        break;
+      }
+    }
+    for(int id : ids){
+      msg.add_int32(id);
+      msg.add_int32(after);
+      after = id;
+    }
+    any = true;
+  }
+  if(any) SCLang::SendOSCCustom("/algaudioSC/reorder", msg);
+}
+
+std::vector<int> Canvas::GetOrderableIDs(const std::shared_ptr<Module>& m){
+  if(!m->templ->has_sc_code) return {};
+  auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+  if(subpatch){
+    if(subpatch->IsFlattened() && subpatch->GetInternalCanvas()){
+      // Internal modules of a flattened subpatch are ordered directly.
+      std::vector<int> result = subpatch->GetInternalCanvas()->GetFlatOrderableIDs();
+      result.push_back(m->sc_id);
+      return result;
+    }
+    // Special cas for builtin subpatch module. Ordering full node groups (subtrees)
+    return {subpatch->GetGroupID(), m->sc_id};
+  }
+  return {m->sc_id};
+}
+
+std::list<std::shared_ptr<Module>> Canvas::GetConnectedModules(std::shared_ptr<Module> m){
+  std::list<std::shared_ptr<Module>> result;
+  CanvasGraph::ModuleHandle h = GetHandle(m);
+  if(h == CanvasGraph::Invalid) return result;
+  for(CanvasGraph::EdgeHandle e : graph.GetOutEdges(h))
+    if(graph.GetEdgeType(e) == CanvasGraph::EdgeType::Audio)
+      result.push_back(graph.GetModule(graph.GetEdgeTo(e)));
   return result;
 }
 
 
 Canvas::~Canvas(){
   std::cout << "NOTE: A canvas instance is destroyed." << std::endl;
+  for(auto& p : fused_chains) p.second->Release();
   for(auto& m : modules) ModuleFactory::DestroyInstance(m);
 }
 
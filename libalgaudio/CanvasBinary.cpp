@@ -0,0 +1,616 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CanvasBinary.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include "ModuleFactory.hpp"
+#include "ParamController.hpp"
+#include "BuiltinModules.hpp"
+#include "PendingConnections.hpp"
+#ifdef __unix__
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+namespace AlgAudio{
+
+static const char binary_magic[4] = {'A','A','B','N'};
+
+static_assert(sizeof(CanvasBinary::Header) == 64, "Unexpected binary patch header layout");
+static_assert(sizeof(CanvasBinary::ModuleRecord) == 44, "Unexpected binary patch module record layout");
+static_assert(sizeof(CanvasBinary::ParamRecord) == 20, "Unexpected binary patch param record layout");
+
+namespace{
+
+/** Collects tables of a single image and lays them out. */
+class ImageWriter{
+public:
+  std::vector<CanvasBinary::ModuleRecord> modules;
+  std::vector<CanvasBinary::ParamRecord> params;
+  std::vector<CanvasBinary::AudioConnRecord> audioconns;
+  std::vector<CanvasBinary::DataConnRecord> dataconns;
+  std::vector<CanvasBinary::SubpatchDefRecord> subpatchdefs;
+  uint32_t AddString(const std::string& s){
+    auto it = string_ids.find(s);
+    if(it != string_ids.end()) return it->second;
+    uint32_t id = strings.size();
+    strings.push_back(s);
+    string_ids[s] = id;
+    return id;
+  }
+  std::string Build(uint32_t document_version);
+private:
+  std::vector<std::string> strings;
+  std::map<std::string, uint32_t> string_ids;
+  template <typename T>
+  void AppendTable(std::string& out, const std::vector<T>& table, CanvasBinary::Span& span){
+    span.offset = out.size();
+    span.count = table.size();
+    if(!table.empty()) out.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(T));
+  }
+};
+
+std::string ImageWriter::Build(uint32_t document_version){
+  CanvasBinary::Header header;
+  std::memcpy(header.magic, binary_magic, 4);
+  header.format_version = CanvasBinary::FormatVersion;
+  header.document_version = document_version;
+
+  std::string out(sizeof(header), '\0');
+  AppendTable(out, modules, header.modules);
+  AppendTable(out, params, header.params);
+  AppendTable(out, audioconns, header.audioconns);
+  AppendTable(out, dataconns, header.dataconns);
+  AppendTable(out, subpatchdefs, header.subpatchdefs);
+  // The span table is written before the pool, so its size must be known.
+  std::vector<CanvasBinary::Span> spans(strings.size());
+  size_t pool = out.size() + spans.size() * sizeof(CanvasBinary::Span);
+  for(unsigned int i = 0; i < strings.size(); i++){
+    spans[i].offset = pool;
+    spans[i].count = strings[i].size();
+    // Keep the terminating null, and keep nested images aligned.
+    pool += (strings[i].size() + 1 + 3) & ~size_t(3);
+  }
+  AppendTable(out, spans, header.strings);
+  for(const std::string& s : strings){
+    out += s;
+    out.append(((s.size() + 1 + 3) & ~size_t(3)) - s.size(), '\0');
+  }
+  header.size = out.size();
+  std::memcpy(&out[0], &header, sizeof(header));
+  return out;
+}
+
+int ReadInt(rapidxml::xml_node<>* node, const char* name){
+  rapidxml::xml_attribute<>* attr = node->first_attribute(name);
+  if(!attr) throw Exceptions::XMLParse(std::string("A ") + node->name() + " node is missing " + name + " attribute");
+  try{
+    return std::stoi(attr->value());
+  }catch(...){
+    throw Exceptions::XMLParse(std::string("A ") + node->name() + " node has invalid " + name + " attribute");
+  }
+}
+std::string ReadString(rapidxml::xml_node<>* node, const char* name){
+  rapidxml::xml_attribute<>* attr = node->first_attribute(name);
+  if(!attr) throw Exceptions::XMLParse(std::string("A ") + node->name() + " node is missing " + name + " attribute");
+  return attr->value();
+}
+
+/** Encodes an algaudio XML node as a binary image. Subpatch definitions are
+ *  encoded recursively. May throw Exceptions::XMLParse. */
+std::string EncodeNode(rapidxml::xml_node<>* root){
+  Utilities::LocaleDecPoint ldp;
+  ImageWriter w;
+
+  std::map<std::string, int32_t> def_indices;
+  for(rapidxml::xml_node<>* def_node = root->first_node("subpatchdef"); def_node; def_node = def_node->next_sibling("subpatchdef")){
+    rapidxml::xml_node<>* contents = def_node->first_node("algaudio");
+    if(!contents) throw Exceptions::XMLParse("A subpatchdef node has no contents");
+    std::string id = ReadString(def_node, "id");
+    def_indices[id] = w.subpatchdefs.size();
+    w.subpatchdefs.push_back({w.AddString(id), w.AddString(EncodeNode(contents))});
+  }
+
+  for(rapidxml::xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module")){
+    CanvasBinary::ModuleRecord rec;
+    rec.saveid = ReadInt(module_node, "saveid");
+    rec.templ = w.AddString(ReadString(module_node, "template"));
+    rec.runpolicy = 0;
+    rapidxml::xml_attribute<>* runpolicy_attr = module_node->first_attribute("runpolicy");
+    if(runpolicy_attr){
+      std::string runpolicy = runpolicy_attr->value();
+      if(runpolicy == "keeprunning") rec.runpolicy = 1;
+      else if(runpolicy == "allowpausing") rec.runpolicy = 2;
+      else throw Exceptions::XMLParse("A module has invalid runpolicy attribute: " + runpolicy);
+    }
+    rec.flags = 0;
+    rec.x = rec.y = 0;
+    rapidxml::xml_node<>* guinode = module_node->first_node("gui");
+    if(guinode && guinode->first_attribute("x") && guinode->first_attribute("y")){
+      rec.flags |= CanvasBinary::HasGUI;
+      rec.x = ReadInt(guinode, "x");
+      rec.y = ReadInt(guinode, "y");
+    }
+    rec.first_param = w.params.size();
+    for(rapidxml::xml_node<>* param_node = module_node->first_node("param"); param_node; param_node = param_node->next_sibling("param") ){
+      CanvasBinary::ParamRecord prec;
+      prec.id = w.AddString(ReadString(param_node, "id"));
+      prec.flags = 0;
+      prec.min = prec.max = 0.0f;
+      try{
+        prec.value = std::stof(ReadString(param_node, "value"));
+        rapidxml::xml_attribute<>* min_attr = param_node->first_attribute("min");
+        rapidxml::xml_attribute<>* max_attr = param_node->first_attribute("max");
+        if(min_attr){ prec.flags |= CanvasBinary::HasMin; prec.min = std::stof(min_attr->value()); }
+        if(max_attr){ prec.flags |= CanvasBinary::HasMax; prec.max = std::stof(max_attr->value()); }
+      }catch(...){
+        throw Exceptions::XMLParse("A param node has an invalid value");
+      }
+      w.params.push_back(prec);
+    }
+    rec.param_count = w.params.size() - rec.first_param;
+    rapidxml::xml_node<>* customstringnode = module_node->first_node("customstring");
+    rec.customstring = customstringnode ? w.AddString(customstringnode->value()) : -1;
+    rec.customxml = -1;
+    rec.subpatchdef = -1;
+    rapidxml::xml_node<>* customxmlnode = module_node->first_node("customxml");
+    if(customxmlnode){
+      // The definition reference is stored in its own field, everything else
+      // is kept as a blob.
+      rapidxml::xml_document<> tmp;
+      rapidxml::xml_node<>* copy = tmp.allocate_node(rapidxml::node_type::node_element);
+      rapidxml::clone_node_copying(customxmlnode, copy, &tmp);
+      rapidxml::xml_attribute<>* def_attr = copy->first_attribute("subpatchdef");
+      if(def_attr){
+        auto it = def_indices.find(def_attr->value());
+        if(it == def_indices.end()) throw Exceptions::XMLParse("A subpatch refers to a missing definition: " + std::string(def_attr->value()));
+        rec.subpatchdef = it->second;
+        copy->remove_attribute(def_attr);
+      }
+      if(!def_attr || copy->first_attribute() || copy->first_node()){
+        std::string blob;
+        rapidxml::print(std::back_inserter(blob), *copy, rapidxml::print_no_indenting);
+        rec.customxml = w.AddString(blob);
+      }
+    }
+    w.modules.push_back(rec);
+  }
+
+  for(rapidxml::xml_node<>* audioconn_node = root->first_node("audioconn"); audioconn_node; audioconn_node = audioconn_node->next_sibling("audioconn")){
+    CanvasBinary::AudioConnRecord rec;
+    rec.from = ReadInt(audioconn_node, "frommodule");
+    rec.to = ReadInt(audioconn_node, "tomodule");
+    rec.fromiolet = w.AddString(ReadString(audioconn_node, "fromioletid"));
+    rec.toiolet = w.AddString(ReadString(audioconn_node, "toioletid"));
+    w.audioconns.push_back(rec);
+  }
+  for(rapidxml::xml_node<>* dataconn_node = root->first_node("dataconn"); dataconn_node; dataconn_node = dataconn_node->next_sibling("dataconn")){
+    CanvasBinary::DataConnRecord rec;
+    rec.from = ReadInt(dataconn_node, "frommodule");
+    rec.to = ReadInt(dataconn_node, "tomodule");
+    rec.fromparam = w.AddString(ReadString(dataconn_node, "fromparamid"));
+    rec.toparam = w.AddString(ReadString(dataconn_node, "toparamid"));
+    std::string mode = ReadString(dataconn_node, "mode");
+    if(mode == "absolute") rec.mode = 0;
+    else if(mode == "relative") rec.mode = 1;
+    else throw Exceptions::XMLParse("Dataconn has invalid mode value");
+    w.dataconns.push_back(rec);
+  }
+
+  return w.Build(ReadInt(root, "version"));
+}
+
+} // anonymous namespace
+
+CanvasBinary::CanvasBinary(){
+
+}
+
+CanvasBinary::~CanvasBinary(){
+
+}
+
+std::shared_ptr<CanvasBinary> CanvasBinary::CreateFromFile(std::string path){
+  auto res = std::shared_ptr<CanvasBinary>( new CanvasBinary() );
+#ifdef __unix__
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) throw Exceptions::XMLFileAccess("Unable to open file '" + path + "'");
+  struct stat st;
+  if(fstat(fd, &st) != 0){
+    close(fd);
+    throw Exceptions::XMLFileAccess("Unable to read file '" + path + "'");
+  }
+  size_t len = st.st_size;
+  if(len < sizeof(Header)){
+    close(fd);
+    throw Exceptions::BinaryPatchParse("The file is too short to be a binary patch.");
+  }
+  void* addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping stays valid.
+  if(addr == MAP_FAILED) throw Exceptions::XMLFileAccess("Unable to map file '" + path + "'");
+  res->storage = std::shared_ptr<void>(addr, [len](void* p){ munmap(p, len); });
+  res->data = static_cast<const char*>(addr);
+  res->size = len;
+#else
+  std::ifstream file(path, std::ios::binary);
+  if(!file) throw Exceptions::XMLFileAccess("Unable to open file '" + path + "'");
+  auto buffer = std::make_shared<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  res->data = buffer->data();
+  res->size = buffer->size();
+  res->storage = buffer;
+#endif
+  res->Validate();
+  return res;
+}
+
+std::shared_ptr<CanvasBinary> CanvasBinary::CreateFromXML(std::shared_ptr<CanvasXML> xml){
+  xml->ShareSubpatchDefinitions();
+  auto buffer = std::make_shared<std::string>(EncodeNode(xml->root));
+  auto res = std::shared_ptr<CanvasBinary>( new CanvasBinary() );
+  res->data = buffer->data();
+  res->size = buffer->size();
+  res->storage = buffer;
+  return res;
+}
+
+std::shared_ptr<CanvasBinary> CanvasBinary::CreateFromCanvas(std::shared_ptr<Canvas> canvas){
+  // Saving is rare compared to loading, so the binary image is simply
+  // converted from the XML document.
+  return CreateFromXML(CanvasXML::CreateFromCanvas(canvas));
+}
+
+std::shared_ptr<CanvasBinary> CanvasBinary::CreateNested(uint32_t string_index) const{
+  const Span& span = Table<Span>(GetHeader().strings)[string_index];
+  if(span.count < sizeof(Header) || span.offset % 4 != 0)
+    throw Exceptions::BinaryPatchParse("A subpatch definition is malformed.");
+  auto res = std::shared_ptr<CanvasBinary>( new CanvasBinary() );
+  res->storage = storage;
+  res->data = data + span.offset;
+  res->size = span.count;
+  res->Validate();
+  return res;
+}
+
+void CanvasBinary::Validate() const{
+  if(size < sizeof(Header) || std::memcmp(data, binary_magic, 4) != 0)
+    throw Exceptions::BinaryPatchParse("This is not a binary patch file.");
+  const Header& h = GetHeader();
+  if(h.format_version != FormatVersion)
+    throw Exceptions::BinaryPatchParse("Unsupported binary patch version (" + std::to_string(h.format_version) + ")");
+  if(h.document_version != 1 && h.document_version != 2)
+    throw Exceptions::BinaryPatchParse("Invalid file version (" + std::to_string(h.document_version) + ")");
+  if(h.size != size)
+    throw Exceptions::BinaryPatchParse("The binary patch is truncated.");
+
+  auto check_table = [this](const Span& s, size_t record_size){
+    if(s.offset % 4 != 0 || uint64_t(s.offset) + uint64_t(s.count) * record_size > size)
+      throw Exceptions::BinaryPatchParse("A binary patch table is out of bounds.");
+  };
+  check_table(h.modules, sizeof(ModuleRecord));
+  check_table(h.params, sizeof(ParamRecord));
+  check_table(h.audioconns, sizeof(AudioConnRecord));
+  check_table(h.dataconns, sizeof(DataConnRecord));
+  check_table(h.subpatchdefs, sizeof(SubpatchDefRecord));
+  check_table(h.strings, sizeof(Span));
+
+  const Span* spans = Table<Span>(h.strings);
+  for(unsigned int i = 0; i < h.strings.count; i++)
+    if(uint64_t(spans[i].offset) + spans[i].count >= size || data[spans[i].offset + spans[i].count] != '\0')
+      throw Exceptions::BinaryPatchParse("A binary patch string is out of bounds.");
+
+  auto check_string = [&h](int64_t index){
+    if(index < 0 || index >= h.strings.count)
+      throw Exceptions::BinaryPatchParse("A binary patch string index is invalid.");
+  };
+  auto check_optional = [](int32_t index, uint32_t count){
+    if(index < -1 || index >= int64_t(count))
+      throw Exceptions::BinaryPatchParse("A binary patch index is invalid.");
+  };
+  const ModuleRecord* modules = Table<ModuleRecord>(h.modules);
+  for(unsigned int i = 0; i < h.modules.count; i++){
+    const ModuleRecord& m = modules[i];
+    check_string(m.templ);
+    check_optional(m.customstring, h.strings.count);
+    check_optional(m.customxml, h.strings.count);
+    check_optional(m.subpatchdef, h.subpatchdefs.count);
+    if(m.runpolicy > 2 || uint64_t(m.first_param) + m.param_count > h.params.count)
+      throw Exceptions::BinaryPatchParse("A binary patch module record is invalid.");
+  }
+  const ParamRecord* params = Table<ParamRecord>(h.params);
+  for(unsigned int i = 0; i < h.params.count; i++)
+    check_string(params[i].id);
+  const AudioConnRecord* audioconns = Table<AudioConnRecord>(h.audioconns);
+  for(unsigned int i = 0; i < h.audioconns.count; i++){
+    check_string(audioconns[i].fromiolet);
+    check_string(audioconns[i].toiolet);
+  }
+  const DataConnRecord* dataconns = Table<DataConnRecord>(h.dataconns);
+  for(unsigned int i = 0; i < h.dataconns.count; i++){
+    check_string(dataconns[i].fromparam);
+    check_string(dataconns[i].toparam);
+    if(dataconns[i].mode > 1)
+      throw Exceptions::BinaryPatchParse("Dataconn has invalid mode value");
+  }
+  const SubpatchDefRecord* defs = Table<SubpatchDefRecord>(h.subpatchdefs);
+  for(unsigned int i = 0; i < h.subpatchdefs.count; i++){
+    check_string(defs[i].id);
+    check_string(defs[i].image);
+  }
+}
+
+const char* CanvasBinary::CString(uint32_t index) const{
+  return data + Table<Span>(GetHeader().strings)[index].offset;
+}
+std::string CanvasBinary::String(uint32_t index) const{
+  const Span& span = Table<Span>(GetHeader().strings)[index];
+  return std::string(data + span.offset, span.count);
+}
+
+bool CanvasBinary::IsBinaryFile(std::string path){
+  std::ifstream file(path, std::ios::binary);
+  char magic[4];
+  if(!file.read(magic, 4)) return false;
+  return std::memcmp(magic, binary_magic, 4) == 0;
+}
+bool CanvasBinary::HasBinaryExtension(std::string path){
+  std::string ext = Extension();
+  return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+void CanvasBinary::SaveToFile(std::string path) const{
+  std::ofstream file(path, std::ios::binary);
+  if(!file) throw Exceptions::XMLFileAccess("Unable to write to file '" + path + "'.");
+  file.write(data, size);
+  file.close();
+  if(!file) throw Exceptions::XMLFileAccess("Failed to write to file '" + path + "'.");
+  std::cout << "File saved." << std::endl;
+}
+
+#define allocs(x) doc.allocate_string((x).c_str())
+#define alloc2s(x) doc.allocate_string(std::to_string(x).c_str())
+#define allocf(x) doc.allocate_string(Utilities::FloatToString(x).c_str())
+
+std::shared_ptr<CanvasXML> CanvasBinary::ToXML() const{
+  const Header& h = GetHeader();
+  auto res = std::shared_ptr<CanvasXML>( new CanvasXML() );
+  rapidxml::xml_document<>& doc = res->doc;
+  res->root = doc.allocate_node(rapidxml::node_type::node_element, "algaudio");
+  res->root->append_attribute( doc.allocate_attribute("version", alloc2s(h.document_version)) );
+  doc.append_node( res->root );
+
+  const SubpatchDefRecord* defs = Table<SubpatchDefRecord>(h.subpatchdefs);
+  for(unsigned int i = 0; i < h.subpatchdefs.count; i++){
+    rapidxml::xml_node<>* defnode = doc.allocate_node(rapidxml::node_type::node_element, "subpatchdef");
+    defnode->append_attribute( doc.allocate_attribute("id", allocs(String(defs[i].id))) );
+    rapidxml::xml_node<>* contents = doc.allocate_node(rapidxml::node_type::node_element);
+    defnode->append_node(contents);
+    CreateNested(defs[i].image)->ToXML()->CloneToAnotherXMLTree(contents, &doc);
+    res->root->append_node(defnode);
+  }
+
+  const ModuleRecord* modules = Table<ModuleRecord>(h.modules);
+  const ParamRecord* params = Table<ParamRecord>(h.params);
+  for(unsigned int i = 0; i < h.modules.count; i++){
+    const ModuleRecord& m = modules[i];
+    rapidxml::xml_node<>* modulenode = doc.allocate_node(rapidxml::node_type::node_element, "module");
+    res->root->append_node(modulenode);
+    modulenode->append_attribute( doc.allocate_attribute("saveid", alloc2s(m.saveid)) );
+    modulenode->append_attribute( doc.allocate_attribute("template", allocs(String(m.templ))) );
+    if(m.runpolicy == 1)
+      modulenode->append_attribute( doc.allocate_attribute("runpolicy","keeprunning") );
+    else if(m.runpolicy == 2)
+      modulenode->append_attribute( doc.allocate_attribute("runpolicy","allowpausing") );
+    for(unsigned int j = m.first_param; j < m.first_param + m.param_count; j++){
+      const ParamRecord& p = params[j];
+      rapidxml::xml_node<>* pcnode = doc.allocate_node(rapidxml::node_type::node_element, "param");
+      pcnode->append_attribute( doc.allocate_attribute("id", allocs(String(p.id))) );
+      pcnode->append_attribute( doc.allocate_attribute("value", allocf(p.value)) );
+      if(p.flags & HasMin) pcnode->append_attribute( doc.allocate_attribute("min", allocf(p.min)) );
+      if(p.flags & HasMax) pcnode->append_attribute( doc.allocate_attribute("max", allocf(p.max)) );
+      modulenode->append_node(pcnode);
+    }
+    if(m.flags & HasGUI){
+      rapidxml::xml_node<>* guinode = doc.allocate_node(rapidxml::node_type::node_element, "gui");
+      guinode->append_attribute( doc.allocate_attribute("x", alloc2s(m.x)) );
+      guinode->append_attribute( doc.allocate_attribute("y", alloc2s(m.y)) );
+      modulenode->append_node(guinode);
+    }
+    if(m.customstring >= 0){
+      rapidxml::xml_node<>* customnode = doc.allocate_node(rapidxml::node_type::node_element, "customstring");
+      customnode->value(allocs(String(m.customstring)));
+      modulenode->append_node(customnode);
+    }
+    if(m.customxml >= 0 || m.subpatchdef >= 0){
+      rapidxml::xml_node<>* xmlnode = doc.allocate_node(rapidxml::node_type::node_element, "customxml");
+      if(m.customxml >= 0){
+        std::string blob = String(m.customxml);
+        rapidxml::xml_document<> tmp;
+        try{
+          tmp.parse<0>(&blob[0]);
+        }catch(rapidxml::parse_error ex){
+          throw Exceptions::BinaryPatchParse("A module has malformed custom data: " + std::string(ex.what()));
+        }
+        rapidxml::xml_node<>* stored = tmp.first_node("customxml");
+        if(!stored) throw Exceptions::BinaryPatchParse("A module has malformed custom data.");
+        rapidxml::clone_node_copying(stored, xmlnode, &doc);
+      }
+      if(m.subpatchdef >= 0)
+        xmlnode->append_attribute( doc.allocate_attribute("subpatchdef", allocs(String(defs[m.subpatchdef].id))) );
+      modulenode->append_node(xmlnode);
+    }
+  }
+
+  const AudioConnRecord* audioconns = Table<AudioConnRecord>(h.audioconns);
+  for(unsigned int i = 0; i < h.audioconns.count; i++){
+    rapidxml::xml_node<>* connnode = doc.allocate_node(rapidxml::node_type::node_element, "audioconn");
+    connnode->append_attribute( doc.allocate_attribute("frommodule", alloc2s(audioconns[i].from)) );
+    connnode->append_attribute( doc.allocate_attribute(  "tomodule", alloc2s(audioconns[i].to)) );
+    connnode->append_attribute( doc.allocate_attribute("fromioletid", allocs(String(audioconns[i].fromiolet))) );
+    connnode->append_attribute( doc.allocate_attribute(  "toioletid", allocs(String(audioconns[i].toiolet))) );
+    res->root->append_node(connnode);
+  }
+  const DataConnRecord* dataconns = Table<DataConnRecord>(h.dataconns);
+  for(unsigned int i = 0; i < h.dataconns.count; i++){
+    rapidxml::xml_node<>* connnode = doc.allocate_node(rapidxml::node_type::node_element, "dataconn");
+    connnode->append_attribute( doc.allocate_attribute("frommodule", alloc2s(dataconns[i].from)) );
+    connnode->append_attribute( doc.allocate_attribute(  "tomodule", alloc2s(dataconns[i].to)) );
+    connnode->append_attribute( doc.allocate_attribute("fromparamid", allocs(String(dataconns[i].fromparam))) );
+    connnode->append_attribute( doc.allocate_attribute(  "toparamid", allocs(String(dataconns[i].toparam))) );
+    connnode->append_attribute( doc.allocate_attribute("mode", (dataconns[i].mode == 0) ? "absolute" : "relative") );
+    res->root->append_node(connnode);
+  }
+  return res;
+}
+
+LateReturn<std::shared_ptr<Canvas>> CanvasBinary::CreateNewCanvas(std::shared_ptr<Canvas> parent){
+  Relay<std::shared_ptr<Canvas>> r;
+  // Capturing a shared pointer to self to extend lifetime.
+  Canvas::CreateEmpty(parent).Then([me = shared_from_this(),r](std::shared_ptr<Canvas> res){
+    me->ApplyToCanvas(res).ThenReturn(r).Catch(r);
+  });
+  return r;
+}
+
+// Helper macro for exitting with an error.
+#define parseerror(x) {r.LateThrow<Exceptions::BinaryPatchParse>(x); return r;}
+#define parseerrornr(x) {r.LateThrow<Exceptions::BinaryPatchParse>(x); return;}
+
+LateReturn<std::shared_ptr<Canvas>> CanvasBinary::ApplyToCanvas(std::shared_ptr<Canvas> c){
+  Relay<std::shared_ptr<Canvas>> r;
+  const Header& h = GetHeader();
+
+  const ModuleRecord* modules = Table<ModuleRecord>(h.modules);
+  std::set<int> saveids;
+  for(unsigned int i = 0; i < h.modules.count; i++){
+    if(modules[i].saveid <= 0) parseerror("A module has invalid fileid.");
+    saveids.insert(modules[i].saveid);
+  }
+
+  auto pending = std::make_shared<PendingConnections>(c);
+  const AudioConnRecord* audioconns = Table<AudioConnRecord>(h.audioconns);
+  for(unsigned int i = 0; i < h.audioconns.count; i++){
+    if(!saveids.count(audioconns[i].from) || !saveids.count(audioconns[i].to))
+      parseerror("Audioconn has invalid from/to save id");
+    pending->AddAudio(audioconns[i].from, CString(audioconns[i].fromiolet), audioconns[i].to, CString(audioconns[i].toiolet));
+  }
+  const DataConnRecord* dataconns = Table<DataConnRecord>(h.dataconns);
+  for(unsigned int i = 0; i < h.dataconns.count; i++){
+    if(!saveids.count(dataconns[i].from) || !saveids.count(dataconns[i].to))
+      parseerror("Dataconn has invalid from/to save id");
+    auto connmode = (dataconns[i].mode == 0) ? Canvas::DataConnectionMode::Absolute : Canvas::DataConnectionMode::Relative;
+    pending->AddData(dataconns[i].from, CString(dataconns[i].fromparam), dataconns[i].to, CString(dataconns[i].toparam), connmode);
+  }
+
+  // Same as with XML, connections are made as modules appear.
+  c->BlockReordering(true);
+
+  Sync s(h.modules.count);
+  for(unsigned int i = 0; i < h.modules.count; i++)
+    AddModule(c, modules[i], pending).ThenSync(s).Catch(r);
+
+  // Capturing me as shared_ptr to extend lifetime
+  s.WhenAll([me = shared_from_this(),r,c,pending]()->void{
+    if(pending->CountRemaining() > 0)
+      std::cout << "WARNING: " << pending->CountRemaining() << " connection(s) were not restored." << std::endl;
+    c->BlockReordering(false);
+    r.Return(c);
+  });
+
+  return r;
+}
+
+LateReturn<> CanvasBinary::AddModule(std::shared_ptr<Canvas> c, const ModuleRecord& rec, std::shared_ptr<PendingConnections> pending){
+  Relay<> r;
+  std::string template_id = String(rec.templ);
+  auto templptr = ModuleFactory::GetTemplateByID(template_id);
+  if(!templptr) parseerror("Missing template: " + template_id + ". This may happen if you lack\none of module collections that were used to create the save file.");
+
+  // Param values are applied by the factory while the instance is created.
+  ParamPresets presets;
+  const ParamRecord* params = Table<ParamRecord>(GetHeader().params);
+  for(unsigned int i = rec.first_param; i < rec.first_param + rec.param_count; i++){
+    ParamPreset preset;
+    preset.id = CString(params[i].id);
+    preset.value = params[i].value;
+    preset.has_min = params[i].flags & HasMin;
+    preset.has_max = params[i].flags & HasMax;
+    preset.min = params[i].min;
+    preset.max = params[i].max;
+    presets.push_back(preset);
+  }
+
+  // The record lives in the mapping, which is kept alive by capturing me.
+  const ModuleRecord* recptr = &rec;
+  ModuleFactory::CreateNewInstance(templptr, c, presets).Then([this,me = shared_from_this(),c,r,recptr,presets,pending](std::shared_ptr<Module> m) -> void{
+    const ModuleRecord& rec = *recptr;
+    if(rec.flags & HasGUI) m->position_in_canvas = Point2D(rec.x, rec.y);
+    m->saveid = rec.saveid;
+    c->InsertModule(m);
+
+    for(const ParamPreset& preset : presets)
+      if(!m->GetParamControllerByID(preset.id)) parseerrornr("A param record has invalid id: " + preset.id.str());
+
+    if(rec.runpolicy == 1) m->SetRunPolicy(Module::RunPolicy::KeepRunning);
+    else if(rec.runpolicy == 2) m->SetRunPolicy(Module::RunPolicy::AllowPausing);
+
+    if(rec.customstring >= 0) m->state_load_string(String(rec.customstring));
+    if(rec.customxml >= 0){
+      // Custom XML state is the only part that still needs parsing.
+      std::string blob = String(rec.customxml);
+      rapidxml::xml_document<> tmp;
+      try{
+        tmp.parse<0>(&blob[0]);
+      }catch(rapidxml::parse_error ex){
+        parseerrornr("A module has malformed custom data: " + std::string(ex.what()));
+      }
+      rapidxml::xml_node<>* customxmlnode = tmp.first_node("customxml");
+      if(!customxmlnode) parseerrornr("A module has malformed custom data.");
+      m->state_load_xml(customxmlnode);
+    }
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    if(rec.subpatchdef >= 0 && subpatch){
+      auto it = subpatchdefs.find(rec.subpatchdef);
+      if(it == subpatchdefs.end()){
+        try{
+          const SubpatchDefRecord* defs = Table<SubpatchDefRecord>(GetHeader().subpatchdefs);
+          it = subpatchdefs.emplace(rec.subpatchdef, CreateNested(defs[rec.subpatchdef].image)).first;
+        }catch(Exceptions::BinaryPatchParse ex){
+          parseerrornr(ex.what());
+        }
+      }
+      subpatch->LoadFromDefinition(it->second);
+    }
+
+    // Connect this module to all already existing ones.
+    pending->ModuleCreated(rec.saveid, m);
+    // The module is complete once subpatch contents are loaded.
+    if(subpatch) subpatch->WhenLoaded().Then([r](){ r.Return(); });
+    else r.Return();
+  }).Catch<Exceptions::ModuleInstanceCreationFailed>([r](auto ex){
+    parseerrornr("Failed to create module instance: " + ex->what());
+  });
+  return r;
+}
+
+} // namespace AlgAudio
@@ -0,0 +1,114 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CanvasGraph.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace AlgAudio{
+
+CanvasGraph::ModuleHandle CanvasGraph::AddModule(std::shared_ptr<Module> m){
+  ModuleHandle h;
+  if(!free_modules.empty()){
+    h = free_modules.back();
+    free_modules.pop_back();
+    module_ptr[h] = m;
+  }else{
+    h = module_ptr.size();
+    module_ptr.push_back(m);
+    module_out.emplace_back();
+    module_in.emplace_back();
+  }
+  handles[m.get()] = h;
+  return h;
+}
+
+void CanvasGraph::RemoveModule(ModuleHandle h){
+  if(!module_out[h].empty() || !module_in[h].empty())
+    std::cout << "WARNING: Removing a module from graph, while it still has connections." << std::endl;
+  handles.erase(module_ptr[h].get());
+  module_ptr[h] = nullptr;
+  module_out[h].clear();
+  module_in[h].clear();
+  free_modules.push_back(h);
+}
+
+CanvasGraph::ModuleHandle CanvasGraph::Find(const Module* m) const{
+  auto it = handles.find(m);
+  if(it == handles.end()) return Invalid;
+  return it->second;
+}
+
+CanvasGraph::EdgeHandle CanvasGraph::AddEdge(EdgeType type, ModuleHandle from, Symbol from_port, ModuleHandle to, Symbol to_port, unsigned char tag){
+  EdgeHandle e;
+  if(!free_edges.empty()){
+    e = free_edges.back();
+    free_edges.pop_back();
+    edge_type[e] = type;
+    edge_from[e] = from;
+    edge_to[e] = to;
+    edge_from_port[e] = from_port;
+    edge_to_port[e] = to_port;
+    edge_tag[e] = tag;
+  }else{
+    e = edge_type.size();
+    edge_type.push_back(type);
+    edge_from.push_back(from);
+    edge_to.push_back(to);
+    edge_from_port.push_back(from_port);
+    edge_to_port.push_back(to_port);
+    edge_tag.push_back(tag);
+  }
+  module_out[from].push_back(e);
+  module_in[to].push_back(e);
+  return e;
+}
+
+void CanvasGraph::RemoveEdge(EdgeHandle e){
+  if(edge_type[e] == EdgeType::None) return;
+  RemoveFromList(module_out[edge_from[e]], e);
+  RemoveFromList(module_in[edge_to[e]], e);
+  edge_type[e] = EdgeType::None;
+  free_edges.push_back(e);
+}
+
+CanvasGraph::EdgeHandle CanvasGraph::FindEdge(EdgeType type, ModuleHandle from, Symbol from_port, ModuleHandle to, Symbol to_port) const{
+  for(EdgeHandle e : module_out[from])
+    if(edge_type[e] == type && edge_to[e] == to && edge_from_port[e] == from_port && edge_to_port[e] == to_port)
+      return e;
+  return Invalid;
+}
+
+unsigned int CanvasGraph::CountEdgesFrom(EdgeType type, ModuleHandle from, Symbol from_port) const{
+  unsigned int n = 0;
+  for(EdgeHandle e : module_out[from])
+    if(edge_type[e] == type && edge_from_port[e] == from_port) n++;
+  return n;
+}
+
+void CanvasGraph::RemoveFromList(std::vector<EdgeHandle>& list, EdgeHandle e){
+  auto it = std::find(list.begin(), list.end(), e);
+  if(it == list.end()) return;
+  // Order of edges is irrelevant, so swap with the last one instead of
+  // shifting the rest.
+  *it = list.back();
+  list.pop_back();
+}
+
+} // namespace AlgAudio
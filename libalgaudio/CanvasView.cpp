@@ -24,6 +24,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "Window.hpp"
 #include "SDLMain.hpp"
 #include "ModuleFactory.hpp"
+#include "MIDI.hpp"
 
 namespace AlgAudio{
 
@@ -77,8 +78,12 @@ void CanvasView::CreateModuleGUIs(){
   auto current_canvas = GetCurrentCanvas();
   if(!current_canvas){
     std::cout << "Unable to CreateModuleGUIs, there is no top canvas." << std::endl;
+    module_inserted_subscription.Release();
     return;
   }
+  module_inserted_subscription = current_canvas->on_module_inserted.Subscribe([this](std::shared_ptr<Module> m){
+    OnModuleInserted(m);
+  });
 
   // Regain or rebuild guis
   for(auto& m : current_canvas->modules){
@@ -94,13 +99,7 @@ void CanvasView::CreateModuleGUIs(){
       }else{
         // The GUI was not yet build. Let's make it.
         try{
-          modulegui = m->BuildGUI(window.lock());
-          // Mark us as the modulegui parent
-          modulegui->Widget()->parent = shared_from_this();
-          // Resize the gui
-          Size2D guisize = modulegui->Widget()->GetRequestedSize();
-          modulegui->Widget()->Resize(guisize);
-          
+          modulegui = BuildModuleGUI(m);
         }catch(Exceptions::GUIBuild ex){
           current_canvas->RemoveModule(m);
           window.lock()->ShowErrorAlert("Failed to create module GUI.\n\n" + ex.what(),"Dismiss");
@@ -111,6 +110,28 @@ void CanvasView::CreateModuleGUIs(){
   }
 }
 
+std::shared_ptr<ModuleGUI> CanvasView::BuildModuleGUI(std::shared_ptr<Module> m){
+  auto modulegui = m->BuildGUI(window.lock());
+  // Mark us as the modulegui parent
+  modulegui->Widget()->parent = shared_from_this();
+  // Resize the gui
+  Size2D guisize = modulegui->Widget()->GetRequestedSize();
+  modulegui->Widget()->Resize(guisize);
+  return modulegui;
+}
+
+void CanvasView::OnModuleInserted(std::shared_ptr<Module> m){
+  auto modulegui = m->GetGUI();
+  if(modulegui && modulegui->Widget()->parent.lock() == shared_from_this()) return;
+  try{
+    module_guis.push_back(BuildModuleGUI(m));
+    SetNeedsRedrawing();
+  }catch(Exceptions::GUIBuild ex){
+    // The module will be removed once the canvas is entered again.
+    std::cout << "WARNING: Failed to create module GUI: " << ex.what() << std::endl;
+  }
+}
+
 void CanvasView::ResetUI(){
   drag_in_progress = false;
   mouse_down_mode = ModeNone;
@@ -131,12 +152,14 @@ LateReturn<> CanvasView::AddModule(std::string id, Point2D pos){
   
   current_canvas->CreateModule(id).Then([this,r,pos,current_canvas](std::shared_ptr<Module> m){
     try{
-      auto modulegui = m->BuildGUI(window.lock());
+      // The gui was usually already built when the module was inserted.
+      auto modulegui = m->GetGUI();
+      if(!modulegui){
+        modulegui = BuildModuleGUI(m);
+        module_guis.push_back(modulegui);
+      }
       Size2D guisize = modulegui->Widget()->GetRequestedSize();
       modulegui->position() = pos - guisize/2;
-      modulegui->Widget()->parent = shared_from_this();
-      modulegui->Widget()->Resize(guisize);
-      module_guis.push_back(modulegui);
       ClearSelection();
       selection.push_back({modulegui, (guisize/2).ToPoint()});
       modulegui->SetHighlight(true);
@@ -175,32 +198,31 @@ void CanvasView::CustomDraw(DrawContext& c){
   // TODO: Connection ending offsets should be cached. Asking each module gui
   // about the io position every time when redrawing is not going to be
   // efficient when there are 100+ modules present.
+  // The connections are read directly from the canvas graph, so that no
+  // connection lists are copied while drawing.
+  const CanvasGraph& graph = current_canvas->GetGraph();
   c.SetColor(Theme::Get("canvas-connection-audio"));
-  for(auto it : current_canvas->audio_connections){
-    Canvas::IOID from = it.first;
-    Point2D from_pos = from.module->GetGUI()->position() + from.module->GetGUI()->WhereIsOutlet(from.iolet);
-    // For each target of this outlet
-    std::list<Canvas::IOID> to_list = it.second;
-    for(auto to : to_list){
-      Point2D to_pos = to.module->GetGUI()->position() + to.module->GetGUI()->WhereIsInlet(to.iolet);
-      int strength = CurveStrengthFuncA(from_pos, to_pos);
-      c.DrawCubicBezier(from_pos, from_pos + Point2D(0,strength), to_pos + Point2D(0, -strength), to_pos, 2.0f);
-    }
+  for(CanvasGraph::EdgeHandle e = 0; e < graph.GetEdgeSlots(); e++){
+    if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+    const std::shared_ptr<Module>& from = graph.GetModule(graph.GetEdgeFrom(e));
+    const std::shared_ptr<Module>& to   = graph.GetModule(graph.GetEdgeTo(e));
+    Point2D from_pos = from->GetGUI()->position() + from->GetGUI()->WhereIsOutlet(graph.GetEdgeFromPort(e));
+    Point2D to_pos = to->GetGUI()->position() + to->GetGUI()->WhereIsInlet(graph.GetEdgeToPort(e));
+    int strength = CurveStrengthFuncA(from_pos, to_pos);
+    c.DrawCubicBezier(from_pos, from_pos + Point2D(0,strength), to_pos + Point2D(0, -strength), to_pos, 2.0f);
   }
   // Next, data connections.
-  for(auto it : current_canvas->data_connections){
-    Canvas::IOID from = it.first;
-    Point2D from_pos_relative = from.module->GetGUI()->position() + from.module->GetGUI()->WhereIsParamRelativeOutlet(from.iolet);
-    Point2D from_pos_absolute = from.module->GetGUI()->position() + from.module->GetGUI()->WhereIsParamAbsoluteOutlet(from.iolet);
-    // For each target of this data outlet:
-    std::list<Canvas::IOIDWithMode> to_list = it.second;
-    for(auto to : to_list){
-      c.SetColor(Theme::Get( (to.mode == Canvas::DataConnectionMode::Relative) ? "canvas-connection-data-relative" : "canvas-connection-data-absolute"));
-      Point2D to_pos = to.ioid.module->GetGUI()->position() + to.ioid.module->GetGUI()->WhereIsParamInlet(to.ioid.iolet);
-      Point2D from_pos = (to.mode == Canvas::DataConnectionMode::Relative) ? from_pos_relative : from_pos_absolute;
-      int strength = CurveStrengthFuncB(from_pos, to_pos);
-      c.DrawCubicBezier(from_pos, from_pos + Point2D(strength,0), to_pos + Point2D(-strength, 0), to_pos, 1.0f);
-    }
+  for(CanvasGraph::EdgeHandle e = 0; e < graph.GetEdgeSlots(); e++){
+    if(graph.GetEdgeType(e) != CanvasGraph::EdgeType::Data) continue;
+    const std::shared_ptr<Module>& from = graph.GetModule(graph.GetEdgeFrom(e));
+    const std::shared_ptr<Module>& to   = graph.GetModule(graph.GetEdgeTo(e));
+    bool relative = ((Canvas::DataConnectionMode)graph.GetEdgeTag(e) == Canvas::DataConnectionMode::Relative);
+    c.SetColor(Theme::Get( relative ? "canvas-connection-data-relative" : "canvas-connection-data-absolute"));
+    Point2D from_pos = from->GetGUI()->position() + (relative ? from->GetGUI()->WhereIsParamRelativeOutlet(graph.GetEdgeFromPort(e))
+                                                              : from->GetGUI()->WhereIsParamAbsoluteOutlet(graph.GetEdgeFromPort(e)));
+    Point2D to_pos = to->GetGUI()->position() + to->GetGUI()->WhereIsParamInlet(graph.GetEdgeToPort(e));
+    int strength = CurveStrengthFuncB(from_pos, to_pos);
+    c.DrawCubicBezier(from_pos, from_pos + Point2D(strength,0), to_pos + Point2D(-strength, 0), to_pos, 1.0f);
   }
 
   // Then draw the potential new wire.
@@ -208,7 +230,7 @@ void CanvasView::CustomDraw(DrawContext& c){
 
     std::shared_ptr<ModuleGUI> from_mgui = module_guis[potential_wire_connection.first .first],
                                  to_mgui = module_guis[potential_wire_connection.second.first];
-    std::string from_outlet_paramid = potential_wire_connection.first .second,
+    Symbol from_outlet_paramid = potential_wire_connection.first .second,
                    to_inlet_paramid = potential_wire_connection.second.second;
 
     if(potential_wire == PotentialWireMode::Remove) c.SetColor(Theme::Get("canvas-connection-remove"));
@@ -503,8 +525,8 @@ void CanvasView::FinalizeAudioConnectingDrag(int inlet_module_id, UIWidget::ID i
     window.lock()->ShowErrorAlert("Failed to create connection, one of the corresponding modules does not exist." , "Cancel");
     return;
   }
-  std::string outlet_id = module_guis[outlet_module_id]->GetIoletParamID(outlet_widget_id);
-  std::string inlet_id = module_guis[inlet_module_id]->GetIoletParamID(inlet_widget_id);
+  Symbol outlet_id = module_guis[outlet_module_id]->GetIoletParamID(outlet_widget_id);
+  Symbol inlet_id = module_guis[inlet_module_id]->GetIoletParamID(inlet_widget_id);
   std::cout << "Which corresponds to " << inlet_module_id << "/" << inlet_id << " to " << outlet_module_id << "/" << outlet_id << std::endl;
   Canvas::IOID from = {from_module,outlet_id};
   Canvas::IOID   to = {  to_module,inlet_id };
@@ -519,6 +541,8 @@ void CanvasView::FinalizeAudioConnectingDrag(int inlet_module_id, UIWidget::ID i
       window.lock()->ShowErrorAlert(ex.what(), "Cancel connection");
     }catch(Exceptions::DoubleConnection ex){
       window.lock()->ShowErrorAlert(ex.what(), "Cancel connection");
+    }catch(Exceptions::ChannelMismatch ex){
+      window.lock()->ShowErrorAlert(ex.what(), "Cancel connection");
     }
   }else{
     // This connection already exists, remove it.
@@ -537,8 +561,8 @@ void CanvasView::FinalizeDataConnectingDrag(int inlet_module_id, UIWidget::ID in
     window.lock()->ShowErrorAlert("Failed to create connection, one of the corresponding modules does not exist." , "Cancel");
     return;
   }
-  std::string param1_id = module_guis[outlet_module_id]->GetIoletParamID(outlet_slider_id);
-  std::string param2_id = module_guis[inlet_module_id]->GetIoletParamID(inlet_slider_id);
+  Symbol param1_id = module_guis[outlet_module_id]->GetIoletParamID(outlet_slider_id);
+  Symbol param2_id = module_guis[inlet_module_id]->GetIoletParamID(inlet_slider_id);
   std::cout << "Which corresponds to " << inlet_module_id << "/" << param1_id << " to " << outlet_module_id << "/" << param2_id << std::endl;
 
   Canvas::IOID from = {from_module,param1_id};
@@ -623,6 +647,7 @@ void CanvasView::CustomMouseMotion(Point2D from_abs,Point2D to_abs){
 }
 
 void CanvasView::MouseMotionOverCanvasPlane(Point2D from, Point2D to){
+  pointer_position = to;
   
   if(drag_in_progress){
     // A drag is already in progress.
@@ -781,6 +806,10 @@ void CanvasView::OnKeyboard(KeyData k){
   if(k.type == KeyData::KeyType::Ctrl) ctrl_held = k.pressed;
   if(k.type == KeyData::KeyType::Letter && k.symbol == "c" && k.IsTrig())
     CenterView();
+  if(k.type == KeyData::KeyType::Letter && k.symbol == "k" && k.IsTrig())
+    CycleSelectedRunPolicy();
+  if(k.type == KeyData::KeyType::Letter && k.symbol == "m" && k.IsTrig())
+    LearnMIDIAtPointer(shift_held);
     
   if(ctrl_held && k.IsTrig()){
     if(k.symbol == "-"){
@@ -802,17 +831,55 @@ void CanvasView::StopDrag(){
 }
 
 void CanvasView::RemoveSelected(){
+  // Remove all selected modules at once, so that SC is updated only once.
+  Canvas::Transaction transaction(GetCurrentCanvas());
   for(auto p : selection){
     std::shared_ptr<ModuleGUI> mgui = p.first;
     std::shared_ptr<Module> module = mgui->GetModule();
-    if(module) GetCurrentCanvas()->RemoveModule(module);
+    if(module) transaction.RemoveModule(module);
     module_guis.erase(std::remove(module_guis.begin(), module_guis.end(), mgui), module_guis.end());
   }
+  transaction.Commit();
   selection.clear();
   StopDrag();
   SetNeedsRedrawing();
 }
 
+void CanvasView::CycleSelectedRunPolicy(){
+  if(selection.empty()) return;
+  std::shared_ptr<Module> first = selection.front().first->GetModule();
+  if(!first) return;
+  Module::RunPolicy next = Module::RunPolicy::Default;
+  if(first->GetRunPolicy() == Module::RunPolicy::Default) next = Module::RunPolicy::KeepRunning;
+  else if(first->GetRunPolicy() == Module::RunPolicy::KeepRunning) next = Module::RunPolicy::AllowPausing;
+  for(auto p : selection){
+    std::shared_ptr<Module> module = p.first->GetModule();
+    if(module) module->SetRunPolicy(next);
+  }
+  SetNeedsRedrawing();
+}
+
+void CanvasView::LearnMIDIAtPointer(bool unmap){
+  int id = InWhich(pointer_position);
+  if(id < 0) return;
+  auto whatishere = module_guis[id]->GetWhatIsHere(pointer_position - module_guis[id]->position());
+  if(whatishere.type != ModuleGUI::WhatIsHereType::SliderBody &&
+     whatishere.type != ModuleGUI::WhatIsHereType::SliderInput &&
+     whatishere.type != ModuleGUI::WhatIsHereType::SliderOutputRelative &&
+     whatishere.type != ModuleGUI::WhatIsHereType::SliderOutputAbsolute) return;
+  std::shared_ptr<Module> module = module_guis[id]->GetModule();
+  if(!module) return;
+  auto param = module->GetParamControllerByID(whatishere.param_id);
+  if(!param) return;
+  if(unmap){
+    MIDI::Unmap(param);
+    std::cout << "MIDI mapping removed from " << whatishere.param_id << std::endl;
+  }else{
+    MIDI::Learn(param);
+    std::cout << "MIDI learn: move a control to map it to " << whatishere.param_id << std::endl;
+  }
+}
+
 void CanvasView::FadeoutWireStart(PotentialWireMode m){
   if(potential_wire == PotentialWireMode::None || m == PotentialWireMode::None) return;
   fadeout_wire = m;
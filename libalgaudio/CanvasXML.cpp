@@ -20,17 +20,26 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "CanvasXML.hpp"
 #include <cstring>
 #include <sstream>
+#include <algorithm>
+#include <set>
+#include <iterator>
+#include <tuple>
 #include "ModuleUI/ModuleGUI.hpp"
 #include "ModuleTemplate.hpp"
 #include "ModuleCollection.hpp"
 #include "ModuleFactory.hpp"
 #include "ParamController.hpp"
+#include "BuiltinModules.hpp"
+#include "PendingConnections.hpp"
 
 namespace AlgAudio{
   
   
 #define allocs(x) doc.allocate_string((x).c_str())
 #define alloc2s(x) doc.allocate_string(std::to_string(x).c_str())
+#define allocf(x) doc.allocate_string(Utilities::FloatToString(x).c_str())
+
+int CanvasXML::save_depth = 0;
   
 CanvasXML::CanvasXML(){
   
@@ -55,6 +64,7 @@ std::shared_ptr<CanvasXML> CanvasXML::CreateFromString(std::string string){
   
   auto res = std::shared_ptr<CanvasXML>( new CanvasXML() );
   res->doc_text = string;
+  res->doc_text_valid = true;
   res->doc.clear();
   int len = string.length();
   res->input_buffer = new char[len + 1];
@@ -73,7 +83,7 @@ std::shared_ptr<CanvasXML> CanvasXML::CreateFromString(std::string string){
     if(!version_attr) throw Exceptions::XMLParse("Version information is missing");
     std::string version(version_attr->value());
     // Version check!
-    if(version != "1") throw Exceptions::XMLParse("Invalid file version (" + version + ")");
+    if(version != "1" && version != "2") throw Exceptions::XMLParse("Invalid file version (" + version + ")");
   
   }catch(rapidxml::parse_error ex){
     throw Exceptions::XMLParse("The XML data is not valid.\nChar: " + std::to_string((int)(ex.where<char>() - res->input_buffer)) + "\n" + ex.what());
@@ -99,7 +109,7 @@ std::shared_ptr<CanvasXML> CanvasXML::CreateFromNode(rapidxml::xml_node<>* node)
   if(!version_attr) throw Exceptions::XMLParse("Version information is missing");
   std::string version(version_attr->value());
   // Version check!
-  if(version != "1") throw Exceptions::XMLParse("Invalid file version (" + version + ")");
+  if(version != "1" && version != "2") throw Exceptions::XMLParse("Invalid file version (" + version + ")");
   
   return res;
 }
@@ -114,27 +124,43 @@ std::shared_ptr<CanvasXML> CanvasXML::CreateFromCanvas(std::shared_ptr<Canvas> c
   res->root->append_attribute( res->doc.allocate_attribute("version","1") );
   res->doc.append_node( res->root );
   
-  res->block_string_updates = true;
+  // The document itself is formatted independently of the locale, but
+  // custom modules may rely on the C locale when storing their state. It is
+  // set once for the whole save, including all nested subpatches. Both the
+  // depth and the locale are restored even if saving a module throws.
+  struct DepthGuard{
+    DepthGuard() {save_depth++;}
+    ~DepthGuard() {save_depth--;}
+  } depth_guard;
+  bool outermost = (save_depth == 1);
+  std::unique_ptr<Utilities::LocaleDecPoint> locale_guard;
+  if(outermost) locale_guard = std::make_unique<Utilities::LocaleDecPoint>();
   
-  // Save all modules
-  for(const auto &m : canvas->modules){
+  // Save all modules. They are sorted by template and position, so that
+  // identical canvases are always stored identically, and therefore
+  // identical subpatches can be detected.
+  std::vector<std::shared_ptr<Module>> modules = canvas->GetModulesInOrder();
+  auto position = [](const std::shared_ptr<Module>& m){
+    auto gui = m->GetGUI();
+    return gui ? gui->position() : m->position_in_canvas;
+  };
+  std::stable_sort(modules.begin(), modules.end(), [&position](const std::shared_ptr<Module>& a, const std::shared_ptr<Module>& b){
+    Point2D pa = position(a), pb = position(b);
+    return std::make_tuple(a->templ->GetFullID(), pa.y, pa.x) < std::make_tuple(b->templ->GetFullID(), pb.y, pb.x);
+  });
+  for(const auto &m : modules){
     res->AppendModule(m);
   }
   // Save all audio connections
-  for(const auto &p : canvas->audio_connections){
-    Canvas::IOID from = p.first;
-    for(const Canvas::IOID& to : p.second)
-      res->AppendAudioConnection(from, to);
-  }
+  for(const auto &p : canvas->GetAudioConnections())
+    res->AppendAudioConnection(p.first, p.second);
   // Save all data connections
-  for(const auto &p : canvas->data_connections){
-    Canvas::IOID from = p.first;
-    for(const Canvas::IOIDWithMode& to : p.second)
-      res->AppendDataConnection(from, to);
-  }
+  for(const auto &p : canvas->GetDataConnections())
+    res->AppendDataConnection(p.first, p.second);
   
-  res->block_string_updates = false;
-  res->UpdateStringFromDoc();
+  // Nested documents are cloned into the outermost one, which shares all
+  // subpatches at once.
+  res->sharing_pending = outermost;
   
   // Modules saveid map shall no longer be needed.
   res->modules_to_saveids.clear();
@@ -142,30 +168,26 @@ std::shared_ptr<CanvasXML> CanvasXML::CreateFromCanvas(std::shared_ptr<Canvas> c
   return res;
 }
 
-void CanvasXML::UpdateStringFromDoc(){
-  if(block_string_updates) return;
-  std::stringstream ss;
-  ss << doc;
-  doc_text = ss.str();
-}
-
 void CanvasXML::AppendModule(std::shared_ptr<Module> m){
-  Utilities::LocaleDecPoint ldp;
-  
   rapidxml::xml_node<>* modulenode = doc.allocate_node(rapidxml::node_type::node_element, "module");
   root->append_node(modulenode);
   
   int id = ++saveid_counter;
   modules_to_saveids[m] = id;
+  m->saveid = id;
   modulenode->append_attribute( doc.allocate_attribute("saveid",alloc2s(id)) );
   modulenode->append_attribute( doc.allocate_attribute("template",allocs(m->templ->GetFullID())) );
+  if(m->GetRunPolicy() == Module::RunPolicy::KeepRunning)
+    modulenode->append_attribute( doc.allocate_attribute("runpolicy","keeprunning") );
+  else if(m->GetRunPolicy() == Module::RunPolicy::AllowPausing)
+    modulenode->append_attribute( doc.allocate_attribute("runpolicy","allowpausing") );
   // Save paramcontrollers state
   for(std::shared_ptr<ParamController> pc : m->param_controllers){
     rapidxml::xml_node<>* pcnode = doc.allocate_node(rapidxml::node_type::node_element, "param");
     pcnode->append_attribute( doc.allocate_attribute("id", allocs(pc->id) ));
-    pcnode->append_attribute( doc.allocate_attribute("value", alloc2s( pc->Get() )));
-    pcnode->append_attribute( doc.allocate_attribute("min", alloc2s( pc->GetRangeMin() )));
-    pcnode->append_attribute( doc.allocate_attribute("max", alloc2s( pc->GetRangeMax() )));
+    pcnode->append_attribute( doc.allocate_attribute("value", allocf( pc->Get() )));
+    pcnode->append_attribute( doc.allocate_attribute("min", allocf( pc->GetRangeMin() )));
+    pcnode->append_attribute( doc.allocate_attribute("max", allocf( pc->GetRangeMax() )));
     modulenode->append_node(pcnode);
   }
   // Gui data
@@ -187,17 +209,68 @@ void CanvasXML::AppendModule(std::shared_ptr<Module> m){
   rapidxml::xml_node<>* xmlnode = doc.allocate_node(rapidxml::node_type::node_element, "customxml");
   modulenode->append_node(xmlnode); // This sets the parent document.
   m->state_store_xml(xmlnode);
+  if(std::dynamic_pointer_cast<Builtin::Subpatch>(m))
+    xmlnode->append_attribute( doc.allocate_attribute("share", "1") );
   auto childnode = xmlnode->first_node();
   auto childattr = xmlnode->first_attribute();
   if(!childnode && !childattr){ // Do not save the node if it has no custom data.
     modulenode->remove_node(xmlnode);
   }
-  
-  UpdateStringFromDoc();
 }
+void CanvasXML::ShareSubpatchDefinitions(){
+  if(!sharing_pending) return;
+  ShareSubpatchDefinitions(root);
+  sharing_pending = false;
+}
+void CanvasXML::ShareSubpatchDefinitions(rapidxml::xml_node<>* level){
+  // Maps serialized subpatch contents to their subpatchdef ids.
+  std::map<std::string, int> subpatchdefs_by_content;
+  int subpatchdef_counter = 0;
+  for(rapidxml::xml_node<>* module_node = level->first_node("module"); module_node; module_node = module_node->next_sibling("module")){
+    rapidxml::xml_node<>* customxml = module_node->first_node("customxml");
+    if(!customxml) continue;
+    rapidxml::xml_attribute<>* mark = customxml->first_attribute("share");
+    if(!mark) continue;
+    customxml->remove_attribute(mark);
+    rapidxml::xml_node<>* contents = customxml->first_node("algaudio");
+    if(!contents) continue;
+    ShareSubpatchDefinitions(contents);
+
+    std::string serialized;
+    rapidxml::print(std::back_inserter(serialized), *contents, rapidxml::print_no_indenting);
+    int defid;
+    auto it = subpatchdefs_by_content.find(serialized);
+    if(it != subpatchdefs_by_content.end()){
+      defid = it->second;
+    }else{
+      defid = ++subpatchdef_counter;
+      subpatchdefs_by_content[serialized] = defid;
+      rapidxml::xml_node<>* defnode = doc.allocate_node(rapidxml::node_type::node_element, "subpatchdef");
+      defnode->append_attribute( doc.allocate_attribute("id", alloc2s(defid)) );
+      // Definitions are placed before all modules.
+      level->insert_node(level->first_node("module"), defnode);
+      customxml->remove_node(contents);
+      defnode->append_node(contents);
+    }
+    if(contents->parent() == customxml) customxml->remove_node(contents);
+    customxml->append_attribute( doc.allocate_attribute("subpatchdef", alloc2s(defid)) );
+  }
+  // Subpatch definitions are not understood by older versions.
+  rapidxml::xml_attribute<>* version_attr = level->first_attribute("version");
+  if(subpatchdef_counter > 0 && version_attr) version_attr->value("2");
+}
+
+void CanvasXML::ParseSubpatchDefinitions(){
+  if(subpatchdefs_parsed) return;
+  for(rapidxml::xml_node<>* def_node = root->first_node("subpatchdef"); def_node; def_node = def_node->next_sibling("subpatchdef")){
+    rapidxml::xml_attribute<>* id_attr = def_node->first_attribute("id");
+    if(!id_attr) throw Exceptions::XMLParse("A subpatchdef node is missing id attribute");
+    subpatchdefs[id_attr->value()] = CreateFromNode(def_node->first_node("algaudio"));
+  }
+  subpatchdefs_parsed = true;
+}
+
 void CanvasXML::AppendAudioConnection(Canvas::IOID from, Canvas::IOID to){
-  Utilities::LocaleDecPoint ldp;
-  
   rapidxml::xml_node<>* connnode = doc.allocate_node(rapidxml::node_type::node_element, "audioconn");
   auto it1 = modules_to_saveids.find(from.module); auto it2 = modules_to_saveids.find(to.module);
   if(it1 == modules_to_saveids.end() || it2 == modules_to_saveids.end()){
@@ -209,12 +282,8 @@ void CanvasXML::AppendAudioConnection(Canvas::IOID from, Canvas::IOID to){
   connnode->append_attribute( doc.allocate_attribute("fromioletid",allocs(from.iolet)) );
   connnode->append_attribute( doc.allocate_attribute(  "toioletid",allocs(  to.iolet)) );
   root->append_node(connnode);
-  
-  UpdateStringFromDoc();
 }
 void CanvasXML::AppendDataConnection(Canvas::IOID from, Canvas::IOIDWithMode to){
-  Utilities::LocaleDecPoint ldp;
-  
   rapidxml::xml_node<>* connnode = doc.allocate_node(rapidxml::node_type::node_element, "dataconn");
   auto it1 = modules_to_saveids.find(from.module); auto it2 = modules_to_saveids.find(to.ioid.module);
   if(it1 == modules_to_saveids.end() || it2 == modules_to_saveids.end()){
@@ -231,18 +300,29 @@ void CanvasXML::AppendDataConnection(Canvas::IOID from, Canvas::IOIDWithMode to)
     connnode->append_attribute( doc.allocate_attribute(  "mode","relative") );
 
   root->append_node(connnode);
-  
-  UpdateStringFromDoc();
 }
 
 void CanvasXML::SaveToFile(std::string path){
   std::ofstream file(path);
   if(!file) throw Exceptions::XMLFileAccess("Unable to write to file '" + path + "'.");
-  file << doc_text << std::endl;
+  WriteTo(file);
+  file << std::endl;
   file.close();
+  if(!file) throw Exceptions::XMLFileAccess("Failed to write to file '" + path + "'.");
   std::cout << "File saved." << std::endl;
 }
+void CanvasXML::WriteTo(std::ostream& out){
+  ShareSubpatchDefinitions();
+  if(doc_text_valid) out << doc_text;
+  else rapidxml::print(std::ostreambuf_iterator<char>(out), doc);
+}
 std::string CanvasXML::GetXMLAsString(){
+  if(!doc_text_valid){
+    ShareSubpatchDefinitions();
+    doc_text.clear();
+    rapidxml::print(std::back_inserter(doc_text), doc);
+    doc_text_valid = true;
+  }
   return doc_text;
 }
 
@@ -266,134 +346,115 @@ LateReturn<std::shared_ptr<Canvas>> CanvasXML::ApplyToCanvas(std::shared_ptr<Can
   // Traverse all nodes, add their state to canvas.
   Relay<std::shared_ptr<Canvas>> r;
 
-  // Assuming version 1
+  try{
+    ParseSubpatchDefinitions();
+  }catch(Exceptions::XMLParse ex){
+    parseerror(ex.what());
+  }
   
-  saveids_to_modules.clear(); // just to make sure.
+  // Save ids are gathered first, so that connections can be validated before
+  // any module is created.
+  std::set<int> saveids;
+  std::vector<std::pair<rapidxml::xml_node<>*, int>> module_nodes;
+  for(rapidxml::xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module")){
+    rapidxml::xml_attribute<>* saveid_attr = module_node->first_attribute("saveid");
+    if(!saveid_attr) parseerror("A module has missing fileid.");
+    int saveid = std::stoi(saveid_attr->value());
+    if(saveid <= 0) parseerror("A module has invalid fileid.");
+    saveids.insert(saveid);
+    module_nodes.push_back({module_node, saveid});
+  }
   
-  int module_count = 0;
-  for(rapidxml::xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module"))
-    module_count++;
-
-  Sync s(module_count);
-  for(rapidxml::xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module"))
-      AddModuleFromNode(c, module_node).ThenSync(s).Catch(r);
+  auto pending = std::make_shared<PendingConnections>(c);
+  
+  for(rapidxml::xml_node<>* audioconn_node = root->first_node("audioconn"); audioconn_node; audioconn_node = audioconn_node->next_sibling("audioconn")){
+    rapidxml::xml_attribute<>*  fromsaveid_attr = audioconn_node->first_attribute( "frommodule");
+    rapidxml::xml_attribute<>*    tosaveid_attr = audioconn_node->first_attribute(   "tomodule");
+    rapidxml::xml_attribute<>* fromioletid_attr = audioconn_node->first_attribute("fromioletid");
+    rapidxml::xml_attribute<>*   toioletid_attr = audioconn_node->first_attribute(  "toioletid");
+    if(!fromioletid_attr || !toioletid_attr || !fromsaveid_attr || !tosaveid_attr)
+      parseerror("Audioconn node is missing one of its attributes");
+    int fromsaveid = std::stoi(fromsaveid_attr->value());
+    int tosaveid = std::stoi(tosaveid_attr->value());
+    if(!saveids.count(fromsaveid) || !saveids.count(tosaveid))
+      parseerror("Audioconn has invalid from/to save id");
+    pending->AddAudio(fromsaveid, fromioletid_attr->value(), tosaveid, toioletid_attr->value());
+  }
+  
+  for(rapidxml::xml_node<>* dataconn_node = root->first_node("dataconn"); dataconn_node; dataconn_node = dataconn_node->next_sibling("dataconn")){
+    rapidxml::xml_attribute<>*  fromsaveid_attr = dataconn_node->first_attribute( "frommodule");
+    rapidxml::xml_attribute<>*    tosaveid_attr = dataconn_node->first_attribute(   "tomodule");
+    rapidxml::xml_attribute<>* fromparamid_attr = dataconn_node->first_attribute("fromparamid");
+    rapidxml::xml_attribute<>*   toparamid_attr = dataconn_node->first_attribute(  "toparamid");
+    rapidxml::xml_attribute<>*        mode_attr = dataconn_node->first_attribute(       "mode");
+    if(!fromparamid_attr || !toparamid_attr || !fromsaveid_attr || !tosaveid_attr || !mode_attr)
+      parseerror("Dataconn node is missing one of its attributes");
+    int fromsaveid = std::stoi(fromsaveid_attr->value());
+    int tosaveid = std::stoi(tosaveid_attr->value());
+    if(!saveids.count(fromsaveid) || !saveids.count(tosaveid))
+      parseerror("Dataconn has invalid from/to save id");
+    std::string mode = mode_attr->value();
+    Canvas::DataConnectionMode connmode;
+    if(mode == "absolute"){
+      connmode = Canvas::DataConnectionMode::Absolute;
+    }else if(mode == "relative"){
+      connmode = Canvas::DataConnectionMode::Relative;
+    }else{
+      parseerror("Dataconn has invalid mode value");
+    }
+    pending->AddData(fromsaveid, fromparamid_attr->value(), tosaveid, toparamid_attr->value(), connmode);
+  }
+  
+  // Each connection is made as soon as both its modules exist, so the order
+  // of synths is only recalculated once, when all modules are ready.
+  c->BlockReordering(true);
+  
+  Sync s(module_nodes.size());
+  for(const auto& p : module_nodes)
+    AddModuleFromNode(c, p.first, p.second, pending).ThenSync(s).Catch(r);
       
   // Capturing me as shared_ptr to extend lifetime
-  s.WhenAll([this,me = shared_from_this(),r,c]()->void{
-    
-    std::cout << "Modules parsed, now connections." << std::endl;
-
-    // Next, parse audio connections.
-    c->BlockReordering(true);
-    
-    for(rapidxml::xml_node<>* audioconn_node = root->first_node("audioconn"); audioconn_node; audioconn_node = audioconn_node->next_sibling("audioconn")){
-      std::cout << "Parsing audio connection." << std::endl;
-      
-      rapidxml::xml_attribute<>*  fromsaveid_attr = audioconn_node->first_attribute( "frommodule");
-      rapidxml::xml_attribute<>*    tosaveid_attr = audioconn_node->first_attribute(   "tomodule");
-      rapidxml::xml_attribute<>* fromioletid_attr = audioconn_node->first_attribute("fromioletid");
-      rapidxml::xml_attribute<>*   toioletid_attr = audioconn_node->first_attribute(  "toioletid");
-      if(!fromioletid_attr || !toioletid_attr || !fromsaveid_attr || !tosaveid_attr)
-        parseerrornr("Audioconn node is missing one of its attributes");
-      int fromsaveid = std::stoi(fromsaveid_attr->value());
-      int tosaveid = std::stoi(tosaveid_attr->value());
-      std::string fromioletid = fromioletid_attr->value();
-      std::string toioletid = toioletid_attr->value();
-      auto from_it = saveids_to_modules.find(fromsaveid);
-      auto   to_it = saveids_to_modules.find(  tosaveid);
-      if(from_it == saveids_to_modules.end() || to_it == saveids_to_modules.end())
-        parseerrornr("Audioconn has invalid from/to save id");
-      std::shared_ptr<Module> from = from_it->second;
-      std::shared_ptr<Module>   to =   to_it->second;
-
-      c->Connect({from, fromioletid},{to, toioletid});
-    }
-    
+  s.WhenAll([me = shared_from_this(),r,c,pending]()->void{
+    if(pending->CountRemaining() > 0)
+      std::cout << "WARNING: " << pending->CountRemaining() << " connection(s) were not restored." << std::endl;
     c->BlockReordering(false);
-    
-    // Then, parse data connections.
-    for(rapidxml::xml_node<>* dataconn_node = root->first_node("dataconn"); dataconn_node; dataconn_node = dataconn_node->next_sibling("dataconn")){
-      std::cout << "Parsing data connection." << std::endl;
-      
-      rapidxml::xml_attribute<>*  fromsaveid_attr = dataconn_node->first_attribute( "frommodule");
-      rapidxml::xml_attribute<>*    tosaveid_attr = dataconn_node->first_attribute(   "tomodule");
-      rapidxml::xml_attribute<>* fromparamid_attr = dataconn_node->first_attribute("fromparamid");
-      rapidxml::xml_attribute<>*   toparamid_attr = dataconn_node->first_attribute(  "toparamid");
-      rapidxml::xml_attribute<>*        mode_attr = dataconn_node->first_attribute(       "mode");
-      if(!fromparamid_attr || !toparamid_attr || !fromsaveid_attr || !tosaveid_attr || !mode_attr)
-        parseerrornr("Dataconn node is missing one of its attributes");
-      int fromsaveid = std::stoi(fromsaveid_attr->value());
-      int tosaveid = std::stoi(tosaveid_attr->value());
-      std::string fromparamid = fromparamid_attr->value();
-      std::string toparamid = toparamid_attr->value();
-      auto from_it = saveids_to_modules.find(fromsaveid);
-      auto   to_it = saveids_to_modules.find(  tosaveid);
-      if(from_it == saveids_to_modules.end() || to_it == saveids_to_modules.end())
-        parseerrornr("Dataconn has invalid from/to save id");
-      std::shared_ptr<Module> from = from_it->second;
-      std::shared_ptr<Module>   to =   to_it->second;
-      std::string mode = mode_attr->value();
-      Canvas::DataConnectionMode connmode;
-      if(mode == "absolute"){
-        connmode = Canvas::DataConnectionMode::Absolute;
-      }else if(mode == "relative"){
-        connmode = Canvas::DataConnectionMode::Relative;
-      }else{
-        parseerrornr("Dataconn has invalid mode value");
-      }
-
-      c->ConnectData({from, fromparamid},{to, toparamid},connmode);
-    }
-    
     r.Return(c);
-    
-  }); // sync.whenall
+  });
   
   return r;
 }
 
-LateReturn<> CanvasXML::AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::xml_node<>* module_node){
+LateReturn<> CanvasXML::AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::xml_node<>* module_node, int saveid, std::shared_ptr<PendingConnections> pending){
   Utilities::LocaleDecPoint ldp;
   
   Relay<> r;
-  rapidxml::xml_attribute<>* saveid_attr = module_node->first_attribute("saveid");
-  if(!saveid_attr) parseerror("A module has missing fileid.");
-  int saveid = std::stoi(saveid_attr->value());
-  if(saveid <= 0) parseerror("A module has invalid fileid.");
   rapidxml::xml_attribute<>* template_attr = module_node->first_attribute("template");
   if(!template_attr) parseerror("A module has missing template.");
   std::string template_id = template_attr->value();
 
-  auto templptr = ModuleCollectionBase::GetTemplateByID(template_id);
+  auto templptr = ModuleFactory::GetTemplateByID(template_id);
   if(!templptr) parseerror("Missing template: " + template_id + ". This may happen if you lack\none of module collections that were used to create the save file.");
 
-  ModuleFactory::CreateNewInstance(templptr, c).Then([this,c,r,saveid,module_node](std::shared_ptr<Module> m) -> void{
-    c->modules.emplace(m);
-    saveids_to_modules.insert(std::make_pair(saveid,m));
-    m->canvas = c;
-
-    // Parse param data.
-    for(rapidxml::xml_node<>* param_node = module_node->first_node("param"); param_node; param_node = param_node->next_sibling("param") ){
-      rapidxml::xml_attribute<>* id_attr  = param_node->first_attribute("id");
-      rapidxml::xml_attribute<>* val_attr = param_node->first_attribute("value");
-      if(!id_attr) parseerrornr("A param node is missing id attribute. saveid = " + std::to_string(saveid));
-      if(!val_attr) parseerrornr("A param node is missing value attribute. saveid = " + std::to_string(saveid));
-      
-      rapidxml::xml_attribute<>* min_attr = param_node->first_attribute("min");
-      rapidxml::xml_attribute<>* max_attr = param_node->first_attribute("max");
-      
-      std::string paramid = id_attr->value();
-      float value = std::stof(val_attr->value());
-
-      auto pc = m->GetParamControllerByID(paramid);
-      if(!pc) parseerrornr("A param node has invalid id attribute: " + paramid);
-      
-      if(min_attr) pc->SetRangeMin( std::stof(min_attr->value()) );
-      if(max_attr) pc->SetRangeMax( std::stof(max_attr->value()) );
-      
-      pc->Set(value);
-    }
+  // Param values are applied by the factory while the instance is created.
+  ParamPresets presets;
+  for(rapidxml::xml_node<>* param_node = module_node->first_node("param"); param_node; param_node = param_node->next_sibling("param") ){
+    rapidxml::xml_attribute<>* id_attr  = param_node->first_attribute("id");
+    rapidxml::xml_attribute<>* val_attr = param_node->first_attribute("value");
+    if(!id_attr) parseerror("A param node is missing id attribute. saveid = " + std::to_string(saveid));
+    if(!val_attr) parseerror("A param node is missing value attribute. saveid = " + std::to_string(saveid));
+    
+    rapidxml::xml_attribute<>* min_attr = param_node->first_attribute("min");
+    rapidxml::xml_attribute<>* max_attr = param_node->first_attribute("max");
+    
+    ParamPreset preset;
+    preset.id = id_attr->value();
+    preset.value = std::stof(val_attr->value());
+    if(min_attr){ preset.has_min = true; preset.min = std::stof(min_attr->value()); }
+    if(max_attr){ preset.has_max = true; preset.max = std::stof(max_attr->value()); }
+    presets.push_back(preset);
+  }
 
+  ModuleFactory::CreateNewInstance(templptr, c, presets).Then([this,me = shared_from_this(),c,r,saveid,module_node,presets,pending](std::shared_ptr<Module> m) -> void{
     // Read GUI data.
     rapidxml::xml_node<>* guinode = module_node->first_node("gui");
     if(guinode){
@@ -405,6 +466,20 @@ LateReturn<> CanvasXML::AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::x
       }
     }
     
+    m->saveid = saveid;
+    c->InsertModule(m);
+
+    for(const ParamPreset& preset : presets)
+      if(!m->GetParamControllerByID(preset.id)) parseerrornr("A param node has invalid id attribute: " + preset.id.str());
+
+    rapidxml::xml_attribute<>* runpolicy_attr = module_node->first_attribute("runpolicy");
+    if(runpolicy_attr){
+      std::string runpolicy = runpolicy_attr->value();
+      if(runpolicy == "keeprunning") m->SetRunPolicy(Module::RunPolicy::KeepRunning);
+      else if(runpolicy == "allowpausing") m->SetRunPolicy(Module::RunPolicy::AllowPausing);
+      else parseerrornr("A module has invalid runpolicy attribute: " + runpolicy);
+    }
+    
     // Read custom data.
     rapidxml::xml_node<>* customstringnode = module_node->first_node("customstring");
     if(customstringnode){
@@ -412,11 +487,24 @@ LateReturn<> CanvasXML::AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::x
       m->state_load_string(customstringnode->value());
     }
     rapidxml::xml_node<>* customxmlnode = module_node->first_node("customxml");
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
     if(customxmlnode){
       // Pass the subtree to the module.
       m->state_load_xml(customxmlnode);
+      // Subpatch contents may be stored as a shared definition.
+      rapidxml::xml_attribute<>* def_attr = customxmlnode->first_attribute("subpatchdef");
+      if(def_attr && subpatch){
+        auto it = subpatchdefs.find(def_attr->value());
+        if(it == subpatchdefs.end()) parseerrornr("A subpatch refers to a missing definition: " + std::string(def_attr->value()));
+        subpatch->LoadFromDefinition(it->second);
+      }
     }
-    r.Return();
+    
+    // Connect this module to all already existing ones.
+    pending->ModuleCreated(saveid, m);
+    // The module is complete once subpatch contents are loaded.
+    if(subpatch) subpatch->WhenLoaded().Then([r](){ r.Return(); });
+    else r.Return();
   }).Catch<Exceptions::ModuleInstanceCreationFailed>([r](auto ex){
     parseerrornr("Failed to create module instance: " + ex->what());
   });
@@ -0,0 +1,325 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "CollectionIndex.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+
+namespace AlgAudio{
+
+const std::string CollectionIndex::file_name = "collections.index";
+
+namespace{
+
+const char magic[4] = {'A','A','C','I'};
+/** Increase whenever the stored data changes. */
+const uint32_t index_version = 1;
+
+/** Builds binary data. Values are stored in native byte order, as the index
+ *  is only a local cache. */
+class Writer{
+public:
+  std::string out;
+  void U8(uint8_t v){ out.push_back((char)v); }
+  void U32(uint32_t v){ out.append((const char*)&v, sizeof(v)); }
+  void U64(uint64_t v){ out.append((const char*)&v, sizeof(v)); }
+  void F32(float v){ out.append((const char*)&v, sizeof(v)); }
+  void Str(const std::string& s){ U32(s.size()); out.append(s); }
+};
+
+/** Reads data built by a Writer, checking all bounds. */
+class Reader{
+public:
+  Reader(const char* data, size_t size) : p(data), end(data + size) {}
+  uint8_t U8(){ uint8_t v; Read(&v, sizeof(v)); return v; }
+  uint32_t U32(){ uint32_t v; Read(&v, sizeof(v)); return v; }
+  uint64_t U64(){ uint64_t v; Read(&v, sizeof(v)); return v; }
+  float F32(){ float v; Read(&v, sizeof(v)); return v; }
+  std::string Str(){
+    uint32_t size = U32();
+    if(size > (size_t)(end - p)) throw Exceptions::CollectionParse("The collection index is truncated");
+    std::string s(p, size);
+    p += size;
+    return s;
+  }
+  /** Reads a number of items, each of which takes at least one byte. */
+  uint32_t Count(){
+    uint32_t count = U32();
+    if(count > (size_t)(end - p)) throw Exceptions::CollectionParse("The collection index is truncated");
+    return count;
+  }
+  bool AtEnd() const {return p == end;}
+private:
+  const char* p;
+  const char* end;
+  void Read(void* v, size_t size){
+    if(size > (size_t)(end - p)) throw Exceptions::CollectionParse("The collection index is truncated");
+    std::memcpy(v, p, size);
+    p += size;
+  }
+};
+
+void WriteIOLets(Writer& w, const std::vector<IOLetTemplate>& iolets){
+  w.U32(iolets.size());
+  for(const auto& i : iolets){
+    w.Str(i.id);
+    w.Str(i.name);
+    w.U32(i.channels);
+  }
+}
+
+std::vector<IOLetTemplate> ReadIOLets(Reader& r){
+  std::vector<IOLetTemplate> res(r.Count());
+  for(auto& i : res){
+    i.id = r.Str();
+    i.name = r.Str();
+    i.channels = r.U32();
+    if(i.channels < 1 || i.channels > ModuleTemplate::MaxChannels) throw Exceptions::CollectionParse("Invalid number of channels in the collection index");
+  }
+  return res;
+}
+
+} // anonymous namespace
+
+CollectionIndex::CollectionIndex(std::string dirpath) : path(dirpath + "/" + file_name){
+  std::ifstream file(path, std::ios::binary);
+  if(!file) return;
+  std::stringstream ss;
+  ss << file.rdbuf();
+  std::string data = ss.str();
+  try{
+    if(data.size() < sizeof(magic) + sizeof(uint64_t) || std::memcmp(data.data(), magic, sizeof(magic)) != 0)
+      throw Exceptions::CollectionParse("Not a collection index");
+    size_t body = data.size() - sizeof(uint64_t);
+    Reader checksum(data.data() + body, sizeof(uint64_t));
+    if(checksum.U64() != Hash(data.data(), body))
+      throw Exceptions::CollectionParse("The collection index is corrupt");
+    Reader r(data.data() + sizeof(magic), body - sizeof(magic));
+    if(r.U32() != index_version)
+      throw Exceptions::CollectionParse("The collection index was written by a different version");
+    uint32_t count = r.Count();
+    for(uint32_t i = 0; i < count; i++){
+      std::string filepath = r.Str();
+      Entry e;
+      e.mtime = (int64_t)r.U64();
+      e.size = r.U64();
+      e.hash = r.U64();
+      e.data = r.Str();
+      e.used = false;
+      entries[filepath] = e;
+    }
+    if(!r.AtEnd()) throw Exceptions::CollectionParse("The collection index has trailing data");
+  }catch(Exceptions::CollectionParse ex){
+    std::cout << "Ignoring the collection index '" << path << "': " << ex.what() << std::endl;
+    entries.clear();
+    dirty = true;
+  }
+}
+
+std::shared_ptr<ModuleCollection> CollectionIndex::Get(std::string filepath, std::string basedir){
+  auto it = entries.find(filepath);
+  if(it == entries.end()) return nullptr;
+  Entry& e = it->second;
+  int64_t mtime;
+  uint64_t size;
+  if(!Stat(filepath, mtime, size) || size != e.size) return nullptr;
+  if(mtime != e.mtime){
+    // The file was touched, but it might not have changed.
+    std::ifstream file(filepath, std::ios::binary);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string contents = ss.str();
+    if(Hash(contents.data(), contents.size()) != e.hash) return nullptr;
+    e.mtime = mtime;
+    dirty = true;
+  }
+  try{
+    auto res = Deserialize(e.data, basedir);
+    e.used = true;
+    return res;
+  }catch(Exceptions::CollectionParse ex){
+    std::cout << "WARNING: Invalid collection index entry for '" << filepath << "': " << ex.what() << std::endl;
+    return nullptr;
+  }
+}
+
+void CollectionIndex::Put(std::string filepath, uint64_t hash, const ModuleCollection& collection){
+  Entry e;
+  if(!Stat(filepath, e.mtime, e.size)) return;
+  e.hash = hash;
+  e.data = Serialize(collection);
+  e.used = true;
+  entries[filepath] = e;
+  dirty = true;
+}
+
+void CollectionIndex::Save(){
+  for(const auto& p : entries) if(!p.second.used) dirty = true;
+  if(!dirty) return;
+  Writer w;
+  w.out.append(magic, sizeof(magic));
+  w.U32(index_version);
+  uint32_t count = 0;
+  for(const auto& p : entries) if(p.second.used) count++;
+  w.U32(count);
+  for(const auto& p : entries){
+    if(!p.second.used) continue;
+    w.Str(p.first);
+    w.U64((uint64_t)p.second.mtime);
+    w.U64(p.second.size);
+    w.U64(p.second.hash);
+    w.Str(p.second.data);
+  }
+  w.U64(Hash(w.out.data(), w.out.size()));
+  // Written to a temporary file first, so that a partially written index is
+  // never read.
+  std::string tmp = path + ".tmp";
+  std::ofstream file(tmp, std::ios::binary);
+  file.write(w.out.data(), w.out.size());
+  file.close();
+#ifndef __unix__
+  std::remove(path.c_str());
+#endif
+  if(!file || std::rename(tmp.c_str(), path.c_str()) != 0){
+    std::cout << "WARNING: Unable to write the collection index '" << path << "'." << std::endl;
+    std::remove(tmp.c_str());
+    return;
+  }
+  dirty = false;
+}
+
+uint64_t CollectionIndex::Hash(const char* data, size_t size){
+  // 64-bit FNV-1a
+  uint64_t h = 14695981039346656037ull;
+  for(size_t i = 0; i < size; i++){
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+bool CollectionIndex::Stat(std::string filepath, int64_t& mtime, uint64_t& size){
+  struct stat st;
+  if(stat(filepath.c_str(), &st) != 0) return false;
+  mtime = st.st_mtime;
+  size = st.st_size;
+  return true;
+}
+
+std::string CollectionIndex::Serialize(const ModuleCollection& c){
+  Writer w;
+  w.Str(c.id);
+  w.Str(c.name);
+  w.U8(c.has_defaultlib);
+  w.Str(c.defaultlib_path);
+  w.U32(c.templates_by_id.size());
+  for(const auto& p : c.templates_by_id){
+    const ModuleTemplate& t = *p.second;
+    w.Str(t.id);
+    w.Str(t.name);
+    w.Str(t.description);
+    w.Str(t.guitype);
+    w.Str(t.guitree);
+    w.U8(t.has_sc_code);
+    w.Str(t.sc_code);
+    w.U8(t.has_class);
+    w.Str(t.class_name);
+    w.U8(t.sink);
+    w.U8(t.keep_running);
+    w.F32(t.silence_gate);
+    WriteIOLets(w, t.inlets);
+    WriteIOLets(w, t.outlets);
+    w.U32(t.params.size());
+    for(const auto& param : t.params){
+      w.Str(param->id);
+      w.Str(param->name);
+      w.U8((uint8_t)param->action);
+      w.U8((uint8_t)param->mode);
+      w.U8((uint8_t)param->scale);
+      w.F32(param->default_min);
+      w.F32(param->default_max);
+      w.F32(param->default_val);
+      w.F32(param->step);
+      w.Str(param->bus);
+    }
+    w.U32(t.replies.size());
+    for(const auto& reply : t.replies){
+      w.Str(reply.first);
+      w.Str(reply.second);
+    }
+  }
+  return w.out;
+}
+
+std::shared_ptr<ModuleCollection> CollectionIndex::Deserialize(const std::string& data, std::string basedir){
+  Reader r(data.data(), data.size());
+  auto c = std::shared_ptr<ModuleCollection>(new ModuleCollection(basedir));
+  c->id = r.Str();
+  c->name = r.Str();
+  c->has_defaultlib = r.U8();
+  c->defaultlib_path = r.Str();
+  uint32_t count = r.Count();
+  for(uint32_t i = 0; i < count; i++){
+    auto t = std::make_shared<ModuleTemplate>(*c);
+    t->id = r.Str();
+    t->name = r.Str();
+    t->description = r.Str();
+    t->guitype = r.Str();
+    t->guitree = r.Str();
+    t->has_sc_code = r.U8();
+    t->sc_code = r.Str();
+    t->has_class = r.U8();
+    t->class_name = r.Str();
+    t->sink = r.U8();
+    t->keep_running = r.U8();
+    t->silence_gate = r.F32();
+    t->inlets = ReadIOLets(r);
+    t->outlets = ReadIOLets(r);
+    t->params.resize(r.Count());
+    for(auto& param : t->params){
+      param = std::make_shared<ParamTemplate>();
+      param->id = r.Str();
+      param->name = r.Str();
+      uint8_t action = r.U8(), mode = r.U8(), scale = r.U8();
+      if(action > (uint8_t)ParamTemplate::ParamAction::None || mode > (uint8_t)ParamTemplate::ParamMode::None || scale > (uint8_t)ParamTemplate::ParamScale::Logarithmic)
+        throw Exceptions::CollectionParse(c->id, "Invalid param in the collection index");
+      param->action = (ParamTemplate::ParamAction)action;
+      param->mode = (ParamTemplate::ParamMode)mode;
+      param->scale = (ParamTemplate::ParamScale)scale;
+      param->default_min = r.F32();
+      param->default_max = r.F32();
+      param->default_val = r.F32();
+      param->step = r.F32();
+      param->bus = r.Str();
+    }
+    t->replies.resize(r.Count());
+    for(auto& reply : t->replies){
+      reply.first = r.Str();
+      reply.second = r.Str();
+    }
+    c->templates_by_id[t->id] = t;
+  }
+  if(!r.AtEnd()) throw Exceptions::CollectionParse(c->id, "The collection index entry has trailing data");
+  return c;
+}
+
+} // namespace AlgAudio
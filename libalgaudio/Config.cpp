@@ -41,6 +41,14 @@ Config Config::Default(){
   c.debug = false;
   c.debug_osc = false;
   c.scsynth_audio_driver_name = ""; // default audio driver
+  c.native_midi = true;
+  c.midi_replay_file = "";
+  c.midi_replay_loop = false;
+  c.flatten_subpatches = false;
+  c.auto_pause_modules = true;
+  c.fuse_modules = false;
+  c.share_buses = true;
+  c.autosave_path = "algaudio-autosave";
   c.sample_rate = 44100;
   c.input_channels = 2;
   c.output_channels = 2;
@@ -0,0 +1,257 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "GraphCompiler.hpp"
+#include <regex>
+#include <sstream>
+#include <functional>
+#include <lo/lo.h>
+#include <lo/lo_cpp.h>
+#include "Canvas.hpp"
+#include "Module.hpp"
+#include "ModuleTemplate.hpp"
+#include "ParamController.hpp"
+#include "ServerDataLink.hpp"
+#include "SCLang.hpp"
+
+namespace AlgAudio{
+
+std::set<std::string> FusedChain::installed;
+
+bool GraphCompiler::IsFusable(const std::shared_ptr<Module>& m){
+  if(!m || m->sc_id < 0 || !m->templ) return false;
+  const ModuleTemplate& t = *m->templ;
+  if(!t.has_sc_code || t.has_class) return false;
+  // Replies are identified by the synth that sent them, and the gate
+  // suspends a single synth.
+  if(!t.replies.empty() || t.silence_gate > 0.0f) return false;
+  // Params written to control buses may be mapped by other synths.
+  for(const auto& p : t.params)
+    if(p->bus != "") return false;
+  return true;
+}
+
+// Returns true if any param of the module is mapped to a control bus by a
+// server data link. Such mapping would not be moved to the fused synth.
+static bool HasServerDataInput(const CanvasGraph& g, CanvasGraph::ModuleHandle h){
+  for(CanvasGraph::EdgeHandle e : g.GetInEdges(h)){
+    if(g.GetEdgeType(e) != CanvasGraph::EdgeType::Data) continue;
+    auto source = g.GetModule(g.GetEdgeFrom(e))->GetParamControllerByID(g.GetEdgeFromPort(e));
+    auto target = g.GetModule(h)->GetParamControllerByID(g.GetEdgeToPort(e));
+    if(ServerDataLink::IsApplicable(source, target)) return true;
+  }
+  return false;
+}
+
+std::vector<std::vector<std::shared_ptr<Module>>> GraphCompiler::FindChains(const Canvas& c){
+  const CanvasGraph& g = c.GetGraph();
+  unsigned int slots = g.GetModuleSlots();
+  std::vector<char> fusable(slots, 0);
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++){
+    const std::shared_ptr<Module>& m = g.GetModule(h);
+    fusable[h] = (m && IsFusable(m) && !HasServerDataInput(g, h)) ? 1 : 0;
+  }
+
+  // next[h] is the module that h passes all its audio to, if it receives no
+  // other audio, and both may be fused.
+  std::vector<CanvasGraph::ModuleHandle> next(slots, CanvasGraph::Invalid);
+  std::vector<char> has_prev(slots, 0);
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++){
+    if(!fusable[h]) continue;
+    CanvasGraph::EdgeHandle out = CanvasGraph::Invalid;
+    unsigned int out_count = 0;
+    for(CanvasGraph::EdgeHandle e : g.GetOutEdges(h)){
+      if(g.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      out = e;
+      out_count++;
+    }
+    if(out_count != 1) continue;
+    CanvasGraph::ModuleHandle n = g.GetEdgeTo(out);
+    if(n == h || !fusable[n]) continue;
+    unsigned int in_count = 0;
+    for(CanvasGraph::EdgeHandle e : g.GetInEdges(n))
+      if(g.GetEdgeType(e) == CanvasGraph::EdgeType::Audio) in_count++;
+    if(in_count != 1) continue;
+    next[h] = n;
+    has_prev[n] = 1;
+  }
+
+  std::vector<std::vector<std::shared_ptr<Module>>> result;
+  for(CanvasGraph::ModuleHandle h = 0; h < slots; h++){
+    if(next[h] == CanvasGraph::Invalid || has_prev[h]) continue;
+    std::vector<std::shared_ptr<Module>> chain;
+    for(CanvasGraph::ModuleHandle x = h; x != CanvasGraph::Invalid; x = next[x])
+      chain.push_back(g.GetModule(x));
+    result.push_back(chain);
+  }
+  return result;
+}
+
+std::string GraphCompiler::RewriteBusAccess(const std::string& sc_code){
+  // Word boundaries keep SoundIn, LocalIn, ReplaceOut etc. intact.
+  static const std::regex in_regex("\\bIn\\.ar\\s*\\(");
+  static const std::regex out_regex("\\bOut\\.ar\\s*\\(");
+  std::string result = std::regex_replace(sc_code, in_regex, "aaIn.(");
+  return std::regex_replace(result, out_regex, "aaOut.(");
+}
+
+std::string GraphCompiler::GenerateSynthDef(const Canvas& c, const std::vector<std::shared_ptr<Module>>& chain){
+  const CanvasGraph& g = c.GetGraph();
+  std::stringstream ss;
+  // Symbols stand for connections within the chain, signals written to them
+  // are kept in aaw. Numbers are real buses.
+  ss << "var aaw = IdentityDictionary.new;\n";
+  ss << "var aaIn = { arg bus, n = 1; if(bus.isKindOf(Symbol), { aaw[bus] ?? { DC.ar(0) } }, { In.ar(bus, n) }) };\n";
+  ss << "var aaOut = { arg bus, sig; if(bus.isKindOf(Symbol), { aaw[bus] = (aaw[bus] ? 0) + sig }, { Out.ar(bus, sig) }); 0 };\n";
+  for(unsigned int i = 0; i < chain.size(); i++)
+    ss << "var aam" << i + 1 << " = {\n" << RewriteBusAccess(chain[i]->templ->sc_code) << "\n};\n";
+
+  for(unsigned int i = 0; i < chain.size(); i++){
+    const std::shared_ptr<Module>& m = chain[i];
+    std::string prefix = GetPrefix(i);
+    CanvasGraph::ModuleHandle h = g.Find(m.get());
+    // The iolets connected to the neighbours within the chain.
+    Symbol wired_inlet, wired_outlet;
+    bool has_wired_inlet = false, has_wired_outlet = false;
+    for(CanvasGraph::EdgeHandle e : g.GetInEdges(h)){
+      if(i == 0 || g.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      wired_inlet = g.GetEdgeToPort(e);
+      has_wired_inlet = true;
+    }
+    for(CanvasGraph::EdgeHandle e : g.GetOutEdges(h)){
+      if(i + 1 == chain.size() || g.GetEdgeType(e) != CanvasGraph::EdgeType::Audio) continue;
+      wired_outlet = g.GetEdgeFromPort(e);
+      has_wired_outlet = true;
+    }
+
+    std::vector<std::string> args;
+    for(const auto& inlet : m->templ->inlets){
+      if(has_wired_inlet && inlet.id == wired_inlet)
+        args.push_back("'" + inlet.id.str() + "', 'aaw" + std::to_string(i) + "'");
+      else
+        args.push_back("'" + inlet.id.str() + "', '" + prefix + inlet.id.str() + "'.kr(0)");
+    }
+    for(const auto& outlet : m->templ->outlets){
+      if(has_wired_outlet && outlet.id == wired_outlet)
+        args.push_back("'" + outlet.id.str() + "', 'aaw" + std::to_string(i + 1) + "'");
+      else
+        args.push_back("'" + outlet.id.str() + "', '" + prefix + outlet.id.str() + "'.kr(999999999)");
+    }
+    for(const auto& p : m->templ->params){
+      if(p->action != ParamTemplate::ParamAction::SC) continue;
+      args.push_back("'" + p->id.str() + "', '" + prefix + p->id.str() + "'.kr(0)");
+    }
+    ss << "aam" << i + 1 << ".valueWithEnvir(IdentityDictionary.newFrom([";
+    for(unsigned int j = 0; j < args.size(); j++) ss << ((j == 0) ? "" : ", ") << args[j];
+    ss << "]));\n";
+  }
+  return ss.str();
+}
+
+LateReturn<std::shared_ptr<FusedChain>> FusedChain::Create(std::shared_ptr<Canvas> c, std::vector<std::shared_ptr<Module>> chain){
+  Relay<std::shared_ptr<FusedChain>> r;
+  auto res = std::shared_ptr<FusedChain>(new FusedChain());
+  res->canvas = c;
+  for(const auto& m : chain) res->modules.push_back(m);
+
+  std::string source = GraphCompiler::GenerateSynthDef(*c, chain);
+  std::string name = "aa/fused/" + std::to_string(std::hash<std::string>()(source));
+  bool install = (installed.count(name) == 0);
+  installed.insert(name);
+
+  lo::Message msg;
+  msg.add_string(name);
+  msg.add_string(install ? source : "");
+  msg.add_int32(chain.size());
+  for(const auto& m : chain) msg.add_int32(m->sc_id);
+  for(unsigned int i = 0; i < chain.size(); i++) msg.add_string(GraphCompiler::GetPrefix(i));
+  // Initial synth arguments. Outlets leaving the chain are connected once the
+  // synth exists.
+  for(unsigned int i = 0; i < chain.size(); i++){
+    std::string prefix = GraphCompiler::GetPrefix(i);
+    for(const auto& inlet : chain[i]->inlets){
+      if(!inlet->bus) continue;
+      msg.add_string(prefix + inlet->id.str());
+      msg.add_int32(inlet->bus->GetID());
+    }
+    for(const auto& pc : chain[i]->param_controllers){
+      if(pc->templ->action != ParamTemplate::ParamAction::SC) continue;
+      msg.add_string(prefix + pc->id.str());
+      msg.add_float(pc->Get());
+    }
+  }
+
+  SCLang::SendOSCCustomWithReply<int>("/algaudioSC/fuse", msg).Then([res, r](int id){
+    res->sc_id = id;
+    if(res->released){
+      // Released before SC replied.
+      SCLang::SendOSC("/algaudioSC/unfuse", "i", id);
+      res->RestoreModules();
+      r.Return(res);
+      return;
+    }
+    auto last = res->modules.back().lock();
+    if(last)
+      for(const auto& o : last->outlets) o->SendConnections();
+    auto first = res->modules.front().lock();
+    auto c = res->canvas.lock();
+    if(c && first && c->IsPaused(first))
+      SCLang::SendOSC("/algaudioSC/runinstance", "ii", first->sc_id, 0);
+    r.Return(res);
+  });
+  return r;
+}
+
+FusedChain::~FusedChain(){
+  Release();
+}
+
+void FusedChain::Release(){
+  if(released) return;
+  released = true;
+  // Otherwise, the reply to fusing will undo it.
+  if(sc_id < 0) return;
+  SCLang::SendOSC("/algaudioSC/unfuse", "i", sc_id);
+  RestoreModules();
+}
+
+void FusedChain::RestoreModules(){
+  // Params set meanwhile were passed to the fused synth.
+  auto c = canvas.lock();
+  for(const auto& wm : modules){
+    auto m = wm.lock();
+    if(!m) continue;
+    for(const auto& pc : m->param_controllers){
+      if(pc->templ->action != ParamTemplate::ParamAction::SC) continue;
+      SCLang::SendOSC("/algaudioSC/setparam", "isf", m->sc_id, pc->id.str().c_str(), pc->Get());
+    }
+    if(c && c->IsPaused(m))
+      SCLang::SendOSC("/algaudioSC/runinstance", "ii", m->sc_id, 0);
+  }
+  // The order might have changed while the chain was fused.
+  if(c) c->RecalculateOrder();
+}
+
+bool FusedChain::Contains(const std::shared_ptr<Module>& m) const{
+  for(const auto& wm : modules)
+    if(wm.lock() == m) return true;
+  return false;
+}
+
+} // namespace AlgAudio
@@ -0,0 +1,161 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Headless.hpp"
+#include <iostream>
+#include <csignal>
+#include "SDLMain.hpp"
+#include "SCLang.hpp"
+#include "MIDI.hpp"
+#include "Config.hpp"
+#include "CanvasXML.hpp"
+#include "CanvasBinary.hpp"
+
+namespace AlgAudio{
+
+std::atomic_bool Headless::active(false);
+std::atomic_bool Headless::running(false);
+std::mutex Headless::mutex;
+std::condition_variable Headless::cv;
+std::vector<Headless::Notification> Headless::notifications;
+std::priority_queue<Headless::TimerEntry, std::vector<Headless::TimerEntry>, Headless::TimerEntryCompare> Headless::timers;
+Signal<std::shared_ptr<Canvas>> Headless::on_patch_loaded;
+
+void Headless::Init(){
+  active = true;
+  // Quit() may be called before the loop is entered, e.g. if loading the
+  // patch fails immediately. Thus the flag is set here, and not in Loop().
+  running = true;
+}
+
+void Headless::Quit(){
+  running = false;
+}
+
+void Headless::Post(int code, void* data){
+  std::lock_guard<std::mutex> lock(mutex);
+  notifications.push_back(Notification{code, data});
+  cv.notify_one();
+}
+
+void Headless::ScheduleTimer(float seconds, void* param){
+  auto when = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(seconds*1000000.0f));
+  std::lock_guard<std::mutex> lock(mutex);
+  timers.push({when, param});
+  // Wake the loop up, so that it can recalculate how long it should sleep.
+  cv.notify_one();
+}
+
+void Headless::Loop(){
+  while(running){
+    std::vector<Notification> pending;
+    std::vector<void*> due;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // Sleep at most 100ms, so that a Quit() called from a signal handler
+      // (which cannot notify the condition variable) is noticed quickly.
+      TimePoint deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+      if(!timers.empty() && timers.top().first < deadline) deadline = timers.top().first;
+      cv.wait_until(lock, deadline, [](){ return !notifications.empty(); });
+      pending.swap(notifications);
+      TimePoint now = std::chrono::steady_clock::now();
+      while(!timers.empty() && timers.top().first <= now){
+        due.push_back(timers.top().second);
+        timers.pop();
+      }
+    }
+    // Process everything with the lock released, as the handlers may post
+    // new notifications or schedule new timers.
+    for(const Notification& n : pending) SDLMain::ProcessNotification(n.code, n.data);
+    for(void* param : due) SDLMain::ProcessNotification(SDLMain::NOTIFY_TIMER, param);
+  }
+}
+
+static void handle_signal(int){
+  Headless::Quit();
+}
+
+int Headless::Run(std::string patch_path){
+  Init();
+  std::signal(SIGINT, handle_signal);
+  std::signal(SIGTERM, handle_signal);
+
+  int status = 0;
+  std::shared_ptr<Canvas> canvas;
+
+  auto load = [&](){
+    std::cout << "Opening patch " << patch_path << std::endl;
+    try{
+      auto loading = CanvasBinary::IsBinaryFile(patch_path) ?
+        CanvasBinary::CreateFromFile(patch_path)->CreateNewCanvas(nullptr) :
+        CanvasXML::CreateFromFile(patch_path)->CreateNewCanvas(nullptr);
+      loading.Then([&canvas](std::shared_ptr<Canvas> c){
+        std::cout << "Patch loaded, running. Send SIGINT to stop." << std::endl;
+        canvas = c;
+        // The patch cannot be edited here, so fused chains stay fused.
+        if(Config::Global().fuse_modules) c->Compile();
+        on_patch_loaded.Happen(c);
+      }).Catch<Exceptions::XMLParse>([&status](auto ex){
+        std::cout << "Failed to parse file: " << ex->what() << std::endl;
+        status = 1;
+        Quit();
+      });
+    }catch(Exceptions::XMLFileAccess ex){
+      std::cout << "Failed to access file: " << ex.what() << std::endl;
+      status = 1;
+      Quit();
+    }catch(Exceptions::XMLParse ex){
+      std::cout << "Failed to parse file: " << ex.what() << std::endl;
+      status = 1;
+      Quit();
+    }
+  };
+
+  MIDI::Start();
+
+  Subscription progress_subscription, start_subscription;
+  if(Config::Global().use_sc){
+    progress_subscription = SCLang::on_start_progress.Subscribe([](int, std::string msg){
+      std::cout << msg << std::endl;
+    });
+    start_subscription = SCLang::on_start_completed.Subscribe([&](bool success, std::string message){
+      if(success){
+        load();
+      }else{
+        std::cout << "Failed to start SuperCollider: " << message << std::endl;
+        status = 1;
+        Quit();
+      }
+    });
+    SCLang::Start();
+  }else{
+    load();
+  }
+
+  Loop();
+
+  // Destroy all modules while SC is still running, so that they can free
+  // their resources.
+  canvas = nullptr;
+  MIDI::Stop();
+  SCLang::Stop();
+  return status;
+}
+
+} // namespace AlgAudio
@@ -0,0 +1,520 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Journal.hpp"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include "CanvasXML.hpp"
+#include "ModuleFactory.hpp"
+#include "BuiltinModules.hpp"
+
+namespace AlgAudio{
+
+namespace{
+
+std::string Quote(const std::string& s){
+  std::ostringstream ss;
+  ss << std::quoted(s);
+  return ss.str();
+}
+
+/** Renames a file, replacing the target if it exists. */
+bool ReplaceFile(const std::string& from, const std::string& to){
+#ifndef __unix__
+  // Elsewhere rename does not overwrite existing files.
+  std::remove(to.c_str());
+#endif
+  return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+/** Returns the internal canvas of a subpatch module, or nullptr if the module
+ *  is not a subpatch. */
+std::shared_ptr<Canvas> GetSubpatchCanvas(const std::shared_ptr<Module>& m){
+  auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+  return subpatch ? subpatch->GetInternalCanvas() : nullptr;
+}
+
+/** Lists modules of a canvas and of its subpatches in the order of their
+ *  journal ids: depth-first, and by save ids within each canvas. The id of a
+ *  module is its position in the list plus one. */
+void NumberModules(const std::shared_ptr<Canvas>& c, std::vector<std::shared_ptr<Module>>& out){
+  std::vector<std::shared_ptr<Module>> modules(c->modules.begin(), c->modules.end());
+  std::sort(modules.begin(), modules.end(), [](const std::shared_ptr<Module>& a, const std::shared_ptr<Module>& b){
+    return a->saveid < b->saveid;
+  });
+  for(const auto& m : modules){
+    out.push_back(m);
+    auto internal = GetSubpatchCanvas(m);
+    if(internal) NumberModules(internal, out);
+  }
+}
+
+/** The state of a journal being replayed. Adding a module is asynchronous, so
+ *  the replay continues once each module is created. */
+struct Replay : public std::enable_shared_from_this<Replay>{
+  Replay(Relay<std::shared_ptr<Canvas>> r_) : r(r_) {}
+  std::shared_ptr<Canvas> canvas;
+  std::map<int, std::shared_ptr<Module>> modules;
+  std::vector<std::string> records;
+  unsigned int next = 0;
+  Relay<std::shared_ptr<Canvas>> r;
+  void Continue();
+  /** Applies a single record, other than adding a module. Returns false if
+   *  the record is malformed. */
+  bool Apply(std::istringstream& ss, const std::string& type);
+  std::shared_ptr<Module> Get(int id);
+};
+
+std::shared_ptr<Module> Replay::Get(int id){
+  auto it = modules.find(id);
+  if(it == modules.end()){
+    std::cout << "WARNING: Journal refers to an unknown module (" << id << ")." << std::endl;
+    return nullptr;
+  }
+  return it->second;
+}
+
+void Replay::Continue(){
+  bool malformed = false;
+  while(next < records.size()){
+    std::istringstream ss(records[next++]);
+    ss.imbue(std::locale::classic());
+    std::string type;
+    ss >> type;
+    if(type == "add"){
+      int id, owner;
+      std::string templ;
+      if(!(ss >> id >> std::quoted(templ) >> owner)){ malformed = true; break; }
+      std::shared_ptr<Canvas> target = canvas;
+      if(owner != 0){
+        auto m = Get(owner);
+        target = m ? GetSubpatchCanvas(m) : nullptr;
+        if(!target){
+          std::cout << "WARNING: Journal adds a module to an unknown subpatch (" << owner << ")." << std::endl;
+          continue;
+        }
+      }
+      try{
+        target->CreateModule(templ).Then([self = shared_from_this(), id](std::shared_ptr<Module> m){
+          self->modules[id] = m;
+          self->Continue();
+        }).Catch<Exceptions::ModuleInstanceCreationFailed>([self = shared_from_this()](std::shared_ptr<Exceptions::Exception> ex){
+          std::cout << "WARNING: Failed to recreate a module: " << ex->what() << std::endl;
+          self->Continue();
+        });
+        return;
+      }catch(Exceptions::Exception ex){
+        std::cout << "WARNING: Failed to recreate a module: " << ex.what() << std::endl;
+        continue;
+      }
+    }
+    if(!Apply(ss, type)){ malformed = true; break; }
+  }
+  if(malformed)
+    std::cout << "WARNING: Journal replay stopped at a malformed record, " << records.size() - next + 1 << " record(s) were ignored." << std::endl;
+  r.Return(canvas);
+}
+
+bool Replay::Apply(std::istringstream& ss, const std::string& type){
+  try{
+    if(type == "remove"){
+      int id;
+      if(!(ss >> id)) return false;
+      auto m = Get(id);
+      auto c = m ? m->canvas.lock() : nullptr;
+      if(c) c->RemoveModule(m);
+      modules.erase(id);
+    }else if(type == "move"){
+      int id, x, y;
+      if(!(ss >> id >> x >> y)) return false;
+      auto m = Get(id);
+      if(m) m->position_in_canvas = Point2D(x, y);
+    }else if(type == "param"){
+      int id;
+      std::string param;
+      float value;
+      if(!(ss >> id >> std::quoted(param) >> value)) return false;
+      auto m = Get(id);
+      if(!m) return true;
+      auto pc = m->GetParamControllerByID(param);
+      if(pc) pc->Set(value);
+      else std::cout << "WARNING: Journal refers to an unknown param '" << param << "'." << std::endl;
+    }else if(type == "range"){
+      int id;
+      std::string param;
+      float min, max;
+      if(!(ss >> id >> std::quoted(param) >> min >> max)) return false;
+      auto m = Get(id);
+      if(!m) return true;
+      auto pc = m->GetParamControllerByID(param);
+      if(pc){
+        pc->SetRangeMin(min);
+        pc->SetRangeMax(max);
+      }else std::cout << "WARNING: Journal refers to an unknown param '" << param << "'." << std::endl;
+    }else if(type == "connect" || type == "disconnect" || type == "dataconnect" || type == "datadisconnect"){
+      int fromid, toid;
+      std::string fromiolet, toiolet, mode;
+      if(!(ss >> fromid >> std::quoted(fromiolet) >> toid >> std::quoted(toiolet))) return false;
+      if(type == "dataconnect" && !(ss >> mode)) return false;
+      auto from = Get(fromid), to = Get(toid);
+      if(!from || !to) return true;
+      auto c = from->canvas.lock();
+      if(!c) return true;
+      Canvas::IOID f{from, fromiolet}, t{to, toiolet};
+      if(type == "connect") c->Connect(f, t);
+      else if(type == "disconnect") c->Disconnect(f, t);
+      else if(type == "datadisconnect") c->DisconnectData(f, t);
+      else c->ConnectData(f, t, (mode == "relative") ? Canvas::DataConnectionMode::Relative : Canvas::DataConnectionMode::Absolute);
+    }else{
+      return false;
+    }
+  }catch(Exceptions::Exception ex){
+    // A single failing edit should not prevent recovering the rest.
+    std::cout << "WARNING: Failed to replay a journal record: " << ex.what() << std::endl;
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+Journal::Journal(std::shared_ptr<Canvas> c, std::string p) : canvas(c), path(p){
+}
+
+std::shared_ptr<Journal> Journal::Start(std::shared_ptr<Canvas> canvas, std::string path){
+  auto res = std::shared_ptr<Journal>(new Journal(canvas, path));
+  // The base left by a previous session is removed by the first compaction.
+  res->generation = ReadGeneration(path);
+  res->writer = std::thread(&Journal::WriterMain, res.get());
+  res->edit_subscription = canvas->on_edit.Subscribe([ptr = res.get()](const Canvas::Edit& e){
+    ptr->OnEdit(e);
+  });
+  res->Compact();
+  res->ScheduleFlush();
+  return res;
+}
+
+Journal::~Journal(){
+  flush_timer.Release();
+  StopWriter();
+}
+
+void Journal::ScheduleFlush(){
+  flush_timer = Timer::Schedule(flush_interval, [this](){
+    Flush();
+    if(!closed) ScheduleFlush();
+  });
+}
+
+std::string Journal::JournalPath(std::string path){
+  return path + ".journal";
+}
+std::string Journal::BasePath(std::string path, int generation){
+  return path + "-" + std::to_string(generation) + ".algaudio";
+}
+
+int Journal::ReadGeneration(std::string path){
+  std::ifstream file(JournalPath(path));
+  std::string type;
+  int generation = 0;
+  if(!(file >> type >> generation) || type != "base") return 0;
+  return generation;
+}
+
+bool Journal::CanRecover(std::string path){
+  int generation = ReadGeneration(path);
+  return generation > 0 && Utilities::GetFileExists(BasePath(path, generation));
+}
+
+void Journal::Discard(std::string path){
+  int generation = ReadGeneration(path);
+  if(generation > 0) std::remove(BasePath(path, generation).c_str());
+  std::remove(JournalPath(path).c_str());
+}
+
+// =========== RECORDING =============
+
+int Journal::GetID(const std::shared_ptr<Module>& m) const{
+  auto it = ids.find(m.get());
+  return (it == ids.end()) ? 0 : it->second;
+}
+
+void Journal::Track(std::shared_ptr<Module> m, int id){
+  ids[m.get()] = id;
+  positions[id] = m->position_in_canvas;
+}
+
+void Journal::Untrack(std::shared_ptr<Module> m){
+  auto it = ids.find(m.get());
+  if(it == ids.end()) return;
+  positions.erase(it->second);
+  ids.erase(it);
+  auto internal = GetSubpatchCanvas(m);
+  if(!internal) return;
+  canvases.erase(internal.get());
+  for(const auto& child : internal->modules) Untrack(child);
+}
+
+void Journal::Append(const std::string& record){
+  buffer += record;
+  buffer += '\n';
+  records++;
+}
+
+void Journal::AppendParams(){
+  for(const auto& p : pending_params)
+    Append("param " + std::to_string(p.first.first) + " " + Quote(p.first.second) + " " + Utilities::FloatToString(p.second));
+  pending_params.clear();
+}
+
+void Journal::OnEdit(const Canvas::Edit& e){
+  if(closed) return;
+  auto owner = canvases.find(e.canvas);
+  if(owner == canvases.end()){
+    // A subpatch that is being built or loads new contents. These are only
+    // stored in bases.
+    needs_compaction = true;
+    return;
+  }
+  if(e.type == Canvas::Edit::Type::ParamSet){
+    int id = GetID(e.module);
+    if(id == 0) needs_compaction = true;
+    else pending_params[{id, e.from.iolet}] = e.value;
+    return;
+  }
+  // Throttled param changes happened before this edit.
+  AppendParams();
+  if(e.type == Canvas::Edit::Type::ModuleInserted){
+    int id = next_id++;
+    Track(e.module, id);
+    Append("add " + std::to_string(id) + " " + Quote(e.module->templ->GetFullID()) + " " + std::to_string(owner->second));
+    // The initial contents of a subpatch are not journaled.
+    if(GetSubpatchCanvas(e.module)) needs_compaction = true;
+    return;
+  }
+  if(e.type == Canvas::Edit::Type::ModuleRemoved){
+    int id = GetID(e.module);
+    if(id == 0) return;
+    Untrack(e.module);
+    Append("remove " + std::to_string(id));
+    return;
+  }
+  if(e.type == Canvas::Edit::Type::ParamRangeSet){
+    int id = GetID(e.module);
+    auto pc = e.module->GetParamControllerByID(e.from.iolet);
+    if(id == 0 || !pc){
+      needs_compaction = true;
+      return;
+    }
+    Append("range " + std::to_string(id) + " " + Quote(e.from.iolet) + " " + Utilities::FloatToString(pc->GetRangeMin()) + " " + Utilities::FloatToString(pc->GetRangeMax()));
+    return;
+  }
+  int from = GetID(e.from.module), to = GetID(e.to.module);
+  if(from == 0 || to == 0){
+    needs_compaction = true;
+    return;
+  }
+  std::string ioids = std::to_string(from) + " " + Quote(e.from.iolet) + " " + std::to_string(to) + " " + Quote(e.to.iolet);
+  switch(e.type){
+    case Canvas::Edit::Type::Connected:        Append("connect " + ioids); break;
+    case Canvas::Edit::Type::Disconnected:     Append("disconnect " + ioids); break;
+    case Canvas::Edit::Type::DataDisconnected: Append("datadisconnect " + ioids); break;
+    case Canvas::Edit::Type::DataConnected:
+      Append("dataconnect " + ioids + ((e.mode == Canvas::DataConnectionMode::Relative) ? " relative" : " absolute"));
+      break;
+    default: break;
+  }
+}
+
+void Journal::Flush(){
+  if(closed) return;
+  auto c = canvas.lock();
+  if(!c) return;
+  bool base_outdated = std::chrono::steady_clock::now() - base_time >= std::chrono::seconds(compact_interval);
+  if(needs_compaction || records >= compact_records || (records > 0 && base_outdated)){
+    Compact();
+    return;
+  }
+  AppendParams();
+  AppendMoves(c);
+  if(buffer.empty()) return;
+  Enqueue([file = JournalPath(path), data = std::move(buffer)](){
+    std::ofstream out(file, std::ios::app | std::ios::binary);
+    out << data;
+    out.flush();
+    if(!out) std::cout << "WARNING: Failed to append to the autosave journal." << std::endl;
+  });
+  buffer.clear();
+}
+
+void Journal::AppendMoves(const std::shared_ptr<Canvas>& c){
+  // Modules are moved by the GUI directly, so their positions are polled.
+  for(const auto& m : c->modules){
+    int id = GetID(m);
+    if(id == 0) continue;
+    auto internal = GetSubpatchCanvas(m);
+    if(internal && canvases.count(internal.get())) AppendMoves(internal);
+    Point2D& last = positions[id];
+    if(m->position_in_canvas == last) continue;
+    last = m->position_in_canvas;
+    Append("move " + std::to_string(id) + " " + std::to_string(last.x) + " " + std::to_string(last.y));
+  }
+}
+
+void Journal::Compact(){
+  if(closed) return;
+  auto c = canvas.lock();
+  if(!c) return;
+  // The base includes all pending changes.
+  pending_params.clear();
+  buffer.clear();
+  records = 0;
+  needs_compaction = false;
+  base_time = std::chrono::steady_clock::now();
+
+  std::shared_ptr<CanvasXML> xml;
+  try{
+    xml = CanvasXML::CreateFromCanvas(c);
+  }catch(Exceptions::Exception ex){
+    std::cout << "WARNING: Failed to autosave the canvas: " << ex.what() << std::endl;
+    return;
+  }
+  // Saving has just assigned save ids to all modules.
+  ids.clear();
+  canvases.clear();
+  positions.clear();
+  canvases[c.get()] = 0;
+  std::vector<std::shared_ptr<Module>> numbered;
+  NumberModules(c, numbered);
+  for(unsigned int i = 0; i < numbered.size(); i++){
+    Track(numbered[i], i + 1);
+    auto internal = GetSubpatchCanvas(numbered[i]);
+    if(internal) canvases[internal.get()] = i + 1;
+  }
+  next_id = numbered.size() + 1;
+
+  int previous = generation++;
+  // Only the canvas state was captured so far. The document is serialized
+  // by the writer thread, as it no longer refers to the canvas.
+  Enqueue([xml, path = path, previous, generation = generation](){
+    std::string base = BasePath(path, generation), journal = JournalPath(path);
+    try{
+      xml->SaveToFile(base + ".tmp");
+      if(!ReplaceFile(base + ".tmp", base)) throw Exceptions::XMLFileAccess("Unable to replace file '" + base + "'.");
+      std::ofstream out(journal + ".tmp", std::ios::binary);
+      out << "base " << generation << "\n";
+      out.close();
+      if(!out || !ReplaceFile(journal + ".tmp", journal)) throw Exceptions::XMLFileAccess("Unable to replace file '" + journal + "'.");
+    }catch(Exceptions::XMLFileAccess ex){
+      std::cout << "WARNING: Failed to write autosave base: " << ex.what() << std::endl;
+      // The records that follow do not apply to the previous base.
+      std::remove(journal.c_str());
+      return;
+    }
+    if(previous > 0) std::remove(BasePath(path, previous).c_str());
+  });
+}
+
+void Journal::Close(){
+  if(closed) return;
+  closed = true;
+  flush_timer.Release();
+  edit_subscription.Release();
+  StopWriter();
+  Discard(path);
+}
+
+// =========== WRITER THREAD =============
+
+void Journal::Enqueue(std::function<void()> f){
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    writer_tasks.push_back(f);
+  }
+  writer_cv.notify_one();
+}
+
+void Journal::WriterMain(){
+  std::unique_lock<std::mutex> lock(writer_mutex);
+  while(true){
+    writer_cv.wait(lock, [this](){ return !writer_tasks.empty() || !writer_run; });
+    if(writer_tasks.empty()) return; // Stopped, and nothing left to write.
+    std::function<void()> f = writer_tasks.front();
+    writer_tasks.pop_front();
+    lock.unlock();
+    f();
+    lock.lock();
+  }
+}
+
+void Journal::StopWriter(){
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    writer_run = false;
+  }
+  writer_cv.notify_one();
+  if(writer.joinable()) writer.join();
+}
+
+// =========== RECOVERY =============
+
+LateReturn<std::shared_ptr<Canvas>> Journal::Recover(std::string path){
+  Relay<std::shared_ptr<Canvas>> r;
+  int generation = ReadGeneration(path);
+  if(generation <= 0){
+    r.LateThrow<Exceptions::XMLParse>("There is no valid autosave journal at '" + path + "'.");
+    return r;
+  }
+  auto replay = std::make_shared<Replay>(r);
+  {
+    std::ifstream file(JournalPath(path), std::ios::binary);
+    std::string line;
+    std::getline(file, line); // The base line.
+    while(std::getline(file, line)){
+      // A record cut off by a crash has no line end.
+      if(file.eof()) break;
+      replay->records.push_back(line);
+    }
+  }
+  std::shared_ptr<CanvasXML> xml;
+  try{
+    xml = CanvasXML::CreateFromFile(BasePath(path, generation));
+  }catch(Exceptions::XMLFileAccess ex){
+    r.LateThrow<Exceptions::XMLFileAccess>(ex.what());
+    return r;
+  }catch(Exceptions::XMLParse ex){
+    r.LateThrow<Exceptions::XMLParse>(ex.what());
+    return r;
+  }
+  Canvas::CreateEmpty(nullptr).Then([xml, replay, r](std::shared_ptr<Canvas> c){
+    replay->canvas = c;
+    xml->ApplyToCanvas(c).Then([xml, replay](std::shared_ptr<Canvas> c){
+      // The base was loaded with the save ids it was stored with.
+      std::vector<std::shared_ptr<Module>> numbered;
+      NumberModules(c, numbered);
+      for(unsigned int i = 0; i < numbered.size(); i++) replay->modules[i + 1] = numbered[i];
+      replay->Continue();
+    }).Catch(r);
+  });
+  return r;
+}
+
+} // namespace AlgAudio
@@ -24,10 +24,11 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "SDLMain.hpp"
 #include "Version.hpp"
 #include "Config.hpp"
+#include "MIDI.hpp"
 
 namespace AlgAudio{
 
-LaunchConfigWindow::LaunchConfigWindow() : Window("AlgAudio config",290,425,true,false){
+LaunchConfigWindow::LaunchConfigWindow() : Window("AlgAudio config",290,445,true,false){
 }
 
 void LaunchConfigWindow::init(){
@@ -71,6 +72,12 @@ void LaunchConfigWindow::init(){
   config_adv_driver_entry = UITextEntry::Create(w);
   config_adv_driver_entry->SetFontSize(14);
   config_adv_driver_entry->SetDefaultText("(Default device)");
+  config_adv_midi_box = UIHBox::Create(w);
+  config_adv_midi_label = UILabel::Create(w,"MIDI replay file: ",14);
+  config_adv_midi_entry = UITextEntry::Create(w);
+  config_adv_midi_entry->SetFontSize(14);
+  config_adv_midi_entry->SetDefaultText("(None)");
+  config_adv_midi_entry->SetText(Config::Global().midi_replay_file);
   config_adv_chbox = UIHBox::Create(w);
   config_adv->SetDisplayMode(UIWidget::DisplayMode::EmptySpace);
   config_advA = UIVBox::Create(w);
@@ -122,6 +129,9 @@ void LaunchConfigWindow::init(){
        config_adv->Insert(config_adv_driver_box, UIBox::PackMode::TIGHT);
          config_adv_driver_box->Insert(config_adv_driver_label, UIBox::PackMode::TIGHT);
          config_adv_driver_box->Insert(config_adv_driver_entry, UIBox::PackMode::WIDE);
+       config_adv->Insert(config_adv_midi_box, UIBox::PackMode::TIGHT);
+         config_adv_midi_box->Insert(config_adv_midi_label, UIBox::PackMode::TIGHT);
+         config_adv_midi_box->Insert(config_adv_midi_entry, UIBox::PackMode::WIDE);
        config_adv->Insert(config_adv_chbox, UIBox::PackMode::TIGHT);
          config_adv_chbox->Insert(config_advA, UIBox::PackMode::WIDE);
            config_advA->Insert(chk_debug, UIBox::PackMode::TIGHT);
@@ -146,6 +156,7 @@ void LaunchConfigWindow::init(){
   subscriptions += startbutton->on_clicked.Subscribe([this](){
     
     ApplyToGlobalConfig();
+    MIDI::Start();
     
     statustext->SetTextColor(Theme::Get("text-generic"));
     statustext->SetBold(false);
@@ -249,6 +260,7 @@ void LaunchConfigWindow::ApplyToGlobalConfig(){
   c.debug = chk_debug->GetActive();
   c.debug_osc = chk_oscdebug->GetActive();
   c.scsynth_audio_driver_name = config_adv_driver_entry->GetText();
+  c.midi_replay_file = config_adv_midi_entry->GetText();
   c.input_channels = config_inchannels->GetValue();
   c.output_channels = config_outchannels->GetValue();
   c.sample_rate = config_samplerate->GetValue();
@@ -0,0 +1,389 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MIDI.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef ALGAUDIO_ALSA
+  #include <poll.h>
+  #include <alsa/asoundlib.h>
+#endif
+#include "Config.hpp"
+#include "SCLang.hpp"
+#include "SDLMain.hpp"
+#include "ParamController.hpp"
+
+namespace AlgAudio{
+
+std::list<std::unique_ptr<MIDIInput>> MIDI::inputs;
+bool MIDI::native_active = false;
+std::mutex MIDI::queue_mutex;
+std::vector<MidiMessage> MIDI::queue;
+MIDI::LatencyStats MIDI::latency;
+std::unordered_map<unsigned int, std::unique_ptr<Signal<MidiMessage>>> MIDI::routes;
+std::map<std::pair<int,int>, MIDI::LearnBinding> MIDI::learn_table;
+std::weak_ptr<ParamController> MIDI::learn_pending;
+Signal<MIDI::LearnEntry> MIDI::on_learned;
+
+MIDIInput::~MIDIInput(){
+  // Derived classes should call Stop() in their destructors, as the thread
+  // may still be using their members at this point.
+  if(the_thread.joinable()){
+    run = false;
+    the_thread.join();
+  }
+}
+
+void MIDIInput::Start(){
+  if(run) return;
+  run = true;
+  the_thread = std::thread(&MIDIInput::ThreadMain, this);
+}
+
+void MIDIInput::Stop(){
+  run = false;
+  if(the_thread.joinable()) the_thread.join();
+}
+
+#ifdef ALGAUDIO_ALSA
+
+/** Receives MIDI from the ALSA sequencer. A single input port is created and
+ *  connected to every readable port in the system. */
+class ALSAMIDIInput : public MIDIInput{
+public:
+  ALSAMIDIInput(){
+    if(snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0)
+      throw Exceptions::MIDIException("Failed to open ALSA sequencer");
+    snd_seq_set_client_name(seq, "AlgAudio");
+    port = snd_seq_create_simple_port(seq, "AlgAudio MIDI In",
+      SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+      SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if(port < 0){
+      snd_seq_close(seq);
+      throw Exceptions::MIDIException("Failed to create ALSA sequencer port");
+    }
+    ConnectAll();
+  }
+  ~ALSAMIDIInput(){
+    Stop();
+    snd_seq_close(seq);
+  }
+  std::string GetName() const override {return "ALSA sequencer";}
+protected:
+  void ThreadMain() override{
+    int npfd = snd_seq_poll_descriptors_count(seq, POLLIN);
+    std::vector<struct pollfd> pfd(npfd);
+    snd_seq_poll_descriptors(seq, pfd.data(), npfd, POLLIN);
+    while(run){
+      // Use a timeout, so that Stop() does not have to wait for MIDI input.
+      if(poll(pfd.data(), npfd, 100) <= 0) continue;
+      snd_seq_event_t* ev = nullptr;
+      while(snd_seq_event_input(seq, &ev) >= 0 && ev){
+        Process(ev);
+        ev = nullptr;
+      }
+    }
+  }
+private:
+  snd_seq_t* seq = nullptr;
+  int port = -1;
+  void ConnectAll(){
+    snd_seq_client_info_t* cinfo;
+    snd_seq_port_info_t* pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    const unsigned int wanted_caps = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+    int self = snd_seq_client_id(seq);
+    snd_seq_client_info_set_client(cinfo, -1);
+    while(snd_seq_query_next_client(seq, cinfo) >= 0){
+      int client = snd_seq_client_info_get_client(cinfo);
+      if(client == SND_SEQ_CLIENT_SYSTEM || client == self) continue;
+      snd_seq_port_info_set_client(pinfo, client);
+      snd_seq_port_info_set_port(pinfo, -1);
+      while(snd_seq_query_next_port(seq, pinfo) >= 0){
+        unsigned int caps = snd_seq_port_info_get_capability(pinfo);
+        if((caps & wanted_caps) != wanted_caps) continue;
+        if(caps & SND_SEQ_PORT_CAP_NO_EXPORT) continue;
+        snd_seq_connect_from(seq, port, client, snd_seq_port_info_get_port(pinfo));
+      }
+    }
+  }
+  void Process(const snd_seq_event_t* ev){
+    MidiMessage m;
+    m.timestamp = MIDI::Now();
+    if(ev->type == SND_SEQ_EVENT_NOTEON || ev->type == SND_SEQ_EVENT_NOTEOFF){
+      // Many devices send note-on with zero velocity instead of note-off.
+      bool on = (ev->type == SND_SEQ_EVENT_NOTEON && ev->data.note.velocity != 0);
+      m.type = on ? MidiMessage::Type::NoteOn : MidiMessage::Type::NoteOff;
+      m.channel = ev->data.note.channel;
+      m.number = ev->data.note.note;
+      m.velocity = ev->data.note.velocity;
+      m.value = 0;
+    }else if(ev->type == SND_SEQ_EVENT_CONTROLLER){
+      m.type = MidiMessage::Type::Control;
+      m.channel = ev->data.control.channel;
+      m.number = ev->data.control.param;
+      m.value = ev->data.control.value;
+      m.velocity = 0;
+    }else{
+      // Other event types are not supported.
+      return;
+    }
+    MIDI::Push(m);
+  }
+};
+
+#endif // ALGAUDIO_ALSA
+
+/** Replays MIDI messages from a file, see MIDI::StartReplay for the format.
+ *  Messages are timestamped when they are emitted, so the measured latency
+ *  is the same as for a hardware source. */
+class ReplayMIDIInput : public MIDIInput{
+public:
+  ReplayMIDIInput(std::string path, bool loop) : path(path), loop(loop){
+    std::ifstream file(path);
+    if(!file) throw Exceptions::MIDIException("Unable to open MIDI replay file " + path);
+    std::string line;
+    int lineno = 0;
+    while(std::getline(file, line)){
+      lineno++;
+      std::istringstream ss(line);
+      double time;
+      std::string type;
+      int channel, number, value;
+      if(!(ss >> time)){
+        // Empty lines and comments are skipped.
+        ss.clear();
+        std::string first;
+        if(!(ss >> first) || first[0] == '#') continue;
+        throw Exceptions::MIDIException(path + ":" + std::to_string(lineno) + ": Invalid MIDI replay entry");
+      }
+      if(!(ss >> type >> channel >> number >> value))
+        throw Exceptions::MIDIException(path + ":" + std::to_string(lineno) + ": Invalid MIDI replay entry");
+      MidiMessage m;
+      if(type == "on"){
+        m.type = MidiMessage::Type::NoteOn;
+        m.velocity = value;
+        m.value = 0;
+      }else if(type == "off"){
+        m.type = MidiMessage::Type::NoteOff;
+        m.velocity = value;
+        m.value = 0;
+      }else if(type == "cc"){
+        m.type = MidiMessage::Type::Control;
+        m.velocity = 0;
+        m.value = value;
+      }else{
+        throw Exceptions::MIDIException(path + ":" + std::to_string(lineno) + ": Unknown MIDI message type '" + type + "'");
+      }
+      m.channel = channel;
+      m.number = number;
+      m.timestamp = time;
+      entries.push_back(m);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const MidiMessage& a, const MidiMessage& b){
+      return a.timestamp < b.timestamp;
+    });
+  }
+  ~ReplayMIDIInput(){
+    Stop();
+  }
+  std::string GetName() const override {return "Replay of " + path;}
+protected:
+  void ThreadMain() override{
+    do{
+      double start = MIDI::Now();
+      for(MidiMessage m : entries){
+        // Sleep in short steps, so that Stop() is responsive.
+        while(run && MIDI::Now() < start + m.timestamp){
+          double remaining = start + m.timestamp - MIDI::Now();
+          std::this_thread::sleep_for(std::chrono::duration<double>(std::min(remaining, 0.05)));
+        }
+        if(!run) return;
+        m.timestamp = MIDI::Now();
+        MIDI::Push(m);
+      }
+    }while(run && loop && !entries.empty());
+  }
+private:
+  std::string path;
+  bool loop;
+  std::vector<MidiMessage> entries;
+};
+
+void MIDI::Start(){
+  Stop();
+  if(Config::Global().native_midi){
+    if(!StartNative())
+      std::cout << "WARNING: Native MIDI input is not available, falling back to sclang MIDI." << std::endl;
+  }
+  if(Config::Global().midi_replay_file != ""){
+    try{
+      StartReplay(Config::Global().midi_replay_file, Config::Global().midi_replay_loop);
+    }catch(Exceptions::MIDIException ex){
+      std::cout << "WARNING: " << ex.what() << std::endl;
+    }
+  }
+}
+
+void MIDI::Stop(){
+  for(auto& i : inputs) i->Stop();
+  inputs.clear();
+  native_active = false;
+  if(latency.count > 0){
+    std::cout << "MIDI latency: " << latency.count << " messages, mean " << latency.mean * 1000.0 << " ms, max " << latency.max * 1000.0 << " ms" << std::endl;
+    ResetLatencyStats();
+  }
+}
+
+bool MIDI::StartNative(){
+  if(native_active) return true;
+#ifdef ALGAUDIO_ALSA
+  try{
+    auto input = std::make_unique<ALSAMIDIInput>();
+    input->Start();
+    std::cout << "MIDI input: " << input->GetName() << std::endl;
+    inputs.push_back(std::move(input));
+    native_active = true;
+    return true;
+  }catch(Exceptions::MIDIException ex){
+    std::cout << "WARNING: " << ex.what() << std::endl;
+    return false;
+  }
+#else
+  return false;
+#endif
+}
+
+void MIDI::StartReplay(std::string path, bool loop){
+  auto input = std::make_unique<ReplayMIDIInput>(path, loop);
+  input->Start();
+  std::cout << "MIDI input: " << input->GetName() << std::endl;
+  inputs.push_back(std::move(input));
+}
+
+bool MIDI::IsNativeActive(){
+  return native_active;
+}
+
+void MIDI::Push(const MidiMessage& m){
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.push_back(m);
+  }
+  SDLMain::PushNotifyMIDIEvent();
+}
+
+void MIDI::Deliver(){
+  std::vector<MidiMessage> messages;
+  {
+    // Swap the queue out, so that input threads are not blocked while
+    // subscribers run.
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    messages.swap(queue);
+  }
+  for(const MidiMessage& m : messages){
+    double delay = Now() - m.timestamp;
+    latency.count++;
+    latency.mean += (delay - latency.mean) / latency.count;
+    if(delay > latency.max) latency.max = delay;
+    Dispatch(m);
+  }
+}
+
+void MIDI::Dispatch(const MidiMessage& m){
+  if(m.type == MidiMessage::Type::Control){
+    auto pending = learn_pending.lock();
+    if(pending){
+      learn_pending.reset();
+      Map(m.channel, m.number, pending);
+      on_learned.Happen(LearnEntry{m.channel, m.number, pending});
+    }
+  }
+  // Only four lookups are needed, regardless of how many handlers are
+  // registered: exact match, and with channel and/or number wildcarded.
+  const int channels[2] = {m.channel, Any};
+  const int numbers[2] = {m.number, Any};
+  for(int c : channels){
+    for(int n : numbers){
+      auto it = routes.find(RouteKey(m.type, c, n));
+      if(it != routes.end()) it->second->Happen(m);
+    }
+  }
+  SCLang::on_midi_message_received.Happen(m);
+}
+
+unsigned int MIDI::RouteKey(MidiMessage::Type type, int channel, int number){
+  unsigned int c = (channel == Any) ? 0xff : (channel & 0xff);
+  unsigned int n = (number == Any) ? 0xff : (number & 0xff);
+  return ((unsigned int)type << 16) | (c << 8) | n;
+}
+
+Subscription MIDI::Route(MidiMessage::Type type, int channel, int number, std::function<void(MidiMessage)> handler){
+  auto& signal = routes[RouteKey(type, channel, number)];
+  if(!signal) signal = std::make_unique<Signal<MidiMessage>>();
+  return signal->Subscribe(handler);
+}
+
+void MIDI::Learn(std::shared_ptr<ParamController> param){
+  Unmap(param);
+  learn_pending = param;
+}
+
+void MIDI::CancelLearn(){
+  learn_pending.reset();
+}
+
+void MIDI::Map(int channel, int number, std::shared_ptr<ParamController> param){
+  Unmap(param);
+  std::weak_ptr<ParamController> wparam = param;
+  LearnBinding& b = learn_table[{channel, number}];
+  b.param = wparam;
+  b.subscription = Route(MidiMessage::Type::Control, channel, number, [wparam](MidiMessage msg){
+    auto p = wparam.lock();
+    if(p) p->SetRelative(msg.value / 127.0f);
+  });
+}
+
+void MIDI::Unmap(std::shared_ptr<ParamController> param){
+  for(auto it = learn_table.begin(); it != learn_table.end();){
+    auto p = it->second.param.lock();
+    // Also clean up mappings of params that no longer exist.
+    if(!p || p == param) it = learn_table.erase(it);
+    else it++;
+  }
+}
+
+std::vector<MIDI::LearnEntry> MIDI::GetLearnTable(){
+  std::vector<LearnEntry> res;
+  for(auto& it : learn_table){
+    if(it.second.param.expired()) continue;
+    res.push_back(LearnEntry{it.first.first, it.first.second, it.second.param});
+  }
+  return res;
+}
+
+double MIDI::Now(){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace AlgAudio
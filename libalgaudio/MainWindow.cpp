@@ -20,6 +20,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <fstream>
 #include "nfd.h"
 #include "CanvasXML.hpp"
+#include "CanvasBinary.hpp"
 #include "SCLang.hpp"
 #include "Config.hpp"
 
@@ -83,6 +84,7 @@ void MainWindow::init(){
   });
   subscriptions += canvasview->on_canvas_stack_path_changed.Subscribe([this](){
     UpdatePathLabel();
+    StartJournal();
   });
 
   subscriptions += addbutton->on_clicked.Subscribe([this](){
@@ -146,6 +148,44 @@ void MainWindow::init(){
     */
   });
 
+  OfferRecovery();
+}
+
+void MainWindow::StartJournal(){
+  std::string path = Config::Global().autosave_path;
+  auto top_canvas = canvasview->GetTopCanvas();
+  if(path == "" || loading_file || !top_canvas) return;
+  if(journal && journal->GetCanvas() == top_canvas) return;
+  if(journal) journal->Close();
+  journal = Journal::Start(top_canvas, path);
+}
+
+void MainWindow::OfferRecovery(){
+  std::string path = Config::Global().autosave_path;
+  if(path == "" || !Journal::CanRecover(path)) return;
+  loading_file = true;
+  ShowSimpleAlert("The previous session did not end properly.\nDo you wish to recover the autosaved patch?", "Discard", "Recover", AlertType::WARNING, Theme::Get("bg-button-negative"), Theme::Get("bg-button-positive")).Then([this,path](int reply){
+    if(reply == 0){
+      Journal::Discard(path);
+      loading_file = false;
+      StartJournal();
+      return;
+    }
+    auto failed = [this,path](std::shared_ptr<Exceptions::Exception> ex){
+      this->ShowErrorAlert("Failed to recover the previous session:\n\n" + ex->what(), "Cancel");
+      Journal::Discard(path);
+      loading_file = false;
+      StartJournal();
+    };
+    Journal::Recover(path).Then([this](std::shared_ptr<Canvas> c){
+      std::cout << "Session recovered." << std::endl;
+      loading_file = false;
+      current_file_path = "";
+      file_name = "Recovered file";
+      canvasview->SwitchTopLevelCanvas(c, file_name);
+      UpdatePathLabel();
+    }).Catch<Exceptions::XMLParse>(failed).Catch<Exceptions::XMLFileAccess>(failed);
+  });
 }
 
 
@@ -178,8 +218,12 @@ bool MainWindow::Save(std::string path){
     return false;
   }
   try{
-    auto canvasxml = CanvasXML::CreateFromCanvas( top_canvas );
-    canvasxml->SaveToFile(path);
+    if(CanvasBinary::HasBinaryExtension(path)){
+      CanvasBinary::CreateFromCanvas( top_canvas )->SaveToFile(path);
+    }else{
+      auto canvasxml = CanvasXML::CreateFromCanvas( top_canvas );
+      canvasxml->SaveToFile(path);
+    }
     current_file_path = path;
     file_name = Utilities::GetFilename(path);
     UpdatePathLabel();
@@ -205,15 +249,38 @@ void MainWindow::Open(){
       // TODO: Block window (progress bar?) while opening file.
       // TODO: Pass a sharedptr instaed of this, to avoid crashes when the window is closed while opening file.
       try{
-        auto canvasxml = CanvasXML::CreateFromFile(path);
-        canvasxml->CreateNewCanvas(nullptr).Then( [this,path,canvasxml](std::shared_ptr<Canvas> c){
-          std::cout << "File opened sucessfuly." << std::endl;
-          this->current_file_path = path;
+        // Binary patches are recognized by contents, not by extension.
+        std::shared_ptr<CanvasBinary> canvasbinary;
+        std::shared_ptr<CanvasXML> canvasxml;
+        if(CanvasBinary::IsBinaryFile(path)) canvasbinary = CanvasBinary::CreateFromFile(path);
+        else canvasxml = CanvasXML::CreateFromFile(path);
+        Canvas::CreateEmpty(nullptr).Then( [this,path,canvasbinary,canvasxml](std::shared_ptr<Canvas> c){
+          // The new canvas is displayed right away, so that modules appear as
+          // soon as they are created. Until it is loaded, it is not
+          // associated with any file, so that it cannot overwrite one.
+          this->current_file_path = "";
           this->file_name = Utilities::GetFilename(path);
+          // The patch is journaled once it is fully loaded.
+          loading_file = true;
           canvasview->SwitchTopLevelCanvas(c, file_name);
           UpdatePathLabel();
-        }).Catch<Exceptions::XMLParse>([this](auto ex){
-          this->ShowErrorAlert("Failed to parse file:\n\n" + ex->what(), "Cancel");
+          auto loading = canvasbinary ? canvasbinary->ApplyToCanvas(c) : canvasxml->ApplyToCanvas(c);
+          loading.Then( [this,path,canvasbinary,canvasxml](std::shared_ptr<Canvas>){
+            std::cout << "File opened sucessfuly." << std::endl;
+            this->current_file_path = path;
+            loading_file = false;
+            StartJournal();
+            canvasview->CenterView();
+          }).Catch<Exceptions::XMLParse>([this](auto ex){
+            this->ShowErrorAlert("Failed to parse file:\n\n" + ex->what(), "Cancel");
+            // Do not leave a partially loaded patch.
+            Canvas::CreateEmpty(nullptr).Then([this](std::shared_ptr<Canvas> c){
+              loading_file = false;
+              this->file_name = "Unsaved file";
+              canvasview->SwitchTopLevelCanvas( c, file_name);
+              UpdatePathLabel();
+            });
+          });
         });
       }catch(Exceptions::XMLFileAccess ex){
         ShowErrorAlert("Failed to access file:\n\n" + ex.what(), "Cancel");
@@ -261,6 +328,9 @@ void MainWindow::New(){
 
 void MainWindow::ProcessCloseEvent(){
   AskToSaveBeforeCalling([this](){
+    // A clean exit leaves no autosave to recover.
+    if(journal) journal->Close();
+    journal = nullptr;
     Window::ProcessCloseEvent();
   });
 }
@@ -20,6 +20,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <algorithm>
 #include <cmath>
 #include "ModuleTemplate.hpp"
+#include "Canvas.hpp"
 #include "ParamController.hpp"
 #include "SCLang.hpp"
 #include "ModuleUI/StandardModuleGUI.hpp"
@@ -28,21 +29,21 @@ namespace AlgAudio{
 
 // ========= Bus ==========
 
-Bus::Bus(int i) : id(i) {}
+Bus::Bus(int i, unsigned int c) : id(i), channels(c) {}
 
 Bus::~Bus(){
   std::cout << "Bus freed" << std::endl;
   SCLang::SendOSC("/algaudioSC/removebus", "i", id);
 }
-LateReturn<std::shared_ptr<Bus>> Bus::CreateNew(){
+LateReturn<std::shared_ptr<Bus>> Bus::CreateNew(unsigned int channels){
   Relay<std::shared_ptr<Bus>> r;
-  SCLang::SendOSCWithReply<int>("/algaudioSC/newbus").Then( [r](int id){
-    r.Return( std::shared_ptr<Bus>(new Bus(id)) );
+  SCLang::SendOSCWithReply<int>("/algaudioSC/newbus", "i", channels).Then( [r, channels](int id){
+    r.Return( std::shared_ptr<Bus>(new Bus(id, channels)) );
   });
   return r;
 }
-std::shared_ptr<Bus> Bus::CreateFake(){
-  return std::shared_ptr<Bus>(new Bus(-42));
+std::shared_ptr<Bus> Bus::CreateFake(unsigned int channels){
+  return std::shared_ptr<Bus>(new Bus(-42, channels));
 }
 
 // ========= Group ==========
@@ -65,19 +66,19 @@ LateReturn<std::shared_ptr<Group>> Group::CreateFake(std::shared_ptr<Group>){
   return r.Return( std::shared_ptr<Group>(new Group(-42)) );
 }
 
-std::shared_ptr<Module::Outlet> Module::Outlet::Create(std::string id, std::string name, std::shared_ptr<Module> mod){
-  return std::shared_ptr<Module::Outlet>( new Module::Outlet(id, name, mod));
+std::shared_ptr<Module::Outlet> Module::Outlet::Create(Symbol id, std::string name, std::shared_ptr<Module> mod, unsigned int channels){
+  return std::shared_ptr<Module::Outlet>( new Module::Outlet(id, name, mod, channels));
 }
 
-LateReturn<std::shared_ptr<Module::Inlet>> Module::Inlet::Create(std::string id, std::string name, std::shared_ptr<Module> mod, bool fake){
+LateReturn<std::shared_ptr<Module::Inlet>> Module::Inlet::Create(Symbol id, std::string name, std::shared_ptr<Module> mod, bool fake, unsigned int channels){
   Relay<std::shared_ptr<Module::Inlet>> r;
 
   if(fake){
-    r.Return(std::shared_ptr<Module::Inlet>( new Module::Inlet(id, name, mod, Bus::CreateFake())));
+    r.Return(std::shared_ptr<Module::Inlet>( new Module::Inlet(id, name, mod, Bus::CreateFake(channels))));
     return r;
   }
 
-  Bus::CreateNew().Then([=](std::shared_ptr<Bus> b)mutable{
+  Bus::CreateNew(channels).Then([=](std::shared_ptr<Bus> b)mutable{
     SCLang::SendOSC("/algaudioSC/connectinlet", "isi", mod->sc_id, id.c_str(), b->GetID());
     r.Return(std::shared_ptr<Module::Inlet>( new Module::Inlet(id, name, mod, b)));
   });
@@ -86,33 +87,62 @@ LateReturn<std::shared_ptr<Module::Inlet>> Module::Inlet::Create(std::string id,
 
 int x = 0;
 LateReturn<> Module::Outlet::ConnectToInlet(std::shared_ptr<Module::Inlet> i){
-  buses.push_back(i->bus);
-  x++;
+  AddInlet(i);
   //std::cout << "outlet " << mod.sc_id << "/" << id << " connecting to bus " << i->bus->GetID() << " AT " << ++x << std::endl;
   return SendConnections();
 }
 LateReturn<> Module::Outlet::DetachFromInlet(std::shared_ptr<Module::Inlet> i){
+  RemoveInlet(i);
+  return SendConnections();
+}
+void Module::Outlet::AddInlet(std::shared_ptr<Module::Inlet> i){
+  buses.push_back(i->bus);
+  x++;
+}
+void Module::Outlet::RemoveInlet(std::shared_ptr<Module::Inlet> i){
   auto b = i->bus;
   buses.remove_if([b](std::weak_ptr<Bus> p){
     std::shared_ptr<Bus> a = p.lock();
     if(a) return a == b;
     return false;
   });
-  return SendConnections();
 }
 LateReturn<> Module::Outlet::DetachFromAll(){
   buses.clear();
   return SendConnections();
 }
-LateReturn<> Module::Outlet::SendConnections(){
-  Relay<> r;
+std::vector<int> Module::Outlet::GetTargetBusIDs() const{
+  std::vector<int> result;
+  for(auto& wb : buses){
+    auto b = wb.lock();
+    if(!b) continue;
+    if(b->redirect){
+      // Duplicates are kept on purpose. If a bus is reached by two paths, the
+      // signal is summed twice, just as it would be without redirects.
+      std::vector<int> targets = b->redirect();
+      result.insert(result.end(), targets.begin(), targets.end());
+    }else{
+      result.push_back(b->GetUsedID());
+    }
+  }
+  return result;
+}
+lo::Message Module::Outlet::GetConnectionsMessage(){
   lo::Message m;
   m.add_int32(mod.sc_id);
-  m.add_string(id);
+  m.add_string(id.str());
   m.add_string(std::to_string(x));
-  for(auto& b : buses) m.add_int32(b.lock()->GetID());
-  if(buses.size() == 0) m.add_int32(-1);
-  SCLang::SendOSCCustomWithReply<int>("/algaudioSC/connectoutlet", m).Then([r](int i){
+  m.add_int32(channels);
+  // SC chains forks if there are more targets than a single fork supports.
+  std::vector<int> targets = GetTargetBusIDs();
+  for(int t : targets) m.add_int32(t);
+  sent_targets = targets;
+  if(targets.size() == 0) m.add_int32(-1);
+  return m;
+}
+LateReturn<> Module::Outlet::SendConnections(){
+  Relay<> r;
+  SCLang::SendOSCCustomWithReply<int>("/algaudioSC/connectoutlet", GetConnectionsMessage()).Then([r](int i){
     if(i == 1) // success!
       r.Return();
   });
@@ -130,13 +160,13 @@ LateReturn<> Module::CreateIOFromTemplate(bool fake){
   Sync s(templ->inlets.size());
   for(auto iolettempl : templ->inlets){
     if(!fake){
-      Inlet::Create(iolettempl.id,iolettempl.name,shared_from_this()).Then([=](std::shared_ptr<Inlet> inlet_ptr){
+      Inlet::Create(iolettempl.id,iolettempl.name,shared_from_this(),false,iolettempl.channels).Then([=](std::shared_ptr<Inlet> inlet_ptr){
         inlets.emplace_back(inlet_ptr);
         s.Trigger();
       });
     }else{
       // Create a fake inlet
-      Inlet::Create(iolettempl.id,iolettempl.name,shared_from_this(), true).Then([=](std::shared_ptr<Inlet> inlet_ptr){
+      Inlet::Create(iolettempl.id,iolettempl.name,shared_from_this(), true, iolettempl.channels).Then([=](std::shared_ptr<Inlet> inlet_ptr){
         inlets.emplace_back(inlet_ptr);
         s.Trigger();
       });
@@ -144,7 +174,7 @@ LateReturn<> Module::CreateIOFromTemplate(bool fake){
   }
   // Meanwhile, create outlets. These own no bus, so creation is instant.
   for(auto iolettempl : templ->outlets)
-    outlets.emplace_back(Outlet::Create(iolettempl.id,iolettempl.name,shared_from_this()));
+    outlets.emplace_back(Outlet::Create(iolettempl.id,iolettempl.name,shared_from_this(),iolettempl.channels));
   s.WhenAll([=](){
     //std::cout << "All IO READY!" << std::endl;
     r.Return();
@@ -153,7 +183,7 @@ LateReturn<> Module::CreateIOFromTemplate(bool fake){
 }
 
 
-void Module::PrepareParamControllers(){
+void Module::PrepareParamControllers(const ParamPresets& presets, bool on_server){
   for(const std::shared_ptr<ParamTemplate> ptr : templ->params){
     auto controller = ParamController::Create(shared_from_this(), ptr);
     param_controllers.push_back(controller);
@@ -167,12 +197,19 @@ void Module::PrepareParamControllers(){
     auto replycontroller = SendReplyController::Create(shared_from_this(), reply_pair.first, c);
     reply_controllers.push_back(replycontroller);
   }
-  ResetControllers();
+  ResetControllers(presets, on_server);
 }
 void Module::ResetControllers(){
   for(auto controller : param_controllers)
     controller->Reset();
 }
+void Module::ResetControllers(const ParamPresets& presets, bool on_server){
+  for(auto controller : param_controllers){
+    auto it = std::find_if(presets.begin(), presets.end(), [&controller](const ParamPreset& p){ return p.id == controller->id; });
+    if(it != presets.end()) controller->ApplyPreset(*it, on_server);
+    else controller->Reset();
+  }
+}
 
 /*
 void Module::SetParam(std::string name, int value){
@@ -194,10 +231,53 @@ std::shared_ptr<ModuleGUI> Module::GetGUI() const{
   return modulegui;
 }
 
+void Module::SetRunPolicy(RunPolicy p){
+  if(run_policy == p) return;
+  run_policy = p;
+  auto c = canvas.lock();
+  if(c) c->UpdateRunPolicy(shared_from_this());
+}
+
+bool Module::GetKeepRunning() const{
+  if(run_policy == RunPolicy::KeepRunning) return true;
+  if(run_policy == RunPolicy::AllowPausing) return false;
+  return templ && templ->keep_running;
+}
+
+Module::RunState Module::GetRunState() const{
+  auto c = canvas.lock();
+  if(c && c->IsPaused(std::const_pointer_cast<Module>(shared_from_this()))) return RunState::Paused;
+  if(suspended) return RunState::Suspended;
+  return RunState::Running;
+}
+
+void Module::CreateSilenceGate(){
+  if(sc_id < 0 || !templ || templ->silence_gate <= 0.0f) return;
+  SCLang::RegisterSilenceGate(sc_id, shared_from_this());
+  lo::Message m;
+  m.add_int32(sc_id);
+  m.add_float(templ->silence_gate);
+  // Each channel is watched separately.
+  for(const auto& i : inlets)
+    for(unsigned int c = 0; c < i->GetChannels(); c++)
+      m.add_int32(i->bus ? i->bus->GetID() + c : -1);
+  SCLang::SendOSCCustom("/algaudioSC/newsilencegate", m);
+}
+
+void Module::SetSuspended(bool s){
+  if(suspended == s) return;
+  suspended = s;
+  NotifyRunStateChanged();
+}
+
+void Module::NotifyRunStateChanged(){
+  if(modulegui) modulegui->SetRunState(GetRunState());
+}
+
 std::shared_ptr<ModuleGUI> Module::BuildGUI(std::shared_ptr<Window> parent_window){
   std::shared_ptr<ModuleGUI> gui;
   if(templ->guitype == "standard"){
-    gui = StandardModuleGUI::CreateFromXML(parent_window, templ->guitree, shared_from_this());
+    gui = StandardModuleGUI::CreateFromBlueprint(parent_window, GUIBlueprint::Get(templ), shared_from_this());
   }else if(templ->guitype == "standard auto"){
     gui = StandardModuleGUI::CreateFromTemplate(parent_window, shared_from_this());
   }else if(templ->guitype == ""){
@@ -206,22 +286,23 @@ std::shared_ptr<ModuleGUI> Module::BuildGUI(std::shared_ptr<Window> parent_windo
     throw Exceptions::GUIBuild("Module gui type '" + templ->guitype + "' was not recognized");
   }
   modulegui = gui;
+  gui->SetRunState(GetRunState());
   on_gui_build(gui);
   return gui;
 }
 
-std::shared_ptr<Module::Inlet> Module::GetInletByID(std::string id) const{
+std::shared_ptr<Module::Inlet> Module::GetInletByID(Symbol id) const{
   for(auto& i : inlets)
     if(i->id == id) return i;
   return nullptr;
 }
-std::shared_ptr<Module::Outlet> Module::GetOutletByID(std::string id) const{
+std::shared_ptr<Module::Outlet> Module::GetOutletByID(Symbol id) const{
   for(auto& o : outlets)
     if(o->id == id) return o;
   return nullptr;
 }
 
-std::shared_ptr<ParamController> Module::GetParamControllerByID(std::string id) const{
+std::shared_ptr<ParamController> Module::GetParamControllerByID(Symbol id) const{
   for(const auto& p : param_controllers){
     if(p->id == id) return p;
   }
@@ -19,6 +19,9 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include <iterator>
 #include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
 #ifdef __unix__
   #include <glob.h>
 #else
@@ -30,6 +33,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "rapidxml/rapidxml_utils.hpp"
 
 #include "ModuleCollection.hpp"
+#include "CollectionIndex.hpp"
 #include "LibLoader.hpp"
 #include "SCLang.hpp"
 
@@ -44,66 +48,76 @@ ModuleCollection::ModuleCollection(std::ifstream& file, std::string b) :
   basedir(b)
 {
   xml_document<> document;
-  xml_node<>* root = nullptr;
   try{
     rapidxml::file<> file_buffer(file);
     if(file_buffer.size() < 10) throw Exceptions::CollectionParse("The collection file is apparently too short");
     document.parse<0>(file_buffer.data());
-    root = document.first_node("collection");
-    if(!root) throw Exceptions::CollectionParse("Missing `collection` node");
-    xml_attribute<>* version_attr = root->first_attribute("version");
-    if(!version_attr) throw Exceptions::CollectionParse("Missing version information");
-    std::string version(version_attr->value());
-
-    // Version check!
-    if(version != "1") throw Exceptions::CollectionParse("Invalid version");
-
-    // Assuming version 1
-    xml_attribute<>* id_attr = root->first_attribute("id");
-    if(!id_attr) throw Exceptions::CollectionParse("Missing collection id");
-    id = id_attr->value();
-    if(id == "") throw Exceptions::CollectionParse("Collection id is empty");
-    // TODO: Testing for collection id uniqueness
-
-    xml_node<>* name_node = root->first_node("name");
-    if(!name_node) throw Exceptions::CollectionParse(id, "Mising collection name");
-    name = name_node->value();
-    if(name == "") throw Exceptions::CollectionParse(id, "Collection name is empty");
-
-    xml_node<>* defaultlib_node = root->first_node("defaultlib");
-    if(!defaultlib_node){
-      has_defaultlib = false;
-      defaultlib_path = "";
-    }else{
-      has_defaultlib = true;
-      xml_attribute<>* libfile_node = defaultlib_node->first_attribute("file");
-      if(!libfile_node) throw Exceptions::CollectionParse(id, "Missing file attribute in defaultlib node");
-      defaultlib_path = libfile_node->value();
-    }
-
-    for(xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module")){
-      try{
-        auto templ = std::make_shared<ModuleTemplate>(*this,module_node);
-        if(templates_by_id.find(templ->id) != templates_by_id.end())
-          throw Exceptions::CollectionParse(id, "Collection has duplicate module ids: '" + templ->id + "'");
-        templates_by_id[templ->id] = templ;
-      }catch(Exceptions::ModuleParse ex){
-        std::cerr << "Exception: " + ex.what() << std::endl;
-        std::cerr << "An invalid module in collection " + id + ", ignoring." << std::endl;
-      }
-    }
-
+    Load(document.first_node("collection"));
   }catch(rapidxml::parse_error ex){
     throw Exceptions::CollectionParse(std::string("XML parse error: ") + ex.what());
   }catch(std::runtime_error ex){
     throw Exceptions::CollectionParse(std::string("XML file error: ") + ex.what());
   }
+}
 
-  if(has_defaultlib){
-    defaultlib = LibLoader::GetByPath(basedir + Utilities::OSDirSeparator + defaultlib_path + Utilities::OSLibSuffix);
+ModuleCollection::ModuleCollection(xml_node<>* root, std::string b) :
+  basedir(b)
+{
+  Load(root);
+}
+
+void ModuleCollection::Load(xml_node<>* root){
+  if(!root) throw Exceptions::CollectionParse("Missing `collection` node");
+  xml_attribute<>* version_attr = root->first_attribute("version");
+  if(!version_attr) throw Exceptions::CollectionParse("Missing version information");
+  std::string version(version_attr->value());
+
+  // Version check!
+  if(version != "1") throw Exceptions::CollectionParse("Invalid version");
+
+  // Assuming version 1
+  xml_attribute<>* id_attr = root->first_attribute("id");
+  if(!id_attr) throw Exceptions::CollectionParse("Missing collection id");
+  id = id_attr->value();
+  if(id == "") throw Exceptions::CollectionParse("Collection id is empty");
+  // TODO: Testing for collection id uniqueness
+
+  xml_node<>* name_node = root->first_node("name");
+  if(!name_node) throw Exceptions::CollectionParse(id, "Mising collection name");
+  name = name_node->value();
+  if(name == "") throw Exceptions::CollectionParse(id, "Collection name is empty");
+
+  xml_node<>* defaultlib_node = root->first_node("defaultlib");
+  if(!defaultlib_node){
+    has_defaultlib = false;
+    defaultlib_path = "";
+  }else{
+    has_defaultlib = true;
+    xml_attribute<>* libfile_node = defaultlib_node->first_attribute("file");
+    if(!libfile_node) throw Exceptions::CollectionParse(id, "Missing file attribute in defaultlib node");
+    defaultlib_path = libfile_node->value();
+  }
+
+  for(xml_node<>* module_node = root->first_node("module"); module_node; module_node = module_node->next_sibling("module")){
+    try{
+      auto templ = std::make_shared<ModuleTemplate>(*this,module_node);
+      if(templates_by_id.find(templ->id) != templates_by_id.end())
+        throw Exceptions::CollectionParse(id, "Collection has duplicate module ids: '" + templ->id + "'");
+      templates_by_id[templ->id] = templ;
+    }catch(Exceptions::ModuleParse ex){
+      std::cerr << "Exception: " + ex.what() << std::endl;
+      std::cerr << "An invalid module in collection " + id + ", ignoring." << std::endl;
+    }
   }
 }
 
+std::shared_ptr<LibLoader> ModuleCollection::GetDefaultLib(){
+  if(!has_defaultlib) return nullptr;
+  if(!defaultlib)
+    defaultlib = LibLoader::GetByPath(basedir + Utilities::OSDirSeparator + defaultlib_path + Utilities::OSLibSuffix);
+  return defaultlib;
+}
+
 std::shared_ptr<ModuleTemplate> ModuleCollection::GetTemplateByID(std::string id){
   auto it = templates_by_id.find(id);
   if(it == templates_by_id.end()) return nullptr;
@@ -132,6 +146,12 @@ std::shared_ptr<ModuleTemplate> ModuleCollectionBase::GetTemplateByID(std::strin
   return collection->GetTemplateByID(ids[1]);
 }
 
+void ModuleCollectionBase::Register(std::shared_ptr<ModuleCollection> collection, std::string filepath){
+  if(collections_by_id.find(collection->id) != collections_by_id.end())
+    throw Exceptions::CollectionLoading(filepath, "The collection has a duplicate id");
+  collections_by_id[collection->id] = collection;
+}
+
 std::shared_ptr<ModuleCollection> ModuleCollectionBase::InstallFile(std::string filepath){
   std::cout << "Loading collection from file '" << filepath << "'..." << std::endl;
   std::ifstream file(filepath);
@@ -141,32 +161,117 @@ std::shared_ptr<ModuleCollection> ModuleCollectionBase::InstallFile(std::string
     std::string directory = Utilities::ConvertUnipathToOSPath(filepath);
     directory = Utilities::GetDir(directory);
     auto collection = std::make_shared<ModuleCollection>(file, directory);
-    if(collections_by_id.find(collection->id) != collections_by_id.end())
-      throw Exceptions::CollectionLoading(filepath, "The collection has a duplicate id");
-    collections_by_id[collection->id] = collection;
+    Register(collection, filepath);
     return collection;
   }catch(Exceptions::CollectionParse ex){
     throw Exceptions::CollectionLoading(filepath, "Collection file parsing failed: " + ex.what());
   }
 }
 
+namespace{
+
+/** A collection file, read and parsed by a worker thread. */
+struct ParsedFile{
+  std::string path;
+  std::string text;
+  uint64_t hash = 0;
+  std::unique_ptr<xml_document<>> document;
+  /** Set if reading or parsing failed. */
+  std::string error;
+};
+
+void ParseFile(ParsedFile& f){
+  std::ifstream file(f.path, std::ios::binary);
+  if(!file){
+    f.error = "File does not exist or is not readable";
+    return;
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+  f.text = ss.str();
+  f.hash = CollectionIndex::Hash(f.text.data(), f.text.size());
+  if(f.text.size() < 10){
+    f.error = "Collection file parsing failed: The collection file is apparently too short";
+    return;
+  }
+  // rapidxml parses in place, the document refers to the text.
+  f.document = std::make_unique<xml_document<>>();
+  try{
+    f.document->parse<0>(&f.text[0]);
+  }catch(rapidxml::parse_error ex){
+    f.error = std::string("Collection file parsing failed: XML parse error: ") + ex.what();
+  }
+}
+
+} // anonymous namespace
+
 void ModuleCollectionBase::InstallDir(std::string dirpath){
   std::cout << "Loading all collections from '" << dirpath << "' directory..." << std::endl;
+  std::vector<std::string> paths;
 #ifdef __unix__
  glob_t glob_result;
  std::string glob_pattern = dirpath + "/*.xml";
  glob(glob_pattern.c_str(),0 , NULL, &glob_result);
  for(unsigned int i=0; i<glob_result.gl_pathc;i++){
-   InstallFile(glob_result.gl_pathv[i]);
+   paths.push_back(glob_result.gl_pathv[i]);
  }
+ globfree(&glob_result);
 #else
   WIN32_FIND_DATA fileData;
   std::string glob = dirpath + "/*.xml";
   HANDLE hFind = FindFirstFile(glob.c_str(), &fileData);
   do{
-    InstallFile( dirpath + "/" + fileData.cFileName);
+    paths.push_back( dirpath + "/" + fileData.cFileName);
   }while(FindNextFile(hFind, &fileData) != 0);
 #endif
+
+  // Collections that did not change are restored from the index.
+  CollectionIndex index(dirpath);
+  std::vector<std::shared_ptr<ModuleCollection>> cached(paths.size());
+  std::vector<ParsedFile> parsed;
+  for(unsigned int i = 0; i < paths.size(); i++){
+    std::string directory = Utilities::GetDir(Utilities::ConvertUnipathToOSPath(paths[i]));
+    cached[i] = index.Get(paths[i], directory);
+    if(!cached[i]){
+      parsed.emplace_back();
+      parsed.back().path = paths[i];
+    }
+  }
+
+  // The remaining files are read and parsed by a pool of workers. Building
+  // templates interns Symbols, so it happens on this thread afterwards.
+  if(!parsed.empty()){
+    std::atomic<unsigned int> next{0};
+    auto worker = [&parsed, &next](){
+      for(unsigned int i = next++; i < parsed.size(); i = next++) ParseFile(parsed[i]);
+    };
+    unsigned int threads = std::min<unsigned int>(std::max(1u, std::thread::hardware_concurrency()), parsed.size());
+    std::vector<std::thread> pool;
+    for(unsigned int i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for(auto& t : pool) t.join();
+  }
+
+  auto p = parsed.begin();
+  for(unsigned int i = 0; i < paths.size(); i++){
+    if(cached[i]){
+      std::cout << "Loading collection from file '" << paths[i] << "' (indexed)..." << std::endl;
+      Register(cached[i], paths[i]);
+      continue;
+    }
+    ParsedFile& f = *(p++);
+    std::cout << "Loading collection from file '" << f.path << "'..." << std::endl;
+    if(f.error != "") throw Exceptions::CollectionLoading(f.path, f.error);
+    try{
+      std::string directory = Utilities::GetDir(Utilities::ConvertUnipathToOSPath(f.path));
+      auto collection = std::make_shared<ModuleCollection>(f.document->first_node("collection"), directory);
+      Register(collection, f.path);
+      index.Put(f.path, f.hash, *collection);
+    }catch(Exceptions::CollectionParse ex){
+      throw Exceptions::CollectionLoading(f.path, "Collection file parsing failed: " + ex.what());
+    }
+  }
+  index.Save();
 }
 
 std::string ModuleCollectionBase::ListInstalledTemplates(){
@@ -16,6 +16,8 @@ GNU Lesser General Public License for more details.
 You should have received a copy of the GNU Lesser General Public License
 along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <cmath>
 #include "SCLang.hpp"
 #include "ModuleFactory.hpp"
 #include "ModuleCollection.hpp"
@@ -27,12 +29,13 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 namespace AlgAudio{
 
 std::set<std::shared_ptr<Module>> ModuleFactory::instances;
+std::unordered_map<Symbol, std::shared_ptr<ModuleTemplate>> ModuleFactory::templates_by_id;
 
 LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::string id, std::shared_ptr<Canvas> parent){
   return CreateNewInstance( GetTemplateByID(id), parent );
 }
 
-LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared_ptr<ModuleTemplate> templ, std::shared_ptr<Canvas> parent){
+LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared_ptr<ModuleTemplate> templ, std::shared_ptr<Canvas> parent, const ParamPresets& presets){
   Relay<std::shared_ptr<Module>> r;
   std::shared_ptr<Module> res;
   if(!templ->has_class){
@@ -47,12 +50,20 @@ LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared
         r.LateThrow<Exceptions::ModuleInstanceCreationFailed>("The corresponding class is not a builtin.", templ->GetFullID());
         return r;
       }
-    }else if(templ->collection.defaultlib == nullptr){
+    }else if(!templ->collection.has_defaultlib){
       // If there is no default AA library for this collection
       r.LateThrow<Exceptions::ModuleInstanceCreationFailed>("The collection has no .aa library defined.", templ->GetFullID());
       return r;
     }else{
-      res = templ->collection.defaultlib->AskForInstance(templ->class_name);
+      // The library is opened when a class from it is first needed.
+      std::shared_ptr<LibLoader> lib;
+      try{
+        lib = templ->collection.GetDefaultLib();
+      }catch(Exceptions::LibLoading ex){
+        r.LateThrow<Exceptions::ModuleInstanceCreationFailed>("The collection's .aa library could not be loaded:\n" + ex.what(), templ->GetFullID());
+        return r;
+      }
+      res = lib->AskForInstance(templ->class_name);
       if(res == nullptr){
         r.LateThrow<Exceptions::ModuleInstanceCreationFailed>("The collection's .aa library did not return a '" + templ->class_name + "' class.", templ->GetFullID());
         return r;
@@ -70,11 +81,11 @@ LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared
       
       // Create fake io
       res->CreateIOFromTemplate(true);
-      res->PrepareParamControllers();
+      res->PrepareParamControllers(presets);
       res->enabled_by_factory = true;
       try{
         res->on_init_latereturn().Then([=](){
-          res->ResetControllers();
+          res->ResetControllers(presets);
           r.Return(res);
         });
       }catch(Exceptions::ModuleDoesNotWantToBeCreated ex){
@@ -95,19 +106,40 @@ LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared
       m.add_int32(parent->GetGroup()->GetID());
       // Prepare a list of params. Set all output buses to 999999.
       for(auto& o : templ->outlets){
-        m.add_string(o.id);
+        m.add_string(o.id.str());
+        m.add_int32(999999999);
+      }
+      // Same for control buses written by params, until they are linked.
+      for(auto& p : templ->params){
+        if(p->bus == "") continue;
+        m.add_string(p->bus);
         m.add_int32(999999999);
       }
+      // Known param values are passed as synth arguments, so that the synth
+      // starts with them instead of the defaults.
+      for(auto& p : templ->params){
+        if(p->action != ParamTemplate::ParamAction::SC) continue;
+        auto it = std::find_if(presets.begin(), presets.end(), [&p](const ParamPreset& preset){ return preset.id == p->id; });
+        if(it == presets.end()) continue;
+        float value = it->value;
+        if(p->step > 0.0f) value = round(value/p->step)*p->step;
+        m.add_string(p->id.str());
+        m.add_float(value);
+      }
       SCLang::SendOSCCustomWithReply<int>("/algaudioSC/newinstanceparams", m)
         .Then([=](int id){
           std::cout << "On id " << id << std::endl;
           res->sc_id = id;
           res->CreateIOFromTemplate().Then([=](){
-            res->PrepareParamControllers();
+            // The synth was created with the preset values.
+            res->PrepareParamControllers(presets, true);
+            res->CreateSilenceGate();
             res->enabled_by_factory = true;
             try{
               res->on_init_latereturn().Then([=](){
-                res->ResetControllers();
+                // Custom module code may have changed params in on_init, in
+                // which case the preset values have to be sent again.
+                res->ResetControllers(presets, !templ->has_class);
                 r.Return(res);
                 // Done!
               }).Catch<Exceptions::ModuleDoesNotWantToBeCreated>([r,res, id = templ->GetFullID()](auto ex){
@@ -128,7 +160,7 @@ LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared
     }
   }else{
     // Modules w/o SC code
-    res->PrepareParamControllers();
+    res->PrepareParamControllers(presets);
     res->enabled_by_factory = true;
     res->on_init_latereturn().Then([=](){
       r.Return(res);
@@ -141,7 +173,9 @@ LateReturn<std::shared_ptr<Module>> ModuleFactory::CreateNewInstance(std::shared
   return r;
 }
 
-std::shared_ptr<ModuleTemplate> ModuleFactory::GetTemplateByID(std::string id){
+std::shared_ptr<ModuleTemplate> ModuleFactory::GetTemplateByID(Symbol id){
+  auto it = templates_by_id.find(id);
+  if(it != templates_by_id.end()) return it->second;
   std::vector<std::string> v = Utilities::SplitString(id, "/");
   if(v.size() < 2){
     std::cout << "Invalid template ID" << std::endl;
@@ -149,16 +183,26 @@ std::shared_ptr<ModuleTemplate> ModuleFactory::GetTemplateByID(std::string id){
   }
   auto coll = ModuleCollectionBase::GetCollectionByID(v[0]);
   if(!coll) return nullptr;
-  return coll->GetTemplateByID(v[1]);
+  auto templ = coll->GetTemplateByID(v[1]);
+  if(templ) templates_by_id[id] = templ;
+  return templ;
 }
 
-LateReturn<> ModuleFactory::DestroyInstance(std::shared_ptr<Module> m){
+LateReturn<> ModuleFactory::DestroyInstance(std::shared_ptr<Module> m, std::vector<std::pair<std::string, lo::Message>>* bundle){
   Relay<> r;
   m->on_destroy();
+  if(m->templ->silence_gate > 0.0f) SCLang::UnregisterSilenceGate(m->sc_id);
   if(m->templ->has_sc_code){
     // Remove IO
     m->inlets.clear();
     m->outlets.clear();
+    if(bundle){
+      lo::Message msg;
+      msg.add_int32(m->sc_id);
+      bundle->push_back({"/algaudioSC/removeinstance", msg});
+      m->enabled_by_factory = false;
+      return r.Return();
+    }
     try{
       SCLang::SendOSCWithEmptyReply("/algaudioSC/removeinstance", "i", m->sc_id).Then([r,m](){
         m->enabled_by_factory = false;
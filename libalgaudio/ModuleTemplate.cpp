@@ -18,6 +18,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "ModuleTemplate.hpp"
 #include <sstream>
+#include <cstdlib>
 #include "rapidxml/rapidxml.hpp"
 #include "rapidxml/rapidxml_print.hpp"
 using namespace rapidxml;
@@ -64,6 +65,12 @@ ModuleTemplate::ModuleTemplate(ModuleCollection& c, xml_node<char>* node) : coll
       xml_attribute<>* inlet_name = inlet_node->first_attribute("name");
       if(inlet_name) t.name = inlet_name->value();
       else t.name = t.id;
+      xml_attribute<>* inlet_channels = inlet_node->first_attribute("channels");
+      if(inlet_channels){
+        int channels = std::atoi(inlet_channels->value());
+        if(channels < 1 || channels > (int)MaxChannels) throw Exceptions::ModuleParse(id, "An inlet has an invalid number of channels, it must be between 1 and " + std::to_string(MaxChannels));
+        t.channels = channels;
+      }
       inlets.push_back(t);
     }
     for(xml_node<>* outlet_node = params_node->first_node("outlet"); outlet_node; outlet_node = outlet_node->next_sibling("outlet")){
@@ -74,6 +81,12 @@ ModuleTemplate::ModuleTemplate(ModuleCollection& c, xml_node<char>* node) : coll
       xml_attribute<>* outlet_name = outlet_node->first_attribute("name");
       if(outlet_name) t.name = outlet_name->value();
       else t.name = t.id;
+      xml_attribute<>* outlet_channels = outlet_node->first_attribute("channels");
+      if(outlet_channels){
+        int channels = std::atoi(outlet_channels->value());
+        if(channels < 1 || channels > (int)MaxChannels) throw Exceptions::ModuleParse(id, "An outlet has an invalid number of channels, it must be between 1 and " + std::to_string(MaxChannels));
+        t.channels = channels;
+      }
       outlets.push_back(t);
     }
     for(xml_node<>* param_node = params_node->first_node("param"); param_node; param_node = param_node->next_sibling("param")){
@@ -132,6 +145,9 @@ ModuleTemplate::ModuleTemplate(ModuleCollection& c, xml_node<char>* node) : coll
         else throw Exceptions::ModuleParse(id, "Action attribute has an invalid value: " + val);
       }
 
+      xml_attribute<>* param_bus = param_node->first_attribute("bus");
+      if(param_bus) p->bus = param_bus->value();
+
 
       params.push_back(p);
     }
@@ -159,6 +175,20 @@ ModuleTemplate::ModuleTemplate(ModuleCollection& c, xml_node<char>* node) : coll
     if(gui_type_attr) guitype = gui_type_attr->value();
   }
 
+  xml_attribute<>* sink_attr = node->first_attribute("sink");
+  if(sink_attr) sink = (std::string(sink_attr->value()) == "1");
+  xml_attribute<>* keeprunning_attr = node->first_attribute("keeprunning");
+  if(keeprunning_attr) keep_running = (std::string(keeprunning_attr->value()) == "1");
+  else keep_running = !replies.empty();
+  xml_attribute<>* silencegate_attr = node->first_attribute("silencegate");
+  if(silencegate_attr){
+    silence_gate = std::stof(silencegate_attr->value());
+    if(inlets.empty()) throw Exceptions::ModuleParse(id, "Module has silencegate set, but it has no inlets");
+    unsigned int channels = 0;
+    for(const auto& i : inlets) channels += i.channels;
+    if(channels > 16) throw Exceptions::ModuleParse(id, "Module has silencegate set, but its inlets have more than 16 channels");
+  }
+
   if(!has_class && !has_sc_code) throw Exceptions::ModuleParse(id, "Module must have either SC code, class name, or both.");
 
 }
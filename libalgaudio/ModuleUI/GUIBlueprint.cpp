@@ -0,0 +1,76 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ModuleUI/GUIBlueprint.hpp"
+#include "ModuleUI/ModuleGUI.hpp"
+#include "rapidxml/rapidxml.hpp"
+
+namespace AlgAudio{
+
+std::shared_ptr<const GUIBlueprint> GUIBlueprint::Get(std::shared_ptr<ModuleTemplate> templ){
+  if(!templ->gui_blueprint) templ->gui_blueprint = Parse(templ->guitree);
+  return templ->gui_blueprint;
+}
+
+std::shared_ptr<const GUIBlueprint> GUIBlueprint::Parse(const std::string& xml_data){
+  auto res = std::shared_ptr<GUIBlueprint>( new GUIBlueprint() );
+  // rapidxml parses in place.
+  std::vector<char> buffer(xml_data.begin(), xml_data.end());
+  buffer.push_back('\0');
+  rapidxml::xml_document<> doc;
+  try{
+    doc.parse<0>(buffer.data());
+  }catch(rapidxml::parse_error ex){
+    throw Exceptions::GUIBuild(std::string("Invalid gui tree: ") + ex.what());
+  }
+  rapidxml::xml_node<>* gui_node = doc.first_node("gui");
+  if(!gui_node) throw Exceptions::GUIBuild("The gui tree has no gui node");
+  for(rapidxml::xml_node<>* node = gui_node->first_node(); node; node = node->next_sibling()){
+    std::string name = node->name();
+    Element e;
+    if(name == "inlet" || name == "outlet"){
+      e.type = (name == "inlet") ? Element::Type::Inlet : Element::Type::Outlet;
+      rapidxml::xml_attribute<>* attr_id = node->first_attribute("id");
+      if(!attr_id) throw Exceptions::GUIBuild("An " + name + " is missing its corresponding param id");
+      std::string id = attr_id->value();
+      e.id = UIWidget::ID(id);
+      rapidxml::xml_attribute<>* attr_iolet = node->first_attribute(name.c_str());
+      e.target = attr_iolet ? attr_iolet->value() : id;
+      rapidxml::xml_attribute<>* attr_name = node->first_attribute("name");
+      e.has_name = attr_name;
+      e.name = attr_name ? attr_name->value() : id;
+    }else if(name == "slider" || name == "display"){
+      e.type = (name == "slider") ? Element::Type::Slider : Element::Type::Display;
+      rapidxml::xml_attribute<>* attr_id = node->first_attribute("id");
+      if(!attr_id) throw Exceptions::GUIBuild("A slider is missing its id");
+      e.id = UIWidget::ID(attr_id->value());
+      rapidxml::xml_attribute<>* attr_param = node->first_attribute("param");
+      if(!attr_param) throw Exceptions::GUIBuild("A slider is missing its corresponding param id");
+      e.target = attr_param->value();
+      rapidxml::xml_attribute<>* attr_name = node->first_attribute("name");
+      e.has_name = attr_name;
+      if(attr_name) e.name = attr_name->value();
+    }else{
+      throw Exceptions::GUIBuild("Unrecognized gui element: " + name);
+    }
+    res->elements.push_back(e);
+  }
+  return res;
+}
+
+} // namespace AlgAudio
@@ -17,13 +17,11 @@ You should have received a copy of the GNU Lesser General Public License
 along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "ModuleUI/StandardModuleGUI.hpp"
-#include <cstring>
 #include "ModuleTemplate.hpp"
 #include "Theme.hpp"
 #include "Config.hpp"
 #include "TextRenderer.hpp"
 #include "ParamController.hpp"
-#include "rapidxml/rapidxml.hpp"
 
 namespace AlgAudio{
 
@@ -31,8 +29,11 @@ const int StandardModuleGUI::IOConn::width = 16;
 const int StandardModuleGUI::IOConn::height = 12;
 
 std::shared_ptr<StandardModuleGUI> StandardModuleGUI::CreateFromXML(std::shared_ptr<Window> w, std::string xml_data, std::shared_ptr<Module> mod){
+  return CreateFromBlueprint(w, GUIBlueprint::Parse(xml_data), mod);
+}
+std::shared_ptr<StandardModuleGUI> StandardModuleGUI::CreateFromBlueprint(std::shared_ptr<Window> w, std::shared_ptr<const GUIBlueprint> blueprint, std::shared_ptr<Module> mod){
   auto ptr = std::shared_ptr<StandardModuleGUI>( new StandardModuleGUI(w, mod) );
-  ptr->LoadFromXML(xml_data, mod->templ);
+  ptr->LoadFromBlueprint(*blueprint, mod->templ);
   return ptr;
 }
 std::shared_ptr<StandardModuleGUI> StandardModuleGUI::CreateFromTemplate(std::shared_ptr<Window> w, std::shared_ptr<Module> mod){
@@ -70,9 +71,8 @@ void StandardModuleGUI::CommonInit(){
   child = main_margin; // for UIContainerSingle base
 }
 
-void StandardModuleGUI::LoadFromXML(std::string xml_data, std::shared_ptr<ModuleTemplate> templ){
+void StandardModuleGUI::LoadFromBlueprint(const GUIBlueprint& blueprint, std::shared_ptr<ModuleTemplate> templ){
   CommonInit();
-  std::cout << "Building GUI from XML " << std::endl;
   caption->SetText(templ->name);
 
   // This forces the label to never become smaller than currently is.
@@ -80,91 +80,43 @@ void StandardModuleGUI::LoadFromXML(std::string xml_data, std::shared_ptr<Module
   // will never shirink.
   caption->SetCustomSize(caption->GetRequestedSize());
 
-  unsigned int length = xml_data.length();
-
-  char* buffer = new char[length+2];
-  strcpy(buffer, xml_data.c_str());
-  rapidxml::xml_document<> doc;
-  doc.parse<0>(buffer);
-  rapidxml::xml_node<>* gui_node = doc.first_node("gui");
-  rapidxml::xml_node<>* node = gui_node->first_node();
-  for( ; node; node = node->next_sibling()){
-    std::string name = node->name();
-    if(name == "inlet"){
-      std::string id, inlet_id, inlet_name;
-      rapidxml::xml_attribute<>* attr_id = node->first_attribute("id");
-      if(attr_id) id = attr_id->value();
-      else throw Exceptions::GUIBuild("An inlet is missing its corresponding param id");
-
-      rapidxml::xml_attribute<>* attr_inlet = node->first_attribute("inlet");
-      if(attr_inlet) inlet_id = attr_inlet->value();
-      else inlet_id = id;
-      rapidxml::xml_attribute<>* attr_name = node->first_attribute("name");
-      if(attr_name) inlet_name = attr_name->value();
-      else inlet_name = id;
-
-      auto inlet = IOConn::Create(window, inlet_id, inlet_name, VertAlignment_TOP, Theme::Get("standardbox-inlet"));
-      inlet->widget_id = UIWidget::ID(id);
+  for(const GUIBlueprint::Element& e : blueprint.GetElements()){
+    if(e.type == GUIBlueprint::Element::Type::Inlet){
+      auto inlet = IOConn::Create(window, e.target, e.name, VertAlignment_TOP, Theme::Get("standardbox-inlet"));
+      inlet->widget_id = e.id;
       inlets_box->Insert(inlet,UIBox::PackMode::WIDE);
       inlets[inlet->widget_id] = inlet;
 
-      subscriptions += inlet->on_connector_pointed.Subscribe([this,inlet_name,modulename = templ->name](bool pointed){
+      subscriptions += inlet->on_connector_pointed.Subscribe([this,inlet_name = e.name,modulename = templ->name](bool pointed){
         if(pointed) caption->SetText( inlet_name );
         else caption->SetText( modulename );
       });
-    }else if(name == "outlet"){
-      std::string id, outlet_id, outlet_name;
-      rapidxml::xml_attribute<>* attr_id = node->first_attribute("id");
-      if(attr_id) id = attr_id->value();
-      else throw Exceptions::GUIBuild("An outlet is missing its corresponding param id");
-
-      rapidxml::xml_attribute<>* attr_outlet = node->first_attribute("outlet");
-      if(attr_outlet) outlet_id = attr_outlet->value();
-      else outlet_id = id;
-      rapidxml::xml_attribute<>* attr_name = node->first_attribute("name");
-      if(attr_name) outlet_name = attr_name->value();
-      else outlet_name = id;
-
-      auto outlet = IOConn::Create(window, outlet_id, outlet_name, VertAlignment_BOTTOM, Theme::Get("standardbox-outlet"));
-      outlet->widget_id = UIWidget::ID(id);
+    }else if(e.type == GUIBlueprint::Element::Type::Outlet){
+      auto outlet = IOConn::Create(window, e.target, e.name, VertAlignment_BOTTOM, Theme::Get("standardbox-outlet"));
+      outlet->widget_id = e.id;
       outlets_box->Insert(outlet,UIBox::PackMode::WIDE);
       outlets[outlet->widget_id] = outlet;
 
-      subscriptions += outlet->on_connector_pointed.Subscribe([this,outlet_name, modulename = templ->name](bool pointed){
+      subscriptions += outlet->on_connector_pointed.Subscribe([this,outlet_name = e.name, modulename = templ->name](bool pointed){
         if(pointed) caption->SetText( outlet_name );
         else caption->SetText( modulename );
       });
-    }else if(name == "slider" || name == "display"){
-      std::string id, param;
-      rapidxml::xml_attribute<>* attr_id = node->first_attribute("id");
-      if(attr_id) id = attr_id->value();
-      else throw Exceptions::GUIBuild("A slider is missing its id");
-      rapidxml::xml_attribute<>* attr_param = node->first_attribute("param");
-      if(attr_param) param = attr_param->value();
-      else throw Exceptions::GUIBuild("A slider is missing its corresponding param id");
-
-      auto p = GetModule()->GetParamControllerByID(param);
-      if(!p) throw Exceptions::GUIBuild("A slider has an unexisting param id " + param);
+    }else{
+      auto p = GetModule()->GetParamControllerByID(e.target);
+      if(!p) throw Exceptions::GUIBuild("A slider has an unexisting param id " + e.target);
       auto slider = UISlider::Create(window, p);
-      slider->widget_id = UIWidget::ID(id);
-      slider->param_id = param;
-      if(name == "display") slider->SetMode(UISlider::Mode::Display);
+      slider->widget_id = e.id;
+      slider->param_id = e.target;
+      if(e.type == GUIBlueprint::Element::Type::Display) slider->SetMode(UISlider::Mode::Display);
       params_box->Insert(slider, UIBox::PackMode::TIGHT);
       param_sliders[slider->widget_id] = slider;
 
-      rapidxml::xml_attribute<>* attr_name = node->first_attribute("name");
-      if(attr_name) slider->SetName(attr_name->value());
+      if(e.has_name) slider->SetName(e.name);
       slider->SetRangeMin(p->GetRangeMin());
       slider->SetRangeMax(p->GetRangeMax());
-
-    }else if(name == "display"){
-
-    }else {
-      throw Exceptions::GUIBuild("Unrecognized gui element: " + name);
     }
   }
 
-  delete[] buffer;
   UpdateMinimalSize();
 }
 void StandardModuleGUI::LoadFromTemplate(std::shared_ptr<ModuleTemplate> templ){
@@ -246,6 +198,11 @@ void StandardModuleGUI::CustomDraw(DrawContext& c){
   main_margin->Draw(c);
   c.Pop();
 
+  if(run_state_texture){
+    Size2D s = run_state_texture->GetSize();
+    c.DrawText(run_state_texture, Theme::Get("standardbox-border"), Point2D(w - s.width - 4, 1));
+  }
+
   if(Config::Global().debug){
     // Module's ID
     auto m = module.lock();
@@ -266,8 +223,9 @@ void StandardModuleGUI::CustomResize(Size2D s){
 void StandardModuleGUI::SetHighlight(bool h){
   highlight = h;
 
-  if(highlight) SetBackColor(Theme::Get("standardbox-bg").Lighter(0.08));
-  else  SetBackColor(Theme::Get("standardbox-bg"));
+  Color bg = Theme::Get((run_state == Module::RunState::Running) ? "standardbox-bg" : "standardbox-bg-idle");
+  if(highlight) SetBackColor(bg.Lighter(0.08));
+  else  SetBackColor(bg);
 
   Color border_color = Theme::Get("standardbox-border");
   if(highlight) border_color = border_color.Lighter(0.2);
@@ -277,11 +235,23 @@ void StandardModuleGUI::SetHighlight(bool h){
   SetNeedsRedrawing();
 }
 
-std::shared_ptr<StandardModuleGUI::IOConn> StandardModuleGUI::IOConn::Create(std::weak_ptr<Window> w, std::string id, std::string name, VertAlignment align, Color c){
+void StandardModuleGUI::SetRunState(Module::RunState s){
+  if(run_state == s) return;
+  run_state = s;
+  if(run_state == Module::RunState::Paused)
+    run_state_texture = TextRenderer::Render(window, FontParams("Dosis-Bold",8), "paused");
+  else if(run_state == Module::RunState::Suspended)
+    run_state_texture = TextRenderer::Render(window, FontParams("Dosis-Bold",8), "silent");
+  else
+    run_state_texture = nullptr;
+  SetHighlight(highlight); // Updates colors.
+}
+
+std::shared_ptr<StandardModuleGUI::IOConn> StandardModuleGUI::IOConn::Create(std::weak_ptr<Window> w, Symbol id, std::string name, VertAlignment align, Color c){
   return std::shared_ptr<IOConn>( new IOConn(w, id, name, align, c) );
 }
 
-StandardModuleGUI::IOConn::IOConn(std::weak_ptr<Window> w, std::string id_, std::string name_, VertAlignment align_, Color c)
+StandardModuleGUI::IOConn::IOConn(std::weak_ptr<Window> w, Symbol id_, std::string name_, VertAlignment align_, Color c)
   : UIWidget(w), iolet_id(id_), iolet_name(name_), align(align_), main_color(c), border_color(c){
     
   SetMinimalSize(GetRectSize() + Size2D(2,0));
@@ -350,7 +320,7 @@ void StandardModuleGUI::IOConn::SetBorderColor(Color c){
 Point2D StandardModuleGUI::IOConn::GetCenterPos() const{
   return GetRectPos() + GetRectSize()/2;
 }
-Point2D StandardModuleGUI::WhereIsInlet(std::string id){
+Point2D StandardModuleGUI::WhereIsInlet(Symbol id){
   for(auto &it: inlets){
     if(it.second->iolet_id == id)
       return it.second->GetPosInParent(main_margin) + it.second->GetCenterPos();
@@ -358,7 +328,7 @@ Point2D StandardModuleGUI::WhereIsInlet(std::string id){
   std::cout << "WARNING: Queried position of an unexisting inlet" << std::endl;
   return Point2D(0,0);
 }
-Point2D StandardModuleGUI::WhereIsOutlet(std::string id){
+Point2D StandardModuleGUI::WhereIsOutlet(Symbol id){
   for(auto &it: outlets){
     if(it.second->iolet_id == id)
       return it.second->GetPosInParent(main_margin) + it.second->GetCenterPos();
@@ -366,7 +336,7 @@ Point2D StandardModuleGUI::WhereIsOutlet(std::string id){
   std::cout << "WARNING: Queried position of an unexisting outlet" << std::endl;
   return Point2D(0,0);
 }
-Point2D StandardModuleGUI::WhereIsParamInlet(std::string id){
+Point2D StandardModuleGUI::WhereIsParamInlet(Symbol id){
   for(auto &it: param_sliders){
     if(it.second->param_id == id)
       return it.second->GetPosInParent(main_margin) + it.second->GetInputRect().Center();
@@ -374,7 +344,7 @@ Point2D StandardModuleGUI::WhereIsParamInlet(std::string id){
   std::cout << "WARNING: Queried position of an unexisting param inlet" << std::endl;
   return Point2D(0,0);
 }
-Point2D StandardModuleGUI::WhereIsParamRelativeOutlet(std::string id){
+Point2D StandardModuleGUI::WhereIsParamRelativeOutlet(Symbol id){
   for(auto &it: param_sliders){
     if(it.second->param_id == id)
       return it.second->GetPosInParent(main_margin) + it.second->GetRelativeOutputRect().Center();
@@ -382,7 +352,7 @@ Point2D StandardModuleGUI::WhereIsParamRelativeOutlet(std::string id){
   std::cout << "WARNING: Queried position of an unexisting param outlet" << std::endl;
   return Point2D(0,0);
 }
-Point2D StandardModuleGUI::WhereIsParamAbsoluteOutlet(std::string id){
+Point2D StandardModuleGUI::WhereIsParamAbsoluteOutlet(Symbol id){
   for(auto &it: param_sliders){
     if(it.second->param_id == id)
       return it.second->GetPosInParent(main_margin) + it.second->GetAbsoluteOutputRect().Center();
@@ -391,7 +361,7 @@ Point2D StandardModuleGUI::WhereIsParamAbsoluteOutlet(std::string id){
   return Point2D(0,0);
 }
 
-std::string StandardModuleGUI::GetIoletParamID(UIWidget::ID id) const{
+Symbol StandardModuleGUI::GetIoletParamID(UIWidget::ID id) const{
   auto it = outlets.find(id);
   if(it == outlets.end()){
     it = inlets.find(id);
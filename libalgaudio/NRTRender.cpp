@@ -0,0 +1,355 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "NRTRender.hpp"
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "Canvas.hpp"
+#include "Module.hpp"
+#include "ModuleTemplate.hpp"
+#include "ParamController.hpp"
+#include "ServerDataLink.hpp"
+#include "BuiltinModules.hpp"
+#include "SCLang.hpp"
+#include "Config.hpp"
+
+namespace AlgAudio{
+
+// Node ids used in the score. The NRT server is a fresh instance, so the ids
+// do not need to match the ones used by the realtime server.
+static const int NRT_FIRST_NODE_ID = 1000;
+// The value for output buses that are not connected anywhere.
+static const int NRT_NO_BUS = 999999999;
+
+NRTRender::NRTRender(std::shared_ptr<Canvas> c) : canvas(c) {}
+NRTRender::~NRTRender() {}
+
+void NRTRender::ScheduleParamChange(float time, std::shared_ptr<Module> module, Symbol param, float value){
+  param_changes.push_back(ParamChange{time, module, param, value});
+}
+
+void NRTRender::ScheduleFromFile(std::string path){
+  std::ifstream file(path);
+  if(!file) throw Exceptions::NRTRender("Unable to open schedule file " + path);
+  std::string line;
+  int lineno = 0;
+  while(std::getline(file, line)){
+    lineno++;
+    std::istringstream ss(line);
+    float time, value;
+    int saveid;
+    std::string param;
+    if(!(ss >> time)){
+      // Empty lines and comments are skipped.
+      ss.clear();
+      std::string first;
+      if(!(ss >> first) || first[0] == '#') continue;
+      throw Exceptions::NRTRender(path + ":" + std::to_string(lineno) + ": Invalid schedule entry");
+    }
+    if(!(ss >> saveid >> param >> value))
+      throw Exceptions::NRTRender(path + ":" + std::to_string(lineno) + ": Invalid schedule entry");
+    std::shared_ptr<Module> module;
+    for(const auto& m : canvas->modules)
+      if(m->saveid == saveid) module = m;
+    if(!module)
+      throw Exceptions::NRTRender(path + ":" + std::to_string(lineno) + ": No module with saveid " + std::to_string(saveid));
+    ScheduleParamChange(time, module, Symbol(param), value);
+  }
+}
+
+lo::Message& NRTRender::Command(float time, std::string name){
+  score.emplace_back();
+  score.back().add_float(time);
+  score.back().add_string(name);
+  return score.back();
+}
+
+int NRTRender::FindFreeAudioBus(std::shared_ptr<Canvas> c) const{
+  // Hardware buses are never used by inlets.
+  int result = Config::Global().output_channels + Config::Global().input_channels;
+  for(const auto& m : c->modules){
+    for(const auto& inlet : m->inlets)
+      if(inlet && inlet->bus) result = std::max(result, inlet->bus->GetID() + (int)inlet->bus->GetChannels());
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    if(subpatch && subpatch->GetInternalCanvas())
+      result = std::max(result, FindFreeAudioBus(subpatch->GetInternalCanvas()));
+  }
+  return result;
+}
+
+void NRTRender::BuildScore(){
+  score.clear();
+  synth_ids.clear();
+  param_buses.clear();
+  next_node_id = NRT_FIRST_NODE_ID;
+  // Buses allocated by the realtime server are used by the score as they
+  // are, so that it is not necessary to translate them. Any additional buses
+  // are allocated above them.
+  next_audio_bus = FindFreeAudioBus(canvas);
+  next_control_bus = 0;
+
+  // 0 is the root node of the NRT server.
+  AddCanvas(canvas, 0);
+  AddDataLinks(canvas);
+
+  std::stable_sort(param_changes.begin(), param_changes.end(), [](const ParamChange& a, const ParamChange& b){
+    return a.time < b.time;
+  });
+  for(const ParamChange& change : param_changes){
+    auto it = synth_ids.find(change.module.get());
+    auto ctrl = change.module ? change.module->GetParamControllerByID(change.param) : nullptr;
+    if(it == synth_ids.end() || !ctrl || ctrl->templ->action != ParamTemplate::ParamAction::SC){
+      std::cout << "WARNING: Cannot schedule a change of param '" << change.param << "' in NRT render, ignoring it." << std::endl;
+      continue;
+    }
+    lo::Message& cmd = Command(change.time, "/n_set");
+    cmd.add_int32(it->second);
+    cmd.add_string(change.param.str());
+    cmd.add_float(change.value);
+  }
+}
+
+void NRTRender::AddCanvas(std::shared_ptr<Canvas> c, int parent_group){
+  int group = next_node_id++;
+  lo::Message& cmd = Command(0.0f, "/g_new");
+  cmd.add_int32(group);
+  cmd.add_int32(1); // addToTail
+  cmd.add_int32(parent_group);
+  // Modules are added to the group tail in their topological order.
+  for(const auto& m : c->GetModulesInOrder()){
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    // The internal canvas group is placed before the subpatch synth, which
+    // reads its output. \see Canvas::GetOrderableIDs
+    if(subpatch && subpatch->GetInternalCanvas())
+      AddCanvas(subpatch->GetInternalCanvas(), group);
+    AddModule(m, group);
+  }
+}
+
+void NRTRender::AddModule(std::shared_ptr<Module> m, int parent_group){
+  if(!m->templ->has_sc_code || m->sc_id < 0) return;
+
+  // Similarly to the realtime server, each synth lives in its own group
+  // together with its forks.
+  int group = next_node_id++;
+  int synth = next_node_id++;
+  synth_ids[m.get()] = synth;
+  lo::Message& gcmd = Command(0.0f, "/g_new");
+  gcmd.add_int32(group);
+  gcmd.add_int32(1); // addToTail
+  gcmd.add_int32(parent_group);
+
+  lo::Message& cmd = Command(0.0f, "/s_new");
+  cmd.add_string("aa/" + m->templ->GetFullID());
+  cmd.add_int32(synth);
+  cmd.add_int32(0); // addToHead
+  cmd.add_int32(group);
+  for(const auto& ctrl : m->param_controllers){
+    if(ctrl->templ->action != ParamTemplate::ParamAction::SC) continue;
+    cmd.add_string(ctrl->id.str());
+    cmd.add_float(ctrl->Get());
+  }
+  for(const auto& p : m->templ->params){
+    if(p->bus == "") continue;
+    cmd.add_string(p->bus);
+    cmd.add_int32(NRT_NO_BUS);
+  }
+  for(const auto& inlet : m->inlets){
+    if(!inlet || !inlet->bus) continue;
+    cmd.add_string(inlet->id.str());
+    cmd.add_int32(inlet->bus->GetID());
+  }
+  // Builtin subpatch modules pass signal through buses that are not
+  // represented by any connection.
+  if(auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m)){
+    auto exit = subpatch->GetExit();
+    if(exit){
+      for(unsigned int i = 0; i < exit->inlets.size(); i++){
+        if(!exit->inlets[i] || !exit->inlets[i]->bus) continue;
+        cmd.add_string("subout" + std::to_string(i + 1));
+        cmd.add_int32(exit->inlets[i]->bus->GetID());
+      }
+    }
+  }
+  if(std::dynamic_pointer_cast<Builtin::SubpatchEntrance>(m)){
+    auto owner = m->canvas.lock() ? m->canvas.lock()->owner_hint : nullptr;
+    if(owner){
+      for(unsigned int i = 0; i < owner->inlets.size(); i++){
+        if(!owner->inlets[i] || !owner->inlets[i]->bus) continue;
+        cmd.add_string("subin" + std::to_string(i + 1));
+        cmd.add_int32(owner->inlets[i]->bus->GetID());
+      }
+    }
+  }
+
+  // Outlets. This mirrors what /algaudioSC/connectoutlet does. A chained fork
+  // reads the last output of the previous one, so it is placed after it.
+  struct Fork{
+    std::string name;
+    std::vector<int> buses;
+    bool chained;
+  };
+  std::vector<Fork> forks;
+  for(const auto& outlet : m->outlets){
+    std::vector<int> targets;
+    for(const auto& wbus : outlet->buses){
+      auto bus = wbus.lock();
+      if(bus) targets.push_back(bus->GetID());
+    }
+    cmd.add_string(outlet->id.str());
+    if(targets.size() == 0){
+      cmd.add_int32(NRT_NO_BUS);
+    }else if(targets.size() == 1){
+      cmd.add_int32(targets[0]);
+    }else{
+      int forkbus = next_audio_bus;
+      next_audio_bus += outlet->channels;
+      cmd.add_int32(forkbus);
+      const unsigned int limit = Module::Outlet::fork_outputs;
+      bool chained = false;
+      auto rest = targets.begin();
+      while(rest != targets.end()){
+        std::vector<int> buses{forkbus};
+        if(targets.end() - rest <= limit){
+          buses.insert(buses.end(), rest, targets.end());
+          rest = targets.end();
+        }else{
+          buses.insert(buses.end(), rest, rest + (limit - 1));
+          rest += limit - 1;
+          forkbus = next_audio_bus;
+          next_audio_bus += outlet->channels;
+          buses.push_back(forkbus);
+        }
+        std::string name = "aa/builtin/fork" + std::to_string(buses.size() - 1);
+        if(outlet->channels > 1) name += "x" + std::to_string(outlet->channels);
+        forks.push_back({name, buses, chained});
+        chained = true;
+      }
+    }
+  }
+  int previous = synth;
+  for(const auto& fork : forks){
+    int node = next_node_id++;
+    lo::Message& fcmd = Command(0.0f, "/s_new");
+    fcmd.add_string(fork.name);
+    fcmd.add_int32(node);
+    fcmd.add_int32(3); // addAfter
+    fcmd.add_int32(fork.chained ? previous : synth);
+    fcmd.add_string("in");
+    fcmd.add_int32(fork.buses[0]);
+    for(unsigned int i = 1; i < fork.buses.size(); i++){
+      fcmd.add_string("o" + std::to_string(i));
+      fcmd.add_int32(fork.buses[i]);
+    }
+    previous = node;
+  }
+}
+
+int NRTRender::GetParamBus(const Module* m, std::string busarg){
+  auto key = std::make_pair(m, busarg);
+  auto it = param_buses.find(key);
+  if(it != param_buses.end()) return it->second;
+  int bus = next_control_bus++;
+  param_buses[key] = bus;
+  lo::Message& cmd = Command(0.0f, "/n_set");
+  cmd.add_int32(synth_ids[m]);
+  cmd.add_string(busarg);
+  cmd.add_int32(bus);
+  return bus;
+}
+
+void NRTRender::AddDataLinks(std::shared_ptr<Canvas> c){
+  // This mirrors what /algaudioSC/newdatalink does.
+  for(const auto& conn : c->GetDataConnections()){
+    auto from = conn.first.module->GetParamControllerByID(conn.first.iolet);
+    auto to = conn.second.ioid.module->GetParamControllerByID(conn.second.ioid.iolet);
+    if(!ServerDataLink::IsApplicable(from, to)) continue;
+    auto from_synth = synth_ids.find(conn.first.module.get());
+    auto to_synth = synth_ids.find(conn.second.ioid.module.get());
+    if(from_synth == synth_ids.end() || to_synth == synth_ids.end()) continue;
+
+    int bus = GetParamBus(conn.first.module.get(), from->templ->bus);
+    if(conn.second.mode == Canvas::DataConnectionMode::Relative){
+      int outbus = next_control_bus++;
+      lo::Message& scmd = Command(0.0f, "/s_new");
+      scmd.add_string("aa/builtin/datamap");
+      scmd.add_int32(next_node_id++);
+      scmd.add_int32(3); // addAfter
+      scmd.add_int32(from_synth->second);
+      scmd.add_string("in");   scmd.add_int32(bus);
+      scmd.add_string("out");  scmd.add_int32(outbus);
+      scmd.add_string("smin"); scmd.add_float(from->GetRangeMin());
+      scmd.add_string("smax"); scmd.add_float(from->GetRangeMax());
+      scmd.add_string("slog"); scmd.add_int32(from->templ->scale == ParamTemplate::ParamScale::Logarithmic);
+      scmd.add_string("tmin"); scmd.add_float(to->GetRangeMin());
+      scmd.add_string("tmax"); scmd.add_float(to->GetRangeMax());
+      scmd.add_string("tlog"); scmd.add_int32(to->templ->scale == ParamTemplate::ParamScale::Logarithmic);
+      bus = outbus;
+    }
+    lo::Message& mcmd = Command(0.0f, "/n_map");
+    mcmd.add_int32(to_synth->second);
+    mcmd.add_string(to->id.str());
+    mcmd.add_int32(bus);
+  }
+  for(const auto& m : c->modules){
+    auto subpatch = std::dynamic_pointer_cast<Builtin::Subpatch>(m);
+    if(subpatch && subpatch->GetInternalCanvas())
+      AddDataLinks(subpatch->GetInternalCanvas());
+  }
+}
+
+LateReturn<> NRTRender::Render(const Options& options){
+  Relay<> r;
+  if(!Config::Global().use_sc || !SCLang::ready){
+    r.LateThrow<Exceptions::NRTRender>("Cannot render offline, SuperCollider is not running.");
+    return r;
+  }
+  if(options.output_path == ""){
+    r.LateThrow<Exceptions::NRTRender>("Cannot render offline, no output file was specified.");
+    return r;
+  }
+  BuildScore();
+  std::cout << "Rendering " << options.duration << "s to " << options.output_path << " (" << score.size() << " score commands)." << std::endl;
+
+  SCLang::SendOSC("/algaudioSC/nrtbegin");
+  for(const lo::Message& cmd : score)
+    SCLang::SendOSCCustom("/algaudioSC/nrtcmd", cmd);
+  score.clear();
+
+  int channels = (options.channels > 0) ? options.channels : Config::Global().output_channels;
+  // Keep the default number of audio buses, unless the canvas needs more.
+  int audio_buses = std::max(1024, next_audio_bus);
+  lo::Message m;
+  m.add_string(options.output_path);
+  m.add_float(options.duration);
+  m.add_int32(options.sample_rate);
+  m.add_int32(channels);
+  m.add_int32(Config::Global().input_channels);
+  m.add_int32(audio_buses);
+  m.add_int32(std::max(4096, next_control_bus));
+  SCLang::SendOSCCustomWithReply<int>("/algaudioSC/nrtrender", m).Then([r](int success){
+    if(success) r.Return();
+    else r.LateThrow<Exceptions::NRTRender>("scsynth failed to render the score.");
+  });
+  return r;
+}
+
+} // namespace AlgAudio
@@ -90,6 +90,32 @@ void OSC::Send(std::string a, std::function<void(lo::Message)> reply_action, lo:
   addr.send(a,m);
 }
 
+void OSC::SendBundle(const std::vector<std::pair<std::string, lo::Message>>& messages){
+  // A bundle starts with "#bundle" and a time tag, and each element is
+  // preceded by its size.
+  const size_t header_size = 16;
+  // The element size, the message, and the id to be appended: its value and
+  // possibly another 4 bytes of type tags.
+  auto element_size = [](const std::pair<std::string, lo::Message>& p) -> size_t{
+    return 4 + p.second.length(p.first) + 8;
+  };
+  auto it = messages.begin();
+  while(it != messages.end()){
+    lo::Bundle bundle;
+    size_t size = header_size;
+    // Each bundle gets at least one message, even if it is too large.
+    do{
+      size += element_size(*it);
+      auto p = *it;
+      msg_id++;
+      p.second.add_int32(msg_id);
+      bundle.add(p.first, p.second);
+      it++;
+    }while(it != messages.end() && size + element_size(*it) <= max_bundle_size);
+    addr.send(bundle);
+  }
+}
+
 void OSC::TriggerReplies(){
   osc_mutex.lock();
   for(auto& r : replies_to_call) r();
@@ -20,7 +20,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "ParamController.hpp"
 #include "SCLang.hpp"
 #include "Module.hpp"
-#include <unordered_set>
+#include <algorithm>
 
 namespace AlgAudio{
 
@@ -33,59 +33,118 @@ std::shared_ptr<ParamController> ParamController::Create(std::shared_ptr<Module>
   return std::shared_ptr<ParamController>(new ParamController(m,templ));
 }
 
+bool ParamController::inside_tick = false;
+const ParamController* ParamController::tick_origin = nullptr;
+bool ParamController::reporting = false;
+unsigned long ParamController::pending_counter = 0;
+std::set<ParamController::PendingKey> ParamController::pending_params;
+std::vector<ParamController*> ParamController::committed_params;
+
+ParamController::~ParamController(){
+  if(pending) pending_params.erase(pending_key);
+  if(committed) committed_params.erase(std::remove(committed_params.begin(), committed_params.end(), this), committed_params.end());
+}
+
 void ParamController::Set(float value){
-  ///@{
-  /** These structures prevent stack overflows when setting one param results
-   *  in setting another. This might lead to loops, and thus setting same
-   *  params endlessly. To prevent this, whenever any param is set, it sets
-   *  inside_set_chain flag, and stores its address in already_set set. If the
-   *  action of any handlers to on_set or after_set results in setting som other
-   *  param, it will add itself to the set. If at any point of such chain the 
-   *  same param would be set again, it will find itself in already_set, and
-   *  will ignore new value.
-   *  Note that these variables are declared static.
-   */
-  static bool inside_set_chain = false;
-  static std::unordered_set<ParamController*> already_set;
-  ///@}
-  
-  bool this_is_set_chain_root = false;
-  if(!inside_set_chain){
-    // Apparently this is the beggining of a set-chain.
-    inside_set_chain = true;
-    this_is_set_chain_root = true;
-    already_set.insert(this);
-  }else{
-    if(already_set.find(this) != already_set.end()) // If already set...
-      return; // IGNORE this Set() to avoid passing  parameter data in a loop!
-    already_set.insert(this);
-  }
-  
+  Set(value, false);
+}
+
+void ParamController::Set(float value, bool on_server_){
+  // Setting a param that was already committed within this tick can only
+  // happen if data connections form a loop. Ignore the new value, this way
+  // each loop is passed at most once.
+  if(committed) return;
+
   if(templ->step > 0.0f){
     value = round(value/templ->step)*templ->step;
   }
   current_val = value;
-  
+  on_server = on_server_;
+
+  if(!pending){
+    pending = true;
+    pending_key = PendingKey(propagation_rank, pending_counter++, this);
+    pending_params.insert(pending_key);
+  }
+
+  if(!inside_tick){
+    tick_origin = reporting ? nullptr : this;
+    RunTick();
+  }
+}
+
+void ParamController::SetReported(float value){
+  reporting = true;
+  try{
+    Set(value);
+  }catch(...){
+    reporting = false;
+    throw;
+  }
+  reporting = false;
+}
+
+void ParamController::RekeyPending(){
+  if(pending_params.empty()) return;
+  std::set<PendingKey> rekeyed;
+  for(const PendingKey& k : pending_params){
+    ParamController* p = std::get<2>(k);
+    // Keep the original counter, so that params of equal rank are still
+    // committed in the order they became pending.
+    p->pending_key = PendingKey(p->propagation_rank, std::get<1>(k), p);
+    rekeyed.insert(p->pending_key);
+  }
+  pending_params.swap(rekeyed);
+}
+
+void ParamController::RunTick(){
+  inside_tick = true;
+  try{
+    while(!pending_params.empty()){
+      ParamController* p = std::get<2>(*pending_params.begin());
+      pending_params.erase(pending_params.begin());
+      p->pending = false;
+      p->committed = true;
+      committed_params.push_back(p);
+      p->Commit();
+    }
+  }catch(...){
+    // Do not leave the tick half-open, otherwise no param could ever be set
+    // again.
+    for(auto& k : pending_params) std::get<2>(k)->pending = false;
+    pending_params.clear();
+    for(ParamController* p : committed_params) p->committed = false;
+    committed_params.clear();
+    inside_tick = false;
+    tick_origin = nullptr;
+    throw;
+  }
+  for(ParamController* p : committed_params) p->committed = false;
+  committed_params.clear();
+  inside_tick = false;
+  tick_origin = nullptr;
+}
+
+void ParamController::Commit(){
+  float value = current_val;
   float relative = GetRelative();
-  on_set.Happen(current_val, relative);
-  
+  on_set.Happen(value, relative);
+
   auto m = module.lock();
   if(m){
     if(templ->action == ParamTemplate::ParamAction::SC){
-      SCLang::SendOSC("/algaudioSC/setparam", "isf", m->sc_id, templ->id.c_str(), value);
+      // While the argument is mapped to a bus, setting it would drop the
+      // mapping.
+      if(server_links == 0 && !on_server)
+        SCLang::SendOSC("/algaudioSC/setparam", "isf", m->sc_id, templ->id.c_str(), value);
     }else if(templ->action == ParamTemplate::ParamAction::Custom){
       m->on_param_set(templ->id, value);
     }else if(templ->action == ParamTemplate::ParamAction::None){
       // NOP
     }
   }
+  on_server = false;
   after_set.Happen(value, relative);
-  
-  if(this_is_set_chain_root){
-    // Cleanup
-    already_set.clear();
-    inside_set_chain = false;
-  }
 }
 
 void ParamController::SetRelative(float q){
@@ -114,6 +173,12 @@ void ParamController::Reset(){
   Set(templ->default_val);
 }
 
+void ParamController::ApplyPreset(const ParamPreset& preset, bool on_server){
+  if(preset.has_min) SetRangeMin(preset.min);
+  if(preset.has_max) SetRangeMax(preset.max);
+  Set(preset.value, on_server);
+}
+
 SendReplyController::SendReplyController(std::shared_ptr<Module> m, std::string i, std::shared_ptr<ParamController> ctrl) : id(i), controller(ctrl), module(m){
 }
 std::shared_ptr<SendReplyController> SendReplyController::Create(std::shared_ptr<Module> m, std::string id, std::shared_ptr<ParamController> ctrl){
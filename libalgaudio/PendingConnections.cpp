@@ -0,0 +1,71 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PendingConnections.hpp"
+
+namespace AlgAudio{
+
+void PendingConnections::AddAudio(int from, Symbol fromiolet, int to, Symbol toiolet){
+  Add({true, from, to, fromiolet, toiolet, Canvas::DataConnectionMode::Absolute, false});
+}
+
+void PendingConnections::AddData(int from, Symbol fromparam, int to, Symbol toparam, Canvas::DataConnectionMode mode){
+  Add({false, from, to, fromparam, toparam, mode, false});
+}
+
+void PendingConnections::Add(Connection c){
+  unsigned int index = connections.size();
+  connections.push_back(c);
+  remaining++;
+  // Both modules may already exist if connections are added late.
+  if(modules.count(c.from) && modules.count(c.to)){
+    Make(connections[index]);
+    return;
+  }
+  by_module.insert({c.from, index});
+  if(c.to != c.from) by_module.insert({c.to, index});
+}
+
+void PendingConnections::ModuleCreated(int saveid, std::shared_ptr<Module> m){
+  modules[saveid] = m;
+  auto range = by_module.equal_range(saveid);
+  for(auto it = range.first; it != range.second; it++){
+    Connection& c = connections[it->second];
+    if(!c.made && modules.count(c.from) && modules.count(c.to)) Make(c);
+  }
+  by_module.erase(range.first, range.second);
+}
+
+void PendingConnections::Make(Connection& c){
+  c.made = true;
+  remaining--;
+  auto cv = canvas.lock();
+  if(!cv) return;
+  try{
+    if(c.audio)
+      cv->Connect({modules[c.from], c.fromid}, {modules[c.to], c.toid});
+    else
+      cv->ConnectData({modules[c.from], c.fromid}, {modules[c.to], c.toid}, c.mode);
+  }catch(Exceptions::Exception ex){
+    // A single broken connection should not prevent loading the rest.
+    std::cout << "WARNING: Failed to restore a connection: " << ex.what() << std::endl;
+  }
+}
+
+} // namespace AlgAudio
@@ -30,6 +30,9 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "ParamController.hpp"
 #include "OSC.hpp"
 #include "Config.hpp"
+#include "MIDI.hpp"
+#include "GraphCompiler.hpp"
+#include "ServerDataLink.hpp"
 
 namespace AlgAudio{
 
@@ -46,6 +49,7 @@ std::unique_ptr<OSC> SCLang::osc;
 
 std::map<std::pair<int,int>, std::weak_ptr<SendReplyController>> SCLang::sendreply_map;
 int SCLang::sendreply_id = 0;
+std::map<int, std::weak_ptr<Module>> SCLang::silencegate_map;
 
 void SCLang::Start(){
   if(ready) return;
@@ -95,7 +99,9 @@ void SCLang::Start(){
       osc = std::make_unique<OSC>("localhost", port);
       osc->AddMethodHandler("/algaudio/midiin", ProcessMIDIInput);
       osc->AddMethodHandler("/algaudio/sendreply", [](lo::Message msg){SendReplyCatcher(msg.argv()[0]->i32, msg.argv()[1]->i32, msg.argv()[2]->f); });
-      SendOSCWithEmptyReply("/algaudioSC/hello").Then([](){
+      osc->AddMethodHandler("/algaudio/silencegate", [](lo::Message msg){SilenceGateCatcher(msg.argv()[0]->i32, msg.argv()[1]->i32 != 0); });
+      // Ask sclang to listen for MIDI only if we do not receive it natively.
+      SendOSCWithEmptyReply("/algaudioSC/hello", "i", MIDI::IsNativeActive() ? 0 : 1).Then([](){
         on_start_progress.Happen(5,"Booting server...");
         BootServer();
         on_server_started.SubscribeOnce([&](bool success){
@@ -121,6 +127,8 @@ void SCLang::Restart(){
 }
 void SCLang::Stop(){
   ready = false;
+  FusedChain::ForgetInstalledSynthDefs();
+  ServerDataLink::ReleasePending();
   subprocess.reset(); // Resets the unique_ptr, not the process.
   osc.reset();
 }
@@ -137,6 +145,11 @@ void SCLang::SendOSCCustom(const std::string& path, const lo::Message& m){
   if(!osc) {std::cout << "WARNING: Failed to send OSC message to server, OSC not ready" << std::endl; return;}// throw Exceptions::SCLangException("Failed to send OSC message to server, OSC not yet ready");
   osc->Send(path,m);
 }
+void SCLang::SendOSCBundle(const std::vector<std::pair<std::string, lo::Message>>& messages){
+  if(!Config::Global().use_sc) return;
+  if(!osc) {std::cout << "WARNING: Failed to send OSC bundle to server, OSC not ready" << std::endl; return;}
+  osc->SendBundle(messages);
+}
 LateReturn<lo::Message> SCLang::SendOSCWithLOReply(const std::string& path){
   Relay<lo::Message> r;
   if(!Config::Global().use_sc) return r;
@@ -212,6 +225,8 @@ void SCLang::QueryAllNodes(){
 }
 void SCLang::BootServer(){
 
+  FusedChain::ForgetInstalledSynthDefs();
+  ServerDataLink::ReleasePending();
   const Config& c = Config::Global();
   SendOSCWithReply<int>("/algaudioSC/boothelper", "siiiii",
     c.scsynth_audio_driver_name.c_str(),
@@ -266,6 +281,22 @@ void SCLang::UnregisterSendReply(int synth_id, int reply_id){
   sendreply_map.erase(it);
 }
 
+void SCLang::SilenceGateCatcher(int synth_id, bool silent){
+  auto it = silencegate_map.find(synth_id);
+  if(it == silencegate_map.end()) return; // The module was removed meanwhile.
+  auto m = it->second.lock();
+  if(!m) return;
+  m->SetSuspended(silent);
+}
+
+void SCLang::RegisterSilenceGate(int synth_id, std::weak_ptr<Module> m){
+  silencegate_map[synth_id] = m;
+}
+
+void SCLang::UnregisterSilenceGate(int synth_id){
+  silencegate_map.erase(synth_id);
+}
+
 void SCLang::ProcessMIDIInput(lo::Message msg){
   MidiMessage m;
   int t = msg.argv()[0]->i32;
@@ -291,7 +322,8 @@ void SCLang::ProcessMIDIInput(lo::Message msg){
     std::cout << "WARNING: Unsupported MIDI message received." << std::endl;
     return;
   }
-  on_midi_message_received.Happen(m);
+  m.timestamp = MIDI::Now();
+  MIDI::Dispatch(m);
   return;
 }
 
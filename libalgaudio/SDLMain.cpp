@@ -21,6 +21,8 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include "SCLang.hpp"
 #include "Timer.hpp"
+#include "MIDI.hpp"
+#include "Headless.hpp"
 
 namespace AlgAudio{
 
@@ -31,6 +33,7 @@ int SDLMain::last_draw_time = -1000000;
 std::atomic<int> SDLMain::notify_event_id;
 std::atomic_flag SDLMain::ev_flag_notify_osc_already_pushed = ATOMIC_FLAG_INIT;
 std::atomic_flag SDLMain::ev_flag_notify_subprocess_already_pushed = ATOMIC_FLAG_INIT;
+std::atomic_flag SDLMain::ev_flag_notify_midi_already_pushed = ATOMIC_FLAG_INIT;
 
 void SDLMain::Init(){
   notify_event_id = SDL_RegisterEvents(1);
@@ -76,15 +79,7 @@ void SDLMain::ProcessEvent(const SDL_Event& ev){
   }
 
   if(ev.type == (unsigned int)notify_event_id){
-    if(ev.user.code == NOTIFY_SUBPROCESS){
-      ev_flag_notify_subprocess_already_pushed.clear();
-      SCLang::PollSubprocess();
-    }else if(ev.user.code == NOTIFY_OSC){
-      ev_flag_notify_osc_already_pushed.clear();
-      SCLang::PollOSC();
-    }else if(ev.user.code == NOTIFY_TIMER){
-      Timer::Trigger(ev.user.data1);
-    }
+    ProcessNotification(ev.user.code, ev.user.data1);
     return;
   }
 
@@ -131,10 +126,30 @@ void SDLMain::ProcessEvent(const SDL_Event& ev){
   }
 }
 
+void SDLMain::ProcessNotification(int code, void* data){
+  if(code == NOTIFY_SUBPROCESS){
+    ev_flag_notify_subprocess_already_pushed.clear();
+    SCLang::PollSubprocess();
+  }else if(code == NOTIFY_OSC){
+    ev_flag_notify_osc_already_pushed.clear();
+    SCLang::PollOSC();
+  }else if(code == NOTIFY_TIMER){
+    Timer::Trigger(data);
+  }else if(code == NOTIFY_MIDI){
+    ev_flag_notify_midi_already_pushed.clear();
+    MIDI::Deliver();
+  }
+}
+
 void SDLMain::PushNotifySubprocessEvent(){
   // Do not push another notify event to the queue, is one is already present.
   if(ev_flag_notify_subprocess_already_pushed.test_and_set()) return;
 
+  if(Headless::IsActive()){
+    Headless::Post(NOTIFY_SUBPROCESS, nullptr);
+    return;
+  }
+
   SDL_Event event;
   SDL_zero(event);
   event.type = notify_event_id;
@@ -147,6 +162,11 @@ void SDLMain::PushNotifyOSCEvent(){
   // Do not push another notify event to the queue, is one is already present.
   if(ev_flag_notify_osc_already_pushed.test_and_set()) return;
 
+  if(Headless::IsActive()){
+    Headless::Post(NOTIFY_OSC, nullptr);
+    return;
+  }
+
   SDL_Event event;
   SDL_zero(event);
   event.type = notify_event_id;
@@ -155,6 +175,23 @@ void SDLMain::PushNotifyOSCEvent(){
   event.user.data2 = nullptr;
   SDL_PushEvent(&event);
 }
+void SDLMain::PushNotifyMIDIEvent(){
+  // Do not push another notify event to the queue, is one is already present.
+  if(ev_flag_notify_midi_already_pushed.test_and_set()) return;
+
+  if(Headless::IsActive()){
+    Headless::Post(NOTIFY_MIDI, nullptr);
+    return;
+  }
+
+  SDL_Event event;
+  SDL_zero(event);
+  event.type = notify_event_id;
+  event.user.code = NOTIFY_MIDI;
+  event.user.data1 = nullptr;
+  event.user.data2 = nullptr;
+  SDL_PushEvent(&event);
+}
 
 void SDLMain::Quit(){
   running = false;
@@ -0,0 +1,116 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ServerDataLink.hpp"
+#include "ParamController.hpp"
+#include "Module.hpp"
+#include "SCLang.hpp"
+#include "Config.hpp"
+
+namespace AlgAudio{
+
+std::set<ServerDataLink*> ServerDataLink::pending;
+
+ServerDataLink::ServerDataLink(std::shared_ptr<ParamController> to) : target(to){
+  // Stop sending values to the target right away, a /setparam that reaches
+  // SC after the mapping would undo it.
+  to->server_links++;
+  holds_target = true;
+  pending.insert(this);
+}
+
+bool ServerDataLink::IsApplicable(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to){
+  if(!Config::Global().use_sc) return false;
+  if(!from || !to) return false;
+  if(from->templ->bus == "") return false;
+  if(to->templ->action != ParamTemplate::ParamAction::SC) return false;
+  auto fm = from->GetModule(), tm = to->GetModule();
+  if(!fm || !tm || fm->sc_id < 0 || tm->sc_id < 0) return false;
+  return true;
+}
+
+LateReturn<std::shared_ptr<ServerDataLink>> ServerDataLink::Create(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to, bool relative){
+  Relay<std::shared_ptr<ServerDataLink>> r;
+  lo::Message m;
+  m.add_int32(from->GetModule()->sc_id);
+  m.add_string(from->templ->bus);
+  m.add_int32(to->GetModule()->sc_id);
+  m.add_string(to->templ->id.str());
+  m.add_int32(relative ? 1 : 0);
+  auto res = std::shared_ptr<ServerDataLink>( new ServerDataLink(to) );
+  SCLang::SendOSCCustomWithReply<int>("/algaudioSC/newdatalink", m).Then([=](int id){
+    res->id = id;
+    pending.erase(res.get());
+    if(!res->holds_target){
+      // The server was restarted meanwhile, this link is stale.
+      return;
+    }
+    if(relative){
+      res->SendRanges(from, to);
+      // Keep the scaling synth up to date with the ranges.
+      std::weak_ptr<ParamController> wfrom = from, wto = to;
+      auto update = [res = res.get(), wfrom, wto](float){
+        auto f = wfrom.lock(); auto t = wto.lock();
+        if(f && t) res->SendRanges(f, t);
+      };
+      res->subscriptions += from->on_range_min_set.Subscribe(update);
+      res->subscriptions += from->on_range_max_set.Subscribe(update);
+      res->subscriptions += to->on_range_min_set.Subscribe(update);
+      res->subscriptions += to->on_range_max_set.Subscribe(update);
+    }
+    r.Return(res);
+  });
+  return r;
+}
+
+void ServerDataLink::SendRanges(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to){
+  lo::Message m;
+  m.add_int32(id);
+  m.add_string("smin"); m.add_float(from->GetRangeMin());
+  m.add_string("smax"); m.add_float(from->GetRangeMax());
+  m.add_string("slog"); m.add_int32(from->templ->scale == ParamTemplate::ParamScale::Logarithmic);
+  m.add_string("tmin"); m.add_float(to->GetRangeMin());
+  m.add_string("tmax"); m.add_float(to->GetRangeMax());
+  m.add_string("tlog"); m.add_int32(to->templ->scale == ParamTemplate::ParamScale::Logarithmic);
+  SCLang::SendOSCCustom("/algaudioSC/setdatalink", m);
+}
+
+ServerDataLink::~ServerDataLink(){
+  pending.erase(this);
+  if(id >= 0) SCLang::SendOSC("/algaudioSC/removedatalink", "i", id);
+  ReleaseTarget(true);
+}
+
+void ServerDataLink::ReleaseTarget(bool restore){
+  if(!holds_target) return;
+  holds_target = false;
+  auto t = target.lock();
+  if(t && --t->server_links == 0 && restore){
+    // The argument is unmapped now, restore the value the client knows.
+    auto m = t->GetModule();
+    if(m) SCLang::SendOSC("/algaudioSC/setparam", "isf", m->sc_id, t->templ->id.c_str(), t->Get());
+  }
+}
+
+void ServerDataLink::ReleasePending(){
+  // The instances of the targets are gone together with the server.
+  for(ServerDataLink* link : pending) link->ReleaseTarget(false);
+  pending.clear();
+}
+
+} // namespace AlgAudio
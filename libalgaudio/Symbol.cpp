@@ -0,0 +1,41 @@
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Symbol.hpp"
+
+namespace AlgAudio{
+
+std::deque<std::string>& Symbol::Table(){
+  // Constructed on first use, so that Symbols may be safely created during
+  // static initialization. Index 0 is reserved for the empty string. A deque
+  // is used, so that references returned by str() stay valid as it grows.
+  static std::deque<std::string> table{""};
+  return table;
+}
+
+unsigned int Symbol::Intern(const std::string& s){
+  static std::unordered_map<std::string, unsigned int> ids{{"", 0}};
+  auto it = ids.find(s);
+  if(it != ids.end()) return it->second;
+  unsigned int id = Table().size();
+  Table().push_back(s);
+  ids[s] = id;
+  return id;
+}
+
+} // namespace AlgAudio
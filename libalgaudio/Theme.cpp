@@ -43,6 +43,7 @@ void Theme::Init(){
   thememap["selector-button-highlight"] = Color(0x415a8aff);
 
   thememap["standardbox-bg"] = Color(0x3e4f6cff);
+  thememap["standardbox-bg-idle"] = Color(0x36445cff);
   thememap["standardbox-border"] = Color(0x293b53ff);
   // thememap["standardbox-caption"] = Color(0x94acccff); // Whiteish blue
   thememap["standardbox-caption"] = Color(0x070a0eff); // Blueish black
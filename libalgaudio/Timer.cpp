@@ -20,6 +20,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "Timer.hpp"
 #include <SDL2/SDL.h>
 #include "SDLMain.hpp"
+#include "Headless.hpp"
 
 namespace AlgAudio{
   
@@ -48,7 +49,10 @@ static unsigned int timer_callback_repeat(unsigned int interval, void* param){
 TimerHandle Timer::Schedule(float seconds, std::function<void()> f){
   int* id = new int(counter++);
   awaiting_callbacks[*id] = f;
-  SDL_AddTimer(seconds*1000.0f, timer_callback_once, id);
+  if(Headless::IsActive())
+    Headless::ScheduleTimer(seconds, id);
+  else
+    SDL_AddTimer(seconds*1000.0f, timer_callback_once, id);
   return TimerHandle(*id);
 }
 
@@ -26,6 +26,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <iomanip>
 #include <unordered_map>
 #include <clocale>
+#include <limits>
 #ifdef __unix__
   #include <unistd.h>
   #include <cstdlib>
@@ -189,6 +190,13 @@ Point2D Utilities::Align(HorizAlignment h, VertAlignment v, Size2D inner, Size2D
 
 }
 
+std::string Utilities::FloatToString(float val){
+  std::ostringstream ss;
+  ss.imbue(std::locale::classic());
+  ss << std::setprecision(std::numeric_limits<float>::max_digits10) << val;
+  return ss.str();
+}
+
 std::string Utilities::PrettyFloat(float val){
   std::stringstream ss;
   //std::cout << "Float to prettify: " << val << std::endl;
@@ -22,6 +22,10 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <array>
 
 namespace AlgAudio{
+
+class CanvasXML;
+class CanvasBinary;
+
 namespace Builtin{
   
 class SubpatchEntrance;
@@ -35,6 +39,14 @@ public:
   void state_store_xml(rapidxml::xml_node<char>*) const override;
   void state_load_xml(rapidxml::xml_node<char>*) override;
   
+  // Replaces the internal canvas with a new one built from the given
+  // definition. Used when several subpatches share a single definition.
+  void LoadFromDefinition(std::shared_ptr<CanvasXML> def);
+  void LoadFromDefinition(std::shared_ptr<CanvasBinary> def);
+  // Latereturns once the internal canvas is fully built, immediately unless
+  // a definition is being loaded.
+  LateReturn<> WhenLoaded();
+  
   // Marks the given entrance as an entrance to this subpatch. If buses
   // are ready, it applies their ids to the entrance. If buses are not
   // ready, the ids will be applied as soon as the buses are ready.
@@ -42,13 +54,35 @@ public:
   void LinkToExit(std::shared_ptr<SubpatchExit>);
   bool HasEntrance() const {return entrance != nullptr;};
   bool HasExit() const {return exit != nullptr;};
+  std::shared_ptr<SubpatchExit> GetExit() const {return exit;}
+  std::shared_ptr<Canvas> GetInternalCanvas() const {return internal_canvas;}
   
   void LinkOutput(int output_no, int busid);
   
   // Used for ordering calculation. TODO: Move to an interface imlpemented by both subpatch and poly.
   int GetGroupID() const;
+  // A flattened subpatch does not copy signal across its boundary. Modules
+  // connected to subpatch inlets write directly to whatever the entrance is
+  // connected to, and modules connected to the exit write directly to
+  // whatever the subpatch outlets are connected to. Internal modules are
+  // ordered within the parent canvas instead of as a separate group, and the
+  // copying synths of the subpatch and the entrance are paused.
+  void SetFlattened(bool);
+  bool IsFlattened() const {return flattened;}
 private:
+  bool flattened = false;
+  template <typename Definition>
+  void ApplyDefinition(std::shared_ptr<Definition> def);
+  // Sets up bus redirects and pauses or resumes the copying synths.
+  void ApplyFlattening();
+  // Reapplies flattening and refreshes connections and ordering of the whole
+  // flattened hierarchy.
+  void UpdateFlattening();
   std::shared_ptr<Canvas> internal_canvas;
+  // The number of definitions being loaded, and relays waiting for them.
+  int loading = 0;
+  std::vector<Relay<>> load_waiters;
+  void FinishLoading();
   std::shared_ptr<SubpatchEntrance> entrance;
   std::shared_ptr<SubpatchExit> exit;
 };
@@ -21,11 +21,21 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <memory>
 #include <set>
+#include <map>
+#include <vector>
+#include <unordered_map>
 #include "Module.hpp"
 #include "Utilities.hpp"
+#include "ServerDataLink.hpp"
+#include "CanvasGraph.hpp"
 
 namespace AlgAudio{
 
+namespace Builtin{
+  class Subpatch;
+}
+class FusedChain;
+
 namespace Exceptions{
 struct MultipleConnections : public Exception{
   MultipleConnections(std::string t) : Exception(t) {}
@@ -36,6 +46,9 @@ struct ConnectionLoop : public Exception{
 struct DoubleConnection : public Exception{
   DoubleConnection(std::string t) : Exception(t) {}
 };
+struct ChannelMismatch : public Exception{
+  ChannelMismatch(std::string t) : Exception(t) {}
+};
 } // namespace Exceptions
 
 /** A Canvas represents a collection of interconnected modules. The Canvas
@@ -68,11 +81,32 @@ public:
    *  This is the proper way of adding new modules.
    */
   LateReturn<std::shared_ptr<Module>> CreateModule(std::string id);
+  /** Places an already created module instance onto this Canvas.
+   *  CreateModule does this automatically, this method is useful when the
+   *  instance is created manually, e.g. when loading a file. */
+  void InsertModule(std::shared_ptr<Module>);
+  /** Happens whenever a module is placed onto this canvas. Lets views show
+   *  modules of a patch while it is still being loaded. */
+  Signal<std::shared_ptr<Module>> on_module_inserted;
   /** Removes a particular module instance from the Canvas. */
   void RemoveModule(std::shared_ptr<Module>);
 
-  /** The set of all modules that are placed onto (and maintained by) this Canvas. */
+  /** The set of all modules that are placed onto (and maintained by) this
+   *  Canvas. Do not modify it directly, use InsertModule and RemoveModule. */
   std::set<std::shared_ptr<Module>> modules;
+  /** Returns all modules in the order their synths are placed on the server,
+   *  so that every module comes after all modules it receives audio from. */
+  std::vector<std::shared_ptr<Module>> GetModulesInOrder() const;
+
+  /** If this canvas belongs to a flattened subpatch, returns the canvas its
+   *  modules are actually ordered in, i.e. the nearest ancestor that does not
+   *  belong to a flattened subpatch. Otherwise returns this canvas.
+   *  \see Builtin::Subpatch::SetFlattened */
+  std::shared_ptr<Canvas> GetFlatteningRoot();
+  /** Sends the connections of outlets in this canvas, and in all flattened
+   *  subpatches within, to SC again, as a single bundle. Needed when bus
+   *  redirects change. Only outlets whose target buses changed are sent. */
+  void RefreshFlattenedConnections();
 
   /** It this canvas is managed by a module, it should set this pointer to itself,
    *  so that everyone else can easlily can tell who owns this module. */
@@ -84,7 +118,7 @@ public:
    */
   struct IOID{
     std::shared_ptr<Module> module;
-    std::string iolet;
+    Symbol iolet;
     bool operator<(const IOID& other) const {return (module==other.module)?(iolet<other.iolet):(module<other.module);}
     bool operator==(const IOID& other) const {return (module==other.module)?(iolet==other.iolet):false;}
   };
@@ -109,20 +143,23 @@ public:
    *  the outlets of the module given as argument. */
   std::list<std::shared_ptr<Module>> GetConnectedModules(std::shared_ptr<Module> m);
 
-  /**  Updates SC server synth ordering. Calculates a topological ordering for
-   *  the graph of interconnections, and sends the result to SC so that it can
-   *  reorder synths. */
+  /**  Updates SC server synth ordering. Sends the complete topological
+   *  ordering of modules to SC so that it can reorder synths. The ordering
+   *  itself is maintained incrementally as connections are added, so this
+   *  call does not need to sort the graph. */
   void RecalculateOrder();
   /** If set to true, no synth reordering will happen from now on. When set to
    *  false, synths will be topologically reordered immediatelly, and then after
    *  each new connection. This is useful if you are performing a lot of new
    *  connections at once, for example when loading a save file, and wish to
-   *  avoid unnecesary order calculations after each of them.
+   *  avoid sending partial reorderings to SC after each of them.
    *  \see RecalculateOrder */
   void BlockReordering(bool enable);
   
-  /*The list of all audio connections "from-to", in the format of one-to-many. */
-  std::map<IOID, std::list<IOID>> audio_connections;
+  /** Returns the list of all audio connections, as "from-to" pairs. This
+   *  builds a new list, code that runs often (e.g. drawing) should rather
+   *  walk GetGraph() directly. */
+  std::vector<std::pair<IOID, IOID>> GetAudioConnections() const;
   
   // === DATA CONNECTIONS ====
   
@@ -151,8 +188,160 @@ public:
     mutable DataConnectionMode mode;
     bool operator==(const IOIDWithMode& other) const {return ioid == other.ioid; /* Ignore modes for comparison. */}
   };
-  /** The list of all data connections. */
-  std::map<IOID, std::list<IOIDWithMode>> data_connections;
+  /** Returns the list of all data connections, as "from-to" pairs. \see
+   *  GetAudioConnections */
+  std::vector<std::pair<IOID, IOIDWithMode>> GetDataConnections() const;
+
+  // === EDITS ====
+
+  /** Describes a single change to the structure of a canvas, or to the
+   *  params of its modules. */
+  struct Edit{
+    enum class Type{
+      /** The inserted module is stored in module. */
+      ModuleInserted,
+      /** The removed module is stored in module. Its connections were
+       *  reported as removed before. */
+      ModuleRemoved,
+      Connected,
+      Disconnected,
+      DataConnected,
+      DataDisconnected,
+      /** An input param of module was set directly, not through a data
+       *  connection nor by SC. Its id is stored in from.iolet, and the new
+       *  value in value. */
+      ParamSet,
+      /** The range of a param of module was changed. Its id is stored in
+       *  from.iolet. */
+      ParamRangeSet,
+    };
+    Type type;
+    /** The canvas that was changed. */
+    const Canvas* canvas;
+    std::shared_ptr<Module> module;
+    IOID from;
+    IOID to;
+    DataConnectionMode mode;
+    float value = 0.0f;
+  };
+  /** Happens after each structural change to this canvas, and to any of the
+   *  canvases nested within it. Lets observers (such as the autosave
+   *  Journal) follow the changes without rebuilding the whole patch. */
+  Signal<Edit> on_edit;
+
+  // === GRAPH ====
+
+  /** Provides read-only access to the graph of modules and connections.
+   *  Data connection edges are tagged with their DataConnectionMode. */
+  const CanvasGraph& GetGraph() const {return graph;}
+
+  // === PAUSING ====
+
+  /** Returns true if the SC instance of the given module is paused, because
+   *  its output cannot reach any sink. \see UpdatePausing */
+  bool IsPaused(std::shared_ptr<Module> m) const;
+  /** Finds all modules that can reach a sink through audio or data
+   *  connections, and pauses the SC instances of all other modules, resuming
+   *  the ones that have become reachable. Sinks are modules whose template is
+   *  marked as a sink, modules that shall keep running (see
+   *  Module::RunPolicy), subpatches whose entrance leads to a sink inside,
+   *  and subpatch exits of subpatches that are live in the parent canvas.
+   *  Changes of liveness are passed to the parent and internal canvases of
+   *  subpatches as needed. Edits of a single module or
+   *  connection use UpdatePausingAround instead, this full walk is only
+   *  needed after a batch of edits or a configuration change. */
+  void UpdatePausing();
+  /** Updates pausing after the run policy of the given module has changed.
+   *  \see Module::SetRunPolicy */
+  void UpdateRunPolicy(std::shared_ptr<Module> m);
+  /** Returns true if the given module can reach a sink. Modules on other
+   *  canvases, and modules whose liveness is not known yet, are considered
+   *  live. */
+  bool IsLive(const std::shared_ptr<Module>& m) const;
+
+  // === BUS SHARING ====
+
+  /** Assigns buses to inlets so that inlets whose signals are never live at
+   *  the same time read the same bus. An inlet's signal is live from the
+   *  first module that writes to it to the module that reads it, according
+   *  to the topological order. Buses are assigned with linear scan register
+   *  allocation, using the buses owned by inlets as registers, so that fewer
+   *  buses are touched during each block. A shared bus is cleared after each
+   *  reader, except for the last one in the order, so that the next writer
+   *  starts from silence. Inlets of paused, fused or custom modules, and all
+   *  inlets on canvases involved in flattening, keep their own buses. This
+   *  is called automatically whenever the order or pausing changes. */
+  void UpdateBusSharing();
+
+  // === COMPILING ====
+
+  /** Fuses all chains of plain SC modules on this canvas into single synths.
+   *  Any previously fused chains are released first. Changing connections
+   *  of a fused module releases its chain, so this needs to be called again
+   *  after editing. \see GraphCompiler */
+  LateReturn<> Compile();
+  /** Reverts all fused chains to individual module synths. */
+  void Decompile();
+
+  // === TRANSACTIONS ====
+
+  /** A batch of edits applied to a Canvas at once. Operations are only
+   *  recorded until Commit() is called. Committing applies them all, checks
+   *  the graph for loops once, computes a single new order, and sends all
+   *  resulting changes to SC in a single OSC bundle. If any operation fails,
+   *  all operations applied so far are reverted, nothing is sent to SC, and
+   *  the exception is passed to the caller.
+   *
+   *  Modules are removed only after everything else succeeded, as a
+   *  destroyed module instance cannot be restored.
+   *  \code
+   *    Canvas::Transaction t(canvas);
+   *    for(auto& m : selected) t.RemoveModule(m);
+   *    t.Commit();
+   *  \endcode */
+  class Transaction{
+  public:
+    /** A single recorded edit. */
+    struct Operation{
+      enum class Type{
+        Connect,
+        Disconnect,
+        ConnectData,
+        DisconnectData,
+        /** The module to remove is stored in from.module. */
+        RemoveModule,
+      };
+      Type type;
+      IOID from;
+      IOID to;
+      DataConnectionMode mode;
+    };
+    Transaction(std::shared_ptr<Canvas> c) : canvas(c) {}
+    void Connect(IOID from, IOID to);
+    void Disconnect(IOID from, IOID to);
+    void ConnectData(IOID from, IOID to, DataConnectionMode m);
+    void DisconnectData(IOID from, IOID to);
+    void RemoveModule(std::shared_ptr<Module> m);
+    /** Applies all recorded operations. A transaction can be committed only
+     *  once. \throws whatever the failed operation has thrown, e.g.
+     *  Exceptions::ConnectionLoop. */
+    void Commit();
+    /** Returns the operations that were actually performed by Commit(), in
+     *  order. Module removals are expanded into the disconnections they
+     *  required. Reverting them in reverse order undoes the transaction,
+     *  apart from module removals, so this journal may back undo. */
+    const std::vector<Operation>& GetJournal() const {return journal;}
+  private:
+    std::shared_ptr<Canvas> canvas;
+    std::vector<Operation> operations;
+    std::vector<Operation> journal;
+    bool committed = false;
+    /** Performs a single operation and records it in the journal, if it
+     *  changed anything. */
+    void Apply(const Operation& op);
+    /** Performs the inverse of an operation. */
+    void Revert(const Operation& op);
+  };
 
 private:
   /** Private constructor. Use CreateEmpty() instead. */
@@ -163,14 +352,178 @@ private:
   
   /** The parent canvas. */
   std::weak_ptr<Canvas> parent;
+  /** Appends connection messages of outlets whose targets changed, in this
+   *  canvas and flattened subpatches within. \see RefreshFlattenedConnections */
+  void CollectChangedConnections(std::vector<std::pair<std::string, lo::Message>>& messages);
+  /** Reports an edit to observers of this canvas and of all its ancestors. */
+  void NotifyEdit(const Edit& e);
+  /** Subscriptions reporting param changes as edits, by module. */
+  std::map<const Module*, SubscriptionList> param_edit_subscriptions;
+  void SubscribeParamEdits(std::shared_ptr<Module> m);
   
   /** The subscriptions for reacting on param value change. */
   std::map<IOID, Subscription> data_connections_subscriptions;
   /** The function that provides the reaction on param value changes,
    *  effectively realizing data connections. */
-  void PassData(IOID source, float value, float relative);
+  void PassData(const ParamController* source, float value, float relative);
+
+  /** A single data connection, with its target already resolved to a
+   *  ParamController. */
+  struct DataEdge{
+    ParamController* target;
+    DataConnectionMode mode;
+  };
+  /** The compiled form of data connections. All edges that start at the same
+   *  source param are stored next to each other, so that passing a value is
+   *  a single copy of a contiguous range, with no string lookups. This
+   *  table is a cache, the graph remains the authoritative description of
+   *  connections. */
+  std::vector<DataEdge> data_edges;
+  /** For each source param, the range [first, last) of its edges in
+   *  data_edges. */
+  std::unordered_map<const ParamController*, std::pair<unsigned int, unsigned int>> data_edge_ranges;
+  /** Set whenever data connections change or a module is inserted, as
+   *  either affects propagation ranks. The compiled table is rebuilt
+   *  lazily, when data is passed for the first time after a change, so that
+   *  adding many connections at once (e.g. when loading a file) does not
+   *  rebuild it each time. */
+  bool data_graph_dirty = true;
+  /** Rebuilds data_edges and data_edge_ranges from the graph. */
+  void CompileDataGraph();
+  /** Updates propagation_rank of all params on this canvas, according to
+   *  the compiled data edges. \see ParamController */
+  void CalculatePropagationRanks();
+
+  /** Data connections which are realized on the SC server. These are
+   *  still present in the graph, but are skipped when compiling the
+   *  data graph, as the client does not need to pass their values. */
+  std::map<std::pair<IOID, IOID>, std::shared_ptr<ServerDataLink>> server_data_links;
+  /** Checks whether the given data connection can be realized on the server,
+   *  and if so, asks SC to create such link. */
+  void TryLinkDataOnServer(IOID from, IOID to, DataConnectionMode m);
   /** \see BlockReordering */
   bool do_not_recalculate_ordering;
+
+  /** The graph of modules and connections. This is the authoritative
+   *  description of all connections on this canvas. */
+  CanvasGraph graph;
+  /** Returns the graph handle of a module, or CanvasGraph::Invalid if the
+   *  module is not on this canvas. */
+  CanvasGraph::ModuleHandle GetHandle(const std::shared_ptr<Module>& m) const {return graph.Find(m.get());}
+
+  /** The topological order of modules, maintained dynamically with the
+   *  Pearce-Kelly algorithm. Each module has a unique position, and every
+   *  audio connection leads from a lower position to a higher one. Positions
+   *  do not have to be contiguous. Indexed by module handle. */
+  std::vector<int> topo_position;
+  /** The same order, indexed by position. */
+  std::map<int, CanvasGraph::ModuleHandle> topo_order;
+  /** The lowest position in use. New modules are placed before it, which
+   *  matches SC, where new synth groups are added to the head. */
+  int topo_head = 0;
+  /** Collects modules reachable from start by audio connections, visiting
+   *  only modules positioned at or before bound. Returns true if target was
+   *  reached, which means that a connection from target to start would close
+   *  a loop. */
+  bool SearchForward(CanvasGraph::ModuleHandle start, CanvasGraph::ModuleHandle target, int bound, std::vector<CanvasGraph::ModuleHandle>& result) const;
+  /** Collects modules from which end is reachable by audio connections,
+   *  visiting only modules positioned at or after bound. */
+  void SearchBackward(CanvasGraph::ModuleHandle end, int bound, std::vector<CanvasGraph::ModuleHandle>& result) const;
+  /** Updates the topological order for a new connection between two modules.
+   *  Only the modules between the two endpoints in the current order are
+   *  ever visited. Modules that had to change their position are stored in
+   *  moved, in their new order. \returns false if the new connection would
+   *  close a loop, in which case the order is left unchanged. */
+  bool UpdateOrderForConnection(CanvasGraph::ModuleHandle from, CanvasGraph::ModuleHandle to, std::vector<CanvasGraph::ModuleHandle>& moved);
+  /** Asks SC to move only the given modules, so that the server order matches
+   *  the topological order again. */
+  void SendOrderChanges(const std::vector<CanvasGraph::ModuleHandle>& moved);
+  /** Returns the SC node ids that represent a module in synth ordering. */
+  static std::vector<int> GetOrderableIDs(const std::shared_ptr<Module>& m);
+  /** Returns the SC node ids of all modules in this canvas, in order. */
+  std::vector<int> GetFlatOrderableIDs() const;
+  /** Returns the owner subpatch of this canvas, if it is flattened, or
+   *  nullptr otherwise. */
+  std::shared_ptr<Builtin::Subpatch> GetFlattenedOwner() const;
+  /** Returns true if connections in this canvas may be affected by bus
+   *  redirects of a flattened subpatch. */
+  bool IsFlatteningInvolved() const;
+  /** The modules of a canvas that belongs to a flattened subpatch are ordered
+   *  by the parent canvas. If that is the case, this asks the parent to
+   *  recalculate the order, and returns true. */
+  bool DelegateOrdering();
+  /** Prepares the complete ordering message. \see RecalculateOrder */
+  lo::Message GetOrderingMessage() const;
+  /** Computes the topological order from scratch, preferring to keep
+   *  modules at their current positions. Used after a batch of edits.
+   *  \throws Exceptions::ConnectionLoop if the graph has a cycle, in which
+   *  case the current order is kept. */
+  void RebuildOrder();
+
+  /** Whether the SC instance of each module is paused, indexed by module
+   *  handle. \see UpdatePausing */
+  std::vector<char> paused;
+  /** Whether each module can reach a sink, indexed by module handle. Only
+   *  valid if live_valid is set, which is not the case after edits that
+   *  were made while updates were suspended. */
+  std::vector<char> live;
+  bool live_valid = false;
+  /** Recomputes liveness of the given modules and of all modules that can
+   *  reach them, which are the only ones that may be affected by a change
+   *  of their outgoing connections or sink status, and sends the resulting
+   *  changes of pausing. Bus sharing is updated if pausing has changed, or
+   *  if audio_changed is set. Falls back to UpdatePausing if the current
+   *  liveness is not known. */
+  void UpdatePausingAround(std::vector<CanvasGraph::ModuleHandle> changed, bool audio_changed);
+  /** Pauses or resumes the given modules according to their liveness,
+   *  sending only the changes. Returns true if anything was changed. */
+  bool SendPausingChanges(const std::vector<CanvasGraph::ModuleHandle>& handles);
+  /** Whether a subpatch entrance on this canvas leads to a sink, not
+   *  counting subpatch exits. This decides whether the subpatch that owns
+   *  this canvas is a sink in its parent canvas. */
+  bool entrance_reaches_sink = false;
+  /** Returns the liveness of the subpatch modules among the given ones,
+   *  or -1 if it is not known. */
+  std::vector<std::pair<CanvasGraph::ModuleHandle, int>> GetSubpatchLiveness(const std::vector<CanvasGraph::ModuleHandle>& handles) const;
+  /** Called after liveness on this canvas was updated. Updates the
+   *  internal canvases of subpatches whose liveness differs from the given
+   *  previous one, as their exits may have stopped or started being sinks,
+   *  and the parent canvas if the owner subpatch stopped or started being
+   *  a sink. */
+  void PassLivenessAcrossSubpatches(const std::vector<std::pair<CanvasGraph::ModuleHandle, int>>& before);
+  /** Chains that currently run as fused synths, by chain number.
+   *  \see Compile */
+  std::map<unsigned int, std::shared_ptr<FusedChain>> fused_chains;
+  /** The chain number of each module that is fused, or is being fused. */
+  std::map<const Module*, unsigned int> fused_modules;
+  unsigned int fused_counter = 0;
+  /** Releases the fused chain that contains the given module, if any. */
+  void DecompileModule(const std::shared_ptr<Module>& m);
+  /** The buses cleared after each module, as last sent to SC, indexed by
+   *  module handle. \see UpdateBusSharing */
+  std::vector<std::vector<int>> bus_clears;
+  /** Returns true if the inlets of the given module may share buses. */
+  bool MayShareBuses(CanvasGraph::ModuleHandle h) const;
+  /** Returns true if the given module keeps all modules it depends on
+   *  running. \see UpdatePausing */
+  static bool IsSink(const std::shared_ptr<Module>& m);
+  /** Returns true if the given module may be paused. Subpatch modules are
+   *  never paused, their state is managed by flattening. */
+  static bool IsPausable(const std::shared_ptr<Module>& m);
+
+  /** While a Transaction is being committed, connection changes are not
+   *  sent to SC immediatelly, and the order is not updated for each of
+   *  them. Instead, the touched outlets are collected, so that their state
+   *  can be sent all at once. */
+  bool in_batch = false;
+  bool batch_order_dirty = false;
+  std::vector<std::shared_ptr<Module::Outlet>> batch_outlets;
+  /** Messages removing instances of modules removed during the batch. */
+  std::vector<std::pair<std::string, lo::Message>> batch_removals;
+  void BeginBatch();
+  /** Ends batch mode. If send is true, sends all collected changes to SC in
+   *  a single bundle. */
+  void EndBatch(bool send);
 };
 
 } // namespace AlgAudio
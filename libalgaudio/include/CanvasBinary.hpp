@@ -0,0 +1,159 @@
+#ifndef CANVASBINARY_HPP
+#define CANVASBINARY_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdint>
+#include "CanvasXML.hpp"
+
+namespace AlgAudio{
+
+namespace Exceptions{
+/** Thrown when a binary patch file is malformed. Derives from XMLParse, so
+ *  that code handling failed loads does not need to care about the format. */
+struct BinaryPatchParse : public XMLParse{
+  BinaryPatchParse(std::string t) : XMLParse(t) {}
+};
+} // namespace Exceptions
+
+/** An alternative, compact container for canvas state. Where CanvasXML keeps
+ *  a text document which has to be parsed, a CanvasBinary is a flat image of
+ *  fixed-size tables: modules, params, audio and data connections, subpatch
+ *  definitions and a string table, which also holds custom state blobs. Files
+ *  are memory-mapped and used in place, so opening a patch involves no
+ *  parsing at all, apart from the custom XML state of modules that have one.
+ *
+ *  Subpatch definitions are stored as nested images within the string table,
+ *  so a subpatch is loaded directly from the parent's mapping as well.
+ *
+ *  Conversion to and from CanvasXML is lossless. Binary files are recognized
+ *  by their contents (see IsBinaryFile()), and by convention use the
+ *  extension returned by Extension().
+ */
+class CanvasBinary : public std::enable_shared_from_this<CanvasBinary>{
+public:
+  /** Memory-maps the file at the given path and creates a new CanvasBinary
+   *  using it. May throw Exceptions::XMLFileAccess or
+   *  Exceptions::BinaryPatchParse. */
+  static std::shared_ptr<CanvasBinary> CreateFromFile(std::string path);
+  /** Converts a CanvasXML document into a binary image. May throw
+   *  Exceptions::XMLParse if the document is malformed. */
+  static std::shared_ptr<CanvasBinary> CreateFromXML(std::shared_ptr<CanvasXML> xml);
+  /** Creates a binary image corresponding to the given canvas' current state. */
+  static std::shared_ptr<CanvasBinary> CreateFromCanvas(std::shared_ptr<Canvas> canvas);
+
+  /** Converts the stored image back to an XML document. */
+  std::shared_ptr<CanvasXML> ToXML() const;
+
+  /** Stores the image in a file. May throw Exceptions::XMLFileAccess. */
+  void SaveToFile(std::string path) const;
+
+  /** Applies the stored state to a given Canvas, just like
+   *  CanvasXML::ApplyToCanvas. May latethrow Exceptions::BinaryPatchParse. */
+  LateReturn<std::shared_ptr<Canvas>> ApplyToCanvas(std::shared_ptr<Canvas> c);
+  /** Creates a new canvas basing on the stored image. */
+  LateReturn<std::shared_ptr<Canvas>> CreateNewCanvas(std::shared_ptr<Canvas> parent);
+
+  /** Returns true if the file at the given path starts with the binary patch
+   *  signature. */
+  static bool IsBinaryFile(std::string path);
+  /** Returns true if the given path has the binary patch extension. */
+  static bool HasBinaryExtension(std::string path);
+  static std::string Extension() {return ".algaudiob";}
+
+  // The on-disk layout. All values are stored in host byte order, and all
+  // records are 4-byte aligned. Offsets are relative to the start of the
+  // image. Every string and blob is followed by a null byte.
+  struct Span{
+    uint32_t offset, count;
+  };
+  struct Header{
+    char magic[4];
+    uint32_t format_version;
+    uint32_t document_version; // Corresponds to the XML version attribute.
+    uint32_t size;
+    Span modules, params, audioconns, dataconns, subpatchdefs, strings;
+  };
+  struct ModuleRecord{
+    int32_t saveid;
+    uint32_t templ; // String index.
+    uint32_t runpolicy; // 0 - not stored, 1 - keeprunning, 2 - allowpausing.
+    uint32_t flags;
+    int32_t x, y;
+    uint32_t first_param, param_count;
+    int32_t customstring, customxml, subpatchdef; // Indices, -1 if not present.
+  };
+  struct ParamRecord{
+    uint32_t id;
+    uint32_t flags;
+    float value, min, max;
+  };
+  struct AudioConnRecord{
+    int32_t from, to;
+    uint32_t fromiolet, toiolet;
+  };
+  struct DataConnRecord{
+    int32_t from, to;
+    uint32_t fromparam, toparam;
+    uint32_t mode; // 0 - absolute, 1 - relative.
+  };
+  struct SubpatchDefRecord{
+    uint32_t id, image; // String indices.
+  };
+  enum ModuleFlags : uint32_t{
+    HasGUI = 1,
+  };
+  enum ParamFlags : uint32_t{
+    HasMin = 1,
+    HasMax = 2,
+  };
+  static const uint32_t FormatVersion = 1;
+
+  ~CanvasBinary();
+private:
+  CanvasBinary();
+  /** Checks that all tables and indices lie within the image. Throws
+   *  Exceptions::BinaryPatchParse otherwise. */
+  void Validate() const;
+  /** Creates a CanvasBinary viewing a nested image of this one. */
+  std::shared_ptr<CanvasBinary> CreateNested(uint32_t string_index) const;
+
+  template <typename T>
+  const T* Table(const Span& s) const {return reinterpret_cast<const T*>(data + s.offset);}
+  const Header& GetHeader() const {return *reinterpret_cast<const Header*>(data);}
+  std::string String(uint32_t index) const;
+  const char* CString(uint32_t index) const;
+
+  /** The memory that holds the image, either a mapping or an owned buffer.
+   *  Nested images share the storage of the outermost one. */
+  std::shared_ptr<void> storage;
+  const char* data = nullptr;
+  size_t size = 0;
+
+  // Subpatch definitions of this image, created on first use.
+  std::map<uint32_t, std::shared_ptr<CanvasBinary>> subpatchdefs;
+
+  /** Helper for creating canvas from image. May latethrow
+   *  Exceptions::BinaryPatchParse in case of problems. */
+  LateReturn<> AddModule(std::shared_ptr<Canvas> c, const ModuleRecord& rec, std::shared_ptr<PendingConnections> pending);
+};
+
+} // namespace AlgAudio
+
+#endif // CANVASBINARY_HPP
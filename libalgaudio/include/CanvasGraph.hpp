@@ -0,0 +1,119 @@
+#ifndef CANVASGRAPH_HPP
+#define CANVASGRAPH_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "Symbol.hpp"
+
+namespace AlgAudio{
+
+class Module;
+
+/** A compact storage for the graph of modules and connections of a Canvas.
+ *  Modules are referred to by integer handles, ports by a module handle and
+ *  the Symbol of the iolet or param. Connections (edges) are kept in
+ *  contiguous arrays, one per field, so that traversing the graph requires
+ *  no reference counting and no string operations.
+ *
+ *  Handles are stable for as long as the module or the edge exists. Slots of
+ *  removed modules and edges are reused, so the handles are always small
+ *  integers and may be used as indices into side tables.
+ *
+ *  This class is only a storage, it does not validate connections. Canvas
+ *  uses it internally, and exposes a shared_ptr-based interface on top of it.
+ *  \see Canvas */
+class CanvasGraph{
+public:
+  typedef unsigned int ModuleHandle;
+  typedef unsigned int EdgeHandle;
+  static const unsigned int Invalid = 0xffffffff;
+
+  enum class EdgeType : unsigned char{
+    /** Marks a free edge slot. */
+    None,
+    Audio,
+    Data,
+  };
+
+  /** Adds a module to the graph and returns its new handle. */
+  ModuleHandle AddModule(std::shared_ptr<Module> m);
+  /** Removes a module from the graph. All edges that start or end at this
+   *  module must have been removed beforehand. */
+  void RemoveModule(ModuleHandle h);
+  /** Returns the handle of the given module, or Invalid if it is not a part
+   *  of this graph. */
+  ModuleHandle Find(const Module* m) const;
+  inline const std::shared_ptr<Module>& GetModule(ModuleHandle h) const {return module_ptr[h];}
+  /** Returns the number of module slots. Valid module handles are always
+   *  lower than this value, but some slots may be empty. */
+  inline unsigned int GetModuleSlots() const {return module_ptr.size();}
+
+  /** Adds a new edge. The tag is a small value which the graph stores
+   *  without interpreting, e.g. the data connection mode. */
+  EdgeHandle AddEdge(EdgeType type, ModuleHandle from, Symbol from_port, ModuleHandle to, Symbol to_port, unsigned char tag = 0);
+  /** Removes an edge, its slot may be reused by a subsequent AddEdge. */
+  void RemoveEdge(EdgeHandle e);
+  /** Returns the handle of an edge of the given type connecting the two
+   *  ports, or Invalid if there is none. The cost is proportional to the
+   *  number of edges starting at the source module. */
+  EdgeHandle FindEdge(EdgeType type, ModuleHandle from, Symbol from_port, ModuleHandle to, Symbol to_port) const;
+  /** Returns the number of edges of the given type starting at a port. */
+  unsigned int CountEdgesFrom(EdgeType type, ModuleHandle from, Symbol from_port) const;
+
+  /** Returns the number of edge slots. Slots with EdgeType::None are free. */
+  inline unsigned int GetEdgeSlots() const {return edge_type.size();}
+  inline EdgeType GetEdgeType(EdgeHandle e) const {return edge_type[e];}
+  inline ModuleHandle GetEdgeFrom(EdgeHandle e) const {return edge_from[e];}
+  inline ModuleHandle GetEdgeTo(EdgeHandle e) const {return edge_to[e];}
+  inline Symbol GetEdgeFromPort(EdgeHandle e) const {return edge_from_port[e];}
+  inline Symbol GetEdgeToPort(EdgeHandle e) const {return edge_to_port[e];}
+  inline unsigned char GetEdgeTag(EdgeHandle e) const {return edge_tag[e];}
+  inline void SetEdgeTag(EdgeHandle e, unsigned char tag) {edge_tag[e] = tag;}
+
+  /** Returns the handles of all edges that start at the given module. */
+  inline const std::vector<EdgeHandle>& GetOutEdges(ModuleHandle h) const {return module_out[h];}
+  /** Returns the handles of all edges that end at the given module. */
+  inline const std::vector<EdgeHandle>& GetInEdges(ModuleHandle h) const {return module_in[h];}
+
+private:
+  // Module slots.
+  std::vector<std::shared_ptr<Module>> module_ptr;
+  std::vector<std::vector<EdgeHandle>> module_out;
+  std::vector<std::vector<EdgeHandle>> module_in;
+  std::vector<ModuleHandle> free_modules;
+  std::unordered_map<const Module*, ModuleHandle> handles;
+
+  // Edge slots.
+  std::vector<EdgeType> edge_type;
+  std::vector<ModuleHandle> edge_from;
+  std::vector<ModuleHandle> edge_to;
+  std::vector<Symbol> edge_from_port;
+  std::vector<Symbol> edge_to_port;
+  std::vector<unsigned char> edge_tag;
+  std::vector<EdgeHandle> free_edges;
+
+  static void RemoveFromList(std::vector<EdgeHandle>& list, EdgeHandle e);
+};
+
+} // namespace AlgAudio
+
+#endif // CANVASGRAPH_HPP
@@ -67,6 +67,14 @@ public:
   /** This method removes the currencly selected modules from both the CanvasView
    *  and the underlying Canvas. */
   void RemoveSelected();
+  /** Switches the run policy of the currently selected modules to the next
+   *  one: default, keep running, allow pausing. All selected modules get the
+   *  policy that follows the one of the first module. \see Module::RunPolicy */
+  void CycleSelectedRunPolicy();
+  /** Arms MIDI-learn for the param of the slider under the mouse pointer, so
+   *  that the next MIDI control moved will be mapped to it. If unmap is set,
+   *  removes the MIDI mapping of that param instead. \see MIDI::Learn */
+  void LearnMIDIAtPointer(bool unmap);
   
   /** Resets a view position to the one at the center of the bounding box that
    *  has al module guis inside. */
@@ -117,6 +125,13 @@ private:
   std::vector<std::shared_ptr<ModuleGUI>> module_guis;
   
   void CreateModuleGUIs();
+  /** Builds a GUI for the given module, with this view as its parent. May
+   *  throw Exceptions::GUIBuild. */
+  std::shared_ptr<ModuleGUI> BuildModuleGUI(std::shared_ptr<Module> m);
+  /** Shows modules placed onto the current canvas by someone else, e.g. while
+   *  a patch is being loaded. */
+  void OnModuleInserted(std::shared_ptr<Module> m);
+  Subscription module_inserted_subscription;
   void ResetUI();
   
   // Used to determine which module was clicked knowing the click position.
@@ -144,9 +159,11 @@ private:
   /** The Widget id of the element corresponding to current mouse_down_mode. */
   UIWidget::ID mouse_down_elem_widgetid;
   /** The iolet/param id of the element coresponding to the current mouse_down_mode. */
-  std::string mouse_down_elem_paramid;
+  Symbol mouse_down_elem_paramid;
   /** The position where mouse was last pressed down. */
   Point2D mouse_down_position, drag_position;
+  /** The last position of the mouse pointer, in relative coordinates. */
+  Point2D pointer_position;
   /** The number of the ModuleGUI mouse press happened over. Note that this
    *  value only represents the position in ModuleGUIs vector. */
   int mouse_down_id = -1;
@@ -216,7 +233,7 @@ private:
    *  drawn on the canvas (bright green), but was not yet created. */
   PotentialWireMode potential_wire = PotentialWireMode::None;
   PotentialWireType potential_wire_type;
-  std::pair<std::pair<int,std::string>, std::pair<int,std::string>> potential_wire_connection;
+  std::pair<std::pair<int,Symbol>, std::pair<int,Symbol>> potential_wire_connection;
   // Animated fadeout of potential wire.
   Subscription fadeout_anim;
   PotentialWireMode fadeout_wire = PotentialWireMode::None;
@@ -25,6 +25,8 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "rapidxml_algaudio.hpp"
 
 namespace AlgAudio{
+
+class PendingConnections;
   
 namespace Exceptions{
 struct XMLFileAccess : public Exception{
@@ -45,6 +47,16 @@ struct XMLParse : public Exception{
  *
  *  To save a Canvas to file, you should create a CanvasXML with
  *  CreateFromCanvas, and then use SaveToFile() member function.
+ *
+ *  Identical subpatches are stored only once per document, as a subpatchdef
+ *  node, and each subpatch instance refers to it by id. When loading, each
+ *  definition is parsed once, and the resulting CanvasXML is applied to all
+ *  subpatches that refer to it.
+ *
+ *  Creating a document from a canvas only captures the canvas state. Finding
+ *  identical subpatches and printing the document are deferred until the
+ *  document is first serialized, which does not access the canvas. This way
+ *  a document may be serialized on another thread.
  */
 class CanvasXML : public std::enable_shared_from_this<CanvasXML>{
 public:
@@ -60,12 +72,15 @@ public:
   static std::shared_ptr<CanvasXML> CreateFromNode(rapidxml::xml_node<>* node);
   /** Creates a new CanvasXML which has data corresponding to the given canvas'
    *  current state. Modifying the Canvas afterwards will not result in any
-   *  changes in the CanvasXML. */
+   *  changes in the CanvasXML. Each module's saveid is updated to the id it
+   *  was stored with. */
   static std::shared_ptr<CanvasXML> CreateFromCanvas(std::shared_ptr<Canvas> canvas);
   
   /** Stores the XML document in a file. \param path The path to file the XML
    *  document shall be saved to. */
   void SaveToFile(std::string path);
+  /** Serializes the stored XML document directly to the given stream. */
+  void WriteTo(std::ostream& out);
   /** Returns the stored XML document as a string. */
   std::string GetXMLAsString();
   
@@ -76,27 +91,31 @@ public:
    *   \param doc  The xml_document the node is in.
    */
   void CloneToAnotherXMLTree(rapidxml::xml_node<>* node, rapidxml::xml_document<>* doc){
+    ShareSubpatchDefinitions();
     rapidxml::clone_node_copying(root, node, doc);
   }
   
   /** Applies the data in stored document to a given Canvas, creating new
    *  modules, setting params, adding connections etc. On success, latereturns
    *  the same canvas pointer. Never returns a nullptr. May latethrow
-   *  Exceptions::XMLParse.
-   *  \warning ApplyToCanvas() is strictly NOT late-reentrant! (it shall not be
-   *  invoked again before the previous call latereturns). */
+   *  Exceptions::XMLParse. The same CanvasXML may be applied to multiple
+   *  canvases at once. This latereturns once the contents of all subpatches
+   *  are loaded, too. */
   LateReturn<std::shared_ptr<Canvas>> ApplyToCanvas(std::shared_ptr<Canvas> c);
   
   /** Creates a new canvas basing on the stored document. Never returns a
-   *  nullptr. May latethrow Exceptions::XMLParse.
-   *  \warning CreateNewCanvas() is strictly NOT late-reentrant! (it shall not
-   *  be invoked again before the previous call latereturns) */
+   *  nullptr. May latethrow Exceptions::XMLParse. */
   LateReturn<std::shared_ptr<Canvas>> CreateNewCanvas(std::shared_ptr<Canvas> parent);
   
   ~CanvasXML();
 private:
+  // Converts between binary images and XML documents.
+  friend class CanvasBinary;
   CanvasXML();
+  /** The document text, if known. A document created from a canvas is only
+   *  serialized when it is saved or requested as a string. */
   std::string doc_text;
+  bool doc_text_valid = false;
   char* input_buffer = nullptr;
   rapidxml::xml_document<> doc;
   rapidxml::xml_node<>* root;
@@ -104,22 +123,34 @@ private:
   // Used temporarily when creating a document from canvas.
   std::map<std::shared_ptr<Module>, int> modules_to_saveids;
   int saveid_counter = 0;
-  // Used temporarily when creating a canvas from document.
-  std::map<int, std::shared_ptr<Module>> saveids_to_modules;
-  
+  /** True if this document was created from a canvas, and its subpatches
+   *  were not yet moved to shared definitions. */
+  bool sharing_pending = false;
+  // Subpatch definitions of this document, parsed on first use.
+  std::map<std::string, std::shared_ptr<CanvasXML>> subpatchdefs;
+  bool subpatchdefs_parsed = false;
+  /** Parses all subpatchdef nodes. May throw Exceptions::XMLParse. */
+  void ParseSubpatchDefinitions();
+  /** Moves the contents of subpatches captured from a canvas to subpatchdef
+   *  nodes, if not done yet. */
+  void ShareSubpatchDefinitions();
+  /** Moves the contents of each subpatch module node under the given root
+   *  (recursively, deepest first) to a subpatchdef node of that root, unless
+   *  an identical one exists, and replaces them with a reference. Subpatches
+   *  are recognized by the "share" mark on their custom xml subtree. */
+  void ShareSubpatchDefinitions(rapidxml::xml_node<>* level);
+
   // Adds data to the xml document.
   void AppendModule(std::shared_ptr<Module>);
   void AppendAudioConnection(Canvas::IOID from, Canvas::IOID to);
   void AppendDataConnection(Canvas::IOID from, Canvas::IOIDWithMode to);
   
   /** Helper for creating canvas from document. May latethrow Exceptions::XMLParse in case of problems. */
-  LateReturn<> AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::xml_node<>* module_node);
-  
-  /** Exports the contents of the doc to doc_text. */
-  void UpdateStringFromDoc();
-  /** Set this flag to true if you are going to call Append* multiple times, to
-   * avoid unnvecessary exports to doc_text after each append. */
-  bool block_string_updates = false;
+  LateReturn<> AddModuleFromNode(std::shared_ptr<Canvas> c, rapidxml::xml_node<>* module_node, int saveid, std::shared_ptr<PendingConnections> pending);
+
+  /** The number of CreateFromCanvas calls in progress, as subpatches save
+   *  their contents from within the parent's save. */
+  static int save_depth;
 };
   
 } // namespace AlgAudio
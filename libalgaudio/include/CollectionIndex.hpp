@@ -0,0 +1,81 @@
+#ifndef COLLECTIONINDEX_HPP
+#define COLLECTIONINDEX_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <memory>
+#include <cstdint>
+#include "ModuleCollection.hpp"
+
+namespace AlgAudio{
+
+/** A binary cache of module collections parsed from a directory, so that
+ *  collection files do not need to be parsed again on each start. It is
+ *  stored in that directory, in a file named CollectionIndex::file_name.
+ *
+ *  Each collection is stored together with the modification time, size and
+ *  hash of its file. A cached collection is only used if its file has the
+ *  same modification time and size, or, if these differ, the same contents
+ *  hash. The whole index is checksummed, and an index which is invalid or
+ *  was written by a different version is ignored.
+ */
+class CollectionIndex{
+public:
+  /** Loads the index from the given directory. A missing or invalid index
+   *  results in an empty one. */
+  CollectionIndex(std::string dirpath);
+  /** Returns the collection cached for the given file, or nullptr if the
+   *  file is not indexed, or has changed since. */
+  std::shared_ptr<ModuleCollection> Get(std::string filepath, std::string basedir);
+  /** Stores a collection parsed from the given file. \param hash The
+   *  Hash() of the file contents. */
+  void Put(std::string filepath, uint64_t hash, const ModuleCollection& collection);
+  /** Writes the index back to its directory, if it changed. Entries of files
+   *  that were neither requested nor stored are dropped. An index that cannot
+   *  be written is simply not updated. */
+  void Save();
+  
+  /** Computes the hash used to recognize unchanged files. */
+  static uint64_t Hash(const char* data, size_t size);
+  static const std::string file_name;
+private:
+  struct Entry{
+    int64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+    /** The serialized collection. */
+    std::string data;
+    bool used;
+  };
+  std::string path;
+  std::map<std::string, Entry> entries;
+  bool dirty = false;
+  
+  static std::string Serialize(const ModuleCollection& collection);
+  /** \throws Exceptions::CollectionParse if the data is invalid. */
+  static std::shared_ptr<ModuleCollection> Deserialize(const std::string& data, std::string basedir);
+  /** Reads the modification time and size of a file. Returns false if it
+   *  does not exist. */
+  static bool Stat(std::string filepath, int64_t& mtime, uint64_t& size);
+};
+
+} // namespace AlgAudio
+
+#endif // COLLECTIONINDEX_HPP
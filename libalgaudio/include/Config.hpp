@@ -48,6 +48,32 @@ public:
 	/** The name of driver device to be used by scsynth for audio I/O. If set to
 	 *  an empty string, scsynth will use the default device. */
 	std::string scsynth_audio_driver_name;
+	/** If set to true, MIDI input will be received directly by AlgAudio (using
+	 *  ALSA sequencer on Linux), instead of being passed through sclang. If no
+	 *  native MIDI backend is available, sclang is used anyway. */
+	bool native_midi;
+	/** If non-empty, MIDI messages will be replayed from this file. Useful for
+	 *  testing and benchmarking without MIDI hardware. \see MIDI::StartReplay */
+	std::string midi_replay_file;
+	/** If set to true, the MIDI replay file will be played in a loop. */
+	bool midi_replay_loop;
+	/** False by default. If set to true, new subpatches are flattened.
+	 *  \see Builtin::Subpatch::SetFlattened */
+	bool flatten_subpatches;
+	/** True by default. If set to true, modules whose output cannot reach any
+	 *  sink module are paused on the server. \see Canvas::UpdatePausing */
+	bool auto_pause_modules;
+	/** False by default. If set to true, the headless runner fuses chains of
+	 *  modules into single synths once the patch is loaded.
+	 *  \see Canvas::Compile */
+	bool fuse_modules;
+	/** True by default. If set to true, inlets whose signals are never live
+	 *  at the same time share a single bus. \see Canvas::UpdateBusSharing */
+	bool share_buses;
+	/** The path prefix of autosave files. Edits of the open patch are
+	 *  journaled there, so that they can be recovered after a crash. If set
+	 *  to an empty string, autosave is disabled. \see Journal */
+	std::string autosave_path;
 	
 	int  input_channels;
 	int output_channels;
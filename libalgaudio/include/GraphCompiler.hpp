@@ -0,0 +1,102 @@
+#ifndef GRAPHCOMPILER_HPP
+#define GRAPHCOMPILER_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <set>
+#include "LateReturn.hpp"
+
+namespace AlgAudio{
+
+class Canvas;
+class Module;
+
+/** The graph compiler merges chains of modules into single SynthDefs, so that
+ *  a chain runs as a single synth instead of a synth per module, and passes
+ *  audio between the modules directly, instead of writing and reading private
+ *  buses.
+ *
+ *  A chain is a sequence of modules where each module has a single audio
+ *  connection, which leads to the next module, and that next module receives
+ *  no other audio. Only the first module may have other inputs, and only the
+ *  last one may have other outputs. Only modules that are plain SC synths
+ *  (with no custom class, replies or silence gate) are considered.
+ *
+ *  The fused SynthDef evaluates the sc code of each module in order, with
+ *  In.ar and Out.ar replaced by functions that pass signals directly when
+ *  the bus corresponds to a connection within the chain. All other synth
+ *  arguments are exposed by the fused synth, prefixed with the position of
+ *  the module in the chain, and sclang translates messages addressed to the
+ *  original modules accordingly. Thus params remain addressable, and the
+ *  rest of AlgAudio does not need to know about fusing.
+ *  \see Canvas::Compile */
+class GraphCompiler{
+public:
+  GraphCompiler() = delete; // static class
+  /** Returns true if the given module may become a part of a fused chain. */
+  static bool IsFusable(const std::shared_ptr<Module>& m);
+  /** Finds all chains of at least two modules on the given canvas. Modules
+   *  are listed in the order of the signal flow. */
+  static std::vector<std::vector<std::shared_ptr<Module>>> FindChains(const Canvas& c);
+  /** Generates the body of the fused SynthDef function for the given chain.
+   *  The result depends only on the templates and connections of the modules,
+   *  so identical chains share a single SynthDef. */
+  static std::string GenerateSynthDef(const Canvas& c, const std::vector<std::shared_ptr<Module>>& chain);
+  /** Replaces audio bus reads and writes in the sc code with the direct
+   *  wiring functions used by fused SynthDefs. */
+  static std::string RewriteBusAccess(const std::string& sc_code);
+  /** Returns the prefix of synth arguments of the n-th module of a chain. */
+  static std::string GetPrefix(unsigned int n) {return "m" + std::to_string(n + 1) + "_";}
+};
+
+/** A chain of modules that currently runs as a single fused synth. Destroying
+ *  the instance reverts the modules to their own synths. */
+class FusedChain{
+public:
+  /** Creates the fused synth for the given chain, which should be one of
+   *  the chains returned by GraphCompiler::FindChains. */
+  static LateReturn<std::shared_ptr<FusedChain>> Create(std::shared_ptr<Canvas> c, std::vector<std::shared_ptr<Module>> chain);
+  ~FusedChain();
+  /** Swaps the fused synth back to individual module synths, and restores
+   *  their params. Does nothing if already released. */
+  void Release();
+  bool Contains(const std::shared_ptr<Module>& m) const;
+  /** Forgets which fused SynthDefs were sent to SC, so that they are sent
+   *  again. Called by SCLang whenever the server is booted or stopped, as a
+   *  new server instance knows none of them. */
+  static void ForgetInstalledSynthDefs() {installed.clear();}
+private:
+  FusedChain() {}
+  /** Sends the current state of modules to their own synths. */
+  void RestoreModules();
+  std::weak_ptr<Canvas> canvas;
+  std::vector<std::weak_ptr<Module>> modules;
+  /** The id of the fused synth, or -1 if SC did not create it yet. */
+  int sc_id = -1;
+  bool released = false;
+  /** The names of fused SynthDefs already sent to SC. */
+  static std::set<std::string> installed;
+};
+
+} // namespace AlgAudio
+
+#endif // GRAPHCOMPILER_HPP
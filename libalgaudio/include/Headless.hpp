@@ -0,0 +1,99 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include "Signal.hpp"
+
+namespace AlgAudio{
+
+class Canvas;
+
+/** The static interface implementing a main loop that does not use SDL at all.
+ *  In headless mode no windows are created and no graphics are initialized,
+ *  but the same notifications that SDLMain would process (subprocess output,
+ *  OSC messages, MIDI input, timers) are handled on a plain event loop. This
+ *  allows running patches on machines with no display, and is convenient for
+ *  automated benchmarks.
+ *
+ *  Once Init() is called, SDLMain notification functions and Timer use this
+ *  loop instead of the SDL event queue, so the rest of the engine does not need
+ *  to know which loop is in use.
+ */
+class Headless{
+private:
+  Headless() = delete; // static class
+public:
+  /** Switches the engine to headless mode. Must be called before any timer
+   *  is scheduled or any i/o thread is started. */
+  static void Init();
+  /** Returns true if Init() was called. */
+  static bool IsActive() {return active;}
+  /** Enters the main loop. Processes notifications and timers until Quit() is
+   *  called.
+   *  \warning This is a blocking call. */
+  static void Loop();
+  /** Stops the main loop. This function is safe to call from a signal handler. */
+  static void Quit();
+
+  /** Queues a notification to be processed by the main loop. Thread-safe.
+   *  \param code One of SDLMain::CustomEventCodes. */
+  static void Post(int code, void* data);
+  /** Calls Timer::Trigger with the given param after the specified time. */
+  static void ScheduleTimer(float seconds, void* param);
+
+  /** A complete headless session. Starts MIDI and SuperCollider (unless
+   *  disabled in Config), opens the patch file at the given path into a new
+   *  Canvas, and runs the main loop until Quit() is called or SIGINT/SIGTERM
+   *  is received. \returns The exit status for the process. */
+  static int Run(std::string patch_path);
+
+  /** Happens when the patch passed to Run() was loaded and is running. */
+  static Signal<std::shared_ptr<Canvas>> on_patch_loaded;
+
+private:
+  static std::atomic_bool active;
+  static std::atomic_bool running;
+
+  struct Notification{
+    int code;
+    void* data;
+  };
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  typedef std::pair<TimePoint, void*> TimerEntry;
+  struct TimerEntryCompare{
+    bool operator()(const TimerEntry& a, const TimerEntry& b) const {return a.first > b.first;}
+  };
+
+  static std::mutex mutex;
+  static std::condition_variable cv;
+  static std::vector<Notification> notifications;
+  static std::priority_queue<TimerEntry, std::vector<TimerEntry>, TimerEntryCompare> timers;
+};
+
+} // namespace AlgAudio
+
+#endif // HEADLESS_HPP
@@ -0,0 +1,163 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "Canvas.hpp"
+#include "Timer.hpp"
+
+namespace AlgAudio{
+
+/** An autosave journal of a top-level canvas. When started, a full save of
+ *  the canvas (the base) is written, and from then on each edit is appended
+ *  to the journal file as a single line: modules being added, removed or
+ *  moved, audio and data connections, param changes and param ranges. Param
+ *  changes are throttled, only the last value set between two flushes is
+ *  stored. All file writes happen on a background thread, so editing never
+ *  waits for the disk. That thread also serializes the bases, the UI thread
+ *  only captures the canvas state.
+ *
+ *  Edits within subpatches are journaled as well. Each module, at any depth,
+ *  has a journal id. Modules stored in the base are numbered in the order of
+ *  a depth-first walk over canvases, visiting modules by their save ids, so
+ *  the same ids are found again when the base is loaded. A record adding a
+ *  module names the canvas it is added to by the id of the subpatch that
+ *  owns it, or 0 for the top-level canvas.
+ *
+ *  Periodically the journal is compacted: a new base is written and the
+ *  journal is started over. Compaction also happens as soon as the canvas
+ *  changes in a way the journal cannot describe, e.g. when a subpatch is
+ *  created or loads new contents.
+ *
+ *  After a crash, Recover() loads the last base and replays the journal on
+ *  top of it. A clean exit should Close() the journal, which removes all
+ *  autosave files.
+ *
+ *  Files are named after the given path prefix: the journal is stored at
+ *  "<prefix>.journal", and bases at "<prefix>-<generation>.algaudio". The
+ *  first line of the journal names the generation of the base it applies to.
+ */
+class Journal{
+public:
+  /** Starts journaling the given canvas. Any autosave files left at the same
+   *  path are replaced. */
+  static std::shared_ptr<Journal> Start(std::shared_ptr<Canvas> canvas, std::string path);
+  ~Journal();
+  
+  /** Appends throttled param changes and module moves, compacting the journal
+   *  if needed. Called periodically by a timer. */
+  void Flush();
+  /** Writes a new base and starts a new journal. */
+  void Compact();
+  /** Stops journaling, waits for pending writes and removes all autosave
+   *  files. The journal does nothing afterwards. */
+  void Close();
+  
+  /** Returns true iff there is an autosave journal at the given path, which
+   *  is the case if the previous session did not end cleanly. */
+  static bool CanRecover(std::string path);
+  /** Loads the last base saved at the given path and replays the journal on
+   *  top of it. The latereturned canvas is a new top-level canvas. An
+   *  incomplete record at the end of the journal (e.g. cut off by a crash) is
+   *  ignored. May latethrow Exceptions::XMLFileAccess or
+   *  Exceptions::XMLParse. */
+  static LateReturn<std::shared_ptr<Canvas>> Recover(std::string path);
+  /** Returns the journaled canvas. */
+  std::shared_ptr<Canvas> GetCanvas() const {return canvas.lock();}
+  /** Removes autosave files at the given path. */
+  static void Discard(std::string path);
+  
+  /** After this many records a compaction happens on the next flush. */
+  static const unsigned int compact_records = 500;
+  /** A compaction happens on the next flush if the base is older than this
+   *  many seconds and the journal is not empty. */
+  static const int compact_interval = 60;
+  /** The time between flushes, in seconds. */
+  static constexpr float flush_interval = 1.0f;
+private:
+  Journal(std::shared_ptr<Canvas> canvas, std::string path);
+  
+  std::weak_ptr<Canvas> canvas;
+  std::string path;
+  bool closed = false;
+  
+  /** Journal ids of modules on the canvas and its subpatches. Modules stored
+   *  in the current base are numbered first, new modules after them. */
+  std::map<const Module*, int> ids;
+  int next_id = 1;
+  /** Journaled canvases, mapped to the id of the subpatch that owns them, or
+   *  0 for the top-level canvas. */
+  std::map<const Canvas*, int> canvases;
+  /** Throttled param values, not yet written. */
+  std::map<std::pair<int, Symbol>, float> pending_params;
+  /** Last written module positions, by module id. */
+  std::map<int, Point2D> positions;
+  
+  /** Records not yet passed to the writer thread. */
+  std::string buffer;
+  unsigned int records = 0;
+  bool needs_compaction = false;
+  std::chrono::steady_clock::time_point base_time;
+  /** The generation of the current base. 0 if none was written yet. */
+  int generation = 0;
+  
+  Subscription edit_subscription;
+  TimerHandle flush_timer;
+  void ScheduleFlush();
+  
+  void OnEdit(const Canvas::Edit& e);
+  void Track(std::shared_ptr<Module> m, int id);
+  /** Forgets the module, and the contents of a subpatch. */
+  void Untrack(std::shared_ptr<Module> m);
+  /** Appends moves of modules on the given canvas and nested ones. */
+  void AppendMoves(const std::shared_ptr<Canvas>& c);
+  /** Returns the journal id of the given module, or 0 if it is not known. */
+  int GetID(const std::shared_ptr<Module>& m) const;
+  void Append(const std::string& record);
+  /** Appends throttled param changes to the buffer, so that they are written
+   *  before a structural edit. */
+  void AppendParams();
+  
+  // The writer thread executes file operations in order.
+  std::thread writer;
+  std::mutex writer_mutex;
+  std::condition_variable writer_cv;
+  std::deque<std::function<void()>> writer_tasks;
+  bool writer_run = true;
+  void WriterMain();
+  void Enqueue(std::function<void()> f);
+  /** Stops the writer thread, after it completes all pending tasks. */
+  void StopWriter();
+  
+  static std::string JournalPath(std::string path);
+  static std::string BasePath(std::string path, int generation);
+  /** Returns the base generation named in the journal at the given path, or
+   *  0 if there is no valid journal. */
+  static int ReadGeneration(std::string path);
+};
+
+} // namespace AlgAudio
+
+#endif // JOURNAL_HPP
@@ -77,6 +77,9 @@ std::shared_ptr<UIMarginBox> marginbox;
           std::shared_ptr<UIHBox> config_adv_driver_box;
             std::shared_ptr<UILabel> config_adv_driver_label;
             std::shared_ptr<UITextEntry> config_adv_driver_entry;
+          std::shared_ptr<UIHBox> config_adv_midi_box;
+            std::shared_ptr<UILabel> config_adv_midi_label;
+            std::shared_ptr<UITextEntry> config_adv_midi_entry;
           std::shared_ptr<UIHBox> config_adv_chbox;
             std::shared_ptr<UIVBox> config_advA;
               std::shared_ptr<UICheckbox> chk_debug;
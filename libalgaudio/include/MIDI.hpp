@@ -0,0 +1,177 @@
+#ifndef MIDI_HPP
+#define MIDI_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Utilities.hpp"
+#include "Exception.hpp"
+#include "Signal.hpp"
+
+namespace AlgAudio{
+
+class ParamController;
+
+namespace Exceptions{
+struct MIDIException : public Exception{
+  MIDIException(std::string t) : Exception(t) {}
+};
+} // namespace Exceptions
+
+/** The base class for in-process MIDI sources. Each source runs its own input
+ *  thread, timestamps every message the moment it is received and passes it
+ *  to MIDI::Push(). All signals are later fired by the main thread. */
+class MIDIInput{
+public:
+  virtual ~MIDIInput();
+  /** Starts the input thread. \warning The thread cannot be started in the
+   *  constructor, as it calls virtual methods. */
+  void Start();
+  /** Asks the input thread to stop and waits until it does. */
+  void Stop();
+  bool IsRunning() const {return run;}
+  /** A human-readable description of this source. */
+  virtual std::string GetName() const = 0;
+protected:
+  /** The body of the input thread. Implementations should return soon after
+   *  run becomes false. */
+  virtual void ThreadMain() = 0;
+  std::atomic<bool> run{false};
+private:
+  std::thread the_thread;
+};
+
+/** The static interface to MIDI input. Messages may come from the native
+ *  backend (ALSA sequencer on Linux), a replay file, or from sclang, when no
+ *  native backend is in use. Regardless of the source, they are all delivered
+ *  by the main thread via SCLang::on_midi_message_received. */
+class MIDI{
+private:
+  MIDI() = delete; // static class
+public:
+  /** Starts MIDI sources according to Config::Global(). Safe to call multiple
+   *  times, already running sources are restarted. */
+  static void Start();
+  /** Stops all running MIDI sources, and prints the latency statistics
+   *  gathered since the last Stop(), if any messages were delivered. */
+  static void Stop();
+  /** Opens the native MIDI backend and connects it to all available MIDI
+   *  outputs. Returns false if no native backend is available on this
+   *  platform, or if it failed to open. */
+  static bool StartNative();
+  /** Starts replaying MIDI messages from a text file. Each non-empty line,
+   *  unless it starts with a '#', describes a single message:
+   *  \code
+   *    <time in seconds> on|off|cc <channel> <number> <velocity or value>
+   *  \endcode
+   *  The times are relative to the moment replay starts. If loop is true,
+   *  the file will be replayed over and over again until Stop() is called.
+   *  \throws Exceptions::MIDIException if the file cannot be read or parsed. */
+  static void StartReplay(std::string path, bool loop = false);
+  /** Returns true if the native backend is running, in which case sclang
+   *  should not listen for MIDI on its own. */
+  static bool IsNativeActive();
+
+  /** Queues a message received by an input thread and wakes up the main
+   *  thread. This function is thread-safe. */
+  static void Push(const MidiMessage&);
+  /** Called by the main thread when notified about new MIDI input.
+   *  Dispatches all queued messages. */
+  static void Deliver();
+  /** Passes a single message to the handlers registered with Route() that
+   *  match it, applies MIDI-learn mappings, and finally fires
+   *  SCLang::on_midi_message_received. Must be called by the main thread. */
+  static void Dispatch(const MidiMessage&);
+
+  /** Use this value as a channel or number in Route() to match any. */
+  static const int Any = -1;
+  /** Registers a handler for MIDI messages of the given type, channel and
+   *  number (which is the note number for NoteOn/NoteOff). The handler is
+   *  called only for matching messages, so modules do not have to filter
+   *  the whole MIDI stream themselves. The handler stays registered for as
+   *  long as the returned Subscription is alive.
+   *  \code
+   *    subscriptions += MIDI::Route(MidiMessage::Type::Control, MIDI::Any, 7, [this](MidiMessage m){ ... });
+   *  \endcode */
+  static Subscription Route(MidiMessage::Type type, int channel, int number, std::function<void(MidiMessage)> handler) __attribute__((warn_unused_result));
+
+  /** A single MIDI-learn mapping. Control messages with this channel and
+   *  number set the param, scaling 0-127 to its range. */
+  struct LearnEntry{
+    int channel;
+    int number;
+    std::weak_ptr<ParamController> param;
+  };
+  /** Arms MIDI-learn: the next control message received will be mapped to
+   *  the given param. Any previous mapping for that param is removed. */
+  static void Learn(std::shared_ptr<ParamController> param);
+  /** Stops waiting for a control message to map, if Learn() was called. */
+  static void CancelLearn();
+  /** Explicitly maps a control to a param, replacing existing mappings of
+   *  both. Useful for restoring saved mappings. */
+  static void Map(int channel, int number, std::shared_ptr<ParamController> param);
+  /** Removes the MIDI-learn mapping for the given param, if any. */
+  static void Unmap(std::shared_ptr<ParamController> param);
+  /** Returns all active MIDI-learn mappings. */
+  static std::vector<LearnEntry> GetLearnTable();
+  /** Happens when a pending Learn() gets bound to a control. */
+  static Signal<LearnEntry> on_learned;
+
+  /** Returns current time, in seconds, on the clock used to timestamp MIDI
+   *  messages. */
+  static double Now();
+
+  /** Statistics of the time between receiving a MIDI message by an input
+   *  thread and delivering it to subscribers on the main thread. */
+  struct LatencyStats{
+    unsigned long count = 0;
+    double mean = 0.0;
+    double max = 0.0;
+  };
+  static LatencyStats GetLatencyStats() {return latency;}
+  static void ResetLatencyStats() {latency = LatencyStats();}
+private:
+  static std::list<std::unique_ptr<MIDIInput>> inputs;
+  static bool native_active;
+  static std::mutex queue_mutex;
+  static std::vector<MidiMessage> queue;
+  static LatencyStats latency;
+
+  /** Packs message type, channel and number into a single routing key. */
+  static unsigned int RouteKey(MidiMessage::Type type, int channel, int number);
+  static std::unordered_map<unsigned int, std::unique_ptr<Signal<MidiMessage>>> routes;
+  struct LearnBinding{
+    std::weak_ptr<ParamController> param;
+    Subscription subscription;
+  };
+  // Keyed by (channel, number).
+  static std::map<std::pair<int,int>, LearnBinding> learn_table;
+  static std::weak_ptr<ParamController> learn_pending;
+};
+
+} // namespace AlgAudio
+
+#endif // MIDI_HPP
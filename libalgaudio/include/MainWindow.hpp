@@ -32,6 +32,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "UI/UILabel.hpp"
 #include "CanvasView.hpp"
 #include "Alertable.hpp"
+#include "Journal.hpp"
 
 namespace AlgAudio{
 
@@ -79,6 +80,12 @@ private:
   void init();
   
   void UpdatePathLabel();
+  /** Starts autosaving the top-level canvas, unless it is already
+   *  journaled, or a file is being loaded into it. */
+  void StartJournal();
+  /** Offers to recover the patch autosaved by a previous session that did
+   *  not end cleanly. */
+  void OfferRecovery();
 
 std::shared_ptr<UIVBox> mainvbox;
    std::shared_ptr<UIHBox> toolbarbox;
@@ -110,6 +117,11 @@ std::shared_ptr<UIVBox> mainvbox;
   // Stored for SaveAs.
   std::string current_file_path = "";
   std::string file_name = "Unsaved file";
+  
+  std::shared_ptr<Journal> journal;
+  // Set while a patch is being loaded, or while the user decides whether to
+  // recover the previous session, so that no journal is started early.
+  bool loading_file = false;
 };
 
 } //namespace AlgAudio
@@ -20,12 +20,15 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <memory>
 #include <vector>
+#include <functional>
 #include <unordered_set>
 #include "DynamicallyLoadableClass.hpp"
 #include "Signal.hpp"
 #include "Utilities.hpp"
 #include "LateReturn.hpp"
 #include "Timer.hpp"
+#include "Symbol.hpp"
+#include "ParamController.hpp"
 // Not really needed here, but all collections need that for strcmp in 
 // create instance, so including this is convinient, as all collections include
 // at least Module.hpp
@@ -36,6 +39,10 @@ namespace rapidxml{
   template <class Ch>
   class xml_node;
 }
+// Forward declaration to strip liblo header dependency
+namespace lo{
+  class Message;
+}
 
 namespace AlgAudio{
 
@@ -61,15 +68,30 @@ class SendReplyController;
 class Bus{
 public:
   int GetID() const {return id;}
+  /** The number of adjacent channels of this bus, starting at GetID(). */
+  unsigned int GetChannels() const {return channels;}
   /**  Asks SC for a new bus id, and returns a new Bus instance wrapping that bus. */
-  static LateReturn<std::shared_ptr<Bus>> CreateNew();
+  static LateReturn<std::shared_ptr<Bus>> CreateNew(unsigned int channels = 1);
   /** Creates a fake Bus instance, which does not wrap anything. Useful only for
    *  testing module instances without OSC connection. */
-  static std::shared_ptr<Bus> CreateFake();
+  static std::shared_ptr<Bus> CreateFake(unsigned int channels = 1);
   ~Bus();
+  /** If set, outlets connected to this bus write to the buses returned by
+   *  this function instead. Used by flattened subpatches to bypass the synths
+   *  that copy signal across the subpatch boundary.
+   *  \see Builtin::Subpatch::SetFlattened */
+  std::function<std::vector<int>()> redirect;
+  /** If set, this bus stays unused, and the inlet that owns it reads the
+   *  substitute bus instead, which is shared with other inlets whose signals
+   *  are never live at the same time. \see Canvas::UpdateBusSharing */
+  std::shared_ptr<Bus> substitute;
+  /** Returns the id of the bus that is actually read and written, which is
+   *  the id of the substitute, if there is one. */
+  int GetUsedID() const {return substitute ? substitute->id : id;}
 private:
-  Bus(int id);
+  Bus(int id, unsigned int channels = 1);
   int id;
+  unsigned int channels;
 };
 
 /** This is a wrapper class for SC groups */
@@ -143,6 +165,11 @@ public:
   /** This variable stores the widget position in canvas. */
   Point2D position_in_canvas;
 
+  /** The save id this module was given when its canvas was last saved, or
+   *  the one it was loaded with. 0 if neither happened yet. Save ids are
+   *  unique within a single canvas only. */
+  int saveid = 0;
+
   /** This flag marks whether this module was initialized by ModuleFactory.
    *  When ModuleFactory destoys a module, this flag is set back to false.
    *  This way it's easy to detect whether the module was correctly created,
@@ -155,33 +182,55 @@ public:
   // TODO: Common base class
   class Outlet{
   public:
-    std::string id;
+    Symbol id;
     std::string name;
     Module& mod;
+    unsigned int channels;
     // The outlet is not the owner of the buses.
     std::list<std::weak_ptr<Bus>> buses;
     LateReturn<> ConnectToInlet(std::shared_ptr<Inlet> i);
     LateReturn<> DetachFromInlet(std::shared_ptr<Inlet> i);
     LateReturn<> DetachFromAll();
-    static std::shared_ptr<Outlet> Create(std::string id, std::string name, std::shared_ptr<Module> mod);
+    /** These only update the list of buses this outlet writes to, without
+     *  notifying SC. Use SendConnections() afterwards, or send
+     *  GetConnectionsMessage() as a part of a bundle. */
+    void AddInlet(std::shared_ptr<Inlet> i);
+    void RemoveInlet(std::shared_ptr<Inlet> i);
+    /** Sends the current list of buses to SC. */
+    LateReturn<> SendConnections();
+    /** Returns the ids of the buses this outlet actually writes to, with bus
+     *  redirects resolved. */
+    std::vector<int> GetTargetBusIDs() const;
+    /** Returns the /algaudioSC/connectoutlet message that describes the
+     *  current list of buses. The caller is expected to send it, the target
+     *  buses are remembered as the ones SC writes to. */
+    lo::Message GetConnectionsMessage();
+    /** Returns true iff the buses this outlet should write to differ from the
+     *  ones it was last connected to, e.g. because bus redirects changed. */
+    bool TargetsChanged() const {return GetTargetBusIDs() != sent_targets;}
+    /** The number of buses a single fork synth writes to. An outlet connected
+     *  to more buses uses a chain of forks. */
+    static const unsigned int fork_outputs = 20;
+    static std::shared_ptr<Outlet> Create(Symbol id, std::string name, std::shared_ptr<Module> mod, unsigned int channels = 1);
     ~Outlet(){
       std::cout << "Outlet freed" << std::endl;
     }
   private:
-    LateReturn<> SendConnections();
-    Outlet(std::string i, std::string n, std::shared_ptr<Module> m) : id(i), name(n), mod(*m.get()) {}
+    Outlet(Symbol i, std::string n, std::shared_ptr<Module> m, unsigned int c) : id(i), name(n), mod(*m.get()), channels(c) {}
+    std::vector<int> sent_targets;
   };
   class Inlet{
   public:
     // If fake is set to true, this inlet will have no corresponding bus. Pointless to use, great for debugging.
-    static LateReturn<std::shared_ptr<Inlet>> Create(std::string id, std::string name, std::shared_ptr<Module> mod, bool fake = false);
-    std::string id;
+    static LateReturn<std::shared_ptr<Inlet>> Create(Symbol id, std::string name, std::shared_ptr<Module> mod, bool fake = false, unsigned int channels = 1);
+    Symbol id;
     std::string name;
     Module& mod;
+    unsigned int GetChannels() const {return bus ? bus->GetChannels() : 1;}
     // The inlet is the owner of a bus.
     std::shared_ptr<Bus> bus;
   private:
-    Inlet(std::string i, std::string n, std::shared_ptr<Module> m, std::shared_ptr<Bus> b) : id(i), name(n), mod(*m.get()), bus(b) {}
+    Inlet(Symbol i, std::string n, std::shared_ptr<Module> m, std::shared_ptr<Bus> b) : id(i), name(n), mod(*m.get()), bus(b) {}
   };
 
   /** Returns a reference to the ModuleGUI that represents this particular module
@@ -210,10 +259,18 @@ public:
   std::vector<std::shared_ptr<Inlet>> inlets;
   std::vector<std::shared_ptr<Outlet>> outlets;
 
-  void PrepareParamControllers();
+  /** Creates controllers for all params. They are set to the values from
+   *  the given presets, or to defaults if a param has no preset. If
+   *  on_server is set, the synth was created with the preset values, and
+   *  these are not sent to SC again. */
+  void PrepareParamControllers(const ParamPresets& presets = ParamPresets(), bool on_server = false);
 
   /** Sets all controllers to default values */
   void ResetControllers();
+  /** Sets controllers to the values from the given presets, and all the
+   *  others to default values. If on_server is set, preset values are not
+   *  sent to SC. \see ParamController::ApplyPreset */
+  void ResetControllers(const ParamPresets& presets, bool on_server = false);
 
   // TODO: Make this a map?
   std::vector<std::shared_ptr<ParamController>> param_controllers;
@@ -221,18 +278,57 @@ public:
   std::vector<std::shared_ptr<SendReplyController>> reply_controllers;
 
   /** Returns a ParamController by given ID. */
-  std::shared_ptr<ParamController> GetParamControllerByID(std::string) const;
+  std::shared_ptr<ParamController> GetParamControllerByID(Symbol) const;
 
   /** Returns inlets by their ID. */
-  std::shared_ptr<Inlet >  GetInletByID(std::string id) const;
+  std::shared_ptr<Inlet >  GetInletByID(Symbol id) const;
   /** Returns outlets by their ID. */
-  std::shared_ptr<Outlet> GetOutletByID(std::string id) const;
+  std::shared_ptr<Outlet> GetOutletByID(Symbol id) const;
 
   /** The canvas this module belongs to. */
   std::weak_ptr<Canvas> canvas;
+
+  /** Decides whether the canvas may pause the SC instance of this module
+   *  when its output cannot reach any sink. \see Canvas::UpdatePausing */
+  enum class RunPolicy{
+    /** Use the template's keeprunning setting. */
+    Default,
+    /** Never pause this module, nor any module it receives audio or data
+     *  from. Useful for modules with side effects, like meters. */
+    KeepRunning,
+    /** Pause this module whenever it cannot reach a sink. */
+    AllowPausing,
+  };
+  void SetRunPolicy(RunPolicy p);
+  RunPolicy GetRunPolicy() const {return run_policy;}
+  /** Returns true if the run policy, or the template, says that this module
+   *  shall never be paused. */
+  bool GetKeepRunning() const;
+
+  /** The state of the SC instance of this module. */
+  enum class RunState{
+    Running,
+    /** Paused by the canvas, as its output cannot reach any sink. */
+    Paused,
+    /** Suspended by its silence gate, as its inlets are silent. */
+    Suspended,
+  };
+  RunState GetRunState() const;
+  /** Asks SC to start watching the inlets of this module, and to suspend the
+   *  synth when they become silent. Called by ModuleFactory for templates with
+   *  silence gate enabled. \see ModuleTemplate::silence_gate */
+  void CreateSilenceGate();
+  /** Called when SC reports silence gate state changes. */
+  void SetSuspended(bool s);
+  /** Passes the current run state to the GUI, if there is one. Called
+   *  whenever the state changes. */
+  void NotifyRunStateChanged();
   
 protected:
   std::shared_ptr<ModuleGUI> modulegui;
+private:
+  RunPolicy run_policy = RunPolicy::Default;
+  bool suspended = false;
 };
 
 } // namespace AlgAudio
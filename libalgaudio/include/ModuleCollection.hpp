@@ -29,6 +29,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 namespace AlgAudio{
 
 class LibLoader;
+class CollectionIndex;
 
 namespace Exceptions{
 struct CollectionParse : public Exception{
@@ -54,6 +55,8 @@ struct CollectionLoading : public Exception{
 class ModuleCollection{
 public:
   ModuleCollection(std::ifstream& file, std::string basedir);
+  /** Creates a collection from an already parsed `collection` XML node. */
+  ModuleCollection(rapidxml::xml_node<char>* root, std::string basedir);
   LateReturn<> InstallAllTemplatesIntoSC();
   /** \param id The requested module template id.
    *  \returns a shared_ptr to template with the requested id, or a nullptr
@@ -65,6 +68,17 @@ public:
   std::string basedir;
   bool has_defaultlib;
   std::string defaultlib_path;
+  /** Returns the default .aa library of this collection, or nullptr if it
+   *  has none. The library is only opened when this is first called, so that
+   *  libraries of collections which are never used are not loaded at all.
+   *  May throw Exceptions::LibLoading. */
+  std::shared_ptr<LibLoader> GetDefaultLib();
+private:
+  // Restores collections from its cache.
+  friend class CollectionIndex;
+  ModuleCollection(std::string b) : basedir(b) {}
+  /** Reads the collection data from a `collection` XML node. */
+  void Load(rapidxml::xml_node<char>* root);
   std::shared_ptr<LibLoader> defaultlib;
 };
 
@@ -76,11 +90,18 @@ private:
   ModuleCollectionBase() = delete; // static class
 
   static std::map<std::string, std::shared_ptr<ModuleCollection>> collections_by_id;
+  /** Adds a loaded collection to the base. \throws
+   *  Exceptions::CollectionLoading if its id is already taken. */
+  static void Register(std::shared_ptr<ModuleCollection> collection, std::string filepath);
 public:
   static std::shared_ptr<ModuleCollection> GetCollectionByID(std::string id);
   static std::shared_ptr<ModuleTemplate> GetTemplateByID(std::string id);
   static std::shared_ptr<ModuleCollection> InstallFile(std::string filepath);
   static const std::map<std::string, std::shared_ptr<ModuleCollection>>& GetCollections();
+  /** Installs all collection files from the given directory. Collections are
+   *  restored from the directory's CollectionIndex, if their files have not
+   *  changed since they were indexed. The remaining files are read and
+   *  parsed in parallel, and then added to the index. */
   static void InstallDir(std::string dirpath);
   static std::string ListInstalledTemplates();
   static LateReturn<> InstallAllTemplatesIntoSC();
@@ -21,6 +21,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <memory>
 #include <set>
+#include <unordered_map>
 #include "Module.hpp"
 #include "ModuleTemplate.hpp"
 #include "LateReturn.hpp"
@@ -42,14 +43,18 @@ class ModuleFactory{
 private:
   ModuleFactory() = delete; // static class
   static std::set<std::shared_ptr<Module>> instances;
+  /** Templates that were already looked up, indexed by their full id. */
+  static std::unordered_map<Symbol, std::shared_ptr<ModuleTemplate>> templates_by_id;
 public:
   /** Creates, initializes and installs a new module instance. This is the
    *  correct way to create new module instances. In case of problems, this
    *  method may latethrow Exceptions::ModuleInstanceCreationFailed. The
    *  returned pointer is never null, and always points to a valid module.
    *  \param templ The module template to use when creating a new instance.
-   *  \param parent The parent canvas where this new instance shall be installed. */
-  static LateReturn<std::shared_ptr<Module>> CreateNewInstance(std::shared_ptr<ModuleTemplate> templ, std::shared_ptr<Canvas> parent);
+   *  \param parent The parent canvas where this new instance shall be installed.
+   *  \param presets Initial param values. They are applied as the instance is
+   *  created, in place of the defaults. */
+  static LateReturn<std::shared_ptr<Module>> CreateNewInstance(std::shared_ptr<ModuleTemplate> templ, std::shared_ptr<Canvas> parent, const ParamPresets& presets = ParamPresets());
     /** Creates, initializes and installs a new module instance. This is the
      *  correct way to create new module instances. In case of problems, this
      *  method may latethrow Exceptions::ModuleInstanceCreationFailed. The
@@ -57,8 +62,14 @@ public:
      *  \param id The module template id to use when creating a new instance. 
      *  \param parent The parent canvas where this new instance shall be installed. */
   static LateReturn<std::shared_ptr<Module>> CreateNewInstance(std::string id, std::shared_ptr<Canvas> parent);
-  static LateReturn<> DestroyInstance(std::shared_ptr<Module>);
-  static std::shared_ptr<ModuleTemplate> GetTemplateByID(std::string);
+  /** Uninstalls and destroys a module instance. If bundle is not null, the
+   *  message that removes the SC instance is appended to it instead of being
+   *  sent, and the instance is considered destroyed immediately. */
+  static LateReturn<> DestroyInstance(std::shared_ptr<Module>, std::vector<std::pair<std::string, lo::Message>>* bundle = nullptr);
+  /** Returns the template with the given full id (i.e. "collection/module").
+   *  Found templates are cached, so that subsequent lookups do not need to
+   *  parse the id. */
+  static std::shared_ptr<ModuleTemplate> GetTemplateByID(Symbol);
 };
 
 } // namnespace AlgAudio
@@ -20,9 +20,10 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <string>
 #include <memory>
-#include <list>
+#include <vector>
 
 #include "Utilities.hpp"
+#include "Symbol.hpp"
 
 // Forward declaration, to aviod rapidxml becoming a dependency for
 // external modules
@@ -34,6 +35,7 @@ namespace AlgAudio{
 
 class ModuleCollection;
 class Module;
+class GUIBlueprint;
 
 namespace Exceptions{
 struct ModuleParse : public Exception{
@@ -53,7 +55,7 @@ struct ModuleParse : public Exception{
  */
 class ParamTemplate{
 public:
-  std::string id;
+  Symbol id;
   std::string name;
   enum class ParamAction{
     SC,
@@ -75,12 +77,21 @@ public:
   float default_min, default_max;
   float default_val;
   float step = 0.0;
+  /** The name of the SynthDef argument which selects the control bus the
+   *  synth writes this param's value to, or an empty string if it does not.
+   *  Such params can be connected to other SC params on the server.
+   *  \see ServerDataLink */
+  std::string bus = "";
 };
 
 class IOLetTemplate{
 public:
-  std::string id;
+  Symbol id;
   std::string name;
+  /** The number of audio channels. Multichannel iolets use a single bus of
+   *  this many adjacent channels, and may only be connected to iolets with
+   *  the same number of channels. */
+  unsigned int channels = 1;
 };
 
 /** All modules are build according to a template. If multiple instances
@@ -91,6 +102,8 @@ public:
  */
 class ModuleTemplate{
 public:
+  /** The maximum number of channels of a single iolet. */
+  static const unsigned int MaxChannels = 8;
   ModuleTemplate(ModuleCollection& collection);
   // Create a module template by parsing data from an XML module node.
   ModuleTemplate(ModuleCollection& collection, rapidxml::xml_node<char>* node);
@@ -100,15 +113,31 @@ public:
   std::string description = "";
   std::string guitype = "";
   std::string guitree = "";
+  /** The parsed guitree, shared by all GUIs of this template. It is created
+   *  when the first GUI is built. \see GUIBlueprint */
+  std::shared_ptr<const GUIBlueprint> gui_blueprint;
   bool has_sc_code = false;
   std::string sc_code;
   bool has_class = false;
   std::string class_name;
+  /** True if this module delivers signal outside of its canvas, e.g. to the
+   *  audio device. Modules whose output cannot reach any sink are paused.
+   *  \see Canvas::UpdatePausing */
+  bool sink = false;
+  /** True if instances should not be paused automatically by default, e.g.
+   *  because they report values with SendReply. Defaults to true iff the
+   *  module has any replies. */
+  bool keep_running = false;
+  /** If positive, instances of this module are suspended after their inlets
+   *  have been silent for this many seconds, and resumed as soon as any
+   *  signal arrives. Only useful for modules that output silence when their
+   *  input is silent, like effects. */
+  float silence_gate = 0.0f;
   ModuleCollection& collection;
-  std::list<IOLetTemplate> inlets;
-  std::list<IOLetTemplate> outlets;
-  std::list<std::shared_ptr<ParamTemplate>> params;
-  std::list<std::pair<std::string, std::string>> replies;
+  std::vector<IOLetTemplate> inlets;
+  std::vector<IOLetTemplate> outlets;
+  std::vector<std::shared_ptr<ParamTemplate>> params;
+  std::vector<std::pair<std::string, std::string>> replies;
 };
 
 } // namespace AlgAudio
@@ -0,0 +1,68 @@
+#ifndef GUIBLUEPRINT_HPP
+#define GUIBLUEPRINT_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vector>
+#include <memory>
+#include "ModuleTemplate.hpp"
+#include "UI/UIWidget.hpp"
+
+namespace AlgAudio{
+
+/** The gui tree of a module template, parsed into a list of elements. The
+ *  blueprint of a template is parsed only once, when the first GUI of that
+ *  template is built, and is then shared by all StandardModuleGUIs of that
+ *  template. Blueprints are immutable, a GUI is built by creating a widget
+ *  for each element.
+ */
+class GUIBlueprint{
+public:
+  struct Element{
+    enum class Type{
+      Inlet,
+      Outlet,
+      Slider,
+      Display,
+    };
+    Type type;
+    /** The id of the widget built for this element. */
+    UIWidget::ID id;
+    /** The id of the inlet, outlet or param this element represents. */
+    Symbol target;
+    std::string name;
+    /** False if the element had no name specified. Iolets are then named
+     *  after their id, and sliders after their param. */
+    bool has_name;
+  };
+  const std::vector<Element>& GetElements() const {return elements;}
+
+  /** Returns the blueprint of the given template, parsing its gui tree if
+   *  this is the first time it is needed. \throws Exceptions::GUIBuild */
+  static std::shared_ptr<const GUIBlueprint> Get(std::shared_ptr<ModuleTemplate> templ);
+  /** Parses a gui tree into a new blueprint. \throws Exceptions::GUIBuild */
+  static std::shared_ptr<const GUIBlueprint> Parse(const std::string& xml_data);
+private:
+  GUIBlueprint() {}
+  std::vector<Element> elements;
+};
+
+} // namespace AlgAudio
+
+#endif // GUIBLUEPRINT_HPP
@@ -59,21 +59,25 @@ public:
    *  variant. */
   virtual void SetHighlight(bool) = 0;
 
+  /** Notifies the GUI whether the module is running, or paused or suspended
+   *  on the server. Implementations should make this state visible. */
+  virtual void SetRunState(Module::RunState) {}
+
   ///@{
   /** These methods are used by the CanvasView to query where it should draw
    *  connection wire endings. The only parameter is iolet ID. The ModuleGUI
    *  implementation should return the coordinates where the connector is
    *  drawn. */
-  virtual Point2D WhereIsInlet(std::string inlet) = 0;
-  virtual Point2D WhereIsOutlet(std::string outlet) = 0;
-  virtual Point2D WhereIsParamInlet(std::string inlet) = 0;
-  virtual Point2D WhereIsParamRelativeOutlet(std::string inlet) = 0;
-  virtual Point2D WhereIsParamAbsoluteOutlet(std::string inlet) = 0;
+  virtual Point2D WhereIsInlet(Symbol inlet) = 0;
+  virtual Point2D WhereIsOutlet(Symbol outlet) = 0;
+  virtual Point2D WhereIsParamInlet(Symbol inlet) = 0;
+  virtual Point2D WhereIsParamRelativeOutlet(Symbol inlet) = 0;
+  virtual Point2D WhereIsParamAbsoluteOutlet(Symbol inlet) = 0;
   ///@}
 
   /** This method shall translate an inlet/outlet widget id to the corresponding
    *  param id. */
-  virtual std::string GetIoletParamID(UIWidget::ID) const = 0;
+  virtual Symbol GetIoletParamID(UIWidget::ID) const = 0;
 
   /** CanvasView uses this function to notify the ModuleGUI that a slider is
    *  being dragged. This way the drag can continue outside the ModuleGUI.
@@ -106,7 +110,7 @@ public:
     /** The id of the widget */
     UIWidget::ID widget_id;
     /** The id of the param/inlet/outlet corresponding to this widget */
-    std::string param_id;
+    Symbol param_id;
   };
   /** This function is used by the CanvasView to ask the module GUI what kind of
    *  element is located at a given point. This way the CanvasView can handle
@@ -25,32 +25,37 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "UI/UIBox.hpp"
 #include "UI/UILabel.hpp"
 #include "ModuleUI/UISlider.hpp"
+#include "ModuleUI/GUIBlueprint.hpp"
 
 namespace AlgAudio{
 
 class StandardModuleGUI : public ModuleGUI, public UIContainerSingle{
 public:
   static std::shared_ptr<StandardModuleGUI> CreateFromXML(std::shared_ptr<Window> w, std::string xml_data, std::shared_ptr<Module> mod);
+  /** Builds a GUI according to a parsed gui tree. Use GUIBlueprint::Get to
+   *  reuse the blueprint of the module's template. */
+  static std::shared_ptr<StandardModuleGUI> CreateFromBlueprint(std::shared_ptr<Window> w, std::shared_ptr<const GUIBlueprint> blueprint, std::shared_ptr<Module> mod);
   static std::shared_ptr<StandardModuleGUI> CreateFromTemplate(std::shared_ptr<Window> w, std::shared_ptr<Module> mod);
   void CustomDraw(DrawContext& c) override;
   void CustomResize(Size2D s) override;
   void SetHighlight(bool) override;
+  void SetRunState(Module::RunState) override;
   void OnChildRequestedSizeChanged() override;
   void OnChildVisibilityChanged() override;
   virtual bool CustomMousePress(bool down, MouseButton b,Point2D pos) override {return main_margin->OnMousePress(down,b,pos);}
   virtual void CustomMouseMotion(Point2D pos1,Point2D pos2) override {main_margin->OnMouseMotion(pos1,pos2);}
   virtual void CustomMouseEnter(Point2D pos) override {main_margin->OnMouseEnter(pos);}
   virtual void CustomMouseLeave(Point2D pos) override {main_margin->OnMouseLeave(pos);}
-  virtual Point2D WhereIsInlet(std::string inlet) override;
-  virtual Point2D WhereIsOutlet(std::string outlet) override;
-  virtual Point2D WhereIsParamInlet(std::string inlet) override;
-  virtual Point2D WhereIsParamRelativeOutlet(std::string outlet) override;
-  virtual Point2D WhereIsParamAbsoluteOutlet(std::string outlet) override;
+  virtual Point2D WhereIsInlet(Symbol inlet) override;
+  virtual Point2D WhereIsOutlet(Symbol outlet) override;
+  virtual Point2D WhereIsParamInlet(Symbol inlet) override;
+  virtual Point2D WhereIsParamRelativeOutlet(Symbol outlet) override;
+  virtual Point2D WhereIsParamAbsoluteOutlet(Symbol outlet) override;
   virtual WhatIsHere GetWhatIsHere(Point2D) const override;
   virtual void SliderDragStart(UIWidget::ID id) override;
   virtual void SliderDragStep(UIWidget::ID id, Point2D_<float> current_offset) override;
   virtual void SliderDragEnd(UIWidget::ID id) override;
-  virtual std::string GetIoletParamID(UIWidget::ID) const override;
+  virtual Symbol GetIoletParamID(UIWidget::ID) const override;
   virtual std::shared_ptr<UIWidget> CustomFindChild(ID id) const override{ return main_margin->FindChild(id);}
   virtual void OnInletsChanged();
   virtual Point2D GetChildPos() const {return Point2D(0,0);}
@@ -62,11 +67,13 @@ public:
 protected:
   StandardModuleGUI(std::shared_ptr<Window> w, std::shared_ptr<Module> mod) : ModuleGUI(mod), UIContainerSingle(w){}
 private:
-  void LoadFromXML(std::string xml_data, std::shared_ptr<ModuleTemplate> templ);
+  void LoadFromBlueprint(const GUIBlueprint& blueprint, std::shared_ptr<ModuleTemplate> templ);
   void LoadFromTemplate(std::shared_ptr<ModuleTemplate> templ);
   void UpdateMinimalSize();
   void CommonInit();
   bool highlight = false;
+  Module::RunState run_state = Module::RunState::Running;
+  std::shared_ptr<SDLTextTexture> run_state_texture = nullptr;
   std::shared_ptr<UILabel> caption;
 
   std::shared_ptr<UIMarginBox> main_margin;
@@ -79,7 +86,7 @@ private:
 
   class IOConn : public UIWidget{
   public:
-    std::string iolet_id;
+    Symbol iolet_id;
     std::string iolet_name;
     VertAlignment align;
     Color main_color;
@@ -89,7 +96,7 @@ private:
     // This flag is set iff the mouse pointer is not only pointing at this
     // widget, but also is inside the inlet/outlet rect.
     bool inside = false;
-    static std::shared_ptr<IOConn> Create(std::weak_ptr<Window> w, std::string id, std::string name, VertAlignment align, Color c);
+    static std::shared_ptr<IOConn> Create(std::weak_ptr<Window> w, Symbol id, std::string name, VertAlignment align, Color c);
     void CustomDraw(DrawContext& c) override;
     void SetBorderColor(Color c);
     virtual bool CustomMousePress(bool down, MouseButton b,Point2D pos) override;
@@ -100,7 +107,7 @@ private:
     static const int width, height;
   private:
     void Init();
-    IOConn(std::weak_ptr<Window> w, std::string id_, std::string name, VertAlignment align_, Color c);
+    IOConn(std::weak_ptr<Window> w, Symbol id_, std::string name, VertAlignment align_, Color c);
     Point2D GetRectPos() const;
     inline Size2D  GetRectSize() const {return Size2D(width,height);}
     Point2D GetCenterPos() const;
@@ -21,6 +21,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include "UI/UIWidget.hpp"
 #include "UI/UIBox.hpp"
 #include "UI/UITextEntry.hpp"
+#include "Symbol.hpp"
 
 namespace AlgAudio{
 
@@ -59,7 +60,7 @@ public:
     SetNeedsRedrawing();
   }
 
-  std::string param_id;
+  Symbol param_id;
 protected:
   UISlider(std::weak_ptr<Window> parent_window, std::shared_ptr<ParamController> controller);
 private:
@@ -0,0 +1,129 @@
+#ifndef NRTRENDER_HPP
+#define NRTRENDER_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <memory>
+#include <vector>
+#include <map>
+#include <string>
+#include "LateReturn.hpp"
+#include "Symbol.hpp"
+
+// Forward declaration to strip liblo header dependency
+namespace lo{
+  class Message;
+}
+
+namespace AlgAudio{
+
+class Canvas;
+class Module;
+
+namespace Exceptions{
+struct NRTRender : public Exception{
+  NRTRender(std::string t) : Exception(t) {}
+};
+} // namespace Exceptions
+
+/** Renders a Canvas to a sound file faster than realtime, using SC's
+ *  non-realtime mode (scsynth -N).
+ *
+ *  The current state of the canvas - all module synths, their param values,
+ *  audio connections and server-side data links, as well as the synth
+ *  ordering - is translated into an OSC score. Parameter changes can be
+ *  scheduled at arbitrary times of the render. The score is then passed to
+ *  sclang, which adds all AlgAudio SynthDefs to it and runs scsynth in NRT
+ *  mode.
+ *
+ *  Data connections that are realized by the client (i.e. not by a
+ *  ServerDataLink) cannot be rendered offline. Their targets keep the values
+ *  they have at the moment of rendering.
+ *  \code
+ *    NRTRender render(canvas);
+ *    render.ScheduleParamChange(2.0, module, "freq", 440.0);
+ *    NRTRender::Options options;
+ *    options.output_path = "out.wav";
+ *    options.duration = 5.0;
+ *    render.Render(options).Then([](){ ... });
+ *  \endcode
+ */
+class NRTRender{
+public:
+  struct Options{
+    /** The path of the WAV file to create. */
+    std::string output_path;
+    /** The length of the rendered file, in seconds. */
+    float duration = 10.0f;
+    int sample_rate = 44100;
+    /** The number of channels in the output file. If 0, the number of output
+     *  channels from Config is used. */
+    int channels = 0;
+  };
+  NRTRender(std::shared_ptr<Canvas> canvas);
+  ~NRTRender();
+  /** Schedules a change of a param value at the given time (in seconds from
+   *  the start of the render). Only params with SC action can be scheduled. */
+  void ScheduleParamChange(float time, std::shared_ptr<Module> module, Symbol param, float value);
+  /** Schedules param changes listed in a text file, one per line:
+   *  \code
+   *    <time in seconds> <module saveid> <param id> <value>
+   *  \endcode
+   *  Modules are identified by the saveid they were loaded with from the
+   *  patch file, only modules on the top-level canvas can be referred to.
+   *  Empty lines and lines starting with # are ignored.
+   *  \throws Exceptions::NRTRender if the file cannot be read or parsed. */
+  void ScheduleFromFile(std::string path);
+  /** Prepares the score and renders it. Latereturns once the file is
+   *  written. May latethrow Exceptions::NRTRender.
+   *  \warning Render() is NOT late-reentrant. */
+  LateReturn<> Render(const Options& options);
+private:
+  std::shared_ptr<Canvas> canvas;
+  struct ParamChange{
+    float time;
+    std::shared_ptr<Module> module;
+    Symbol param;
+    float value;
+  };
+  std::vector<ParamChange> param_changes;
+
+  // State used while building the score.
+  std::vector<lo::Message> score;
+  std::map<const Module*, int> synth_ids;
+  std::map<std::pair<const Module*, std::string>, int> param_buses;
+  int next_node_id;
+  int next_audio_bus;
+  int next_control_bus;
+
+  void BuildScore();
+  /** Finds the lowest audio bus id that is not used by the canvas. */
+  int FindFreeAudioBus(std::shared_ptr<Canvas> c) const;
+  void AddCanvas(std::shared_ptr<Canvas> c, int parent_group);
+  void AddModule(std::shared_ptr<Module> m, int parent_group);
+  void AddDataLinks(std::shared_ptr<Canvas> c);
+  /** Returns the control bus the given synth writes a param value to,
+   *  allocating it on first use. */
+  int GetParamBus(const Module* m, std::string busarg);
+  /** Starts a new score command. */
+  lo::Message& Command(float time, std::string name);
+};
+
+} // namespace AlgAudio
+
+#endif // NRTRENDER_HPP
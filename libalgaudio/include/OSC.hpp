@@ -21,6 +21,7 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <functional>
@@ -64,6 +65,15 @@ public:
   void Send(std::string path);
   void Send(std::string path, lo::Message);
   void Send(std::string path, std::function<void(lo::Message)> reply_action, lo::Message);
+  /** Sends a number of messages in a single bundle, so that they are
+   *  received and processed at once. Each message gets an id appended, just
+   *  as with Send, but replies to them are ignored. If the messages do not
+   *  fit in a single datagram, they are split into several consecutive
+   *  bundles, see max_bundle_size. */
+  void SendBundle(const std::vector<std::pair<std::string, lo::Message>>& messages);
+  /** The largest bundle SendBundle sends, in bytes. This is well below the
+   *  UDP datagram limit, as the receiving side may use smaller buffers. */
+  static const size_t max_bundle_size = 8192;
 
   /** Called by the main thread when new OSC replies are ready to process.
    *  The server thread cannot interact with the application, so it stores
@@ -21,26 +21,56 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
 #include <memory>
+#include <set>
+#include <tuple>
+#include <vector>
 #include "ModuleTemplate.hpp"
 #include "Utilities.hpp"
 
 namespace AlgAudio{
 
 class Module;
+
+/** The initial state of a param, used when a module is created with its param
+ *  values already known, e.g. when a patch is loaded. */
+struct ParamPreset{
+  Symbol id;
+  float value;
+  bool has_min = false, has_max = false;
+  float min = 0.0f, max = 0.0f;
+};
+typedef std::vector<ParamPreset> ParamPresets;
   
 /** A ParamController is the representation of a Param state.
  *  All ParamControllers belong to some Module, and are always build according to
  *  a ParramTemplate. The internal state of a ParamController represents it's
  *  current value. A ParamController's value may be Set(...), which sends
  *  the value to SC, or to user-defined custom reaction routine.
+ *
+ *  Setting a value is done in ticks. The outermost Set() starts a tick, and
+ *  any params set as a consequence (e.g. via data connections, or by custom
+ *  module code) are only marked as pending. Once the outermost Set() has
+ *  stored its value, pending params are committed one by one in the order of
+ *  their propagation_rank, so that each of them performs its action and
+ *  notifies subscribers only once per tick, with the final value.
  */
 class ParamController{
 public:
-  std::string id;
+  Symbol id;
   static std::shared_ptr<ParamController> Create(std::shared_ptr<Module> m, const std::shared_ptr<ParamTemplate> templ);
+  ~ParamController();
+  /** Sets a new value. If this param was already committed in the current
+   *  tick, the new value is ignored, this is what breaks data connection
+   *  loops. */
   void Set(float value);
   void SetRelative(float value);
+  /** Sets a value reported by SC, e.g. by a SendReply. \see IsSetDirectly */
+  void SetReported(float value);
   void Reset();
+  /** Applies the range and the value stored in a preset. If on_server is
+   *  set, the synth already has this value, so it is not sent to SC, but
+   *  subscribers are notified as usual. */
+  void ApplyPreset(const ParamPreset& preset, bool on_server = false);
   inline float Get() const {return current_val;}
   float GetRelative() const;
   inline void SetRangeMin(float v) {
@@ -53,8 +83,15 @@ public:
     on_range_max_set.Happen(v);
     //Set(current_val); // Will re-trigger set events with new relative value
   }
+  /** Returns true if the value being committed was set on this param
+   *  directly, false if it was set as a consequence of setting another
+   *  param (e.g. through a data connection), or reported by SC. Only
+   *  meaningful within on_set and after_set handlers. */
+  bool IsSetDirectly() const {return tick_origin == this;}
   inline float GetRangeMin() const {return range_min;}
   inline float GetRangeMax() const {return range_max;}
+  /** Returns the module this param belongs to. */
+  inline std::shared_ptr<Module> GetModule() const {return module.lock();}
 
   /** This signal passes two values: the absolute value of this param, and the relative fraction
    *  of the range it operates in. CAREFUL when subscribing to this signal: When a param
@@ -68,11 +105,53 @@ public:
   Signal<float> on_range_max_set;
   
   const std::shared_ptr<ParamTemplate> templ;
+
+  /** The position of this param in the data flow graph of its Canvas. When
+   *  a value change propagates, params with lower rank are committed first,
+   *  which is a topological order for acyclic connections. Maintained by the
+   *  Canvas, which must call RekeyPending() after changing ranks. */
+  int propagation_rank = 0;
+  /** Re-sorts params pending in the current tick according to their
+   *  current propagation_rank. Ranks may change mid-tick, e.g. when a
+   *  committed param triggers a recompilation of the data graph. */
+  static void RekeyPending();
+  /** The number of ServerDataLinks that currently map this param's synth
+   *  argument to a control bus. While it is non-zero, values set on this
+   *  controller are not sent to SC, because /n_set would unmap the argument
+   *  and break the link. They are still stored and passed to subscribers,
+   *  but note that the value modulated on the server is never reflected
+   *  here. Maintained by ServerDataLink. */
+  int server_links = 0;
 private:
   ParamController(std::shared_ptr<Module> m, const std::shared_ptr<ParamTemplate> t);
   float current_val = 0.0;
   float range_min = 0.0, range_max = 1.0;
   std::weak_ptr<Module> module;
+
+  /** Performs the param action with the current value, and notifies
+   *  subscribers. Called once per tick. */
+  void Commit();
+  /** Commits pending params until there are none left. */
+  static void RunTick();
+
+  /** Ordering key for pending params: rank, then the order in which they
+   *  became pending. */
+  typedef std::tuple<int, unsigned long, ParamController*> PendingKey;
+  PendingKey pending_key;
+  bool pending = false;
+  bool committed = false;
+  /** Set if the value to be committed is already known to SC. */
+  bool on_server = false;
+  void Set(float value, bool on_server);
+
+  static bool inside_tick;
+  /** The param whose Set() started the current tick, nullptr if it was
+   *  started by SetReported(). */
+  static const ParamController* tick_origin;
+  static bool reporting;
+  static unsigned long pending_counter;
+  static std::set<PendingKey> pending_params;
+  static std::vector<ParamController*> committed_params;
 };
 
 /** This class represents a single subscription to received SendReply messages
@@ -84,7 +163,7 @@ private:
 class SendReplyController{
 public:
   std::string id;
-  void Got(float v){ controller->Set(v); }
+  void Got(float v){ controller->SetReported(v); }
   static std::shared_ptr<SendReplyController> Create(std::shared_ptr<Module> m, std::string id, std::shared_ptr<ParamController> ctrl);
   ~SendReplyController();
 private:
@@ -0,0 +1,63 @@
+#ifndef PENDINGCONNECTIONS_HPP
+#define PENDINGCONNECTIONS_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <map>
+#include <vector>
+#include "Canvas.hpp"
+
+namespace AlgAudio{
+
+/** Connections of a canvas that is being loaded from a file. Modules are
+ *  identified by their save ids, and each connection is made as soon as both
+ *  of its modules were created, so that wiring overlaps with the creation of
+ *  the remaining modules, instead of waiting for all of them.
+ */
+class PendingConnections{
+public:
+  PendingConnections(std::shared_ptr<Canvas> c) : canvas(c) {}
+  void AddAudio(int from, Symbol fromiolet, int to, Symbol toiolet);
+  void AddData(int from, Symbol fromparam, int to, Symbol toparam, Canvas::DataConnectionMode mode);
+  /** Marks the module with the given save id as created, and makes all
+   *  connections which now have both of their modules. */
+  void ModuleCreated(int saveid, std::shared_ptr<Module> m);
+  /** Returns the number of connections that were not made yet. */
+  unsigned int CountRemaining() const {return remaining;}
+private:
+  struct Connection{
+    bool audio;
+    int from, to;
+    Symbol fromid, toid;
+    Canvas::DataConnectionMode mode;
+    bool made;
+  };
+  std::weak_ptr<Canvas> canvas;
+  std::vector<Connection> connections;
+  // Indices of connections, by the save ids of modules they refer to.
+  std::multimap<int, unsigned int> by_module;
+  std::map<int, std::shared_ptr<Module>> modules;
+  unsigned int remaining = 0;
+  void Add(Connection c);
+  void Make(Connection& c);
+};
+
+} // namespace AlgAudio
+
+#endif // PENDINGCONNECTIONS_HPP
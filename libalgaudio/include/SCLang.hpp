@@ -31,6 +31,7 @@ namespace AlgAudio{
 class SCLangSubprocess;
 class ModuleTemplate;
 class SendReplyController;
+class Module;
 
 namespace Exceptions{
 struct SCLang : public Exception{
@@ -93,7 +94,9 @@ public:
    *  Observe on_line_received for result. */
   static void QueryAllNodes();
 
-  /** Happens whenever sclang receives some MIDI event. */
+  /** Happens whenever some MIDI event is received, either by sclang or by
+   *  a native MIDI input (see MIDI). Always fired by the main thread. If you
+   *  are interested only in specific messages, use MIDI::Route instead. */
   static Signal<MidiMessage> on_midi_message_received;
 
   ///@{
@@ -102,6 +105,8 @@ public:
   static void SendOSC(const std::string& path);
   static void SendOSC(const std::string& path, std::string tag, ...);
   static void SendOSCCustom(const std::string& path, const lo::Message& m);
+  /** Sends a number of messages to sclang in a single OSC bundle. */
+  static void SendOSCBundle(const std::vector<std::pair<std::string, lo::Message>>& messages);
   static LateReturn<lo::Message> SendOSCWithLOReply(const std::string& path);
   static LateReturn<lo::Message> SendOSCWithLOReply(const std::string& path, std::string tag, ...);
   static LateReturn<lo::Message> SendOSCCustomWithLOReply(const std::string& path, const lo::Message& m);
@@ -122,6 +127,11 @@ public:
   /** Unregisters a sendreply catcher that was previously created with
    *  RegisterSendReply(). */
   static void UnregisterSendReply(int synth_id, int reply_id);
+  /** Registers the module whose silence gate state shall be updated when SC
+   *  reports that the inlets of the synth became silent or active.
+   *  \see ModuleTemplate::silence_gate */
+  static void RegisterSilenceGate(int synth_id, std::weak_ptr<Module>);
+  static void UnregisterSilenceGate(int synth_id);
 
   /** Boots the supercollider server. Uses global configuration. \see Config*/
   static void BootServer();
@@ -139,6 +149,8 @@ private:
   static void ProcessMIDIInput(lo::Message);
   static std::map<std::pair<int,int>, std::weak_ptr<SendReplyController>> sendreply_map;
   static int sendreply_id;
+  static void SilenceGateCatcher(int synth_id, bool silent);
+  static std::map<int, std::weak_ptr<Module>> silencegate_map;
 };
 
 template <typename... T>
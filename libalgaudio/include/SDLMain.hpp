@@ -75,19 +75,27 @@ public:
   // These two funcitions are used by i/o threads to notify the main loop that
   // there is some input ready to be processed. These functions are thread-safe.
   // They send a custom SDL_UserEvent to the main event queue, effectivelly
-  // waking up the main thread.
+  // waking up the main thread. In headless mode, the notification is passed
+  // to the Headless loop instead.
   static void PushNotifySubprocessEvent();
   static void PushNotifyOSCEvent();
+  static void PushNotifyMIDIEvent();
   static std::atomic<int> notify_event_id;
 
   static void SetTextInput(bool);
 
+  /** Performs the action corresponding to a notification, be it received via
+   *  the SDL event queue or the headless loop. \param code One of
+   *  CustomEventCodes. */
+  static void ProcessNotification(int code, void* data);
+
   static std::atomic_bool running;
   
   enum CustomEventCodes{
     NOTIFY_SUBPROCESS,
     NOTIFY_OSC,
     NOTIFY_TIMER,
+    NOTIFY_MIDI,
   };
 private:
   static std::map<unsigned int, std::shared_ptr<Window>> registered_windows;
@@ -100,6 +108,7 @@ private:
   // simultaneously.
   static std::atomic_flag ev_flag_notify_osc_already_pushed;
   static std::atomic_flag ev_flag_notify_subprocess_already_pushed;
+  static std::atomic_flag ev_flag_notify_midi_already_pushed;
 };
 
 } // namespace AlgAudio
@@ -0,0 +1,76 @@
+#ifndef SERVERDATALINK_HPP
+#define SERVERDATALINK_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <set>
+#include "Signal.hpp"
+#include "LateReturn.hpp"
+
+namespace AlgAudio{
+
+class ParamController;
+
+/** A ServerDataLink realizes a single data connection entirely on the SC
+ *  server. The source param must be declared with a `bus` attribute, meaning
+ *  that its synth writes the param value to a control bus. The target param's
+ *  synth argument is then mapped (/n_map) to that bus, either directly for
+ *  absolute connections, or through a small scaling synth for relative ones.
+ *  This way the modulation runs at control rate, and the client is not
+ *  involved at all.
+ *
+ *  Note that the target ParamController does not get informed about values
+ *  passed this way, so its slider will not follow the modulation. While the
+ *  link exists, values set on the target controller are not sent to SC
+ *  either, see ParamController::server_links.
+ *
+ *  The target is muted from the moment the link is requested, and the link
+ *  is released when this object is destructed.
+ */
+class ServerDataLink : public virtual SubscriptionsManager{
+public:
+  /** Returns true iff a data connection between these two params can be
+   *  realized on the server. */
+  static bool IsApplicable(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to);
+  /** Asks SC to create a new server-side data link. */
+  static LateReturn<std::shared_ptr<ServerDataLink>> Create(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to, bool relative);
+  ~ServerDataLink();
+  /** Unmutes the targets of all links SC did not confirm yet. Called by
+   *  SCLang whenever the server is booted or stopped, as replies to these
+   *  requests will never arrive. */
+  static void ReleasePending();
+private:
+  ServerDataLink(std::shared_ptr<ParamController> to);
+  /** Sends current param ranges to the scaling synth. */
+  void SendRanges(std::shared_ptr<ParamController> from, std::shared_ptr<ParamController> to);
+  /** Decrements the target's server_links, once. If restore is set and no
+   *  other link maps the target, sends its current value to SC. */
+  void ReleaseTarget(bool restore);
+  /** The id of the link on SC, or -1 if SC did not reply yet. */
+  int id = -1;
+  std::weak_ptr<ParamController> target;
+  bool holds_target = false;
+  /** Links waiting for a reply from SC. */
+  static std::set<ServerDataLink*> pending;
+};
+
+} // namespace AlgAudio
+
+#endif // SERVERDATALINK_HPP
@@ -0,0 +1,81 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+/*
+This file is part of AlgAudio.
+
+AlgAudio, Copyright (C) 2015 CeTA - Audiovisual Technology Center
+
+AlgAudio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+AlgAudio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <iostream>
+
+namespace AlgAudio{
+
+/** A Symbol is an interned string. All identifiers of templates, params and
+ *  iolets are stored as Symbols, so that comparing, ordering and hashing them
+ *  is as cheap as it is for an integer. Each distinct string is stored once,
+ *  in a global table, and a Symbol is merely an index into that table.
+ *
+ *  Symbols convert implicitly from and to strings, so that they can be used
+ *  wherever a string is expected, e.g. when reading or writing XML, or when
+ *  displaying an identifier to the user. Note that constructing a Symbol from
+ *  a string requires a hash table lookup, so Symbols should be created once
+ *  (e.g. when parsing a template) and then passed around.
+ *
+ *  The ordering of Symbols is the order in which they were interned, not the
+ *  lexicographical order of the corresponding strings.
+ */
+class Symbol{
+public:
+  /** The default Symbol represents an empty string. */
+  Symbol() : id(0) {}
+  Symbol(const std::string& s) : id(Intern(s)) {}
+  Symbol(const char* s) : id(Intern(s)) {}
+  /** Returns the string this Symbol represents. */
+  inline const std::string& str() const {return Table()[id];}
+  inline const char* c_str() const {return str().c_str();}
+  inline bool empty() const {return id == 0;}
+  inline operator const std::string&() const {return str();}
+  /** Returns the integer handle of this Symbol. */
+  inline unsigned int GetID() const {return id;}
+  inline bool operator==(const Symbol& other) const {return id == other.id;}
+  inline bool operator!=(const Symbol& other) const {return id != other.id;}
+  inline bool operator<(const Symbol& other) const {return id < other.id;}
+private:
+  unsigned int id;
+  static unsigned int Intern(const std::string& s);
+  static std::deque<std::string>& Table();
+};
+
+inline std::string operator+(const std::string& a, const Symbol& b) {return a + b.str();}
+inline std::string operator+(const Symbol& a, const std::string& b) {return a.str() + b;}
+inline std::string operator+(const char* a, const Symbol& b) {return a + b.str();}
+inline std::string operator+(const Symbol& a, const char* b) {return a.str() + b;}
+inline std::ostream& operator<<(std::ostream& s, const Symbol& sym) {return s << sym.str();}
+
+} // namespace AlgAudio
+
+namespace std{
+template<>
+struct hash<AlgAudio::Symbol>{
+  size_t operator()(const AlgAudio::Symbol& s) const {return s.GetID();}
+};
+} // namespace std
+
+#endif // SYMBOL_HPP
@@ -208,6 +208,9 @@ struct MidiMessage{
   unsigned char number;
   unsigned char velocity;
   unsigned char value;
+  /** The time (in seconds, see MIDI::Now()) at which AlgAudio received this
+   *  message. */
+  double timestamp = 0.0;
 };
 
 /** A static class encapsulating a number of useful helper functions that are
@@ -269,6 +272,9 @@ public:
   static std::string TrimAllLines(std::string);
   /** Returns a float formatted to a string in a way that uses only a few digits at each magnitude level. */
   static std::string PrettyFloat(float val);
+  /** Returns a float formatted with a '.' decimal point regardless of the
+   *  current locale, with enough digits to be parsed back exactly. */
+  static std::string FloatToString(float val);
   
   // Other
   /** Converts a midi node to the corresponding frequency. */
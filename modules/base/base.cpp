@@ -20,22 +20,20 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstring>
 #include <iostream>
 #include <algorithm>
-#include "SCLang.hpp"
+#include "MIDI.hpp"
 #include "Timer.hpp"
 #include "ParamController.hpp"
 
 class MIDICtrl : public AlgAudio::Module{
 public:
   void on_init(){
-    subscriptions += AlgAudio::SCLang::on_midi_message_received.Subscribe([this](AlgAudio::MidiMessage m){
-      // Ignore non-control messages
-      if(m.type != AlgAudio::MidiMessage::Type::Control) return;
-      // Ignore channel
-      // Test ctrl no.
-      if(m.number > 7) return;
-      // Set the param controler.
-      GetParamControllerByID( "ctrl" + std::to_string(m.number) )->Set(m.value);
-    });
+    // Ignore channel, listen to controls 0-7 only.
+    for(int i = 0; i < 8; i++){
+      auto ctrl = GetParamControllerByID( "ctrl" + std::to_string(i) );
+      subscriptions += AlgAudio::MIDI::Route(AlgAudio::MidiMessage::Type::Control, AlgAudio::MIDI::Any, i, [ctrl](AlgAudio::MidiMessage m){
+        ctrl->Set(m.value);
+      });
+    }
   }
 };
 
@@ -49,16 +47,16 @@ public:
     velocity = GetParamControllerByID("velocity");
     gate     = GetParamControllerByID("gate");
 
-    subscriptions += AlgAudio::SCLang::on_midi_message_received.Subscribe([this](AlgAudio::MidiMessage m){
-      if(m.type == AlgAudio::MidiMessage::Type::NoteOn){
-        note->Set( AlgAudio::Utilities::mtof(m.number) );
-        velocity->Set( m.velocity );
-        notecount++;
-        gate->Set(notecount);
-      }else if(m.type == AlgAudio::MidiMessage::Type::NoteOff){
-        notecount--;
-        gate->Set(notecount);
-      }
+    using AlgAudio::MIDI;
+    subscriptions += MIDI::Route(AlgAudio::MidiMessage::Type::NoteOn, MIDI::Any, MIDI::Any, [this](AlgAudio::MidiMessage m){
+      note->Set( AlgAudio::Utilities::mtof(m.number) );
+      velocity->Set( m.velocity );
+      notecount++;
+      gate->Set(notecount);
+    });
+    subscriptions += MIDI::Route(AlgAudio::MidiMessage::Type::NoteOff, MIDI::Any, MIDI::Any, [this](AlgAudio::MidiMessage){
+      notecount--;
+      gate->Set(notecount);
     });
   }
 };
@@ -36,11 +36,13 @@ along with AlgAudio.  If not, see <http://www.gnu.org/licenses/>.
 	The third element is a dict (string -> fork_pair). It is a collection
 		of fork pairs indexed by outlet name. If an outlet has 0 or 1
 		connection, it should not be present in this dict. Otherwise it should have
-		exactly one fork pair bound.
+		a list of fork pairs bound. A single fork writes to at most 20 buses, so
+		larger fan-outs are realized by a chain of forks, each one passing the
+		signal to the next one through its last output.
 
 	A fork pair is a 2-element array. The first element is a bus id, the second
-		is a fork synth instance. The bus is the one used to connect the module
-		synth with the fork.
+		is a fork synth instance. The bus is the one the fork reads from, it is
+		written by the module synth or by the previous fork in the chain.
 
 */
 
@@ -58,14 +60,26 @@ OSCdef.new( 'hello', {
 		~minstances = Dictionary.new(0);
 		~buses = Dictionary.new(0);
 		~subgroups = Dictionary.new(0);
+		~parambuses = Dictionary.new(0);
+		~datalinks = Dictionary.new(0);
+		~datalinkcounter = 0;
+		~silencegates = Dictionary.new(0);
+		~fused = Dictionary.new(0);
+		~fusedmembers = Dictionary.new(0);
+		~busclears = Dictionary.new(0);
 		"Hello World!".postln;
-		// Initialize MIDI
-		MIDIClient.free;
-		MIDIClient.init;
-		MIDIIn.connectAll;
-		MIDIIn.addFuncTo(\noteOn, ~midinoteon);
-		MIDIIn.addFuncTo(\noteOff, ~midinoteoff);
-		MIDIIn.addFuncTo(\control, ~midicontrol);
+		// Initialize MIDI, unless AlgAudio receives it natively
+		MIDIIn.removeFuncFrom(\noteOn, ~midinoteon);
+		MIDIIn.removeFuncFrom(\noteOff, ~midinoteoff);
+		MIDIIn.removeFuncFrom(\control, ~midicontrol);
+		if((msg.size > 2) && (msg[1] != 0), {
+			MIDIClient.free;
+			MIDIClient.init;
+			MIDIIn.connectAll;
+			MIDIIn.addFuncTo(\noteOn, ~midinoteon);
+			MIDIIn.addFuncTo(\noteOff, ~midinoteoff);
+			MIDIIn.addFuncTo(\control, ~midicontrol);
+		});
 		~addr.sendMsg("/algaudio/reply",msg[msg.size-1]);
 	}, '/algaudioSC/hello'
 ).postln;
@@ -121,6 +135,26 @@ OSCdef.new( 'boothelper', {
 ).postln;
 
 
+// Returns the synth argument name that corresponds to the given argument of
+// an instance. Instances that are a part of a fused synth have their
+// arguments prefixed.
+~argName = {
+	arg id, name;
+	var inst = ~minstances[id];
+	if((inst.size > 3),{ inst[3] ++ name.asString },{ name.asString });
+};
+
+// Returns the name of the SynthDef that copies a signal with the given number
+// of channels to count buses.
+~forkName = {
+	arg count, channels;
+	if((channels == 1),{
+		"aa/builtin/fork" ++ count.asString;
+	},{
+		"aa/builtin/fork" ++ count.asString ++ "x" ++ channels.asString;
+	});
+};
+
 ~getParentGroup = {
 	arg i;
 	var result;
@@ -174,14 +208,77 @@ OSCdef.new( 'removeinstance', {
 		~minstances[id][1].free;
 		~minstances[id][0].free;
 		~minstances.removeAt( id );
+		// The gate synth was a member of the freed group.
+		~silencegates.removeAt( id );
+		~busclears.removeAt( id );
+		if((~parambuses.includesKey(id)),{
+			~parambuses[id].do({ arg bus; bus.free; });
+			~parambuses.removeAt( id );
+		});
 		~addr.sendMsg("/algaudio/reply", msg[msg.size-1]);
 	}, '/algaudioSC/removeinstance'
 ).postln;
 
+// Args: instance id, 0 to pause or 1 to resume the instance
+OSCdef.new( 'runinstance', {
+		arg msg;
+		if((~minstances.includesKey(msg[1])),{
+			~minstances[msg[1]][0].run(msg[2] == 1);
+		});
+	}, '/algaudioSC/runinstance'
+).postln;
+
+// Silence gates watch the inlet buses of an instance, and suspend its synth
+// while they are silent. ~silencegates is a dict (instance id -> gate synth).
+// The gate is placed at the head of the instance group, so it is ordered
+// together with the instance, but keeps running while the synth is suspended.
+// Args: instance id, silence time in seconds, inlet bus ids
+OSCdef.new( 'newsilencegate', {
+		arg msg;
+		var id = msg[1];
+		var buses = msg[3..(msg.size-2)];
+		if((~minstances.includesKey(id)),{
+			~silencegates[id] = Synth.new("aa/builtin/silencegate" ++ buses.size.asString, ["id", id, "time", msg[2], "in", buses], ~minstances[id][0], \addToHead);
+		});
+	}, '/algaudioSC/newsilencegate'
+).postln;
+
+// Sent by gate synths when their inlets become silent (1) or active (0).
+OSCdef.new( 'silencegate', {
+		arg msg;
+		var id = msg[2];
+		var silent = msg[3].asInt;
+		if((~minstances.includesKey(id)),{
+			~minstances[id][1].run(silent == 0);
+			~addr.sendMsg("/algaudio/silencegate", id, silent);
+		});
+	}, '/algaudioSC/silencegate'
+).postln;
+
+// Buses shared by several inlets are cleared after each instance that reads
+// them, so that the next writer starts from silence. ~busclears is a dict
+// (instance id -> clearing synth), placed at the tail of the instance group.
+// Args: instance id, bus ids to clear (none to stop clearing)
+OSCdef.new( 'busclear', {
+		arg msg;
+		var id = msg[1];
+		var buses = msg[2..(msg.size-2)];
+		if((~busclears.includesKey(id)),{
+			~busclears[id].free;
+			~busclears.removeAt(id);
+		});
+		if((~minstances.includesKey(id) && (buses.size > 0)),{
+			~busclears[id] = Synth.new("aa/builtin/busclear" ++ buses.size.asString, ["bus", buses], ~minstances[id][0], \addToTail);
+		});
+	}, '/algaudioSC/busclear'
+).postln;
+
 // reply value: bus instance id
+// Optional arg: the number of channels
 OSCdef.new( 'newbus', {
 		arg msg;
-		var newbus = Bus.audio(s,1);
+		var channels = if((msg.size > 2),{ msg[1] },{ 1 });
+		var newbus = Bus.audio(s,channels);
 		var id = newbus.index;
 		("Creating new bus " ++ id.asString).postln;
 		~buses.add( id -> newbus);
@@ -230,7 +327,7 @@ OSCdef.new( 'setparam', {
 		});
 		//("Setting param " ++ msg[2].asString ++ " of " ++ msg[1].asString ++ " to " ++ msg[3]).postln;
 		~minstances[msg[1]][1].set(
-			msg[2].asString,
+			~argName.value(msg[1], msg[2]),
 			msg[3]
 		);
 	}, '/algaudioSC/setparam'
@@ -245,28 +342,28 @@ OSCdef.new( 'setparamlist', {
 		});
 		//("Setting param " ++ msg[2].asString ++ " of " ++ msg[1].asString ++ " to " ++ list).postln;
 		~minstances[msg[1]][1].set(
-			msg[2].asString,
+			~argName.value(msg[1], msg[2]),
 			list
 		);
 	}, '/algaudioSC/setparamlist'
 ).postln;
 
-// Args: instance id, outlet id, bus id
+// Args: instance id, outlet id, connection id, number of channels, bus ids
 OSCdef.new( 'connectoutlet', {
 		arg msg;
 		var synthid = msg[1];
 		var connid = msg[3];
-		var targets = msg[4..(msg.size-2)];
-		var target = msg[4];
-		var outlet = msg[2].asString;
+		var channels = msg[4];
+		var targets = msg[5..(msg.size-2)];
+		var target = msg[5];
+		var outlet = ~argName.value(synthid, msg[2]);
 		var count = targets.size;
-		var fork, bus, forkpair;
+		var fork, bus, next, node, chunk, rest, forkpairs;
 		(connid.asString ++ " -- Connecting outlet " ++ synthid.asString ++ "/" ++ msg[2].asString ++ " to bus " ++ targets.asString ++ " count " ++ count).postln;
-		// Free the fork synth and bus, if they exists.
-		forkpair = ~minstances[synthid][2][outlet];
-		if((forkpair.notNil),{
-			forkpair[0].free;
-			forkpair[1].free;
+		// Free the fork synths and buses, if they exists.
+		forkpairs = ~minstances[synthid][2][outlet];
+		if((forkpairs.notNil),{
+			forkpairs.do({ arg forkpair; forkpair[0].free; forkpair[1].free; });
 			~minstances[synthid][2].removeAt(outlet);
 		},{});
 
@@ -277,17 +374,31 @@ OSCdef.new( 'connectoutlet', {
 			// Then bind the synth directly to target
 			~minstances[synthid][1].set( outlet, target );
 		},{
-			if((count <= 20),{
-				// Build a new forkpair.
-				bus = Bus.audio(s,1);
-				fork = Synth.new("aa/builtin/fork" ++ count.asString, ["in", [bus.index] ++ targets], ~minstances[synthid][1], \addAfter );
+			// Build a new chain of fork pairs. All but the last fork write to
+			// 19 targets and the next fork's bus, so the last one gets 2 to 20.
+			forkpairs = List.new;
+			bus = Bus.audio(s,channels);
+			node = ~minstances[synthid][1];
+			rest = targets;
+			while({ rest.size > 0 },{
+				if((rest.size <= 20),{
+					chunk = rest;
+					rest = [];
+					next = nil;
+				},{
+					next = Bus.audio(s,channels);
+					chunk = rest[0..18] ++ [next.index];
+					rest = rest[19..];
+				});
+				fork = Synth.new(~forkName.value(chunk.size, channels), ["in", [bus.index] ++ chunk], node, \addAfter );
 				fork.postln;
-				~minstances[synthid][2][outlet] = [bus,fork];
-				// Then bind the synth to the fork
-				~minstances[synthid][1].set( outlet, bus.index );
-			},{
-				("ERROR: Failed to connect, count is over maximum allowed (20)").postln;
+				forkpairs.add([bus,fork]);
+				node = fork;
+				bus = next;
 			});
+			~minstances[synthid][2][outlet] = forkpairs;
+			// Then bind the synth to the first fork
+			~minstances[synthid][1].set( outlet, forkpairs[0][0].index );
 		});
 		
 		~addr.sendMsg("/algaudio/reply", 1, msg[msg.size-1]);
@@ -301,13 +412,144 @@ OSCdef.new( 'connectinlet', {
 		if((msg[1] != -1),{
 			("Connecting inlet " ++ msg[1].asString ++ "/" ++ msg[2].asString ++ " to bus " ++ msg[3]).postln;
 			~minstances[msg[1]][1].set(
-				msg[2].asString,
+				~argName.value(msg[1], msg[2]),
 				msg[3]
 			);
 		});
 	}, '/algaudioSC/connectinlet'
 ).postln;
 
+// Returns the control bus the given synth writes a param value to, allocating
+// it on first use. ~parambuses is a dict (synth id -> dict (bus argument ->
+// bus)), so all data links from the same param share a single bus.
+~getParamBus = {
+	arg id, busarg;
+	var bus;
+	if((~parambuses.includesKey(id).not),{
+		~parambuses.add( id -> Dictionary.new(0));
+	});
+	bus = ~parambuses[id][busarg];
+	if((bus.isNil),{
+		bus = Bus.control(s,1);
+		~parambuses[id][busarg] = bus;
+		~minstances[id][1].set(~argName.value(id, busarg), bus.index);
+	});
+	bus;
+};
+
+// Data links map a synth param to a control bus another synth writes to. A
+// data link is an array of exactly 4 elements: the scaling synth (or nil for
+// absolute links), the bus it writes to (or nil), the target synth id and the
+// target param name.
+// Args: source instance id, source bus argument, target instance id, target
+// param name, relative (0 or 1)
+// reply value: data link id
+OSCdef.new( 'newdatalink', {
+		arg msg;
+		var source = msg[1];
+		var busarg = msg[2].asString;
+		var target = msg[3];
+		var param = msg[4].asString;
+		var srcbus = ~getParamBus.value(source, busarg);
+		var synth = nil, outbus = nil, id;
+		if((msg[5] == 1),{
+			outbus = Bus.control(s,1);
+			synth = Synth.new("aa/builtin/datamap", ["in", srcbus.index, "out", outbus.index], ~minstances[source][1], \addAfter);
+			~minstances[target][1].map(~argName.value(target, param), outbus.index);
+		},{
+			~minstances[target][1].map(~argName.value(target, param), srcbus.index);
+		});
+		~datalinkcounter = ~datalinkcounter + 1;
+		id = ~datalinkcounter;
+		("Linking " ++ source.asString ++ "/" ++ busarg ++ " to " ++ target.asString ++ "/" ++ param ++ " as data link " ++ id.asString).postln;
+		~datalinks.add( id -> [synth, outbus, target, param]);
+		~addr.sendMsg("/algaudio/reply", id, msg[msg.size-1]);
+	}, '/algaudioSC/newdatalink'
+).postln;
+
+// Args: data link id, followed by pairs of scaling synth argument name and value
+OSCdef.new( 'setdatalink', {
+		arg msg;
+		var link = ~datalinks[msg[1]];
+		if((link.notNil and: { link[0].notNil }),{
+			link[0].set( *msg[2..(msg.size-2)] );
+		});
+	}, '/algaudioSC/setdatalink'
+).postln;
+
+// Arg: data link id
+OSCdef.new( 'removedatalink', {
+		arg msg;
+		var id = msg[1];
+		var link = ~datalinks[id];
+		if((link.notNil),{
+			("Removing data link " ++ id.asString).postln;
+			if((~minstances.includesKey(link[2])),{
+				~minstances[link[2]][1].map(~argName.value(link[2], link[3]), -1);
+			});
+			if((link[0].notNil),{ link[0].free; });
+			if((link[1].notNil),{ link[1].free; });
+			~datalinks.removeAt( id );
+		});
+	}, '/algaudioSC/removedatalink'
+).postln;
+
+// Fusing replaces a chain of instances with a single synth, which evaluates
+// the code of all of them. The original instances are paused, and their
+// entries in ~minstances point to the fused synth, with a prefix for argument
+// names as the fourth element, so that all other commands address the fused
+// synth transparently. ~fused is a dict (fused synth id -> member ids), and
+// ~fusedmembers keeps the original entries of the members.
+// Args: SynthDef name, SynthDef function body (or an empty string if the
+// SynthDef was already sent), member count, member ids, member argument
+// prefixes, then pairs of initial synth argument names and values
+// reply value: fused synth id
+OSCdef.new( 'fuse', {
+		arg msg;
+		var name = msg[1].asString;
+		var count = msg[3];
+		var ids = msg[4..(3+count)];
+		var prefixes = msg[(4+count)..(3+(2*count))].collect({ arg p; p.asString });
+		var params = msg[(4+(2*count))..(msg.size-2)];
+		var group = Group.new(~minstances[ids[0]][0], \addBefore);
+		var synth = Synth.basicNew(name, s);
+		var def;
+		("Fusing instances " ++ ids.asString ++ " as " ++ name).postln;
+		if((msg[2].asString.size > 0),{
+			def = ("SynthDef.new('" ++ name ++ "', {" ++ msg[2].asString ++ "})").compile.value;
+			def.add(nil, synth.newMsg(group, params));
+		},{
+			s.listSendMsg(synth.newMsg(group, params));
+		});
+		ids.do({ arg id, i;
+			~fusedmembers[id] = ~minstances[id];
+			~minstances[id][0].run(false);
+			~minstances[id] = [group, synth, Dictionary.new(0), prefixes[i]];
+		});
+		~fused[synth.nodeID] = ids;
+		~addr.sendMsg("/algaudio/reply", synth.nodeID, msg[msg.size-1]);
+	}, '/algaudioSC/fuse'
+).postln;
+
+// Arg: fused synth id
+OSCdef.new( 'unfuse', {
+		arg msg;
+		var ids = ~fused[msg[1]];
+		if((ids.notNil),{
+			("Unfusing instances " ++ ids.asString).postln;
+			// Forks were placed in the fused group, only their buses remain.
+			ids.do({ arg id; ~minstances[id][2].do({ arg forkpairs; forkpairs.do({ arg forkpair; forkpair[0].free; }); }); });
+			~minstances[ids[0]][0].free;
+			ids.do({ arg id;
+				~minstances[id] = ~fusedmembers[id];
+				~fusedmembers.removeAt(id);
+				~minstances[id][0].run(true);
+			});
+			~fused.removeAt(msg[1]);
+		});
+	}, '/algaudioSC/unfuse'
+).postln;
+
 // Returns the top node for given synthid or groupid. Basically the returned node
 // is the handle that should be used for reordering.
 ~getOrderable = {
@@ -325,23 +567,96 @@ OSCdef.new( 'connectinlet', {
 	result;
 };
 
-// This is the helper method that realizes a synth ordering.
+// This is the helper method that realizes a synth ordering. The first
+// argument is the group all nodes are placed in. Nodes do not need to be in
+// that group already, this is how flattened subpatches are realized.
 OSCdef.new( 'ordering', {
 		arg msg;
-		var first = msg[1];
-		var all = msg[1..(msg.size-2)];
-		var firstnode = ~getOrderable.value(first);
-		var prev = firstnode, curr;
+		var group = ~subgroups[msg[1]];
+		var all = msg[2..(msg.size-2)];
+		var prev = nil, curr;
 		("Applying ordering: " ++ all.asString).postln;
-		firstnode.moveToHead(firstnode.group);
-		for(1,msg.size-3,{ arg i;
-			curr = ~getOrderable.value(all[i]);
-			curr.moveAfter(prev);
+		all.do({ arg id;
+			curr = ~getOrderable.value(id);
+			// Members of a fused chain share a single node.
+			if((curr !== prev),{
+				if((prev.isNil),{
+					curr.moveToHead(group);
+				},{
+					curr.moveAfter(prev);
+				});
+			});
 			prev = curr;
 		});
 	}, '/algaudioSC/ordering'
 ).postln;
 
+// Moves selected nodes only. The first argument is the group the nodes are
+// placed in. The rest are pairs of ids: a node to move, and the node after
+// which it should be placed, or -1 to move it to the head of the group.
+OSCdef.new( 'reorder', {
+		arg msg;
+		var group = ~subgroups[msg[1]];
+		var args = msg[2..(msg.size-2)];
+		forBy(0, args.size-2, 2, { arg i;
+			var node = ~getOrderable.value(args[i]);
+			var prev = if((args[i+1] < 0),{ nil },{ ~getOrderable.value(args[i+1]) });
+			if((prev.isNil),{
+				node.moveToHead(group);
+			},{
+				// Members of a fused chain share a single node.
+				if((node !== prev),{ node.moveAfter(prev); });
+			});
+		});
+	}, '/algaudioSC/reorder'
+).postln;
+
+// Offline rendering. The client prepares a score, passing it command by
+// command, and then asks for it to be rendered by a NRT server.
+OSCdef.new( 'nrtbegin', {
+		arg msg;
+		~nrtscore = List.new(0);
+	}, '/algaudioSC/nrtbegin'
+).postln;
+
+// Args: time, command name, command arguments
+OSCdef.new( 'nrtcmd', {
+		arg msg;
+		~nrtscore.add([msg[1], msg[2..(msg.size-2)]]);
+	}, '/algaudioSC/nrtcmd'
+).postln;
+
+// Args: output file path, duration, sample rate, output channels, input
+// channels, audio bus count, control bus count
+// reply value: 1 on success, 0 on failure
+OSCdef.new( 'nrtrender', {
+		arg msg;
+		var replyid = msg[msg.size-1];
+		var score = Score.new;
+		var options = ServerOptions.new;
+		var oscpath = PathName.tmp ++ "algaudio-nrt-" ++ Date.getDate.stamp ++ ".osc";
+		options.numOutputBusChannels = msg[4].asInt;
+		options.numInputBusChannels = msg[5].asInt;
+		options.numAudioBusChannels = msg[6].asInt;
+		options.numControlBusChannels = msg[7].asInt;
+		// The NRT server needs all SynthDefs used by the score. The client has
+		// prepared the commands in the right order, so they are not sorted.
+		SynthDescLib.global.synthDescs.do({ arg desc;
+			if((desc.def.notNil and: { desc.name.asString.beginsWith("aa/") }),{
+				score.add([0.0, ['/d_recv', desc.def.asBytes]]);
+			});
+		});
+		~nrtscore.do({ arg cmd; score.add(cmd); });
+		("Rendering " ++ ~nrtscore.size.asString ++ " score commands to " ++ msg[1].asString).postln;
+		score.recordNRT(oscpath, msg[1].asString, nil, msg[3].asInt, "WAV", "float", options, "", msg[2].asFloat, { arg code;
+			File.delete(oscpath);
+			("NRT render finished with code " ++ code.asString).postln;
+			~addr.sendMsg("/algaudio/reply", (code == 0).binaryValue, replyid);
+		});
+		~nrtscore = nil;
+	}, '/algaudioSC/nrtrender'
+).postln;
+
 // Helper catcher for SendReply-ies
 OSCdef.new( 'sendreply', {
 		arg msg;
@@ -391,3 +706,41 @@ SynthDef.new("aa/builtin/fork17",{ arg in, o1, o2, o3, o4, o5, o6, o7, o8, o9, o
 SynthDef.new("aa/builtin/fork18",{ arg in, o1, o2, o3, o4, o5, o6, o7, o8, o9, o10, o11, o12, o13, o14, o15, o16, o17, o18; var i = In.ar(in); Out.ar(o1,i); Out.ar(o2,i); Out.ar(o3,i); Out.ar(o4,i); Out.ar(o5,i); Out.ar(o6,i); Out.ar(o7,i); Out.ar(o8,i); Out.ar(o9,i); Out.ar(o10,i); Out.ar(o11,i); Out.ar(o12,i); Out.ar(o13,i); Out.ar(o14,i); Out.ar(o15,i); Out.ar(o16,i); Out.ar(o17,i); Out.ar(o18,i); }).add;
 SynthDef.new("aa/builtin/fork19",{ arg in, o1, o2, o3, o4, o5, o6, o7, o8, o9, o10, o11, o12, o13, o14, o15, o16, o17, o18, o19; var i = In.ar(in); Out.ar(o1,i); Out.ar(o2,i); Out.ar(o3,i); Out.ar(o4,i); Out.ar(o5,i); Out.ar(o6,i); Out.ar(o7,i); Out.ar(o8,i); Out.ar(o9,i); Out.ar(o10,i); Out.ar(o11,i); Out.ar(o12,i); Out.ar(o13,i); Out.ar(o14,i); Out.ar(o15,i); Out.ar(o16,i); Out.ar(o17,i); Out.ar(o18,i); Out.ar(o19,i); }).add;
 SynthDef.new("aa/builtin/fork20",{ arg in, o1, o2, o3, o4, o5, o6, o7, o8, o9, o10, o11, o12, o13, o14, o15, o16, o17, o18, o19, o20; var i = In.ar(in); Out.ar(o1,i); Out.ar(o2,i); Out.ar(o3,i); Out.ar(o4,i); Out.ar(o5,i); Out.ar(o6,i); Out.ar(o7,i); Out.ar(o8,i); Out.ar(o9,i); Out.ar(o10,i); Out.ar(o11,i); Out.ar(o12,i); Out.ar(o13,i); Out.ar(o14,i); Out.ar(o15,i); Out.ar(o16,i); Out.ar(o17,i); Out.ar(o18,i); Out.ar(o19,i); Out.ar(o20,i); }).add;
+
+// Silence gates for 1 to 16 inlets. The quiet time stays at zero while any
+// inlet is loud, and grows while all are silent. \see 'newsilencegate'
+(1..16).do({ arg n;
+	SynthDef.new("aa/builtin/silencegate" ++ n.asString, { arg id, time=3, threshold=0.0001;
+		var in = Control.names([\in]).kr(0 ! n);
+		var level = Mix.new(in.collect({ arg b; Amplitude.kr(In.ar(b)) }));
+		var loud = level > threshold;
+		var quiet = Sweep.kr(loud, 1 - loud);
+		var silent = quiet > time;
+		SendReply.kr(Changed.kr(silent), '/algaudioSC/silencegate', silent, id);
+	}).add;
+});
+
+// Forks for multichannel outlets, see ~forkName.
+(2..8).do({ arg channels;
+	(2..20).do({ arg count;
+		SynthDef.new("aa/builtin/fork" ++ count.asString ++ "x" ++ channels.asString, {
+			var i = In.ar(\in.kr(0), channels);
+			(1..count).do({ arg k; Out.ar(("o" ++ k.asString).asSymbol.kr(0), i) });
+		}).add;
+	});
+});
+
+// Clears the given buses, for buses shared by multiple inlets.
+(1..16).do({ arg n;
+	SynthDef.new("aa/builtin/busclear" ++ n.asString, {
+		Control.names([\bus]).kr(0 ! n).asArray.do({ arg b; ReplaceOut.ar(b, DC.ar(0)) });
+	}).add;
+});
+
+// Scales a control value from the source param range to the target param
+// range, keeping its relative position. Used by relative data links.
+SynthDef.new("aa/builtin/datamap",{ arg in, out, smin=0, smax=1, slog=0, tmin=0, tmax=1, tlog=0;
+	var v = In.kr(in);
+	var q = Select.kr(slog, [(v - smin)/(smax - smin), log(v/smin)/log(smax/smin)]);
+	ReplaceOut.kr(out, Select.kr(tlog, [tmin + (q*(tmax - tmin)), tmin*((tmax/tmin)**q)]));
+}).add;